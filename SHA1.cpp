@@ -10,6 +10,7 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 #include "SHA1.h"
+#include "sha1hw.h"
 
 #define SHA1_MAX_FILE_BUFFER (32 * 20 * 820)
 
@@ -39,9 +40,11 @@
 #define S_R3(v,w,x,y,z,i) {z+=(((w|x)&y)|(w&x))+SHABLK(i)+0x8F1BBCDC+ROL32(v,5);w=ROL32(w,30);}
 #define S_R4(v,w,x,y,z,i) {z+=(w^x^y)+SHABLK(i)+0xCA62C1D6+ROL32(v,5);w=ROL32(w,30);}
 
+#ifdef _MSC_VER
 #pragma warning(push)
 // Disable compiler warning 'Conditional expression is constant'
 #pragma warning(disable: 4127)
+#endif
 
 CSHA1::CSHA1()
 {
@@ -50,6 +53,23 @@ CSHA1::CSHA1()
 	Reset();
 }
 
+CSHA1::CSHA1(const CSHA1& sha1)
+{
+	m_block = (SHA1_WORKSPACE_BLOCK*)m_workspace;
+
+	*this = sha1;
+}
+
+CSHA1& CSHA1::operator=(const CSHA1& sha1)
+{
+	// m_block keeps pointing to the workspace of this object
+	memcpy(m_state, sha1.m_state, sizeof(m_state));
+	memcpy(m_count, sha1.m_count, sizeof(m_count));
+	memcpy(m_buffer, sha1.m_buffer, sizeof(m_buffer));
+	memcpy(m_digest, sha1.m_digest, sizeof(m_digest));
+	return *this;
+}
+
 #ifdef SHA1_WIPE_VARIABLES
 CSHA1::~CSHA1()
 {
@@ -72,6 +92,13 @@ void CSHA1::Reset()
 
 void CSHA1::Transform(UINT_32* pState, const UINT_8* pBuffer)
 {
+	// SHA instructions of the CPU if it has them, see sha1hw.h
+	if(sha1HardwareAvailable())
+	{
+		sha1HardwareBlocks(reinterpret_cast<uint32_t*>(pState), pBuffer, 1);
+		return;
+	}
+
 	UINT_32 a = pState[0], b = pState[1], c = pState[2], d = pState[3], e = pState[4];
 
 	memcpy(m_block, pBuffer, 64);
@@ -127,6 +154,14 @@ void CSHA1::Update(const UINT_8* pbData, UINT_32 uLen)
 		memcpy(&m_buffer[j], pbData, i);
 		Transform(m_state, m_buffer);
 
+		// The SHA instructions take all whole blocks in one call
+		if(sha1HardwareAvailable() && (i + 63) < uLen)
+		{
+			UINT_32 uBlocks = (uLen - i) / 64;
+			sha1HardwareBlocks(reinterpret_cast<uint32_t*>(m_state), &pbData[i], uBlocks);
+			i += uBlocks * 64;
+		}
+
 		for( ; (i + 63) < uLen; i += 64)
 			Transform(m_state, &pbData[i]);
 
@@ -253,4 +288,6 @@ bool CSHA1::GetHash(UINT_8* pbDest20) const
 	return true;
 }
 
+#ifdef _MSC_VER
 #pragma warning(pop)
+#endif
@@ -234,6 +234,10 @@ public:
 	// Constructor and destructor
 	CSHA1();
 
+	// Copies the state, e.g. to finalize the digest of the data so far and go on
+	CSHA1(const CSHA1& sha1);
+	CSHA1& operator=(const CSHA1& sha1);
+
 #ifdef SHA1_WIPE_VARIABLES
 	~CSHA1();
 #endif
@@ -0,0 +1,85 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <algorithm>
+
+using namespace std;
+
+static size_t alignUp(size_t n, size_t alignment) {
+	return (n + alignment - 1) / alignment * alignment;
+}
+
+Arena& Arena::local() {
+	static thread_local Arena arena;
+	return arena;
+}
+
+Arena::Arena() : _current(0), _used(0), _depth(0) {
+}
+
+Arena::~Arena() {
+	for (size_t i = 0; i < _blocks.size(); i++)
+		free(_blocks[i].raw);
+}
+
+size_t Arena::capacity() const {
+	size_t bytes = 0;
+	for (size_t i = 0; i < _blocks.size(); i++)
+		bytes += _blocks[i].size;
+	return bytes;
+}
+
+void* Arena::allocate(size_t bytes) {
+	bytes = alignUp(max(bytes, (size_t)1), ARENA_ALIGNMENT);
+
+	//Later blocks are kept from earlier scopes, take the first one with room
+	while (_current < _blocks.size() && _used + bytes > _blocks[_current].size) {
+		_current++;
+		_used = 0;
+	}
+
+	if (_current == _blocks.size()) {
+		Block block;
+		block.size = alignUp(max(bytes, (size_t)ARENA_BLOCKBYTES), ARENA_ALIGNMENT);
+		block.raw = (char*)malloc(block.size + ARENA_ALIGNMENT);
+		if (!block.raw)
+			throw bad_alloc();
+		block.base = (char*)alignUp((uintptr_t)block.raw, ARENA_ALIGNMENT);
+		_blocks.push_back(block);
+		_used = 0;
+	}
+
+	void* p = _blocks[_current].base + _used;
+	_used += bytes;
+	return p;
+}
+
+void Arena::enter() {
+	_depth++;
+}
+
+void Arena::leave() {
+	if (--_depth > 0)
+		return;
+
+	//A scope that spilled over several blocks gets one block of that size next time, and an
+	//arena grown past ARENA_MAXKEEPBYTES by a very long recording is handed back
+	size_t size = capacity();
+	if (_blocks.size() > 1 || size > ARENA_MAXKEEPBYTES) {
+		for (size_t i = 0; i < _blocks.size(); i++)
+			free(_blocks[i].raw);
+		_blocks.clear();
+	}
+	if (_blocks.empty() && size > 0 && size <= ARENA_MAXKEEPBYTES) {
+		Block block;
+		block.size = alignUp(size, ARENA_BLOCKBYTES);
+		block.raw = (char*)malloc(block.size + ARENA_ALIGNMENT);
+		if (block.raw) {
+			block.base = (char*)alignUp((uintptr_t)block.raw, ARENA_ALIGNMENT);
+			_blocks.push_back(block);
+		}
+	}
+	_current = 0;
+	_used = 0;
+}
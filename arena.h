@@ -0,0 +1,127 @@
+//ARENA  Per-worker bump allocator for the temporaries of one conversion.
+//   The large buffers of a conversion (read buffers, filter windows, resampler and pipeline
+//   queues, the deflate state) are carved out of blocks owned by the worker thread and are
+//   not freed one by one. When the outermost ArenaScope on the thread ends the arena
+//   rewinds, so the next file reuses the same memory and, once a worker has converted a
+//   file of a given size, the following ones do not go back to malloc for them. Outside a
+//   scope ArenaAllocator falls back to the heap. Blocks are first touched by the owning
+//   worker, so with workers pinned to NUMA nodes (see numa.h) they are on its node.
+//
+//   Everything allocated in a scope must be destroyed before the scope ends, and containers
+//   filled from the arena must only grow on the thread that owns it.
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+using namespace std;
+
+#define ARENA_BLOCKBYTES (16 << 20)
+#define ARENA_ALIGNMENT (64)
+
+//Memory kept for the next file, a scope that needed more gives it back when it ends
+#ifndef ARENA_MAXKEEPBYTES
+#define ARENA_MAXKEEPBYTES (1ULL << 30)
+#endif
+
+class Arena {
+public:
+	//Arena of the calling thread
+	static Arena& local();
+
+	//bytes aligned to ARENA_ALIGNMENT, valid until the outermost scope ends
+	void* allocate(size_t bytes);
+
+	bool active() const { return _depth > 0; }
+
+	//Bytes held by the arena, used or not
+	size_t capacity() const;
+
+	~Arena();
+
+private:
+	friend class ArenaScope;
+	friend class ArenaRewind;
+
+	Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void enter();
+	void leave();
+
+	struct Block {
+		char* raw;
+		char* base;
+		size_t size;
+	};
+
+	vector<Block> _blocks;
+	size_t _current;           // block being carved
+	size_t _used;              // bytes of it handed out
+	int _depth;
+};
+
+//Scope of one conversion on this thread, scopes may nest
+class ArenaScope {
+public:
+	ArenaScope() { Arena::local().enter(); }
+	~ArenaScope() { Arena::local().leave(); }
+
+private:
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
+//Hands back what the thread's arena gave out while it existed, for a conversion run in the
+//middle of another one on the same thread, which then leaves the arena as it found it
+class ArenaRewind {
+public:
+	ArenaRewind() : _arena(Arena::local()), _current(_arena._current), _used(_arena._used) {}
+	~ArenaRewind() {
+		if (_arena.active()) {
+			_arena._current = _current;
+			_arena._used = _used;
+		}
+	}
+
+private:
+	ArenaRewind(const ArenaRewind&) = delete;
+	ArenaRewind& operator=(const ArenaRewind&) = delete;
+
+	Arena& _arena;
+	size_t _current, _used;
+};
+
+//Standard allocator drawing from the thread's arena when created inside a scope
+template<class T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	ArenaAllocator() : arena(Arena::local().active() ? &Arena::local() : NULL) {}
+	template<class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(size_t n) {
+		if (arena)
+			return static_cast<T*>(arena->allocate(n * sizeof(T)));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t) {
+		if (!arena)
+			::operator delete(p);
+	}
+
+	Arena* arena;              // NULL for the heap
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template<class T>
+using ArenaVector = vector< T, ArenaAllocator<T> >;
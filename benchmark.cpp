@@ -0,0 +1,614 @@
+// benchmark.cpp : Throughput benchmarks of the EDF to CFS conversion, run by "make bench".
+//
+// Synthetic recordings are written with edflib's writer API for every sampling rate, duration
+// and file type asked for (reused on later runs), each stage of the conversion is timed on its
+// own and whole files are converted with 1..N worker threads. Before the whole files are timed,
+// the streamed, parallel, generic resampler and --start/--end conversions of each recording are
+// checked against the payload SHA1 of its whole conversion on one thread, and the benchmark
+// fails if any differs. Results go to stdout as one JSON object per line so runs of different
+// releases can be compared; progress and errors go to stderr.
+//
+extern "C" {
+#include "edflib.h"
+#include "zlib.h"
+}
+#include "tclap/CmdLine.h"
+#include "tclap/ValueArg.h"
+#include "SHA1.h"
+#include "converter.h"
+#include "cfswriter.h"
+#include "cfsreader.h"
+#include "codec.h"
+#include "pipeline.h"
+#include "spectral.h"
+#include "simd.h"
+#include "sha1hw.h"
+#include "threadpool.h"
+#include "scheduler.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define SAMPLINGRATE  (100)
+#define BENCHSIGNALS (5)           // C3, C4, EOG-L, EOG-R and an EMG channel that is not converted
+#define BENCHMINSECONDS (0.5)      // each micro-benchmark repeats until it has run this long
+
+using namespace std;
+
+typedef chrono::steady_clock BenchClock;
+
+struct Recording {
+	string path;
+	int rate;
+	int hours;
+	bool bdf;
+	unsigned long long bytes;
+};
+
+static const char* signalLabels[BENCHSIGNALS] = { "C3-A2", "C4-A1", "EOG-L", "EOG-R", "EMG" };
+
+static double secondsSince(BenchClock::time_point start) {
+	return chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static unsigned long long fileSize(const string& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return 0;
+	return (unsigned long long)st.st_size;
+}
+
+//Slow rhythms, a spindle-like 10.3 Hz component and noise, of about +-150 uV
+static void synthesize(vector<double>& out, int rate, long long first, long long count, int channel, unsigned& seed) {
+	const double PI_2 = 6.28318530717958647692;
+	out.resize(count);
+	for (long long k = 0; k < count; k++) {
+		double t = (double)(first + k) / rate;
+		seed = seed * 1103515245u + 12345u;
+		double noise = ((seed >> 16) & 0x7fff) / 32768.0 - 0.5;
+		out[k] = 80 * sin(PI_2 * (1.5 + channel) * t) + 30 * sin(PI_2 * 10.3 * t + channel) + 20 * noise;
+	}
+}
+
+//Writes one recording of datarecords of one second, false if edflib refuses
+static bool generateRecording(const Recording& recording) {
+	int handle = edfopen_file_writeonly(recording.path.c_str(), recording.bdf ? EDFLIB_FILETYPE_BDFPLUS : EDFLIB_FILETYPE_EDFPLUS, BENCHSIGNALS);
+	if (handle < 0)
+		return false;
+
+	int digitalMax = recording.bdf ? 8388607 : 32767;
+	for (int i = 0; i < BENCHSIGNALS; i++) {
+		edf_set_samplefrequency(handle, i, recording.rate);
+		edf_set_physical_maximum(handle, i, 500);
+		edf_set_physical_minimum(handle, i, -500);
+		edf_set_digital_maximum(handle, i, digitalMax);
+		edf_set_digital_minimum(handle, i, -digitalMax - 1);
+		edf_set_label(handle, i, signalLabels[i]);
+		edf_set_physical_dimension(handle, i, "uV");
+	}
+
+	int rate = recording.rate;
+	vector<short> shorts(BENCHSIGNALS * rate);
+	vector<unsigned char> triplets(BENCHSIGNALS * rate * 3);
+	vector<double> samples;
+	unsigned seed = 12345u;
+	bool ok = true;
+	for (long long second = 0; ok && second < recording.hours * 3600LL; second++) {
+		for (int i = 0; i < BENCHSIGNALS; i++) {
+			synthesize(samples, rate, second * rate, rate, i, seed);
+			for (int k = 0; k < rate; k++) {
+				int digital = (int)lround(samples[k] / 500.0 * digitalMax);
+				if (recording.bdf) {
+					unsigned char* p = &triplets[(i * rate + k) * 3];
+					p[0] = digital & 0xff;
+					p[1] = (digital >> 8) & 0xff;
+					p[2] = (digital >> 16) & 0xff;
+				}
+				else
+					shorts[i * rate + k] = (short)digital;
+			}
+		}
+		if (recording.bdf)
+			ok = edf_blockwrite_digital_3byte_samples(handle, triplets.data()) == 0;
+		else
+			ok = edf_blockwrite_digital_short_samples(handle, shorts.data()) == 0;
+	}
+
+	if (edfclose_file(handle) != 0 || !ok) {
+		remove(recording.path.c_str());
+		return false;
+	}
+	return true;
+}
+
+static void report(const string& benchmark, const string& fields, double seconds) {
+	cout << "{\"benchmark\":\"" << benchmark << "\"," << fields << ",\"seconds\":" << seconds << "}" << endl;
+}
+
+//Runs step until BENCHMINSECONDS have passed, returns the number of runs and their duration
+static long long repeat(const function<void()>& step, double& seconds) {
+	long long runs = 0;
+	BenchClock::time_point start = BenchClock::now();
+	do {
+		step();
+		runs++;
+		seconds = secondsSince(start);
+	} while (seconds < BENCHMINSECONDS);
+	return runs;
+}
+
+static void reportRate(const string& stage, int rate, double units, const char* unitName, double bytes, long long runs, double seconds) {
+	ostringstream fields;
+	fields << "\"stage\":\"" << stage << "\",\"rate\":" << rate << ",\"runs\":" << runs
+		<< ",\"" << unitName << "_per_sec\":" << units * runs / seconds
+		<< ",\"mb_per_sec\":" << bytes * runs / seconds / 1e6;
+	report("stage", fields.str(), seconds);
+}
+
+//Reading the four converted channels of a whole recording with the block reader
+static void benchRead(const Recording& recording) {
+	struct edf_hdr_struct hdr;
+	struct edfhdrblock* reader = NULL;
+	if (edfopen_reader(recording.path.c_str(), &hdr, EDFLIB_DO_NOT_READ_ANNOTATIONS, 0, &reader)) {
+		cerr << "can not open " << recording.path << endl;
+		return;
+	}
+	int signals[4] = { 0, 1, 2, 3 };
+	vector<double> buffers[4];
+	double* bufs[4];
+	for (int c = 0; c < 4; c++) {
+		buffers[c].resize(hdr.signalparam[c].smp_in_file);
+		bufs[c] = buffers[c].data();
+	}
+
+	double seconds;
+	long long runs = repeat([&]() {
+		edfread_reader_datarecords(reader, 4, signals, 0, hdr.datarecords_in_file, bufs);
+	}, seconds);
+	edfclose_reader(reader);
+
+	ostringstream stage;
+	stage << "read_" << (recording.bdf ? "bdf" : "edf");
+	reportRate(stage.str(), recording.rate, 4.0 * hdr.signalparam[0].smp_in_file, "samples", (double)recording.bytes, runs, seconds);
+}
+
+//Band-pass at the native rate, as done for 100 Hz inputs and long filters
+static void benchFilter(const vector<double>& x, int rate) {
+	shared_ptr< const vector<double> > taps = bandPassTaps(CONVERTER_FILTERORDER, 0.3 * 2 / rate, 45 * 2 / rate);
+	ArenaVector<double> out;
+	out.reserve(x.size() + taps->size());
+
+	double seconds;
+	long long runs = repeat([&]() {
+		FirStage<double> stage(*taps);
+		out.clear();
+		stage.push(x.data(), x.size(), out);
+		stage.finish(out);
+	}, seconds);
+	reportRate("filter", rate, (double)x.size(), "samples", x.size() * sizeof(double), runs, seconds);
+}
+
+//Resampling to 100 Hz with the band-pass folded in, the path taken for every other rate
+static void benchResample(const vector<double>& x, int rate) {
+	if (rate == SAMPLINGRATE)
+		return;
+	shared_ptr< const vector<double> > taps = bandPassTaps(CONVERTER_FILTERORDER, 0.3 * 2 / rate, 45 * 2 / rate);
+	ArenaVector<double> out;
+
+	double seconds;
+	long long runs = repeat([&]() {
+		ResampleStage<double> stage(SAMPLINGRATE, rate, (long long)x.size(), *taps);
+		out.clear();
+		stage.push(x.data(), x.size(), out);
+		stage.finish(out);
+	}, seconds);
+	reportRate("resample", rate, (double)x.size(), "samples", x.size() * sizeof(double), runs, seconds);
+}
+
+//Compressed size and speed both ways of every codec at a few levels on one payload
+static void benchCodecs(const string& source, const vector<unsigned char>& payload) {
+	const char* settings[] = { "zlib:1", "zlib:6", "zlib:9", "libdeflate:1", "libdeflate:6", "libdeflate:12",
+		"zstd:1", "zstd:3", "zstd:9", "zstd:19" };
+	for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+		Codec codec;
+		string error;
+		if (!parseCodec(settings[i], codec, error))
+			continue;
+
+		vector<unsigned char> compressed;
+		double compressSeconds;
+		long long compressRuns = repeat([&]() {
+			compressed.clear();
+			unique_ptr<Compressor> compressor = Compressor::create(codec, CFSWRITER_CHUNKBYTES, [&compressed](const unsigned char* data, size_t count) {
+				compressed.insert(compressed.end(), data, data + count);
+				return true;
+			}, error);
+			if (compressor) {
+				compressor->write(payload.data(), payload.size());
+				compressor->finish();
+			}
+		}, compressSeconds);
+
+		vector<unsigned char> decompressed(payload.size());
+		bool ok = true;
+		double decompressSeconds;
+		long long decompressRuns = repeat([&]() {
+			ok = decompressPayload(codec, compressed.data(), compressed.size(), decompressed) && ok;
+		}, decompressSeconds);
+		if (!ok || decompressed != payload) {
+			cerr << settings[i] << " does not give back the payload of " << source << endl;
+			continue;
+		}
+
+		ostringstream fields;
+		fields << "\"codec\":\"" << settings[i] << "\",\"payload\":\"" << source << "\",\"payload_bytes\":" << payload.size()
+			<< ",\"compressed_bytes\":" << compressed.size() << ",\"ratio\":" << (double)payload.size() / compressed.size()
+			<< ",\"compress_mb_per_sec\":" << payload.size() * compressRuns / compressSeconds / 1e6
+			<< ",\"decompress_mb_per_sec\":" << payload.size() * decompressRuns / decompressSeconds / 1e6;
+		report("codec", fields.str(), compressSeconds + decompressSeconds);
+	}
+}
+
+//Spectrogram, digest, compression and writing of the CFS payload of a recording at 100 Hz
+static void benchPayload(int hours, const string& dir) {
+	long long epochs = hours * 3600LL * SAMPLINGRATE / SPECTRAL_EPOCHSAMPLES;
+	vector<double> x;
+	unsigned seed = 12345u;
+	synthesize(x, SAMPLINGRATE, 0, epochs * SPECTRAL_EPOCHSAMPLES, 0, seed);
+
+	vector<float> payload(epochs * PIPELINE_EPOCHSIZE);
+	double seconds;
+	long long runs = repeat([&]() {
+		SpectralEngine& engine = SpectralEngine::local();
+		//One batch per epoch, as the pipelines run it
+		for (long long e = 0; e < epochs; e++) {
+			const double* channels[PIPELINE_CHANNELS];
+			for (int c = 0; c < PIPELINE_CHANNELS; c++)
+				channels[c] = &x[e * SPECTRAL_EPOCHSAMPLES];
+			engine.spectrograms(channels, &payload[e * PIPELINE_EPOCHSIZE]);
+		}
+	}, seconds);
+	double payloadBytes = (double)payload.size() * sizeof(float);
+	reportRate("stft", SAMPLINGRATE, (double)epochs * PIPELINE_CHANNELS * SPECTRAL_WINDOWS, "windows", payloadBytes, runs, seconds);
+
+	const Bytef* bytes = reinterpret_cast<const Bytef*>(payload.data());
+	runs = repeat([&]() {
+		CSHA1 sha1;
+		sha1.Update(bytes, (UINT_32)payloadBytes);
+		sha1.Final();
+	}, seconds);
+	reportRate("sha1", SAMPLINGRATE, (double)epochs, "epochs", payloadBytes, runs, seconds);
+
+	vector<Bytef> compressed(compressBound((uLong)payloadBytes));
+	uLongf compressedSize = 0;
+	runs = repeat([&]() {
+		compressedSize = compressed.size();
+		compress(compressed.data(), &compressedSize, bytes, (uLong)payloadBytes);
+	}, seconds);
+	reportRate("deflate", SAMPLINGRATE, (double)epochs, "epochs", payloadBytes, runs, seconds);
+
+	string path = dir + "/write.tmp";
+	runs = repeat([&]() {
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+			return;
+		for (uLongf offset = 0; offset < compressedSize; offset += CFSWRITER_CHUNKBYTES)
+			fwrite(compressed.data() + offset, 1, min((uLongf)CFSWRITER_CHUNKBYTES, compressedSize - offset), file);
+		fclose(file);
+	}, seconds);
+	remove(path.c_str());
+	reportRate("write", SAMPLINGRATE, (double)epochs, "epochs", (double)compressedSize, runs, seconds);
+
+	//The writer combines the last three as the converter uses it
+	runs = repeat([&]() {
+		CfsWriter writer;
+		if (!writer.open(path))
+			return;
+		for (long long e = 0; e < epochs; e++)
+			writer.writeEpoch(&payload[e * PIPELINE_EPOCHSIZE], PIPELINE_EPOCHSIZE);
+		writer.close((uint16_t)epochs);
+	}, seconds);
+	remove(path.c_str());
+	reportRate("cfswriter", SAMPLINGRATE, (double)epochs, "epochs", payloadBytes, runs, seconds);
+
+	benchCodecs("synthetic", vector<unsigned char>(bytes, bytes + (size_t)payloadBytes));
+}
+
+//The uncompressed payload of an existing CFS, e.g. of a real recording
+static bool readCfsPayload(const string& path, vector<unsigned char>& payload) {
+	CfsReader reader;
+	payload.clear();
+	return reader.open(path) && reader.read([&payload](const unsigned char* data, size_t count) {
+		payload.insert(payload.end(), data, data + count);
+		return true;
+	});
+}
+
+//Converter options for the four channels of the recordings, as edf2cfs passes the labels
+static Converter::Options benchOptions() {
+	Converter::Options options;
+	for (int c = 0; c < 4; c++) {
+		string label = signalLabels[c];
+		label.resize(16, ' ');
+		for (size_t i = 0; i < label.size(); i++)
+			label[i] = (char)tolower((unsigned char)label[i]);
+		options.channelLabels.push_back(label);
+	}
+	return options;
+}
+
+static string sha1Hex(const unsigned char* data, size_t count) {
+	CSHA1 sha1;
+	sha1.Update(data, (UINT_32)count);
+	sha1.Final();
+	string digest;
+	sha1.ReportHashStl(digest, CSHA1::REPORT_HEX_SHORT);
+	return digest;
+}
+
+//How a conversion of the regression check differs from the reference, which reads the
+//whole recording in one piece and converts it on one thread
+struct CheckVariant {
+	const char* name;
+	bool streaming;
+	bool parallel;   // segments and batches of epochs on the pool
+	bool generic;    // generic resampling loop instead of the one compiled for the rate
+	bool range;      // only the middle third of the epochs, as --start and --end give
+};
+
+static const CheckVariant checkVariants[] = {
+	{ "streamed", true, false, false, false },
+	{ "parallel", false, true, false, false },
+	{ "generic_resampler", false, false, true, false },
+	{ "range", false, false, false, true },
+	{ "range_streamed", true, false, false, true },
+	{ "range_parallel", false, true, false, true },
+};
+
+//Converts recording into a CFS next to it and reads its payload back, false with error set
+static bool convertPayload(const Converter::Options& options, const Recording& recording, string& digest,
+	vector<unsigned char>& payload, string& error) {
+	string cfs = recording.path + ".check.cfs";
+	ConvertResult result = Converter(options).convertFile(recording.path, cfs);
+	bool ok = result.ok() && readCfsPayload(cfs, payload);
+	remove(cfs.c_str());
+	digest = result.digest;
+	error = result.ok() ? "can not read back " + cfs : result.message;
+	return ok;
+}
+
+//Every conversion path that claims the bytes of the reference against it, in both precisions:
+//the payload SHA1 of each, for a range that of the same epochs of the reference. False and
+//a message on stderr for every one that differs
+static bool checkConversions(const vector<Recording>& recordings, unsigned threads) {
+	ThreadPool pool(max(threads, 2u));
+	const PipelinePrecision precisions[] = { PIPELINE_DOUBLE, PIPELINE_FLOAT };
+	const unsigned long long epochBytes = PIPELINE_EPOCHSIZE * sizeof(float);
+	bool allMatch = true;
+	for (size_t i = 0; i < recordings.size(); i++) {
+		const Recording& recording = recordings[i];
+		for (size_t p = 0; p < 2; p++) {
+			Converter::Options options = benchOptions();
+			options.precision = precisions[p];
+			const char* precisionName = precisions[p] == PIPELINE_FLOAT ? "float" : "double";
+
+			string reference, error;
+			vector<unsigned char> whole;
+			if (!convertPayload(options, recording, reference, whole, error)) {
+				cerr << "error: " << recording.path << " (" << precisionName << "): " << error << endl;
+				allMatch = false;
+				continue;
+			}
+			long long epochs = (long long)(whole.size() / epochBytes);
+
+			for (size_t v = 0; v < sizeof(checkVariants) / sizeof(checkVariants[0]); v++) {
+				const CheckVariant& variant = checkVariants[v];
+				Converter::Options changed = options;
+				changed.streaming = variant.streaming;
+				changed.pool = variant.parallel ? &pool : NULL;
+				string expected = reference;
+				if (variant.range) {
+					changed.firstEpoch = epochs / 3;
+					changed.endEpoch = 2 * epochs / 3;
+					expected = sha1Hex(whole.data() + changed.firstEpoch * epochBytes, (size_t)((changed.endEpoch - changed.firstEpoch) * epochBytes));
+				}
+
+				setResamplerSpecialization(!variant.generic);
+				string digest;
+				vector<unsigned char> payload;
+				bool converted = convertPayload(changed, recording, digest, payload, error);
+				setResamplerSpecialization(true);
+				bool match = converted && digest == expected;
+				if (!match) {
+					cerr << "error: " << recording.path << " (" << precisionName << "), " << variant.name << ": ";
+					if (converted)
+						cerr << "payload SHA1 " << digest << " differs from " << expected << " of the whole conversion on one thread" << endl;
+					else
+						cerr << error << endl;
+					allMatch = false;
+				}
+
+				ostringstream fields;
+				fields << "\"file\":\"" << recording.path << "\",\"rate\":" << recording.rate << ",\"precision\":\"" << precisionName
+					<< "\",\"variant\":\"" << variant.name << "\",\"sha1\":\"" << digest << "\",\"expected\":\"" << expected
+					<< "\",\"match\":" << (match ? "true" : "false");
+				cout << "{\"benchmark\":\"check\"," << fields.str() << "}" << endl;
+			}
+		}
+	}
+	return allMatch;
+}
+
+//Whole files through the scheduler and converter as edf2cfs runs them
+static void benchEndToEnd(const vector<Recording>& recordings, const vector<unsigned>& threadCounts) {
+	Converter converter(benchOptions());
+
+	vector<string> filelist;
+	unsigned long long bytes = 0;
+	for (size_t i = 0; i < recordings.size(); i++) {
+		filelist.push_back(recordings[i].path);
+		bytes += recordings[i].bytes;
+	}
+
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		unsigned threads = threadCounts[t];
+		size_t failed = 0;
+		BenchClock::time_point start = BenchClock::now();
+		{
+			ThreadPool pool(threads);
+			FileScheduler scheduler(pool);
+			scheduler.run(filelist, [&converter](const string& filename, ostringstream& log) {
+				ConvertResult result = converter.convertFile(filename, filename + ".cfs");
+				log << result.message;
+				return result.ok();
+			}, [&failed](const FileResult& result) {
+				if (!result.success) {
+					cerr << result.filename << ": " << result.log << endl;
+					failed++;
+				}
+				remove((result.filename + ".cfs").c_str());
+			});
+		}
+		double seconds = secondsSince(start);
+
+		ostringstream fields;
+		fields << "\"threads\":" << threads << ",\"files\":" << filelist.size() << ",\"failed\":" << failed
+			<< ",\"files_per_sec\":" << filelist.size() / seconds << ",\"mb_per_sec\":" << bytes / seconds / 1e6;
+		report("end_to_end", fields.str(), seconds);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	vector<int> rates, hours;
+	vector<unsigned> threadCounts;
+	vector<string> cfsFiles;
+	string dir;
+	bool skipEndToEnd;
+	bool checkOnly;
+
+	try {
+		TCLAP::CmdLine cmd("Benchmarks of edf2cfs on synthetic recordings, results as JSON lines on stdout", ' ', "1.0");
+		TCLAP::MultiArg<int> rateArg("", "rate", "Sampling rate of the recordings, repeat for several (default: 100 200 256 500 512)", false, "Hz");
+		TCLAP::MultiArg<int> hourArg("", "hours", "Duration of the recordings, repeat for several (default: 1)", false, "hours");
+		TCLAP::ValueArg<int> threadArg("j", "jobs", "Largest number of threads for the end-to-end runs (default: number of cores)", false, 0, "Number of jobs");
+		TCLAP::ValueArg<string> dirArg("d", "dir", "Where the recordings are generated and kept for later runs (default: bench-data)", false, "bench-data", "directory");
+		TCLAP::MultiArg<string> cfsArg("", "cfs", "Also compare the codecs on the payload of this CFS, e.g. of a real recording (repeatable)", false, "CFS file");
+		TCLAP::SwitchArg stagesArg("s", "stages-only", "only run the per-stage benchmarks", false);
+		TCLAP::SwitchArg checkArg("c", "check-only", "only check that every conversion path gives the payload of the whole conversion on one thread", false);
+		cmd.add(rateArg);
+		cmd.add(hourArg);
+		cmd.add(threadArg);
+		cmd.add(dirArg);
+		cmd.add(cfsArg);
+		cmd.add(stagesArg);
+		cmd.add(checkArg);
+		cmd.parse(argc, argv);
+
+		rates = rateArg.getValue();
+		hours = hourArg.getValue();
+		dir = dirArg.getValue();
+		cfsFiles = cfsArg.getValue();
+		skipEndToEnd = stagesArg.getValue();
+		checkOnly = checkArg.getValue();
+
+		if (rates.empty()) {
+			int defaults[] = { 100, 200, 256, 500, 512 };
+			rates.assign(defaults, defaults + 5);
+		}
+		if (hours.empty())
+			hours.push_back(1);
+
+		unsigned maxThreads = threadArg.getValue() > 0 ? threadArg.getValue() : thread::hardware_concurrency();
+		if (maxThreads == 0)
+			maxThreads = 2;
+		for (unsigned t = 1; t < maxThreads; t *= 2)
+			threadCounts.push_back(t);
+		threadCounts.push_back(maxThreads);
+	}
+	catch (TCLAP::ArgException& e) {
+		cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
+		return(1);
+	}
+
+	mkdir(dir.c_str(), 0755);
+
+	//Recordings are expensive to write, any left by an earlier run are used as they are
+	vector<Recording> recordings;
+	for (size_t h = 0; h < hours.size(); h++) {
+		for (size_t r = 0; r < rates.size(); r++) {
+			for (int bdf = 0; bdf < 2; bdf++) {
+				Recording recording;
+				recording.rate = rates[r];
+				recording.hours = hours[h];
+				recording.bdf = bdf != 0;
+				ostringstream path;
+				path << dir << "/synthetic_" << recording.rate << "hz_" << recording.hours << "h." << (bdf ? "bdf" : "edf");
+				recording.path = path.str();
+				if (fileSize(recording.path) == 0) {
+					cerr << "Generating " << recording.path << endl;
+					if (!generateRecording(recording)) {
+						cerr << "error: can not write " << recording.path << endl;
+						return(1);
+					}
+				}
+				recording.bytes = fileSize(recording.path);
+				recordings.push_back(recording);
+			}
+		}
+	}
+
+	SpectralEngine::initialize();
+
+	//Which kernels ran, for comparing runs on different machines
+	cout << "{\"benchmark\":\"cpu\",\"simd\":\"" << simdInstructionSet() << "\",\"sha1\":\"" << sha1InstructionSet() << "\"}" << endl;
+
+	if (!checkOnly) {
+		cerr << "Stage benchmarks" << endl;
+		for (size_t i = 0; i < recordings.size(); i++)
+			if (recordings[i].hours == hours[0])
+				benchRead(recordings[i]);
+		for (size_t r = 0; r < rates.size(); r++) {
+			vector<double> x;
+			unsigned seed = 12345u;
+			synthesize(x, rates[r], 0, hours[0] * 3600LL * rates[r], 0, seed);
+			benchFilter(x, rates[r]);
+			benchResample(x, rates[r]);
+		}
+		benchPayload(hours[0], dir);
+		for (size_t i = 0; i < cfsFiles.size(); i++) {
+			vector<unsigned char> payload;
+			if (!readCfsPayload(cfsFiles[i], payload)) {
+				cerr << "error: can not read the payload of " << cfsFiles[i] << endl;
+				return(1);
+			}
+			benchCodecs(cfsFiles[i], payload);
+		}
+		if (skipEndToEnd)
+			return(0);
+	}
+
+	//Timings of paths that give other bytes would not be worth comparing
+	cerr << "Checking that every conversion path gives the same payload" << endl;
+	vector<Recording> checked;
+	for (size_t i = 0; i < recordings.size(); i++)
+		if (recordings[i].hours == hours[0])
+			checked.push_back(recordings[i]);
+	if (!checkConversions(checked, threadCounts.back())) {
+		cerr << "error: conversion paths differ, see above" << endl;
+		return(1);
+	}
+
+	if (!checkOnly) {
+		cerr << "End-to-end benchmarks" << endl;
+		benchEndToEnd(recordings, threadCounts);
+	}
+	return(0);
+}
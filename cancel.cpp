@@ -0,0 +1,97 @@
+#include "cancel.h"
+#include <thread>
+#include <algorithm>
+
+using namespace std;
+
+//Steps of CancelToken::sleep(), how late a cancellation is noticed while waiting
+#define CANCEL_SLEEPSTEPMILLIS (50)
+
+static thread_local CancelToken* activeToken = NULL;
+
+CancelToken::CancelToken() : _cancelled(false), _hasDeadline(false), _deadline(0), _paused(false), _state(CANCEL_RUNNING) {
+}
+
+void CancelToken::cancel() {
+	_cancelled.store(true);
+}
+
+void CancelToken::setDeadline(chrono::steady_clock::time_point deadline) {
+	_deadline.store(deadline.time_since_epoch().count());
+	_hasDeadline.store(true);
+}
+
+void CancelToken::pause() {
+	_pausedAt = chrono::steady_clock::now();
+	_paused.store(true);
+}
+
+//The deadline is moved before the pause ends, so no one sees the old one meanwhile
+void CancelToken::resume() {
+	if (!_paused.load())
+		return;
+	_deadline.fetch_add((chrono::steady_clock::now() - _pausedAt).count());
+	_paused.store(false);
+}
+
+chrono::steady_clock::time_point CancelToken::deadline() const {
+	return chrono::steady_clock::time_point(chrono::steady_clock::duration(_deadline.load()));
+}
+
+bool CancelToken::cancelled() const {
+	return _cancelled.load() || expired();
+}
+
+bool CancelToken::expired() const {
+	return _hasDeadline.load() && !_paused.load() && chrono::steady_clock::now() >= deadline();
+}
+
+bool CancelToken::sleep(chrono::milliseconds duration) const {
+	chrono::steady_clock::time_point end = chrono::steady_clock::now() + duration;
+	while (!cancelled()) {
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now >= end)
+			return true;
+		this_thread::sleep_for(min(chrono::duration_cast<chrono::milliseconds>(end - now), chrono::milliseconds(CANCEL_SLEEPSTEPMILLIS)));
+	}
+	return false;
+}
+
+bool CancelToken::complete() {
+	int running = CANCEL_RUNNING;
+	return _state.compare_exchange_strong(running, CANCEL_COMPLETED) || running == CANCEL_COMPLETED;
+}
+
+bool CancelToken::abandon() {
+	int running = CANCEL_RUNNING;
+	if (!_state.compare_exchange_strong(running, CANCEL_ABANDONED))
+		return false;
+	cancel();
+	return true;
+}
+
+ConvertCancelled::ConvertCancelled(bool timedOut) :
+	runtime_error(timedOut ? "The conversion did not finish within its deadline." : "The conversion was cancelled."), _timedOut(timedOut) {
+}
+
+CancelToken* currentCancelToken() {
+	return activeToken;
+}
+
+void cancellationPoint() {
+	CancelToken* token = activeToken;
+	if (!token)
+		return;
+	if (token->_checkpoint)
+		token->_checkpoint();
+	if (token->cancelled())
+		throw ConvertCancelled(token->expired());
+}
+
+CancelScope::CancelScope(CancelToken* token) : _previous(activeToken) {
+	activeToken = token;
+}
+
+CancelScope::~CancelScope() {
+	activeToken = _previous;
+}
@@ -0,0 +1,98 @@
+//CANCEL  Deadlines and cooperative cancellation of a conversion.
+//   Whoever starts a conversion installs a CancelToken on the thread with a CancelScope,
+//   the way a FileProfile is installed. The conversion calls cancellationPoint() between
+//   chunks and between pipeline stages, which throws ConvertCancelled once the token is
+//   cancelled or past its deadline; the Converter turns that into a status. A read that
+//   never returns can not be interrupted this way, so a token is also settled exactly once:
+//   either the conversion completes it, or a watchdog abandons it and reports the file
+//   itself, and the result that arrives late is dropped. The same checkpoints are where a
+//   scheduler can preempt a conversion, through a function the token calls at each of them.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+class CancelToken {
+public:
+	CancelToken();
+
+	void cancel();
+
+	//Cancelled once the time is reached. The deadline can be moved while others read it
+	void setDeadline(chrono::steady_clock::time_point deadline);
+	bool hasDeadline() const { return _hasDeadline.load(); }
+	chrono::steady_clock::time_point deadline() const;
+
+	//Stops the clock of the deadline while the thread does other work, e.g. converts a file
+	//that preempted this one; resume() moves the deadline on by the time paused. Never
+	//expired while paused. Only the thread of the conversion pauses and resumes it
+	void pause();
+	void resume();
+	bool paused() const { return _paused.load(); }
+
+	//Called by every cancellationPoint() of the conversion, on its thread, before the token
+	//is checked. Set before the conversion starts
+	void setCheckpoint(const function<void()>& checkpoint) { _checkpoint = checkpoint; }
+
+	bool cancelled() const;      // by cancel() or by the deadline
+	bool expired() const;        // by the deadline
+
+	//Sleeps for up to duration, false when cancelled before or meanwhile
+	bool sleep(chrono::milliseconds duration) const;
+
+	//Settles the token, true for the conversion when no watchdog abandoned it first and
+	//for the watchdog when the conversion has not completed it first
+	bool complete();
+	bool abandon();
+	bool abandoned() const { return _state.load() == CANCEL_ABANDONED; }
+
+private:
+	CancelToken(const CancelToken&) = delete;
+	CancelToken& operator=(const CancelToken&) = delete;
+
+	enum { CANCEL_RUNNING, CANCEL_COMPLETED, CANCEL_ABANDONED };
+
+	friend void cancellationPoint();
+
+	atomic<bool> _cancelled;
+	atomic<bool> _hasDeadline;
+	atomic<chrono::steady_clock::rep> _deadline; // time_since_epoch()
+	atomic<bool> _paused;
+	chrono::steady_clock::time_point _pausedAt;
+	atomic<int> _state;
+	function<void()> _checkpoint;
+};
+
+class ConvertCancelled : public runtime_error {
+public:
+	explicit ConvertCancelled(bool timedOut);
+
+	bool timedOut() const { return _timedOut; }
+
+private:
+	bool _timedOut;
+};
+
+//Token of the conversion running on this thread, NULL when it can not be cancelled
+CancelToken* currentCancelToken();
+
+//Throws ConvertCancelled if the conversion running on this thread is to stop
+void cancellationPoint();
+
+class CancelScope {
+public:
+	//token may be NULL, then the conversion runs to the end
+	explicit CancelScope(CancelToken* token);
+	~CancelScope();
+
+private:
+	CancelScope(const CancelScope&) = delete;
+	CancelScope& operator=(const CancelScope&) = delete;
+
+	CancelToken* _previous;
+};
@@ -0,0 +1,164 @@
+// cfsmerge.cpp : Merges what the shards of a run of "edf2cfs --shard i/N" left behind, built by "make cfsmerge".
+//
+// Every shard keeps its manifest next to the one given to edf2cfs, as <manifest>.shard-i-of-N.
+// --manifest merges all of them into that manifest, older shard files first so the latest
+// conversion of an input wins; the shard files are left in place for further sharded runs.
+// JSON-lines logs of the shards given on the command line are merged into the -o log, one line
+// per file sorted by path, and the totals of the whole run are printed.
+//
+#include "tclap/CmdLine.h"
+#include "tclap/ValueArg.h"
+#include "manifest.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <stdio.h>
+#include <dirent.h>
+
+using namespace std;
+
+//Shard manifests of manifest, oldest first
+static vector<string> shardManifests(const string& manifest) {
+	size_t slash = manifest.find_last_of('/');
+	string dir = (slash == string::npos) ? "." : manifest.substr(0, slash + 1);
+	string prefix = ((slash == string::npos) ? manifest : manifest.substr(slash + 1)) + ".shard-";
+
+	vector< pair<long long, string> > found;
+	DIR* listing = opendir(dir.c_str());
+	if (!listing)
+		return vector<string>();
+	while (struct dirent* item = readdir(listing)) {
+		string name = item->d_name;
+		//save() writes through a .tmp file that a crash can leave behind
+		if (name.compare(0, prefix.size(), prefix) != 0 || name.find(".tmp") != string::npos)
+			continue;
+		string path = (slash == string::npos) ? name : dir + name;
+		unsigned long long size;
+		long long mtime;
+		if (fileStamp(path, size, mtime))
+			found.push_back(make_pair(mtime, path));
+	}
+	closedir(listing);
+
+	sort(found.begin(), found.end());
+	vector<string> paths;
+	for (size_t i = 0; i < found.size(); i++)
+		paths.push_back(found[i].second);
+	return paths;
+}
+
+//Value of the string field name in a line of logEntryJson(), empty if it has none
+static string jsonField(const string& line, const string& name) {
+	string key = "\"" + name + "\":\"";
+	size_t start = line.find(key);
+	if (start == string::npos)
+		return string();
+	start += key.size();
+	size_t end = start;
+	while (end < line.size() && line[end] != '"')
+		end += (line[end] == '\\') ? 2 : 1;
+	return line.substr(start, min(end, line.size()) - start);
+}
+
+static bool mergeLogs(const vector<string>& logs, const string& output) {
+	vector<string> lines;
+	for (size_t i = 0; i < logs.size(); i++) {
+		ifstream in(logs[i].c_str());
+		if (!in.is_open()) {
+			cerr << "error: can not read " << logs[i] << endl;
+			return false;
+		}
+		string line;
+		while (getline(in, line))
+			//A line cut short when a node was killed is not an object
+			if (!line.empty() && line[0] == '{' && line[line.size() - 1] == '}')
+				lines.push_back(line);
+	}
+	//Lines start with the file, so this orders them by path
+	sort(lines.begin(), lines.end());
+
+	string temporary = output + ".tmp";
+	{
+		ofstream out(temporary.c_str());
+		for (size_t i = 0; i < lines.size(); i++)
+			out << lines[i] << '\n';
+		out.close();
+		if (!out || rename(temporary.c_str(), output.c_str()) != 0) {
+			remove(temporary.c_str());
+			cerr << "error: can not write " << output << endl;
+			return false;
+		}
+	}
+
+	size_t succeeded = 0;
+	map<string, size_t> codes;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lines[i].find("\"success\":true") != string::npos)
+			succeeded++;
+		codes[jsonField(lines[i], "code")]++;
+	}
+	cout << lines.size() << " files in " << logs.size() << " logs merged into " << output << ".\n";
+	cout << succeeded << " Files converted successfully. " << (lines.size() - succeeded) << " Files could not be converted.\n";
+	for (map<string, size_t>::const_iterator it = codes.begin(); it != codes.end(); ++it)
+		cout << "  " << (it->first.empty() ? "unknown" : it->first) << ": " << it->second << "\n";
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	string manifestFile, output;
+	vector<string> logs;
+
+	try {
+		TCLAP::CmdLine cmd("Usage: ./cfsmerge [--manifest edf2cfs.manifest] [-o run_log.jsonl shard_log1.jsonl ... shard_logN.jsonl]\nMerges the manifests and JSON-lines logs of the shards of an edf2cfs --shard run.", ' ', "1.0");
+		TCLAP::ValueArg<string> manifestArg("", "manifest", "Merge the shard manifests of this manifest into it", false, "", "manifest file");
+		TCLAP::ValueArg<string> outputArg("o", "output", "Merge the JSON-lines logs given into this one", false, "", "log file");
+		TCLAP::UnlabeledMultiArg<string> files("logs", "JSON-lines logs of the shards", false, "List of log files", false);
+
+		cmd.add(files);
+		cmd.add(outputArg);
+		cmd.add(manifestArg);
+		cmd.parse(argc, argv);
+
+		manifestFile = manifestArg.getValue();
+		output = outputArg.getValue();
+		logs = files.getValue();
+	}
+	catch (TCLAP::ArgException& e) {
+		cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
+		return(1);
+	}
+	if (manifestFile.empty() && output.empty()) {
+		cerr << "error: nothing to merge, ./cfsmerge -h for usage details" << endl;
+		return(1);
+	}
+	if (output.empty() != logs.empty()) {
+		cerr << "error: -o needs the logs to merge into it, and logs need -o" << endl;
+		return(1);
+	}
+
+	bool ok = true;
+	if (!manifestFile.empty()) {
+		vector<string> shards = shardManifests(manifestFile);
+		Manifest manifest(manifestFile);
+		ok = manifest.open();
+		if (!ok)
+			cerr << "error: can not open manifest " << manifestFile << endl;
+		for (size_t i = 0; ok && i < shards.size(); i++)
+			if (!manifest.merge(shards[i])) {
+				cerr << "error: can not read " << shards[i] << endl;
+				ok = false;
+			}
+		if (ok && manifest.save() && manifest.ok())
+			cout << shards.size() << " shard manifests merged into " << manifestFile << ".\n";
+		else if (ok) {
+			cerr << "error: can not write manifest " << manifestFile << endl;
+			ok = false;
+		}
+	}
+	if (!output.empty() && !mergeLogs(logs, output))
+		ok = false;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+#include "cfsreader.h"
+#include "SHA1.h"
+#include "spectral.h"
+#include "pipeline.h"
+#include <zlib.h>
+#include <string.h>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+#define CFS_HEADERBYTES (11)
+#define CFS_STREAMOFFSET (CFS_HEADERBYTES + 20)
+#define CFS_INDEXENTRYBYTES (16)
+
+static uint64_t littleEndian(const unsigned char* bytes, int count) {
+	uint64_t value = 0;
+	for (int i = count - 1; i >= 0; i--)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+
+//Stored bytes of one epoch
+static unsigned long long epochBytes(const CfsHeader& header) {
+	if (header.version == CFS_VERSION_PAYLOAD)
+		return payloadEpochBytes(header.payload);
+	return (unsigned long long)header.nChannels * header.nFreq * header.nTimes * sizeof(float);
+}
+
+CfsReader::CfsReader() : _file(NULL), _data(NULL), _size(0) {
+}
+
+CfsReader::~CfsReader() {
+	if (_file)
+		fclose(_file);
+}
+
+bool CfsReader::open(const string& filename) {
+	_filename = filename;
+	_file = fopen(filename.c_str(), "rb");
+	if (!_file)
+		return fail("can not open " + filename);
+	if (fseeko(_file, 0, SEEK_END) != 0)
+		return fail("can not read " + filename);
+	_size = (unsigned long long)ftello(_file);
+	return readHeader();
+}
+
+bool CfsReader::open(const unsigned char* data, size_t size) {
+	_filename = "CFS buffer";
+	_data = data;
+	_size = size;
+	return readHeader();
+}
+
+unsigned long long CfsReader::payloadBytes() const {
+	return _header.nEpochs * epochBytes(_header);
+}
+
+bool CfsReader::readHeader() {
+	unsigned char bytes[CFS_STREAMOFFSET + 11];
+	if (_size < CFS_STREAMOFFSET || !fetch(0, CFS_STREAMOFFSET, bytes))
+		return fail("too short for a CFS header");
+	if (bytes[0] != 'C' || bytes[1] != 'F' || bytes[2] != 'S')
+		return fail("not a CFS file");
+
+	CfsHeader& header = _header;
+	header.version = bytes[3];
+	header.nFreq = bytes[4];
+	header.nTimes = bytes[5];
+	header.nChannels = bytes[6];
+	header.nEpochs = (uint16_t)littleEndian(bytes + 7, 2);
+	header.compression = bytes[9];
+	if (!bytes[10])
+		return fail("the header has no SHA1 to verify");
+	static const char hex[] = "0123456789ABCDEF";
+	for (int i = 0; i < 20; i++) {
+		header.digest += hex[bytes[CFS_HEADERBYTES + i] >> 4];
+		header.digest += hex[bytes[CFS_HEADERBYTES + i] & 15];
+	}
+	if (!codecOfHeader(header.version, header.compression, header.codec))
+		return fail("version " + to_string(header.version) + " with compression " + to_string(header.compression) + " can not be read by this build");
+	header.payloadOffset = CFS_STREAMOFFSET;
+	if (header.version != CFS_VERSION_BLOCKS && header.version != CFS_VERSION_PAYLOAD)
+		return true;
+
+	//Payload format of version 4, then block size and index offset
+	size_t offset = CFS_STREAMOFFSET;
+	size_t fields = (header.version == CFS_VERSION_PAYLOAD) ? 11 : 10;
+	if (_size < CFS_STREAMOFFSET + fields || !fetch(CFS_STREAMOFFSET, fields, bytes + CFS_STREAMOFFSET))
+		return fail("too short for a CFS version " + to_string(header.version) + " header");
+	if (header.version == CFS_VERSION_PAYLOAD) {
+		if (bytes[offset] < PAYLOAD_FLOAT16 || bytes[offset] > PAYLOAD_Q8)
+			return fail("unknown payload format " + to_string(bytes[offset]));
+		header.payload = (PayloadFormat)bytes[offset++];
+		if (header.nFreq != SPECTRAL_BINS || header.nTimes != SPECTRAL_WINDOWS || header.nChannels != PIPELINE_CHANNELS)
+			return fail("a " + string(payloadFormatName(header.payload)) + " payload needs " + to_string(SPECTRAL_BINS) + " x " +
+				to_string(SPECTRAL_WINDOWS) + " x " + to_string(PIPELINE_CHANNELS) + " values per epoch");
+	}
+	header.blockEpochs = (unsigned)littleEndian(bytes + offset, 2);
+	header.indexOffset = littleEndian(bytes + offset + 2, 8);
+	header.payloadOffset = offset + 10;
+	if (header.blockEpochs == 0 && (header.version == CFS_VERSION_BLOCKS || header.indexOffset != 0))
+		return fail("the header has an index but no block size");
+	if (header.blockEpochs > 0 && (header.indexOffset < header.payloadOffset || header.indexOffset > _size))
+		return fail("the index offset is outside the file");
+	return true;
+}
+
+bool CfsReader::read(CodecOutput output) {
+	if (!_error.empty() || _header.version == 0)
+		return false;
+
+	//Everything read goes through the SHA1 and to the caller, up to the announced length
+	CSHA1 sha1;
+	unsigned long long expected = payloadBytes(), seen = 0;
+	bool tooLong = false;
+	CodecOutput payload = [&](const unsigned char* data, size_t count) {
+		if (seen + count > expected) {
+			tooLong = true;
+			return false;
+		}
+		seen += count;
+		sha1.Update(data, (UINT_32)count);
+		return !output || output(data, count);
+	};
+
+	bool ok = (_header.blockEpochs > 0) ? readBlocks(payload) : readRange(_header.payloadOffset, _size, payload, NULL);
+	if (tooLong)
+		return fail("the payload is longer than the " + to_string(expected) + " bytes of " + to_string(_header.nEpochs) + " epochs");
+	if (!ok)
+		return false;
+	if (seen != expected)
+		return fail("the payload has " + to_string(seen) + " bytes, " + to_string(_header.nEpochs) + " epochs need " + to_string(expected));
+
+	sha1.Final();
+	string digest;
+	sha1.ReportHashStl(digest, CSHA1::REPORT_HEX_SHORT);
+	if (digest != _header.digest)
+		return fail("SHA1 mismatch, the payload hashes to " + digest);
+	return true;
+}
+
+bool CfsReader::readBlocks(const CodecOutput& output) {
+	unsigned char countBytes[4];
+	if (!fetch(_header.indexOffset, 4, countBytes))
+		return fail("the index is truncated");
+	uint64_t blocks = littleEndian(countBytes, 4);
+	uint64_t expected = (_header.nEpochs + _header.blockEpochs - 1) / _header.blockEpochs;
+	if (blocks != expected)
+		return fail("the index has " + to_string(blocks) + " blocks, " + to_string(_header.nEpochs) + " epochs need " + to_string(expected));
+	if (_header.indexOffset + 4 + blocks * CFS_INDEXENTRYBYTES != _size)
+		return fail("the index does not end the file");
+	vector<unsigned char> index(blocks * CFS_INDEXENTRYBYTES);
+	if (!fetch(_header.indexOffset + 4, index.size(), index.data()))
+		return fail("the index is truncated");
+
+	//Blocks follow each other without gaps, from the header to the index
+	uint64_t offset = _header.payloadOffset;
+	unsigned long long blockBytes = _header.blockEpochs * epochBytes(_header);
+	for (uint64_t b = 0; b < blocks; b++) {
+		const unsigned char* entry = &index[b * CFS_INDEXENTRYBYTES];
+		uint64_t start = littleEndian(entry, 8), size = littleEndian(entry + 8, 4);
+		uint32_t crc = (uint32_t)littleEndian(entry + 12, 4);
+		if (start != offset || start + size > _header.indexOffset)
+			return fail("block " + to_string(b) + " is not where the index puts it");
+		offset += size;
+
+		unsigned long long raw = (b + 1 < blocks) ? blockBytes : payloadBytes() - b * blockBytes;
+		uint32_t blockCrc = (uint32_t)crc32(0L, Z_NULL, 0);
+		unsigned long long seen = 0;
+		CodecOutput sink = [&](const unsigned char* data, size_t count) {
+			blockCrc = (uint32_t)crc32(blockCrc, data, (uInt)count);
+			seen += count;
+			return output(data, count);
+		};
+		if (!readRange(start, start + size, sink, &b))
+			return false;
+		if (seen != raw)
+			return fail("block " + to_string(b) + " has " + to_string(seen) + " bytes instead of " + to_string(raw));
+		if (blockCrc != crc)
+			return fail("CRC32 mismatch in block " + to_string(b));
+	}
+	if (offset != _header.indexOffset)
+		return fail("bytes between the last block and the index");
+	return true;
+}
+
+bool CfsReader::readRange(uint64_t begin, uint64_t end, const CodecOutput& output, const uint64_t* block) {
+	string error;
+	unique_ptr<Decompressor> decompressor = Decompressor::create(_header.codec, CFSREADER_CHUNKBYTES, output, error);
+	if (!decompressor)
+		return fail(error);
+
+	vector<unsigned char> chunk(CFSREADER_CHUNKBYTES);
+	for (uint64_t offset = begin; offset < end; offset += chunk.size()) {
+		size_t count = (size_t)min<uint64_t>(chunk.size(), end - offset);
+		if (!fetch(offset, count, chunk.data()))
+			return fail("can not read " + _filename);
+		if (!decompressor->write(chunk.data(), count))
+			break;
+	}
+	if (decompressor->error().empty())
+		decompressor->finish();
+	if (!decompressor->error().empty())
+		return fail(block ? "block " + to_string(*block) + ": " + decompressor->error() : decompressor->error());
+	return true;
+}
+
+bool CfsReader::fetch(uint64_t offset, size_t count, unsigned char* out) {
+	if (offset + count > _size)
+		return false;
+	if (_data) {
+		memcpy(out, _data + offset, count);
+		return true;
+	}
+	return fseeko(_file, (off_t)offset, SEEK_SET) == 0 && fread(out, 1, count, _file) == count;
+}
+
+bool CfsReader::fail(const string& message) {
+	if (_error.empty())
+		_error = message;
+	return false;
+}
@@ -0,0 +1,80 @@
+//CFSREADER  Reads a CFS back and checks it against its own header.
+//   The header is parsed and checked by open(); read() then streams the payload through the
+//   decompressor a chunk at a time, so a file is never held in memory whole, and checks that
+//   it has exactly the length the header gives (nEpochs x nChannels x nFreq x nTimes floats,
+//   or the epoch size of the payload format of version 4), that the SHA1 matches and, for
+//   block-compressed files, that the index covers the blocks without gaps and every block's
+//   CRC32 matches. Versions 1 to 4 are read, see cfswriter.h for their layout.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include "codec.h"
+#include "quantize.h"
+
+using namespace std;
+
+#define CFSREADER_CHUNKBYTES (65536)
+
+struct CfsHeader {
+	CfsHeader() : version(0), nFreq(0), nTimes(0), nChannels(0), nEpochs(0), compression(0),
+		payload(PAYLOAD_FLOAT), blockEpochs(0), indexOffset(0), payloadOffset(0) {}
+
+	uint8_t version;
+	uint8_t nFreq, nTimes, nChannels;
+	uint16_t nEpochs;
+	uint8_t compression;
+	string digest;               // stored SHA1 of the payload, in hex
+	Codec codec;                 // that reads the payload
+	PayloadFormat payload;
+	unsigned blockEpochs;        // epochs per block, 0 for a single stream
+	uint64_t indexOffset;        // of the block index, 0 for a single stream
+	uint64_t payloadOffset;      // where the compressed stream or the first block starts
+};
+
+class CfsReader {
+public:
+	CfsReader();
+	~CfsReader();
+
+	//Opens filename and reads its header, false with error() set unless it is a CFS this
+	//build can read
+	bool open(const string& filename);
+
+	//Same for the size bytes of a CFS at data, which have to outlive the reader
+	bool open(const unsigned char* data, size_t size);
+
+	const CfsHeader& header() const { return _header; }
+
+	//Bytes of the file and of the stored payload the header announces
+	unsigned long long fileBytes() const { return _size; }
+	unsigned long long payloadBytes() const;
+
+	//Decompresses the whole payload, hands it to output a chunk at a time if there is one,
+	//and checks its length, the blocks and the SHA1. Only once per open()
+	bool read(CodecOutput output = CodecOutput());
+
+	//What went wrong
+	const string& error() const { return _error; }
+
+private:
+	CfsReader(const CfsReader&) = delete;
+	CfsReader& operator=(const CfsReader&) = delete;
+
+	bool readHeader();
+	bool readBlocks(const CodecOutput& output);
+	//Decompresses bytes [begin, end) of the file as one stream, of the block numbered *block if given
+	bool readRange(uint64_t begin, uint64_t end, const CodecOutput& output, const uint64_t* block);
+	bool fetch(uint64_t offset, size_t count, unsigned char* out);
+	bool fail(const string& message);
+
+	string _filename;
+	FILE* _file;
+	const unsigned char* _data;
+	unsigned long long _size;
+	CfsHeader _header;
+	string _error;
+};
@@ -0,0 +1,260 @@
+// cfsverify.cpp : Reads CFS files back and checks them, built by "make cfsverify".
+//
+// Every file is decompressed as a stream and checked against its own header: the payload length
+// the epoch count gives, the SHA1 and, for block-compressed files, the index and the CRC32 of each
+// block. With --reference the payload is also compared with that of a reference CFS, for
+// regression tests of the converter: the file of the same path below -d (or of the same name, for
+// files given on the command line) in a reference directory, or the one reference file given.
+// Files are checked on -j threads at once, those under -d while the directory is still being
+// crawled. The exit status is 1 if any file failed.
+//
+#include "tclap/CmdLine.h"
+#include "tclap/ValueArg.h"
+#include "cfsreader.h"
+#include "crawler.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cmath>
+#include <string.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+//Files still to be checked, from the command line first and then from the crawl
+struct Work {
+	Work() : next(0), referenceDir(false) {}
+
+	mutex lock;
+	vector<string> files;
+	size_t next;
+	unique_ptr<DirectoryCrawler> crawler;
+	string root;                 // of the crawl, with a trailing '/'
+	string reference;
+	bool referenceDir;
+};
+
+static bool isDirectory(const string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static string joined(const string& dir, const string& name) {
+	return (dir.empty() || dir[dir.size() - 1] == '/') ? dir + name : dir + "/" + name;
+}
+
+//Next file and its reference, empty if there is none
+static bool nextFile(Work& work, string& path, string& reference) {
+	string relative;
+	{
+		lock_guard<mutex> lock(work.lock);
+		if (work.next < work.files.size()) {
+			path = work.files[work.next++];
+			size_t slash = path.find_last_of('/');
+			relative = (slash == string::npos) ? path : path.substr(slash + 1);
+		}
+	}
+	if (relative.empty()) {
+		if (!work.crawler || !work.crawler->next(path))
+			return false;
+		relative = path.substr(min(work.root.size(), path.size()));
+	}
+	if (work.reference.empty())
+		reference.clear();
+	else
+		reference = work.referenceDir ? joined(work.reference, relative) : work.reference;
+	return true;
+}
+
+//Magnitudes of the stored payload of a CFS with this header
+static void magnitudes(const CfsHeader& header, const vector<unsigned char>& payload, vector<float>& values) {
+	if (header.version == CFS_VERSION_PAYLOAD) {
+		size_t epochBytes = payloadEpochBytes(header.payload);
+		size_t epochValues = (size_t)header.nChannels * header.nFreq * header.nTimes;
+		values.resize(header.nEpochs * epochValues);
+		for (size_t e = 0; e < header.nEpochs; e++)
+			decodeEpoch(header.payload, &payload[e * epochBytes], &values[e * epochValues]);
+		return;
+	}
+	values.resize(payload.size() / sizeof(float));
+	for (size_t i = 0; i < values.size(); i++) {
+		const unsigned char* bytes = &payload[i * sizeof(float)];
+		uint32_t bits = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+		memcpy(&values[i], &bits, sizeof(float));
+	}
+}
+
+//Reads the whole payload of path, false with error set if it does not check out
+static bool readPayload(CfsReader& reader, const string& path, vector<unsigned char>* payload, string& error) {
+	bool ok = reader.open(path);
+	if (ok && payload)
+		ok = reader.read([payload](const unsigned char* data, size_t count) {
+			payload->insert(payload->end(), data, data + count);
+			return true;
+		});
+	else if (ok)
+		ok = reader.read();
+	if (!ok)
+		error = reader.error();
+	return ok;
+}
+
+//Result line of one file, false if it failed
+static bool check(const string& path, const string& reference, double tolerance, bool info, string& line) {
+	ostringstream out;
+	CfsReader reader;
+	vector<unsigned char> payload;
+	string error;
+	if (!readPayload(reader, path, reference.empty() ? NULL : &payload, error)) {
+		line = "FAILED " + path + ": " + error;
+		return false;
+	}
+
+	const CfsHeader& header = reader.header();
+	out << "OK " << path << ": " << header.nEpochs << " epochs, version " << (int)header.version << ", " << codecName(header.codec);
+	if (header.version == CFS_VERSION_PAYLOAD)
+		out << ", " << payloadFormatName(header.payload);
+	if (header.blockEpochs > 0)
+		out << ", blocks of " << header.blockEpochs;
+	if (info)
+		out << ", " << (int)header.nChannels << " x " << (int)header.nTimes << " x " << (int)header.nFreq << ", "
+			<< reader.fileBytes() << " bytes for " << reader.payloadBytes() << ", SHA1 " << header.digest;
+
+	if (!reference.empty()) {
+		CfsReader expected;
+		vector<unsigned char> expectedPayload;
+		if (!readPayload(expected, reference, &expectedPayload, error)) {
+			line = "FAILED " + path + ": reference " + reference + ": " + error;
+			return false;
+		}
+		const CfsHeader& other = expected.header();
+		if (header.nEpochs != other.nEpochs || header.nChannels != other.nChannels || header.nFreq != other.nFreq || header.nTimes != other.nTimes) {
+			ostringstream message;
+			message << "FAILED " << path << ": " << header.nEpochs << " epochs of " << (int)header.nChannels << " x " << (int)header.nTimes << " x " << (int)header.nFreq
+				<< ", the reference has " << other.nEpochs << " of " << (int)other.nChannels << " x " << (int)other.nTimes << " x " << (int)other.nFreq;
+			line = message.str();
+			return false;
+		}
+
+		//Differences are relative to the largest magnitude of the reference
+		if (header.digest == other.digest)
+			out << ", identical to the reference";
+		else {
+			vector<float> values, expectedValues;
+			magnitudes(header, payload, values);
+			magnitudes(other, expectedPayload, expectedValues);
+			double largest = 0, difference = 0;
+			for (size_t i = 0; i < values.size(); i++) {
+				largest = max(largest, (double)fabs(expectedValues[i]));
+				difference = max(difference, (double)fabs(values[i] - expectedValues[i]));
+			}
+			double relative = largest > 0 ? difference / largest : difference;
+			ostringstream message;
+			message << "differs from the reference by up to " << relative << " of its largest magnitude";
+			if (relative > tolerance || std::isnan(relative)) {
+				line = "FAILED " + path + ": " + message.str();
+				return false;
+			}
+			out << ", " << message.str();
+		}
+	}
+	line = out.str();
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned jobCount = thread::hardware_concurrency();
+	if (jobCount == 0)
+		jobCount = 2;
+	Work work;
+	CrawlOptions crawlOptions;
+	crawlOptions.extensions = vector<string>{ ".cfs" };
+	string dirName;
+	double tolerance = 0;
+	bool quiet, info;
+
+	try {
+		TCLAP::CmdLine cmd("Usage: ./cfsverify [-d cfsDir [-R]] [--reference dir] filename1.cfs ... filenameN.cfs\nChecks the payload of each CFS against its header, SHA1 and block CRCs, and optionally against a reference CFS.", ' ', "1.0");
+		TCLAP::SwitchArg isquiet("q", "quiet", "only show files that fail", false);
+		TCLAP::SwitchArg isinfo("i", "info", "also show the dimensions, sizes and SHA1 of each file", false);
+		TCLAP::SwitchArg isrecursive("R", "recursive", "also check the CFS files in subdirectories of the -d directory", false);
+		TCLAP::ValueArg<string> dir("d", "dir", "CFS Directory", false, "", "CFS Directory");
+		TCLAP::ValueArg<string> reference("", "reference", "Compare each payload with the CFS of the same path below this directory, or with this one CFS", false, "", "file or directory");
+		TCLAP::ValueArg<double> toleranceArg("", "tolerance", "Largest difference from the reference allowed, as a fraction of its largest magnitude (default: 0, identical values)", false, 0, "fraction");
+		TCLAP::ValueArg<int> jobs("j", "jobs", "Number of files checked in parallel (default: number of cores)", false, 0, "Number of jobs");
+		TCLAP::UnlabeledMultiArg<string> files("filenames", "List of CFS files", false, "List of CFS files", false);
+
+		cmd.add(files);
+		cmd.add(dir);
+		cmd.add(jobs);
+		cmd.add(toleranceArg);
+		cmd.add(reference);
+		cmd.add(isrecursive);
+		cmd.add(isinfo);
+		cmd.add(isquiet);
+		cmd.parse(argc, argv);
+
+		quiet = isquiet.getValue();
+		info = isinfo.getValue();
+		crawlOptions.recursive = isrecursive.getValue();
+		dirName = dir.getValue();
+		work.files = files.getValue();
+		work.reference = reference.getValue();
+		tolerance = toleranceArg.getValue();
+		if (jobs.getValue() > 0)
+			jobCount = jobs.getValue();
+		if (tolerance < 0) {
+			cerr << "error: --tolerance must not be negative" << endl;
+			return(1);
+		}
+	}
+	catch (TCLAP::ArgException& e) {
+		cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
+		return(1);
+	}
+
+	if (!dirName.empty()) {
+		work.crawler.reset(new DirectoryCrawler(dirName, crawlOptions));
+		if (!work.crawler->ok()) {
+			cerr << "error: can not read directory " << dirName << endl;
+			return(1);
+		}
+		work.root = joined(dirName, "");
+	}
+	else if (work.files.empty()) {
+		cerr << "error: no CFS files given, ./cfsverify -h for usage details" << endl;
+		return(1);
+	}
+	work.referenceDir = isDirectory(work.reference);
+	if (!work.reference.empty() && !work.referenceDir && !dirName.empty()) {
+		cerr << "error: --reference has to be a directory with -d" << endl;
+		return(1);
+	}
+
+	atomic<unsigned> checked(0), failed(0);
+	mutex output;
+	vector<thread> threads;
+	for (unsigned t = 0; t < jobCount; t++)
+		threads.push_back(thread([&]() {
+			string path, referencePath, line;
+			while (nextFile(work, path, referencePath)) {
+				bool ok = check(path, referencePath, tolerance, info, line);
+				checked++;
+				if (!ok)
+					failed++;
+				if (!ok || !quiet) {
+					lock_guard<mutex> lock(output);
+					cout << line << '\n';
+				}
+			}
+		}));
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	cout << checked << " files checked, " << failed << " failed.\n";
+	return failed > 0 ? 1 : 0;
+}
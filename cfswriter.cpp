@@ -0,0 +1,387 @@
+#include "cfswriter.h"
+#include "order32.h"
+#include "spectral.h"
+#include "profile.h"
+#include "simd.h"
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+#define LITTLEENDIAN (O32_HOST_ORDER == O32_LITTLE_ENDIAN)
+#define CFS_HEADERBYTES (11)
+#define CFS_EPOCHSOFFSET (7)
+
+static void setLittleEndian(unsigned char* at, uint64_t value, int count) {
+	for (int i = 0; i < count; i++)
+		at[i] = (unsigned char)(value >> (8 * i));
+}
+
+static void putLittleEndian(vector<unsigned char>& out, uint64_t value, int count) {
+	out.resize(out.size() + count);
+	setLittleEndian(&out[out.size() - count], value, count);
+}
+
+CfsWriter::CfsWriter() : _toFile(false), _memory(NULL), _flushed(0), _epochBytes(0), _indexOffsetAt(0), _filled(0), _offset(0), _compressedBytes(0) {
+}
+
+CfsWriter::~CfsWriter() {
+	discard();
+}
+
+bool CfsWriter::open(const string& filename, const CfsWriterOptions& options) {
+	_filename = filename;
+	_partname = filename + CFSWRITER_PARTSUFFIX;
+	_options = options;
+	if (options.local && !_output.open(_partname, options.output))
+		return fail(_output.error());
+	size_t slash = filename.find_last_of('/');
+	if (options.upload && !_upload.open(slash == string::npos ? filename : filename.substr(slash + 1), options.upload))
+		return fail(_upload.error());
+	_toFile = true;
+	return start();
+}
+
+bool CfsWriter::open(vector<unsigned char>& buffer, const CfsWriterOptions& options) {
+	_filename = "CFS buffer";
+	_options = options;
+	_memory = &buffer;
+	_memory->clear();
+	return start();
+}
+
+bool CfsWriter::start() {
+
+	const Codec& codec = _options.codec;
+	bool blocked = _options.blockEpochs > 0;
+	bool quantized = _options.payload != PAYLOAD_FLOAT;
+	_epochBytes = payloadEpochBytes(_options.payload);
+	if (quantized || !LITTLEENDIAN)
+		_encoded.resize(_epochBytes);
+	if (blocked) {
+		if (!codecAvailable(codec.type))
+			return fail("this build has no " + codecName(codec));
+		_blocks.resize(_options.pool ? max(_options.pool->size(), 1u) : 1);
+		for (size_t b = 0; b < _blocks.size(); b++)
+			_blocks[b].raw.reserve((size_t)_options.blockEpochs * _epochBytes);
+	}
+	else {
+		string error;
+		_compressor = Compressor::create(codec, CFSWRITER_CHUNKBYTES, [this](const unsigned char* data, size_t count) {
+			_compressedBytes += count;
+			return put(data, count);
+		}, error);
+		if (!_compressor)
+			return fail(error);
+	}
+
+	//HEADER, nEpochs (bytes 7-8) and the SHA1 are filled in by close()
+	uint8_t version = quantized ? CFS_VERSION_PAYLOAD : blocked ? CFS_VERSION_BLOCKS : codec.version();
+	uint8_t hash = true;
+	_head.clear();
+
+	//Header 11 bytes
+	_head.push_back('C');
+	_head.push_back('F');
+	_head.push_back('S');
+	_head.push_back(version);
+	_head.push_back(SPECTRAL_BINS);              // nFreq
+	_head.push_back(SPECTRAL_WINDOWS);           // nTimes
+	_head.push_back(3);                          // nChannels
+	putLittleEndian(_head, 0, 2);                // nEpochs
+	_head.push_back(codec.compression());
+	_head.push_back(hash);
+	//SHA1 20 bytes
+	_head.resize(CFS_HEADERBYTES + 20, 0);
+
+	//Payload format, block size and the offset of the index, which close() fills in
+	if (quantized)
+		_head.push_back((uint8_t)_options.payload);
+	if (blocked || quantized) {
+		putLittleEndian(_head, _options.blockEpochs, 2);
+		_indexOffsetAt = _head.size();
+		putLittleEndian(_head, 0, 8);
+		_offset = _head.size();
+	}
+
+	if (_memory)
+		_memory->assign(_head.begin(), _head.end());
+	else {
+		_flushed = _head.size();
+		_pending.reserve(CFSWRITER_FLUSHBYTES);
+	}
+	return true;
+}
+
+bool CfsWriter::writeEpoch(const float* epoch, size_t count) {
+	if (!_compressor && _blocks.empty())
+		return false;
+
+	//Convert float stream to binary stream
+	const Bytef* istream = reinterpret_cast<const Bytef*>(epoch);
+	uInt sourceLen = (uInt)(count * sizeof(float));
+	if (!_encoded.empty()) {
+		if (_options.payload == PAYLOAD_FLOAT) {
+			_encoded.resize(sourceLen);
+			simdSwapBytes32(epoch, _encoded.data(), count);
+		}
+		else
+			encodeEpoch(_options.payload, epoch, _encoded.data());
+		istream = _encoded.data();
+		sourceLen = (uInt)_encoded.size();
+	}
+
+	{
+		ScopedTimer timer(PROFILE_SHA1);
+		_sha1.Update(istream, sourceLen);
+	}
+
+	if (_compressor) {
+		if (!_compressor->write(istream, sourceLen))
+			return fail(writeError(_compressor->error() + " (" + _filename + ")"));
+		return true;
+	}
+
+	//Blocks are compressed once there is one for every worker
+	Block& block = _blocks[_filled];
+	block.raw.insert(block.raw.end(), istream, istream + sourceLen);
+	if (block.raw.size() >= (size_t)_options.blockEpochs * _epochBytes && ++_filled == _blocks.size())
+		return writeBlocks();
+	return true;
+}
+
+bool CfsWriter::close(uint16_t nEpochs) {
+	if ((!_compressor && _blocks.empty()) || (!_toFile && !_memory))
+		return false;
+
+	//The end of the stream goes out with whatever is left of the last chunk, or of the blocks
+	if (_compressor && !_compressor->finish())
+		return fail(writeError(_compressor->error() + " (" + _filename + ")"));
+	if (!_blocks.empty()) {
+		if (_filled < _blocks.size() && !_blocks[_filled].raw.empty())
+			_filled++;
+		if (!writeBlocks() || !writeIndex())
+			return false;
+	}
+
+	//Find SHA1 hash of stream
+	_sha1.Final();
+	Bytef SHAdigest[20];
+	if (!_sha1.GetHash(SHAdigest))
+		return fail("Problem in conversion! SHA1 Failed...");
+	setLittleEndian(&_head[CFS_EPOCHSOFFSET], nEpochs, 2);
+	copy(SHAdigest, SHAdigest + 20, _head.begin() + CFS_HEADERBYTES);
+
+	if (_memory) {
+		copy(_head.begin(), _head.end(), _memory->begin());
+		_memory = NULL;
+	}
+	else {
+		//The header and the last of the stream go out together, then the file is synced and renamed.
+		//Uploaded first, a file the service does not have is not kept on disk either. Until both
+		//are done the file is still open, so when either fails discard() deletes the other
+		ScopedTimer timer(PROFILE_WRITE);
+		if (_options.upload) {
+			vector<unsigned char> head = _head, data;
+			if (_options.local)
+				data = _pending;
+			else
+				data.swap(_pending);
+			if (!_upload.finish(head, data, _flushed))
+				return fail(_upload.error());
+		}
+		if (_options.local && !_output.finish(_head, _pending, _flushed, _filename))
+			return fail(_output.error());
+		_toFile = false;
+	}
+
+	_sha1.ReportHashStl(_digest, CSHA1::REPORT_HEX_SHORT);
+	return true;
+}
+
+bool CfsWriter::snapshot(uint16_t nEpochs, vector<unsigned char>& cfs) {
+	if (_blocks.empty() || !_memory)
+		return false;
+
+	//Complete blocks go out for good, the one being filled moves to the front
+	size_t filling = _filled;
+	if (!writeBlocks())
+		return false;
+	if (filling > 0) {
+		_blocks[0].raw.assign(_blocks[filling].raw.begin(), _blocks[filling].raw.end());
+		_blocks[filling].raw.clear();
+	}
+	Block last;
+	if (!_blocks[0].raw.empty()) {
+		last.raw.assign(_blocks[0].raw.begin(), _blocks[0].raw.end());
+		compressBlock(last);
+		if (!last.error.empty())
+			return fail(last.error + " (" + _filename + ")");
+	}
+
+	//The digest of the payload so far, the writer's own goes on
+	CSHA1 sha1(_sha1);
+	sha1.Final();
+	Bytef SHAdigest[20];
+	if (!sha1.GetHash(SHAdigest))
+		return fail("Problem in conversion! SHA1 Failed...");
+
+	vector<unsigned char> head = _head;
+	setLittleEndian(&head[CFS_EPOCHSOFFSET], nEpochs, 2);
+	copy(SHAdigest, SHAdigest + 20, head.begin() + CFS_HEADERBYTES);
+	setLittleEndian(&head[_indexOffsetAt], _offset + last.packed.size(), 8);
+
+	cfs.assign(head.begin(), head.end());
+	cfs.insert(cfs.end(), _memory->begin() + head.size(), _memory->end());
+	cfs.insert(cfs.end(), last.packed.begin(), last.packed.end());
+	if (!last.raw.empty()) {
+		_blockOffsets.push_back(_offset);
+		_blockSizes.push_back((uint32_t)last.packed.size());
+		_blockCrcs.push_back(last.crc);
+	}
+	vector<unsigned char> blockIndex = index();
+	if (!last.raw.empty()) {
+		_blockOffsets.pop_back();
+		_blockSizes.pop_back();
+		_blockCrcs.pop_back();
+	}
+	cfs.insert(cfs.end(), blockIndex.begin(), blockIndex.end());
+
+	sha1.ReportHashStl(_digest, CSHA1::REPORT_HEX_SHORT);
+	return true;
+}
+
+bool CfsWriter::put(const unsigned char* data, size_t count) {
+	if (_memory) {
+		_memory->insert(_memory->end(), data, data + count);
+		return true;
+	}
+	_pending.insert(_pending.end(), data, data + count);
+	if (_pending.size() < CFSWRITER_FLUSHBYTES)
+		return true;
+
+	//Handed over whole, the next one starts in a buffer of its own
+	ScopedTimer timer(PROFILE_WRITE);
+	uint64_t offset = _flushed;
+	_flushed += _pending.size();
+	bool written = true;
+	if (_options.upload) {
+		vector<unsigned char> sent;
+		if (_options.local)
+			sent = _pending;
+		else
+			sent.swap(_pending);
+		written = _upload.write(sent, offset);
+	}
+	if (_options.local && written)
+		written = _output.write(_pending, offset);
+	_pending.clear();
+	_pending.reserve(CFSWRITER_FLUSHBYTES);
+	return written;
+}
+
+string CfsWriter::writeError(const string& otherwise) const {
+	string error = _output.error();
+	if (error.empty())
+		error = _upload.error();
+	return error.empty() ? otherwise : error;
+}
+
+//Each block is a complete stream of its own with the CRC32 of what went in
+void CfsWriter::compressBlock(Block& block) const {
+	block.packed.clear();
+	block.crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), block.raw.data(), (uInt)block.raw.size());
+	unique_ptr<Compressor> compressor = Compressor::create(_options.codec, CFSWRITER_CHUNKBYTES, [&block](const unsigned char* data, size_t count) {
+		block.packed.insert(block.packed.end(), data, data + count);
+		return true;
+	}, block.error);
+	if (compressor && !(compressor->write(block.raw.data(), block.raw.size()) && compressor->finish()))
+		block.error = compressor->error();
+}
+
+bool CfsWriter::writeBlocks() {
+	if (_filled == 0)
+		return true;
+
+	function<void(size_t)> compress = [this](size_t b) {
+		compressBlock(_blocks[b]);
+	};
+	{
+		//Timed here as a whole, the codec's timers would only see the blocks of this thread
+		ScopedTimer timer(currentProfile(), PROFILE_COMPRESS);
+		ProfileScope untimed(NULL);
+		if (_options.pool && _filled > 1)
+			_options.pool->parallelFor(_filled, (unsigned)_filled, compress);
+		else
+			for (size_t b = 0; b < _filled; b++)
+				compress(b);
+	}
+
+	for (size_t b = 0; b < _filled; b++) {
+		Block& block = _blocks[b];
+		if (!block.error.empty())
+			return fail(block.error + " (" + _filename + ")");
+		if (!put(block.packed.data(), block.packed.size()))
+			return fail(writeError("Writing " + _filename));
+		_blockOffsets.push_back(_offset);
+		_blockSizes.push_back((uint32_t)block.packed.size());
+		_blockCrcs.push_back(block.crc);
+		_offset += block.packed.size();
+		_compressedBytes += block.packed.size();
+		block.raw.clear();
+	}
+	_filled = 0;
+	return true;
+}
+
+vector<unsigned char> CfsWriter::index() const {
+	vector<unsigned char> index;
+	putLittleEndian(index, _blockOffsets.size(), 4);
+	for (size_t b = 0; b < _blockOffsets.size(); b++) {
+		putLittleEndian(index, _blockOffsets[b], 8);
+		putLittleEndian(index, _blockSizes[b], 4);
+		putLittleEndian(index, _blockCrcs[b], 4);
+	}
+	return index;
+}
+
+bool CfsWriter::writeIndex() {
+	vector<unsigned char> index = this->index();
+	setLittleEndian(&_head[_indexOffsetAt], _offset, 8);
+	if (!put(index.data(), index.size()))
+		return fail(writeError("Writing " + _filename));
+	return true;
+}
+
+unsigned long long CfsWriter::bufferBytes(const CfsWriterOptions& options, unsigned long long payloadBytes) {
+	if (options.blockEpochs == 0)
+		return CFSWRITER_FLUSHBYTES + codecBufferBytes(options.codec, payloadBytes);
+
+	//One block a worker, before and after compression, and the codec's own copies of it
+	unsigned long long blockBytes = min((unsigned long long)options.blockEpochs * payloadEpochBytes(options.payload), payloadBytes);
+	unsigned long long blocks = options.pool ? max(options.pool->size(), 1u) : 1;
+	return CFSWRITER_FLUSHBYTES + blocks * (2 * blockBytes + codecBufferBytes(options.codec, blockBytes));
+}
+
+bool CfsWriter::fail(const string& message) {
+	if (_error.empty())
+		_error = message;
+	discard();
+	return false;
+}
+
+void CfsWriter::discard() {
+	_compressor.reset();
+	_blocks.clear();
+	_filled = 0;
+	if (_toFile) {
+		_output.abandon();
+		_upload.abandon();
+		_toFile = false;
+	}
+	_pending = vector<unsigned char>();
+	if (_memory) {
+		_memory->clear();
+		_memory = NULL;
+	}
+}
@@ -0,0 +1,146 @@
+//CFSWRITER  Writes a CFS file while its epochs are still being computed.
+//   Each epoch is added to the SHA1 and to the compressed stream as soon as it is finished,
+//   and compressed output is handed over as one write whenever CFSWRITER_FLUSHBYTES of it
+//   are together, to an OutputWriter thread if the options give one. The codec sets the
+//   version and compression byte of the header, see codec.h. The epoch count and the
+//   digest are not known until the end, so the header is kept back and written by close()
+//   together with the rest of the stream, a small file with a single write. The file is
+//   built under a temporary name next to the target and only renamed into place once
+//   close() has finished it, so the target is either absent, the old file or complete,
+//   never half written; a temporary that is not closed successfully is removed. The same
+//   stream can be built in memory instead of a file, and a blocked one taken as a complete
+//   CFS at any time in between, for a recording converted while it is being recorded.
+//   With an Uploader in the options the same writes also go to the scoring service as they
+//   are flushed, see upload.h, and the file on disk can be left out.
+//
+//   With blockEpochs set the file is CFS version 3 instead: the payload is cut into blocks
+//   of that many epochs, the last one shorter, each compressed on its own so that blocks
+//   compress in parallel and a reader can decode any of them without the rest. After the
+//   header and the SHA1 of the whole payload come the block size in epochs (uint16) and
+//   the offset of the index (uint64), then the blocks, then the index: the block count
+//   (uint32) and for each block its offset and compressed size (uint64, uint32) and the
+//   CRC32 of its uncompressed bytes (uint32). All numbers are little-endian.
+//
+//   A payload format other than float makes it version 4, whose epochs are stored as
+//   quantize.h describes, and whose digest and CRCs are of those stored bytes. Its header
+//   has the format (uint8) between the SHA1 and the block size, and has the block size and
+//   index offset even for a single stream, as 0. Float payloads are stored little-endian,
+//   swapped on big-endian hosts before they are hashed.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <memory>
+#include <zlib.h>
+#include "SHA1.h"
+#include "codec.h"
+#include "quantize.h"
+#include "threadpool.h"
+#include "arena.h"
+#include "outputwriter.h"
+#include "upload.h"
+
+using namespace std;
+
+#define CFSWRITER_CHUNKBYTES (65536)
+#define CFSWRITER_FLUSHBYTES (1 << 20)
+#define CFSWRITER_PARTSUFFIX ".part"
+
+struct CfsWriterOptions {
+	CfsWriterOptions() : payload(PAYLOAD_FLOAT), blockEpochs(0), pool(NULL), output(NULL), upload(NULL), local(true) {}
+
+	Codec codec;
+	PayloadFormat payload;       // how epochs are stored, version 4 unless PAYLOAD_FLOAT
+	unsigned blockEpochs;        // epochs per block of a version 3 file, 0 for a single stream
+	ThreadPool* pool;            // compresses blocks on idle workers as well, NULL for none
+	OutputWriter* output;        // writes files on its own thread, NULL to write on the caller's
+	Uploader* upload;            // sends files to the scoring service as well, NULL for none
+	bool local;                  // keeps the file on disk, false to only upload it
+};
+
+class CfsWriter {
+public:
+	CfsWriter();
+	~CfsWriter();
+
+	//Creates filename + CFSWRITER_PARTSUFFIX, and with an upload sends it under the name of filename
+	bool open(const string& filename, const CfsWriterOptions& options = CfsWriterOptions());
+
+	//Same, building the CFS in buffer, which is cleared first and again on failure
+	bool open(vector<unsigned char>& buffer, const CfsWriterOptions& options = CfsWriterOptions());
+
+	//Hashes and compresses one epoch of count floats, log-magnitudes unless the payload is
+	//PAYLOAD_FLOAT, ignored once an error has occurred
+	bool writeEpoch(const float* epoch, size_t count);
+
+	//Finishes the stream, writes the real epoch count and digest and renames the file into place
+	bool close(uint16_t nEpochs);
+
+	//Sets cfs to the CFS that close() would give now, the last block as far as it is filled,
+	//and goes on taking epochs; only for blocks built in a buffer. Complete blocks are
+	//compressed once, the last one again by every snapshot until it is complete
+	bool snapshot(uint16_t nEpochs, vector<unsigned char>& cfs);
+
+	//Bytes of compressed payload so far
+	unsigned long long compressedBytes() const { return _compressedBytes; }
+
+	//SHA1 of the payload as stored in the header, in hex, empty until closed or a snapshot
+	const string& digest() const { return _digest; }
+
+	//What went wrong, for the conversion log
+	const string& error() const { return _error; }
+
+	//Memory a writer with these options holds for a payload of payloadBytes, beyond the
+	//CFSWRITER_CHUNKBYTES it always has and the file's bytes queued for the OutputWriter
+	static unsigned long long bufferBytes(const CfsWriterOptions& options, unsigned long long payloadBytes);
+
+private:
+	CfsWriter(const CfsWriter&) = delete;
+	CfsWriter& operator=(const CfsWriter&) = delete;
+
+	//A block of the payload, compressed by whichever thread gets to it
+	struct Block {
+		Block() : crc(0) {}
+		ArenaVector<unsigned char> raw;      // only filled and read on the writer's thread
+		vector<unsigned char> packed;
+		uint32_t crc;
+		string error;
+	};
+
+	bool start();
+	void compressBlock(Block& block) const;
+	bool writeBlocks();
+	vector<unsigned char> index() const;
+	bool writeIndex();
+	bool put(const unsigned char* data, size_t count);
+	//The output's own error if it has one, which is the cause of codec write failures
+	string writeError(const string& otherwise) const;
+	bool fail(const string& message);
+	void discard();
+
+	string _filename;
+	string _partname;            // what is being written until close() renames it
+	OutputFile _output;
+	UploadFile _upload;
+	bool _toFile;
+	vector<unsigned char>* _memory;
+	CfsWriterOptions _options;
+	vector<unsigned char> _head;         // the header, completed by close()
+	vector<unsigned char> _pending;      // of the file, not handed to the output yet
+	uint64_t _flushed;                   // file bytes handed over, _pending goes after them
+	size_t _epochBytes;                  // stored bytes of an epoch
+	vector<unsigned char> _encoded;      // the epoch being written, unless it is stored as computed
+	size_t _indexOffsetAt;               // where close() fills in the index offset
+	unique_ptr<Compressor> _compressor;  // of the single stream
+	vector<Block> _blocks;               // waiting for compression, up to one per worker
+	size_t _filled;                      // blocks completely filled
+	uint64_t _offset;                    // of the next block
+	vector<uint64_t> _blockOffsets;
+	vector<uint32_t> _blockSizes, _blockCrcs;
+	CSHA1 _sha1;
+	unsigned long long _compressedBytes;
+	string _digest;
+	string _error;
+};
@@ -0,0 +1,531 @@
+#include "codec.h"
+#include "arena.h"
+#include "profile.h"
+#include <zlib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#ifdef CODEC_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef CODEC_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+struct CodecInfo {
+	CodecType type;
+	const char* name;
+	int minLevel, maxLevel;
+};
+
+static const CodecInfo codecs[] = {
+	{ CODEC_TYPE_NONE, "none", 0, 0 },
+	{ CODEC_TYPE_ZLIB, "zlib", 1, 9 },
+	{ CODEC_TYPE_LIBDEFLATE, "libdeflate", 1, 12 },
+	{ CODEC_TYPE_ZSTD, "zstd", 1, 22 }
+};
+#define CODECS (4)
+
+uint8_t Codec::version() const {
+	return (type == CODEC_TYPE_ZSTD) ? CFS_VERSION_CODEC : CFS_VERSION_DEFLATE;
+}
+
+uint8_t Codec::compression() const {
+	if (type == CODEC_TYPE_NONE)
+		return CFS_COMPRESSION_NONE;
+	return (type == CODEC_TYPE_ZSTD) ? CFS_COMPRESSION_ZSTD : CFS_COMPRESSION_ZLIB;
+}
+
+bool codecAvailable(CodecType type) {
+	switch (type) {
+	case CODEC_TYPE_NONE:
+	case CODEC_TYPE_ZLIB:
+		return true;
+#ifdef CODEC_LIBDEFLATE
+	case CODEC_TYPE_LIBDEFLATE:
+		return true;
+#endif
+#ifdef CODEC_ZSTD
+	case CODEC_TYPE_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool parseCodec(const string& text, Codec& codec, string& error) {
+	size_t colon = text.find(':');
+	string name = text.substr(0, colon);
+	for (int i = 0; i < CODECS; i++) {
+		if (name != codecs[i].name)
+			continue;
+		if (!codecAvailable(codecs[i].type)) {
+			string flag = name;
+			for (size_t k = 0; k < flag.size(); k++)
+				flag[k] = (char)toupper((unsigned char)flag[k]);
+			error = "this build has no " + name + ", rebuild with make " + flag + "=1";
+			return false;
+		}
+		int level = 0;
+		if (colon != string::npos) {
+			char* end;
+			level = (int)strtol(text.c_str() + colon + 1, &end, 10);
+			if (*end != '\0' || end == text.c_str() + colon + 1 || level < codecs[i].minLevel || level > codecs[i].maxLevel) {
+				error = "level of " + name + " must be between " + to_string(codecs[i].minLevel) + " and " + to_string(codecs[i].maxLevel);
+				return false;
+			}
+		}
+		codec.type = codecs[i].type;
+		codec.level = level;
+		return true;
+	}
+	error = "unknown codec " + name + ", use none, zlib, libdeflate or zstd";
+	return false;
+}
+
+string codecName(const Codec& codec) {
+	string name;
+	for (int i = 0; i < CODECS; i++)
+		if (codecs[i].type == codec.type)
+			name = codecs[i].name;
+	if (codec.level > 0)
+		name += ":" + to_string(codec.level);
+	return name;
+}
+
+bool codecOfHeader(uint8_t version, uint8_t compression, Codec& codec) {
+	codec = Codec();
+	if (version == CFS_VERSION_DEFLATE)
+		codec.type = compression ? CODEC_TYPE_ZLIB : CODEC_TYPE_NONE;
+	else if (version != CFS_VERSION_CODEC && version != CFS_VERSION_BLOCKS && version != CFS_VERSION_PAYLOAD)
+		return false;
+	else if (compression == CFS_COMPRESSION_NONE)
+		codec.type = CODEC_TYPE_NONE;
+	else if (compression == CFS_COMPRESSION_ZLIB)
+		codec.type = CODEC_TYPE_ZLIB;
+	else if (compression == CFS_COMPRESSION_ZSTD)
+		codec.type = CODEC_TYPE_ZSTD;
+	else
+		return false;
+	return codecAvailable(codec.type);
+}
+
+bool CodecStream::emit(const unsigned char* data, size_t count) {
+	if (count == 0)
+		return true;
+	if (!_output(data, count))
+		return fail(_outputError);
+	_outputBytes += count;
+	return true;
+}
+
+bool CodecStream::fail(const string& message) {
+	if (_error.empty())
+		_error = message;
+	return false;
+}
+
+//The payload as it is, passed on without copying
+class StoreCompressor : public Compressor {
+public:
+	explicit StoreCompressor(CodecOutput output) : Compressor(output) {}
+
+	bool write(const unsigned char* data, size_t count) { return emit(data, count); }
+	bool finish() { return true; }
+};
+
+//Inside a conversion the deflate state is taken from the worker's arena as well
+static voidpf arenaAlloc(voidpf opaque, uInt items, uInt size) {
+	return static_cast<Arena*>(opaque)->allocate((size_t)items * size);
+}
+
+static void arenaFree(voidpf, voidpf) {
+}
+
+class ZlibCompressor : public Compressor {
+public:
+	ZlibCompressor(CodecOutput output, size_t chunkBytes) : Compressor(output), _ready(false), _chunk(chunkBytes) {
+		memset(&_stream, 0, sizeof(_stream));
+	}
+
+	~ZlibCompressor() {
+		if (_ready)
+			deflateEnd(&_stream);
+	}
+
+	bool start(int level) {
+		if (Arena::local().active()) {
+			_stream.zalloc = arenaAlloc;
+			_stream.zfree = arenaFree;
+			_stream.opaque = &Arena::local();
+		}
+		if (deflateInit(&_stream, level > 0 ? level : Z_DEFAULT_COMPRESSION) != Z_OK)
+			return fail("Not enough memory for compression!");
+		_ready = true;
+		_stream.next_out = _chunk.data();
+		_stream.avail_out = (uInt)_chunk.size();
+		return true;
+	}
+
+	bool write(const unsigned char* data, size_t count) {
+		_stream.next_in = const_cast<Bytef*>(data);
+		_stream.avail_in = (uInt)count;
+		return deflateInput(Z_NO_FLUSH);
+	}
+
+	bool finish() {
+		_stream.next_in = NULL;
+		_stream.avail_in = 0;
+		if (!deflateInput(Z_FINISH) || !flushOutput())
+			return false;
+		deflateEnd(&_stream);
+		_ready = false;
+		return true;
+	}
+
+private:
+	bool deflateInput(int flush) {
+		if (!_ready)
+			return false;
+		while (true) {
+			//Z_BUF_ERROR only means no progress was possible, which the checks below handle
+			int res;
+			{
+				ScopedTimer timer(PROFILE_COMPRESS);
+				res = deflate(&_stream, flush);
+			}
+			if (res == Z_STREAM_ERROR)
+				return fail("Problem in conversion! Compression failed...");
+
+			bool done = (flush == Z_FINISH) ? (res == Z_STREAM_END) : (_stream.avail_in == 0 && _stream.avail_out != 0);
+
+			//A full chunk is handed on as soon as it is ready
+			if (_stream.avail_out == 0 && !flushOutput())
+				return false;
+			if (done)
+				return true;
+		}
+	}
+
+	bool flushOutput() {
+		size_t ready = _chunk.size() - _stream.avail_out;
+		_stream.next_out = _chunk.data();
+		_stream.avail_out = (uInt)_chunk.size();
+		return emit(_chunk.data(), ready);
+	}
+
+	z_stream _stream;
+	bool _ready;
+	ArenaVector<Bytef> _chunk;
+};
+
+#ifdef CODEC_LIBDEFLATE
+//libdeflate has no streaming interface, the payload is collected and compressed at the end
+class LibdeflateCompressor : public Compressor {
+public:
+	LibdeflateCompressor(CodecOutput output, size_t chunkBytes) : Compressor(output), _chunkBytes(chunkBytes), _compressor(NULL) {}
+
+	~LibdeflateCompressor() {
+		if (_compressor)
+			libdeflate_free_compressor(_compressor);
+	}
+
+	bool start(int level) {
+		_compressor = libdeflate_alloc_compressor(level > 0 ? level : 6);
+		return _compressor ? true : fail("Not enough memory for compression!");
+	}
+
+	bool write(const unsigned char* data, size_t count) {
+		_payload.insert(_payload.end(), data, data + count);
+		return true;
+	}
+
+	bool finish() {
+		ArenaVector<unsigned char> compressed(libdeflate_zlib_compress_bound(_compressor, _payload.size()));
+		size_t size;
+		{
+			ScopedTimer timer(PROFILE_COMPRESS);
+			size = libdeflate_zlib_compress(_compressor, _payload.data(), _payload.size(), compressed.data(), compressed.size());
+		}
+		if (size == 0)
+			return fail("Problem in conversion! Compression failed...");
+		for (size_t offset = 0; offset < size; offset += _chunkBytes)
+			if (!emit(compressed.data() + offset, min(_chunkBytes, size - offset)))
+				return false;
+		return true;
+	}
+
+private:
+	size_t _chunkBytes;
+	struct libdeflate_compressor* _compressor;
+	ArenaVector<unsigned char> _payload;
+};
+#endif
+
+#ifdef CODEC_ZSTD
+class ZstdCompressor : public Compressor {
+public:
+	ZstdCompressor(CodecOutput output, size_t chunkBytes) : Compressor(output), _context(NULL), _chunk(chunkBytes) {}
+
+	~ZstdCompressor() {
+		if (_context)
+			ZSTD_freeCCtx(_context);
+	}
+
+	bool start(int level) {
+		_context = ZSTD_createCCtx();
+		if (!_context)
+			return fail("Not enough memory for compression!");
+		if (ZSTD_isError(ZSTD_CCtx_setParameter(_context, ZSTD_c_compressionLevel, level > 0 ? level : ZSTD_CLEVEL_DEFAULT)))
+			return fail("Problem in conversion! Compression failed...");
+		return true;
+	}
+
+	bool write(const unsigned char* data, size_t count) {
+		ZSTD_inBuffer input = { data, count, 0 };
+		while (input.pos < input.size)
+			if (!compress(input, ZSTD_e_continue))
+				return false;
+		return true;
+	}
+
+	bool finish() {
+		ZSTD_inBuffer input = { NULL, 0, 0 };
+		return compress(input, ZSTD_e_end);
+	}
+
+private:
+	//One call into zstd, then whatever output it gave is handed on; at the end it repeats
+	//until zstd has nothing left
+	bool compress(ZSTD_inBuffer& input, ZSTD_EndDirective mode) {
+		while (true) {
+			ZSTD_outBuffer output = { _chunk.data(), _chunk.size(), 0 };
+			size_t left;
+			{
+				ScopedTimer timer(PROFILE_COMPRESS);
+				left = ZSTD_compressStream2(_context, &output, &input, mode);
+			}
+			if (ZSTD_isError(left))
+				return fail(string("Problem in conversion! Compression failed: ") + ZSTD_getErrorName(left));
+			if (!emit(_chunk.data(), output.pos))
+				return false;
+			if (mode == ZSTD_e_end ? left == 0 : output.pos < output.size)
+				return true;
+		}
+	}
+
+	ZSTD_CCtx* _context;
+	ArenaVector<unsigned char> _chunk;
+};
+#endif
+
+unique_ptr<Compressor> Compressor::create(const Codec& codec, size_t chunkBytes, CodecOutput output, string& error) {
+	if (!codecAvailable(codec.type)) {
+		error = "this build has no " + codecName(codec);
+		return unique_ptr<Compressor>();
+	}
+
+	bool started = true;
+	unique_ptr<Compressor> compressor;
+	if (codec.type == CODEC_TYPE_NONE)
+		compressor.reset(new StoreCompressor(output));
+	else if (codec.type == CODEC_TYPE_ZLIB) {
+		ZlibCompressor* zlib = new ZlibCompressor(output, chunkBytes);
+		compressor.reset(zlib);
+		started = zlib->start(codec.level);
+	}
+#ifdef CODEC_LIBDEFLATE
+	else if (codec.type == CODEC_TYPE_LIBDEFLATE) {
+		LibdeflateCompressor* libdeflate = new LibdeflateCompressor(output, chunkBytes);
+		compressor.reset(libdeflate);
+		started = libdeflate->start(codec.level);
+	}
+#endif
+#ifdef CODEC_ZSTD
+	else if (codec.type == CODEC_TYPE_ZSTD) {
+		ZstdCompressor* zstd = new ZstdCompressor(output, chunkBytes);
+		compressor.reset(zstd);
+		started = zstd->start(codec.level);
+	}
+#endif
+
+	if (!started) {
+		error = compressor->error();
+		compressor.reset();
+	}
+	return compressor;
+}
+
+//Stored payloads are passed on as they are
+class StoreDecompressor : public Decompressor {
+public:
+	explicit StoreDecompressor(CodecOutput output) : Decompressor(output) {}
+
+	bool write(const unsigned char* data, size_t count) { return emit(data, count); }
+	bool finish() { return true; }
+};
+
+class ZlibDecompressor : public Decompressor {
+public:
+	ZlibDecompressor(CodecOutput output, size_t chunkBytes) : Decompressor(output), _ready(false), _ended(false), _chunk(chunkBytes) {
+		memset(&_stream, 0, sizeof(_stream));
+	}
+
+	~ZlibDecompressor() {
+		if (_ready)
+			inflateEnd(&_stream);
+	}
+
+	bool start() {
+		if (inflateInit(&_stream) != Z_OK)
+			return fail("Not enough memory for decompression!");
+		_ready = true;
+		return true;
+	}
+
+	bool write(const unsigned char* data, size_t count) {
+		if (!_ready)
+			return false;
+		_stream.next_in = const_cast<Bytef*>(data);
+		_stream.avail_in = (uInt)count;
+		//Until the input is used up and a chunk is left unfilled, so no output waits inside zlib
+		do {
+			if (_ended)
+				return _stream.avail_in == 0 ? true : fail("data follows the end of the compressed payload");
+			_stream.next_out = _chunk.data();
+			_stream.avail_out = (uInt)_chunk.size();
+			int res = inflate(&_stream, Z_NO_FLUSH);
+			if (res == Z_STREAM_END)
+				_ended = true;
+			else if (res != Z_OK && res != Z_BUF_ERROR)
+				return fail(string("corrupt compressed payload: ") + (_stream.msg ? _stream.msg : zError(res)));
+			if (!emit(_chunk.data(), _chunk.size() - _stream.avail_out))
+				return false;
+		} while (_stream.avail_in > 0 || _stream.avail_out == 0);
+		return true;
+	}
+
+	bool finish() {
+		return _ended ? true : fail("the compressed payload is truncated");
+	}
+
+private:
+	z_stream _stream;
+	bool _ready, _ended;
+	vector<Bytef> _chunk;
+};
+
+#ifdef CODEC_ZSTD
+class ZstdDecompressor : public Decompressor {
+public:
+	ZstdDecompressor(CodecOutput output, size_t chunkBytes) : Decompressor(output), _context(NULL), _ended(false), _chunk(chunkBytes) {}
+
+	~ZstdDecompressor() {
+		if (_context)
+			ZSTD_freeDCtx(_context);
+	}
+
+	bool start() {
+		_context = ZSTD_createDCtx();
+		return _context ? true : fail("Not enough memory for decompression!");
+	}
+
+	bool write(const unsigned char* data, size_t count) {
+		//A frame is done once zstd returns 0, more input would start another one
+		ZSTD_inBuffer input = { data, count, 0 };
+		while (true) {
+			ZSTD_outBuffer output = { _chunk.data(), _chunk.size(), 0 };
+			size_t left = ZSTD_decompressStream(_context, &output, &input);
+			if (ZSTD_isError(left))
+				return fail(string("corrupt compressed payload: ") + ZSTD_getErrorName(left));
+			_ended = (left == 0);
+			if (!emit(_chunk.data(), output.pos))
+				return false;
+			if (input.pos == input.size && output.pos < output.size)
+				return true;
+		}
+	}
+
+	bool finish() {
+		return _ended ? true : fail("the compressed payload is truncated");
+	}
+
+private:
+	ZSTD_DCtx* _context;
+	bool _ended;
+	vector<unsigned char> _chunk;
+};
+#endif
+
+unique_ptr<Decompressor> Decompressor::create(const Codec& codec, size_t chunkBytes, CodecOutput output, string& error) {
+	if (!codecAvailable(codec.type)) {
+		error = "this build has no " + codecName(codec);
+		return unique_ptr<Decompressor>();
+	}
+
+	bool started = true;
+	unique_ptr<Decompressor> decompressor;
+	if (codec.type == CODEC_TYPE_NONE)
+		decompressor.reset(new StoreDecompressor(output));
+	else if (codec.type == CODEC_TYPE_ZLIB || codec.type == CODEC_TYPE_LIBDEFLATE) {
+		ZlibDecompressor* zlib = new ZlibDecompressor(output, chunkBytes);
+		decompressor.reset(zlib);
+		started = zlib->start();
+	}
+#ifdef CODEC_ZSTD
+	else if (codec.type == CODEC_TYPE_ZSTD) {
+		ZstdDecompressor* zstd = new ZstdDecompressor(output, chunkBytes);
+		decompressor.reset(zstd);
+		started = zstd->start();
+	}
+#endif
+
+	if (!started) {
+		error = decompressor->error();
+		decompressor.reset();
+	}
+	return decompressor;
+}
+
+unsigned long long codecBufferBytes(const Codec& codec, unsigned long long payloadBytes) {
+	//The payload, grown a doubling at a time in the arena, and its compressed form
+	if (codec.type == CODEC_TYPE_LIBDEFLATE)
+		return 3 * payloadBytes;
+	return 0;
+}
+
+bool decompressPayload(const Codec& codec, const unsigned char* data, size_t size, vector<unsigned char>& out) {
+	switch (codec.type) {
+	case CODEC_TYPE_NONE:
+		if (size != out.size())
+			return false;
+		memcpy(out.data(), data, size);
+		return true;
+	case CODEC_TYPE_ZLIB: {
+		uLongf length = (uLongf)out.size();
+		return uncompress(out.data(), &length, data, (uLong)size) == Z_OK && length == out.size();
+	}
+#ifdef CODEC_LIBDEFLATE
+	case CODEC_TYPE_LIBDEFLATE: {
+		struct libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+		if (!decompressor)
+			return false;
+		enum libdeflate_result res = libdeflate_zlib_decompress(decompressor, data, size, out.data(), out.size(), NULL);
+		libdeflate_free_decompressor(decompressor);
+		return res == LIBDEFLATE_SUCCESS;
+	}
+#endif
+#ifdef CODEC_ZSTD
+	case CODEC_TYPE_ZSTD: {
+		size_t length = ZSTD_decompress(out.data(), out.size(), data, size);
+		return !ZSTD_isError(length) && length == out.size();
+	}
+#endif
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,123 @@
+//CODEC  Compression of the CFS payload with zlib, libdeflate or zstd.
+//   zlib at any level and libdeflate both produce the zlib stream of a version 1 CFS, so
+//   their files read as before; libdeflate compresses the whole payload in one call at
+//   close and holds it until then. zstd needs readers that know it and is written as
+//   version 2, whose compression byte names the codec instead of being a flag. libdeflate
+//   and zstd are only there when built with LIBDEFLATE=1 or ZSTD=1 (CODEC_LIBDEFLATE and
+//   CODEC_ZSTD). Compressed output is handed on a chunk at a time, as it becomes ready, and
+//   so is decompressed output when reading a CFS back.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+#define CFS_VERSION_DEFLATE (1)      // compression byte 0 or 1, a zlib stream when 1
+#define CFS_VERSION_CODEC (2)        // compression byte is one of CFS_COMPRESSION_*
+#define CFS_VERSION_BLOCKS (3)       // as 2, compressed in blocks with an index, see cfswriter.h
+#define CFS_VERSION_PAYLOAD (4)      // as 3 with a payload format byte, see quantize.h
+#define CFS_COMPRESSION_NONE (0)
+#define CFS_COMPRESSION_ZLIB (1)
+#define CFS_COMPRESSION_ZSTD (2)
+
+enum CodecType {
+	CODEC_TYPE_NONE,
+	CODEC_TYPE_ZLIB,
+	CODEC_TYPE_LIBDEFLATE,
+	CODEC_TYPE_ZSTD
+};
+
+struct Codec {
+	Codec() : type(CODEC_TYPE_ZLIB), level(0) {}
+
+	CodecType type;
+	int level;                   // 0 for the codec's default
+
+	bool operator==(const Codec& other) const { return type == other.type && level == other.level; }
+	bool operator!=(const Codec& other) const { return !(*this == other); }
+
+	//Version and compression byte of the CFS header for this codec
+	uint8_t version() const;
+	uint8_t compression() const;
+};
+
+//Parses "none", "zlib", "libdeflate" or "zstd", optionally followed by ":level", and
+//fails for levels out of range and codecs this build does not have
+bool parseCodec(const string& text, Codec& codec, string& error);
+
+//As parseCodec() takes it, e.g. "zstd:3"
+string codecName(const Codec& codec);
+
+bool codecAvailable(CodecType type);
+
+//Codec that reads the payload of a CFS with this version and compression byte, false if
+//there is none in this build
+bool codecOfHeader(uint8_t version, uint8_t compression, Codec& codec);
+
+//Receives compressed or decompressed bytes, false stops the stream
+typedef function<bool(const unsigned char* data, size_t count)> CodecOutput;
+
+//Compression or decompression of one stream, handed on a chunk at a time
+class CodecStream {
+public:
+	virtual ~CodecStream() {}
+
+	//Takes count more bytes of the stream
+	virtual bool write(const unsigned char* data, size_t count) = 0;
+
+	//Handles what is left and hands on the end of the stream
+	virtual bool finish() = 0;
+
+	//Bytes handed to the output so far
+	unsigned long long outputBytes() const { return _outputBytes; }
+
+	//What went wrong
+	const string& error() const { return _error; }
+
+protected:
+	CodecStream(CodecOutput output, const string& outputError) : _output(output), _outputError(outputError), _outputBytes(0) {}
+
+	bool emit(const unsigned char* data, size_t count);
+	bool fail(const string& message);
+
+private:
+	CodecStream(const CodecStream&) = delete;
+	CodecStream& operator=(const CodecStream&) = delete;
+
+	CodecOutput _output;
+	string _outputError;         // when the output stops the stream
+	unsigned long long _outputBytes;
+	string _error;
+};
+
+class Compressor : public CodecStream {
+public:
+	//Output comes in pieces of at most chunkBytes, NULL with error set if the codec can
+	//not be started
+	static unique_ptr<Compressor> create(const Codec& codec, size_t chunkBytes, CodecOutput output, string& error);
+
+protected:
+	explicit Compressor(CodecOutput output) : CodecStream(output, "Writing the compressed payload failed") {}
+};
+
+//finish() fails unless the compressed stream was complete
+class Decompressor : public CodecStream {
+public:
+	//As Compressor::create(), libdeflate streams are read with zlib
+	static unique_ptr<Decompressor> create(const Codec& codec, size_t chunkBytes, CodecOutput output, string& error);
+
+protected:
+	explicit Decompressor(CodecOutput output) : CodecStream(output, "Reading the payload stopped") {}
+};
+
+//Extra bytes a compressor holds for a payload of payloadBytes, beyond its own state
+unsigned long long codecBufferBytes(const Codec& codec, unsigned long long payloadBytes);
+
+//Decompresses size bytes at data, which must give exactly out.size() bytes
+bool decompressPayload(const Codec& codec, const unsigned char* data, size_t size, vector<unsigned char>& out);
@@ -0,0 +1,950 @@
+extern "C" {
+#include "edflib.h"
+}
+#include "converter.h"
+#include "cfswriter.h"
+#include "filtercache.h"
+#include "arena.h"
+#include "cancel.h"
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+#define SAMPLINGRATE  (100)
+#define STREAMCHUNKSECONDS (300)
+#define CONVERTOVERHEADBYTES (1 << 20)
+//C3 samples of a whole recording pushed between checkpoints when it is converted on one thread
+#define WHOLECHECKPOINTSAMPLES (1 << 20)
+#define EPOCHSECONDS (SPECTRAL_EPOCHSAMPLES / SAMPLINGRATE)
+
+typedef function<bool(CfsWriter&)> OutputOpener;
+
+static const char* channelNames[4] = { "C3", "C4", "EL", "ER" };
+
+const char* convertStatusName(ConvertStatus status) {
+	switch (status) {
+	case CONVERT_OK: return "ok";
+	case CONVERT_OUT_OF_MEMORY: return "out_of_memory";
+	case CONVERT_NO_SUCH_FILE: return "no_such_file";
+	case CONVERT_FORMAT_ERROR: return "format_error";
+	case CONVERT_READ_ERROR: return "read_error";
+	case CONVERT_OPEN_ERROR: return "open_error";
+	case CONVERT_CHANNEL_NOT_FOUND: return "channel_not_found";
+	case CONVERT_INVALID_UNIT: return "invalid_unit";
+	case CONVERT_RATE_MISMATCH: return "rate_mismatch";
+	case CONVERT_WRITE_ERROR: return "write_error";
+	case CONVERT_INVALID_INPUT: return "invalid_input";
+	case CONVERT_OUT_OF_RANGE: return "out_of_range";
+	case CONVERT_TIMED_OUT: return "timed_out";
+	case CONVERT_CANCELLED: return "cancelled";
+	}
+	return "unknown";
+}
+
+bool parseRangePoint(const string& text, bool end, long long& epoch, string& error) {
+	char* unit = NULL;
+	double value = strtod(text.c_str(), &unit);
+	double seconds = value;
+	bool parsed = unit != text.c_str() && value >= 0 && (*unit == 0 || unit[1] == 0);
+	if (parsed) {
+		switch (*unit) {
+		case 0: case 's': break;
+		case 'm': seconds = value * 60; break;
+		case 'h': seconds = value * 3600; break;
+		case 'e': parsed = value == floor(value); seconds = value * EPOCHSECONDS; break;
+		default: parsed = false;
+		}
+	}
+	//Longer than any recording, which keeps the datarecord times below in range
+	if (!parsed || !(seconds < 1e9)) {
+		error = "expected seconds, minutes, hours or an epoch index, e.g. 5400, 90m, 1.5h or 180e";
+		return false;
+	}
+	epoch = (long long)(end ? ceil(seconds / EPOCHSECONDS) : floor(seconds / EPOCHSECONDS));
+	return true;
+}
+
+static ConvertResult& failure(ConvertResult& result, ConvertStatus status, const string& message) {
+	result.status = status;
+	result.message = message;
+	return result;
+}
+
+static double findMultiplier(const string& units) {
+
+	if (units.compare(0,2,"nV") == 0)
+		return 0.001;
+	else if (units.compare(0, 2, "uV") == 0)
+		return 1.0;
+	else if (units.compare(0, 2, "mV") == 0)
+		return 1000;
+	else if (units.compare(0, 1, "V") == 0)
+		return 1000000;
+	else
+		return -1;
+
+}
+
+static string lowerCase(string text) {
+	for (size_t i = 0; i < text.size(); i++)
+		text[i] = (char)tolower((unsigned char)text[i]);
+	return text;
+}
+
+//Same design as sp::fir1 with a Hamming window, without needing armadillo
+static vector<double> firBandPass(int N, double fl, double fh) {
+	const double PI = 3.14159265358979323846;
+	const double PI_2 = 6.28318530717958647692;
+	vector<double> b(N+1);
+	for (int i = 0; i < N+1; i++) {
+		double h = 0.54 - 0.46 * cos(1.0 * PI_2 * i / N);
+		double xh = fh * (i - N / 2.0), xl = fl * (i - N / 2.0);
+		double sh = (xh == 0.0) ? 1.0 : sin(PI * xh) / (PI * xh);
+		double sl = (xl == 0.0) ? 1.0 : sin(PI * xl) / (PI * xl);
+		b[i] = h * (sh * fh - sl * fl);
+	}
+	return b;
+}
+
+shared_ptr< const vector<double> > bandPassTaps(int N, double fl, double fh) {
+	return cachedBandPass(N, fl, fh, [=]() { return firBandPass(N, fl, fh); });
+}
+
+static void designFilters(PipelineSettings& settings, double eegRate, double elRate, double erRate) {
+	settings.eegTaps = *bandPassTaps(CONVERTER_FILTERORDER, 0.3 * 2 / eegRate, 45 * 2 / eegRate);
+	settings.elTaps = *bandPassTaps(CONVERTER_FILTERORDER, 0.3 * 2 / elRate, 12 * 2 / elRate);
+	settings.erTaps = *bandPassTaps(CONVERTER_FILTERORDER, 0.3 * 2 / erRate, 12 * 2 / erRate);
+}
+
+//Mean computation, FIR filtering, downsampling to 100Hz and spectrogram of the channels in
+//result, all but the sample counts
+static PipelineSettings pipelineSettings(const Converter::Options& options, const ConvertResult& result, const double mult[4]) {
+	PipelineSettings settings;
+	settings.eegRate = (int)result.channels[0].rate;
+	settings.elRate = (int)result.channels[2].rate;
+	settings.erRate = (int)result.channels[3].rate;
+	settings.c3Mult = mult[0];
+	settings.c4Mult = mult[1];
+	settings.elMult = mult[2];
+	settings.erMult = mult[3];
+	designFilters(settings, result.channels[0].rate, result.channels[2].rate, result.channels[3].rate);
+	settings.precision = options.precision;
+	settings.logMagnitude = options.payload != PAYLOAD_FLOAT;
+	return settings;
+}
+
+//Whether a recording of that many epochs holds any of the range of options
+static bool rangeInRecording(const Converter::Options& options, long long epochs) {
+	return options.firstEpoch < epochs && (options.endEpoch < 0 || options.endEpoch > options.firstEpoch);
+}
+
+static ConvertResult& rangeFailure(ConvertResult& result) {
+	return failure(result, CONVERT_OUT_OF_RANGE, "The recording ends before the start of the range to convert.");
+}
+
+static ConvertResult& cancelFailure(ConvertResult& result, const ConvertCancelled& cancelled) {
+	return failure(result, cancelled.timedOut() ? CONVERT_TIMED_OUT : CONVERT_CANCELLED, cancelled.what());
+}
+
+//Waits before a read is tried again, false when the conversion was cancelled meanwhile
+static bool retryPause(const CancelToken* token, chrono::milliseconds pause) {
+	if (token)
+		return token->sleep(pause);
+	this_thread::sleep_for(pause);
+	return true;
+}
+
+//Threads a whole recording is spread over
+static unsigned parallelWidth(const Converter::Options& options) {
+	return options.pool ? options.pool->size() : 1;
+}
+
+static CfsWriterOptions writerOptions(const Converter::Options& options) {
+	CfsWriterOptions writer;
+	writer.codec = options.codec;
+	writer.payload = options.payload;
+	writer.blockEpochs = options.blockEpochs;
+	writer.pool = options.pool;
+	writer.output = options.output;
+	writer.upload = options.upload;
+	writer.local = options.local;
+	return writer;
+}
+
+//Peak bytes of a conversion taking chunkSamples[c] samples of each channel at a time:
+//inputSlots sets of read buffers, a chunk of each channel inside the filter and resampling
+//stages, the 100 Hz samples waiting for a full epoch, and the writer, with whatever it
+//keeps of the payload of a recording of recordingSeconds. Converted on several
+//threads, a whole recording also holds a batch of epochs; with Options::quality there are
+//the signal-quality tables and statistics too
+static unsigned long long conversionFootprint(const long long chunkSamples[4], double chunkSeconds, double recordingSeconds,
+	int inputSlots, const Converter::Options& options) {
+	unsigned long long sampleBytes = (options.precision == PIPELINE_FLOAT) ? sizeof(float) : sizeof(double);
+
+	unsigned long long input = 0, staged = 0;
+	for (int c = 0; c < 4; c++) {
+		unsigned long long samples = (unsigned long long)chunkSamples[c];
+		input += samples * sizeof(double);
+		//C3 and C4 are combined before filtering, so EEG is staged once
+		if (c != 1)
+			staged += 2 * samples * sampleBytes;
+	}
+
+	unsigned long long pending = 2 * PIPELINE_CHANNELS * ((unsigned long long)(chunkSeconds * SAMPLINGRATE) + SPECTRAL_EPOCHSAMPLES) * sampleBytes;
+
+	unsigned long long batch = 0;
+	if (inputSlots <= 1 && parallelWidth(options) > 1)
+		batch = (unsigned long long)parallelWidth(options) * PIPELINE_BATCHEPOCHS * PIPELINE_EPOCHSIZE * sizeof(float);
+
+	unsigned long long payload = (unsigned long long)(recordingSeconds * SAMPLINGRATE / SPECTRAL_EPOCHSAMPLES) * payloadEpochBytes(options.payload);
+	unsigned long long writer = CFSWRITER_CHUNKBYTES + CfsWriter::bufferBytes(writerOptions(options), payload);
+
+	unsigned long long quality = 0;
+	if (options.quality && chunkSeconds > 0) {
+		double rates[4];
+		for (int c = 0; c < 4; c++)
+			rates[c] = chunkSamples[c] / chunkSeconds;
+		quality = SignalQuality::footprint(rates, recordingSeconds);
+	}
+
+	return inputSlots * input + staged + pending + batch + writer + quality + CONVERTOVERHEADBYTES;
+}
+
+//The same reading chunkRecords of the datarecords converted at a time, two sets of buffers
+//with more than one chunk
+static unsigned long long conversionFootprint(const struct edf_hdr_struct& hdr, const int signals[4], long long chunkRecords,
+	long long datarecords, const Converter::Options& options) {
+	long long samples[4];
+	for (int c = 0; c < 4; c++)
+		samples[c] = chunkRecords * hdr.signalparam[signals[c]].smp_in_datarecord;
+	double chunkSeconds = (double)chunkRecords * hdr.datarecord_duration / EDFLIB_TIME_DIMENSION;
+	double recordingSeconds = (double)datarecords * hdr.datarecord_duration / EDFLIB_TIME_DIMENSION;
+	return conversionFootprint(samples, chunkSeconds, recordingSeconds, (chunkRecords < datarecords) ? 2 : 1, options);
+}
+
+//Datarecords read at a time when streaming that many
+static long long streamChunkRecords(const struct edf_hdr_struct& hdr, long long datarecords) {
+	if (hdr.datarecord_duration <= 0)
+		return datarecords;
+	long long records = (STREAMCHUNKSECONDS * EDFLIB_TIME_DIMENSION) / hdr.datarecord_duration;
+	return max(1LL, min(records, max(1LL, datarecords)));
+}
+
+//Bytes of that many datarecords of the recording
+static unsigned long long datarecordBytes(const struct edf_hdr_struct& hdr, long long datarecords) {
+	unsigned long long recordBytes = 0;
+	int sampleBytes = (hdr.filetype == EDFLIB_FILETYPE_BDF || hdr.filetype == EDFLIB_FILETYPE_BDFPLUS) ? 3 : 2;
+	for (int i = 0; i < hdr.edfsignals; i++)
+		recordBytes += (unsigned long long)hdr.signalparam[i].smp_in_datarecord * sampleBytes;
+	return recordBytes * datarecords;
+}
+
+//Datarecords [first, end) to read for the epochs of options: from the filter warm-up before
+//the range, moved back to a record where every channel keeps its resampling phase, to the
+//warm-up after it. The 100 Hz samples outside the range are dropped through settings. False
+//when the recording ends before the range
+static bool recordRange(const Converter::Options& options, const struct edf_hdr_struct& hdr, const int signals[4],
+	PipelineSettings& settings, long long& first, long long& end) {
+
+	long long datarecords = hdr.datarecords_in_file;
+	long long duration = hdr.datarecord_duration;
+	first = 0;
+	end = datarecords;
+	if (options.firstEpoch <= 0 && options.endEpoch < 0)
+		return true;
+	if (duration <= 0)
+		return rangeInRecording(options, 0);
+	long long epochTime = (long long)EPOCHSECONDS * EDFLIB_TIME_DIMENSION;
+	if (!rangeInRecording(options, datarecords * duration / epochTime))
+		return false;
+
+	int alignment[PIPELINE_CHANNELS];
+	long long warmup = (long long)ceil(pipelineWarmup(settings, alignment) * EDFLIB_TIME_DIMENSION);
+	//C3 and C4 both feed the EEG stage
+	const int stageOf[4] = { 0, 0, 1, 2 };
+	first = max(0LL, options.firstEpoch * epochTime - warmup) / duration;
+	for (bool aligned = false; !aligned && first > 0; ) {
+		aligned = true;
+		for (int c = 0; c < 4; c++)
+			aligned = aligned && (first * hdr.signalparam[signals[c]].smp_in_datarecord) % alignment[stageOf[c]] == 0;
+		if (!aligned)
+			first--;
+	}
+	settings.skipSamples = options.firstEpoch * SPECTRAL_EPOCHSAMPLES - first * hdr.signalparam[signals[0]].smp_in_datarecord * SAMPLINGRATE / settings.eegRate;
+
+	if (options.endEpoch >= 0) {
+		settings.epochLimit = options.endEpoch - options.firstEpoch;
+		long long endTime = min(options.endEpoch * epochTime, datarecords * duration);
+		end = min(datarecords, (endTime + warmup + duration - 1) / duration);
+	}
+	return true;
+}
+
+//The whole recording through the pipeline, spread over the pool's idle workers when there is one.
+//On one thread it is pushed in pieces, with a cancellationPoint() between them
+static void convertWhole(const Converter::Options& options, ConversionPipeline& pipeline, const double* c3, const double* c4,
+	size_t eegCount, const double* el, size_t elCount, const double* er, size_t erCount) {
+	ThreadPool* pool = options.pool;
+	if (!pool) {
+		size_t pieces = max((size_t)1, (eegCount + WHOLECHECKPOINTSAMPLES - 1) / WHOLECHECKPOINTSAMPLES);
+		for (size_t i = 0; i < pieces; i++) {
+			if (i > 0)
+				cancellationPoint();
+			size_t eeg = eegCount * i / pieces, elFirst = elCount * i / pieces, erFirst = erCount * i / pieces;
+			pipeline.push(c3 + eeg, c4 + eeg, eegCount * (i + 1) / pieces - eeg, el + elFirst, elCount * (i + 1) / pieces - elFirst,
+				er + erFirst, erCount * (i + 1) / pieces - erFirst);
+		}
+		pipeline.finish();
+		return;
+	}
+	pipeline.convertAll(c3, c4, eegCount, el, elCount, er, erCount, [pool](size_t count, const function<void(size_t)>& task) {
+		pool->parallelFor(count, pool->size(), task);
+	}, pool->size());
+}
+
+//Signal quality of the four channels of an EDF, from datarecord firstRecord on
+static SignalQuality* edfQuality(const Converter::Options& options, const struct edf_hdr_struct& hdr, const int signals[4],
+	const double mult[4], const ConvertResult& result, long long firstRecord) {
+	QualityChannel channels[4];
+	long long first[4];
+	for (int c = 0; c < 4; c++) {
+		const struct edf_param_struct& param = hdr.signalparam[signals[c]];
+		channels[c].rate = result.channels[c].rate;
+		channels[c].mult = mult[c];
+		qualityLimits(param.phys_min, param.phys_max, param.dig_min, param.dig_max, channels[c].clipLow, channels[c].clipHigh);
+		first[c] = firstRecord * param.smp_in_datarecord;
+	}
+	return new SignalQuality(channels, first, options.firstEpoch);
+}
+
+//The next counts[c] samples of each channel into quality, a channel per idle worker when
+//there is a pool to spread them over
+static void addQuality(const Converter::Options& options, SignalQuality& quality, const double* const x[4], const long long counts[4], bool spread) {
+	if (spread && options.pool) {
+		options.pool->parallelFor(4, options.pool->size(), [&](size_t c) {
+			quality.add((int)c, x[c], (size_t)counts[c]);
+		});
+		return;
+	}
+	for (int c = 0; c < 4; c++)
+		quality.add(c, x[c], (size_t)counts[c]);
+}
+
+//text at path, complete or not at all like a CFS
+static bool writeSidecar(const string& path, const string& text, OutputWriter* writer, string& error) {
+	OutputFile output;
+	vector<unsigned char> bytes(text.begin(), text.end()), none;
+	uint64_t size = bytes.size();
+	if (output.open(path + CFSWRITER_PARTSUFFIX, writer) && output.finish(bytes, none, size, path))
+		return true;
+	error = output.error();
+	return false;
+}
+
+static ConvertResult& openFailure(ConvertResult& result, int filetype) {
+	switch (filetype) {
+	case EDFLIB_MALLOC_ERROR: return failure(result, CONVERT_OUT_OF_MEMORY, "Memory Error.");
+	case EDFLIB_NO_SUCH_FILE_OR_DIRECTORY: return failure(result, CONVERT_NO_SUCH_FILE, "Can not open file, no such file or directory");
+	case EDFLIB_FILE_CONTAINS_FORMAT_ERRORS: return failure(result, CONVERT_FORMAT_ERROR, "The file is not EDF(+) or BDF(+) compliant (it contains format errors)");
+	case EDFLIB_MAXFILES_REACHED: return failure(result, CONVERT_OPEN_ERROR, "Too many files opened");
+	case EDFLIB_FILE_READ_ERROR: return failure(result, CONVERT_READ_ERROR, "A read error occurred");
+	case EDFLIB_FILE_ALREADY_OPENED: return failure(result, CONVERT_OPEN_ERROR, "File has already been opened");
+	default: return failure(result, CONVERT_OPEN_ERROR, "Unknown error");
+	}
+}
+
+//Finds the four channels in the header and checks their units and rates, false with
+//result failed when the recording can not be converted
+static bool resolveChannels(const Converter::Options& options, const struct edf_hdr_struct& hdr,
+	int signals[4], double mult[4], ConvertResult& result) {
+
+	for (int c = 0; c < 4; c++) {
+		signals[c] = -1;
+		for (int i = 0; i < hdr.edfsignals; i++) {
+			if (lowerCase(hdr.signalparam[i].label) == options.channelLabels[c]) {
+				signals[c] = i;
+				break;
+			}
+		}
+		if (signals[c] < 0) {
+			failure(result, CONVERT_CHANNEL_NOT_FOUND, string(channelNames[c]) + " label not found!");
+			return false;
+		}
+
+		const struct edf_param_struct& param = hdr.signalparam[signals[c]];
+		result.channels[c].label = param.label;
+		result.channels[c].rate = ((double)param.smp_in_datarecord / (double)hdr.datarecord_duration) * EDFLIB_TIME_DIMENSION;
+		result.channels[c].unit = param.physdimension;
+	}
+
+	//Ensure units are in uV
+	for (int c = 0; c < 4; c++)
+		mult[c] = findMultiplier(result.channels[c].unit);
+	if (mult[0] < 0 || mult[1] < 0 || mult[2] < 0 || mult[3] < 0) {
+		failure(result, CONVERT_INVALID_UNIT, "Invalid measurement unit. (must be nV, uV, mV or V)");
+		return false;
+	}
+
+	if ((int)result.channels[0].rate != (int)result.channels[1].rate) {
+		failure(result, CONVERT_RATE_MISMATCH, "C3 and C4 sampling rates must be same.");
+		return false;
+	}
+
+	result.totalSamples = hdr.signalparam[signals[0]].smp_in_file;
+	result.inputBytes = datarecordBytes(hdr, hdr.datarecords_in_file);
+	return true;
+}
+
+//Everything after opening the input: channel lookup, checks, reading and conversion. The
+//output is only created once the recording is known to be convertible
+static ConvertResult& convertReader(const Converter::Options& options, struct edfhdrblock* reader,
+	struct edf_hdr_struct& hdr, const OutputOpener& openOutput, ConvertResult& result) {
+
+	int signals[4];
+	double mult[4];
+	if (!resolveChannels(options, hdr, signals, mult, result)) {
+		edfclose_reader(reader);
+		return result;
+	}
+
+	//Only the datarecords of the range are read, the whole recording without one
+	PipelineSettings settings = pipelineSettings(options, result, mult);
+	long long firstRecord, endRecord;
+	if (!recordRange(options, hdr, signals, settings, firstRecord, endRecord)) {
+		edfclose_reader(reader);
+		return rangeFailure(result);
+	}
+	long long datarecords = endRecord - firstRecord;
+	settings.eegSamples = datarecords * hdr.signalparam[signals[0]].smp_in_datarecord;
+	settings.elSamples = datarecords * hdr.signalparam[signals[2]].smp_in_datarecord;
+	settings.erSamples = datarecords * hdr.signalparam[signals[3]].smp_in_datarecord;
+
+	//Epochs are hashed, compressed and written as soon as their spectrogram is ready
+	CfsWriter writer;
+	if (!openOutput(writer)) {
+		edfclose_reader(reader);
+		return failure(result, CONVERT_WRITE_ERROR, writer.error());
+	}
+
+	//Magnitudes are written as float (IEEE-754) to save space
+	ConversionPipeline pipeline(settings, [&writer](const float* epoch) {
+		writer.writeEpoch(epoch, PIPELINE_EPOCHSIZE);
+	});
+
+	//Quality statistics are taken from the same buffers the pipeline is given
+	unique_ptr<SignalQuality> quality;
+	if (options.quality)
+		quality.reset(edfQuality(options, hdr, signals, mult, result, firstRecord));
+
+	//The whole recording in one read, or in chunks of datarecords when streaming
+	long long chunkRecords = datarecords;
+	long long streamRecords = streamChunkRecords(hdr, datarecords);
+	if (options.streaming)
+		chunkRecords = streamRecords;
+
+	//The estimated peak is reserved before the buffers are allocated. When the whole
+	//recording does not fit next to the conversions already running it is streamed instead
+	MemoryReservation reservation;
+	result.footprint = conversionFootprint(hdr, signals, chunkRecords, datarecords, options);
+	if (options.memoryBudget) {
+		if (!options.memoryBudget->tryAcquire(result.footprint)) {
+			if (chunkRecords != streamRecords) {
+				chunkRecords = streamRecords;
+				result.footprint = conversionFootprint(hdr, signals, chunkRecords, datarecords, options);
+				result.downgraded = true;
+			}
+			options.memoryBudget->acquire(result.footprint);
+		}
+		reservation.adopt(options.memoryBudget, result.footprint);
+	}
+	result.streamed = chunkRecords < datarecords;
+
+	//All four channels are de-interleaved in a single pass over the datarecords. In chunks
+	//there are two sets of buffers, the next chunk is read while the pipeline runs on this one
+	int slots = result.streamed ? 2 : 1;
+	ArenaVector<double> buffers[2][4];
+	double* bufs[2][4];
+	for (int s = 0; s < slots; s++) {
+		for (int c = 0; c < 4; c++) {
+			buffers[s][c].resize(chunkRecords * hdr.signalparam[signals[c]].smp_in_datarecord);
+			bufs[s][c] = buffers[s][c].data();
+		}
+	}
+
+	ArenaVector<char> readBlock;
+	if (!options.useMmap) {
+		readBlock.resize(EDFLIB_READ_BLOCK_BYTES);
+		edf_reader_set_read_buffer(reader, readBlock.data(), readBlock.size());
+	}
+
+	//The next chunk is read on another thread, which times into this file's profile. A read
+	//that fails, e.g. on a network share, is tried again until the conversion is cancelled
+	FileProfile* profile = currentProfile();
+	CancelToken* token = currentCancelToken();
+	auto readChunk = [&](long long record, int s) {
+		ScopedTimer timer(profile, PROFILE_READ);
+		long long n = min(chunkRecords, datarecords - record);
+		long long recordsRead = edfread_reader_datarecords(reader, 4, signals, firstRecord + record, n, bufs[s]);
+		chrono::milliseconds pause(CONVERTER_RETRYMILLIS);
+		for (int retry = 0; recordsRead < 0 && retry < CONVERTER_READRETRIES && retryPause(token, pause); retry++, pause *= 2)
+			recordsRead = edfread_reader_datarecords(reader, 4, signals, firstRecord + record, n, bufs[s]);
+		return recordsRead;
+	};
+
+	future<long long> nextChunk;
+	if (datarecords > 0)
+		nextChunk = async(launch::deferred, readChunk, 0LL, 0);
+
+	//Cancelled between chunks or pipeline stages, the CfsWriter discards what it has written
+	try {
+		for (long long record = 0, s = 0; record < datarecords; record += chunkRecords, s = (s + 1) % slots) {
+			long long n = min(chunkRecords, datarecords - record);
+			long long recordsRead = nextChunk.get();
+			cancellationPoint();
+
+			if (record + chunkRecords < datarecords)
+				nextChunk = async(launch::async, readChunk, record + chunkRecords, (int)((s + 1) % slots));
+
+			if (recordsRead != n) {
+				if (nextChunk.valid())
+					nextChunk.wait();
+				edfclose_reader(reader);
+				return failure(result, CONVERT_READ_ERROR, "reading channel data.");
+			}
+
+			if (quality) {
+				long long counts[4];
+				for (int c = 0; c < 4; c++)
+					counts[c] = n * hdr.signalparam[signals[c]].smp_in_datarecord;
+				addQuality(options, *quality, bufs[s], counts, !result.streamed);
+			}
+
+			if (result.streamed)
+				pipeline.push(bufs[s][0], bufs[s][1], n * hdr.signalparam[signals[0]].smp_in_datarecord,
+					bufs[s][2], n * hdr.signalparam[signals[2]].smp_in_datarecord,
+					bufs[s][3], n * hdr.signalparam[signals[3]].smp_in_datarecord);
+			else
+				convertWhole(options, pipeline, bufs[s][0], bufs[s][1], n * hdr.signalparam[signals[0]].smp_in_datarecord,
+					bufs[s][2], n * hdr.signalparam[signals[2]].smp_in_datarecord,
+					bufs[s][3], n * hdr.signalparam[signals[3]].smp_in_datarecord);
+		}
+		cancellationPoint();
+	}
+	catch (const ConvertCancelled& cancelled) {
+		if (nextChunk.valid())
+			nextChunk.wait();
+		edfclose_reader(reader);
+		return cancelFailure(result, cancelled);
+	}
+
+	edfclose_reader(reader);
+	if (result.streamed || datarecords == 0)
+		pipeline.finish();
+
+	result.epochs = (int)pipeline.epochs();
+	if (!writer.close(result.epochs))
+		return failure(result, CONVERT_WRITE_ERROR, writer.error());
+	result.digest = writer.digest();
+	if (quality)
+		result.quality = quality->csv(result.epochs);
+
+	if (profile) {
+		profile->bytesRead = datarecordBytes(hdr, datarecords);
+		for (int c = 0; c < 4; c++)
+			profile->samplesDecoded += datarecords * hdr.signalparam[signals[c]].smp_in_datarecord;
+		profile->epochs = result.epochs;
+		profile->payloadBytes = (unsigned long long)result.epochs * payloadEpochBytes(options.payload);
+		profile->compressedBytes = writer.compressedBytes();
+	}
+	return result;
+}
+
+//Wall time of a conversion, for its profile
+class TotalTimer {
+public:
+	explicit TotalTimer(FileProfile* profile) : _profile(profile), _start(chrono::steady_clock::now()) {}
+	~TotalTimer() {
+		if (_profile)
+			_profile->totalSeconds = chrono::duration<double>(chrono::steady_clock::now() - _start).count();
+	}
+
+private:
+	FileProfile* _profile;
+	chrono::steady_clock::time_point _start;
+};
+
+//Checks and conversion of channels decoded by the caller
+static ConvertResult& convertDecoded(const Converter::Options& options, const ChannelSet& channels,
+	vector<unsigned char>& cfs, ConvertResult& result) {
+
+	const DecodedChannel* decoded[4] = { &channels.c3, &channels.c4, &channels.el, &channels.er };
+	double mult[4];
+	cfs.clear();
+
+	for (int c = 0; c < 4; c++) {
+		result.channels[c].label = channelNames[c];
+		result.channels[c].rate = decoded[c]->rate;
+		result.channels[c].unit = decoded[c]->unit;
+		if (!(decoded[c]->rate >= 1))
+			return failure(result, CONVERT_INVALID_INPUT, string(channelNames[c]) + " sampling rate must be at least 1 Hz.");
+	}
+
+	for (int c = 0; c < 4; c++)
+		mult[c] = findMultiplier(decoded[c]->unit);
+	if (mult[0] < 0 || mult[1] < 0 || mult[2] < 0 || mult[3] < 0)
+		return failure(result, CONVERT_INVALID_UNIT, "Invalid measurement unit. (must be nV, uV, mV or V)");
+
+	if ((int)channels.c3.rate != (int)channels.c4.rate)
+		return failure(result, CONVERT_RATE_MISMATCH, "C3 and C4 sampling rates must be same.");
+	if (channels.c3.samples.size() != channels.c4.samples.size())
+		return failure(result, CONVERT_INVALID_INPUT, "C3 and C4 must have the same number of samples.");
+
+	result.totalSamples = (long long)channels.c3.samples.size();
+
+	//A range is cut from the samples in whole seconds around it, which keeps the phase of
+	//every channel at an integer rate
+	PipelineSettings settings = pipelineSettings(options, result, mult);
+	const double* starts[4];
+	size_t counts[4];
+	for (int c = 0; c < 4; c++) {
+		starts[c] = decoded[c]->samples.data();
+		counts[c] = decoded[c]->samples.size();
+	}
+	if (options.firstEpoch > 0 || options.endEpoch >= 0) {
+		if (!rangeInRecording(options, (long long)(result.totalSamples / channels.c3.rate) / EPOCHSECONDS))
+			return rangeFailure(result);
+		int alignment[PIPELINE_CHANNELS];
+		double warmup = pipelineWarmup(settings, alignment);
+		long long firstSecond = max(0LL, (long long)floor(options.firstEpoch * EPOCHSECONDS - warmup));
+		long long endSecond = -1;
+		settings.skipSamples = (options.firstEpoch * EPOCHSECONDS - firstSecond) * SAMPLINGRATE;
+		if (options.endEpoch >= 0) {
+			settings.epochLimit = options.endEpoch - options.firstEpoch;
+			endSecond = (long long)ceil(options.endEpoch * EPOCHSECONDS + warmup);
+		}
+		for (int c = 0; c < 4; c++) {
+			long long rate = (int)decoded[c]->rate;
+			size_t first = (size_t)min((long long)counts[c], firstSecond * rate);
+			size_t end = (endSecond < 0) ? counts[c] : (size_t)min((long long)counts[c], endSecond * rate);
+			starts[c] += first;
+			counts[c] = end - first;
+		}
+	}
+	settings.eegSamples = (long long)counts[0];
+	settings.elSamples = (long long)counts[2];
+	settings.erSamples = (long long)counts[3];
+
+	//The samples are the caller's, only the pipeline and the writer need memory of their own
+	MemoryReservation reservation;
+	long long samples[4];
+	for (int c = 0; c < 4; c++)
+		samples[c] = (long long)decoded[c]->samples.size();
+	double seconds = (double)result.totalSamples / channels.c3.rate;
+	result.footprint = conversionFootprint(samples, seconds, seconds, 0, options);
+	if (options.memoryBudget) {
+		options.memoryBudget->acquire(result.footprint);
+		reservation.adopt(options.memoryBudget, result.footprint);
+	}
+
+	CfsWriter writer;
+	if (!writer.open(cfs, writerOptions(options)))
+		return failure(result, CONVERT_WRITE_ERROR, writer.error());
+
+	ConversionPipeline pipeline(settings, [&writer](const float* epoch) {
+		writer.writeEpoch(epoch, PIPELINE_EPOCHSIZE);
+	});
+	try {
+		convertWhole(options, pipeline, starts[0], starts[1], counts[0], starts[2], counts[2], starts[3], counts[3]);
+	}
+	catch (const ConvertCancelled& cancelled) {
+		cfs.clear();
+		return cancelFailure(result, cancelled);
+	}
+
+	result.epochs = (int)pipeline.epochs();
+	if (!writer.close(result.epochs))
+		return failure(result, CONVERT_WRITE_ERROR, writer.error());
+	result.digest = writer.digest();
+
+	//Decoded samples come without a physical range, so none are counted as clipped
+	if (options.quality) {
+		QualityChannel qualityChannels[4];
+		long long first[4];
+		long long sampleCounts[4];
+		for (int c = 0; c < 4; c++) {
+			qualityChannels[c].rate = decoded[c]->rate;
+			qualityChannels[c].mult = mult[c];
+			first[c] = starts[c] - decoded[c]->samples.data();
+			sampleCounts[c] = (long long)counts[c];
+		}
+		SignalQuality quality(qualityChannels, first, options.firstEpoch);
+		addQuality(options, quality, starts, sampleCounts, true);
+		result.quality = quality.csv(result.epochs);
+	}
+
+	if (currentProfile()) {
+		currentProfile()->epochs = result.epochs;
+		currentProfile()->payloadBytes = (unsigned long long)result.epochs * payloadEpochBytes(options.payload);
+		currentProfile()->compressedBytes = writer.compressedBytes();
+	}
+	return result;
+}
+
+Converter::Converter(const Options& options) : _options(options) {
+}
+
+ConvertResult Converter::convertFile(const string& edfPath, const string& cfsPath) const {
+
+	//Buffers of this file come from the worker's arena, rewound once everything below is gone
+	ArenaScope arenaScope;
+
+	ConvertResult result;
+	result.profile.filename = edfPath;
+	ProfileScope profileScope(_options.profile ? &result.profile : NULL);
+	{
+		TotalTimer timer(currentProfile());
+
+		//A reader of our own, so concurrent conversions share no edflib state. Annotations are
+		//not used, parsing them would read the whole file once more before converting
+		struct edf_hdr_struct hdr;
+		struct edfhdrblock* reader = NULL;
+		int openError;
+		{
+			ScopedTimer openTimer(PROFILE_OPEN);
+			openError = edfopen_reader(edfPath.c_str(), &hdr, EDFLIB_DO_NOT_READ_ANNOTATIONS, _options.useMmap ? 1 : 0, &reader);
+		}
+		if (openError)
+			openFailure(result, hdr.filetype);
+		else
+			convertReader(_options, reader, hdr, [this, &cfsPath](CfsWriter& writer) { return writer.open(cfsPath, writerOptions(_options)); }, result);
+
+		string error;
+		if (result.ok() && _options.quality && !writeSidecar(qualityPath(cfsPath), result.quality, _options.output, error))
+			failure(result, CONVERT_WRITE_ERROR, error);
+		result.quality.clear();
+	}
+	return result;
+}
+
+ConvertResult Converter::prescan(const string& edfPath) const {
+	ConvertResult result;
+	struct edf_hdr_struct hdr;
+	struct edfhdrblock* reader = NULL;
+	if (edfopen_reader(edfPath.c_str(), &hdr, EDFLIB_DO_NOT_READ_ANNOTATIONS, 0, &reader))
+		return openFailure(result, hdr.filetype);
+
+	//The footprint convertFile() would reserve first, before any downgrade to streaming
+	int signals[4];
+	double mult[4];
+	if (resolveChannels(_options, hdr, signals, mult, result)) {
+		PipelineSettings settings = pipelineSettings(_options, result, mult);
+		long long firstRecord, endRecord;
+		if (recordRange(_options, hdr, signals, settings, firstRecord, endRecord)) {
+			long long datarecords = endRecord - firstRecord;
+			long long chunkRecords = _options.streaming ? streamChunkRecords(hdr, datarecords) : datarecords;
+			result.footprint = conversionFootprint(hdr, signals, chunkRecords, datarecords, _options);
+			result.streamed = chunkRecords < datarecords;
+		}
+		else
+			rangeFailure(result);
+	}
+	edfclose_reader(reader);
+	return result;
+}
+
+ConvertResult Converter::convertBuffer(const void* data, size_t size, vector<unsigned char>& cfs) const {
+	ArenaScope arenaScope;
+
+	ConvertResult result;
+	ProfileScope profileScope(_options.profile ? &result.profile : NULL);
+	{
+		TotalTimer timer(currentProfile());
+
+		struct edf_hdr_struct hdr;
+		struct edfhdrblock* reader = NULL;
+		int openError;
+		cfs.clear();
+		{
+			ScopedTimer openTimer(PROFILE_OPEN);
+			openError = edfopen_reader_memory((const char*)data, (long long)size, &hdr, EDFLIB_DO_NOT_READ_ANNOTATIONS, &reader);
+		}
+		if (openError)
+			openFailure(result, hdr.filetype);
+		else {
+			//The datarecords are decoded from data itself, there is no file to map
+			Options options = _options;
+			options.useMmap = true;
+			convertReader(options, reader, hdr, [&options, &cfs](CfsWriter& writer) { return writer.open(cfs, writerOptions(options)); }, result);
+		}
+	}
+	return result;
+}
+
+ConvertResult Converter::convertChannels(const ChannelSet& channels, vector<unsigned char>& cfs) const {
+	ArenaScope arenaScope;
+
+	ConvertResult result;
+	ProfileScope profileScope(_options.profile ? &result.profile : NULL);
+	{
+		TotalTimer timer(currentProfile());
+		convertDecoded(_options, channels, cfs, result);
+	}
+	return result;
+}
+
+//Samples per channel the pipeline of a followed recording is made for, until it is complete
+#define FOLLOW_MAXSAMPLES (1LL << 40)
+
+struct FollowConversion::State {
+	State() : records(0), published(-1), done(false) {}
+
+	Converter::Options options;
+	string edfPath, cfsPath;
+	ConvertResult result;                // channels found by the first update
+	int signals[4];
+	int edfsignals;
+	long long duration;
+	vector<int> samplesPerRecord;        // of every signal, which must not change
+	vector<unsigned char> stored;        // header and complete blocks, filled by the writer
+	CfsWriter writer;
+	unique_ptr<ConversionPipeline> pipeline;
+	unique_ptr<SignalQuality> quality;
+	long long records;
+	long long published;                 // epochs of the CFS on disk, -1 before the first
+	bool done;
+};
+
+FollowConversion::FollowConversion(const Converter& converter, const string& edfPath, const string& cfsPath) : _state(new State) {
+	_state->options = converter.options();
+	if (_state->options.blockEpochs == 0)
+		_state->options.blockEpochs = FOLLOW_BLOCKEPOCHS;
+	_state->edfPath = edfPath;
+	_state->cfsPath = cfsPath;
+}
+
+FollowConversion::~FollowConversion() {
+}
+
+long long FollowConversion::datarecords() const {
+	return _state->records;
+}
+
+ConvertResult FollowConversion::update(bool last) {
+	State& state = *_state;
+	const Converter::Options& options = state.options;
+	ConvertResult result = state.result;
+	if (state.done)
+		return result;
+
+	struct edf_hdr_struct hdr;
+	struct edfhdrblock* reader = NULL;
+	if (edfopen_reader_growing(state.edfPath.c_str(), &hdr, &reader))
+		return openFailure(result, hdr.filetype);
+
+	if (!state.pipeline) {
+		double mult[4];
+		if (!resolveChannels(options, hdr, state.signals, mult, result)) {
+			edfclose_reader(reader);
+			return result;
+		}
+		CfsWriter& writer = state.writer;
+		if (!writer.open(state.stored, writerOptions(options))) {
+			edfclose_reader(reader);
+			return failure(result, CONVERT_WRITE_ERROR, writer.error());
+		}
+		PipelineSettings settings = pipelineSettings(options, result, mult);
+		settings.eegSamples = settings.elSamples = settings.erSamples = FOLLOW_MAXSAMPLES;
+		state.pipeline.reset(new ConversionPipeline(settings, [&writer](const float* epoch) {
+			writer.writeEpoch(epoch, PIPELINE_EPOCHSIZE);
+		}));
+		if (options.quality)
+			state.quality.reset(edfQuality(options, hdr, state.signals, mult, result, 0));
+		state.edfsignals = hdr.edfsignals;
+		state.duration = hdr.datarecord_duration;
+		for (int i = 0; i < hdr.edfsignals; i++)
+			state.samplesPerRecord.push_back(hdr.signalparam[i].smp_in_datarecord);
+		state.result = result;
+	}
+	else {
+		bool same = hdr.edfsignals == state.edfsignals && hdr.datarecord_duration == state.duration;
+		for (int i = 0; same && i < hdr.edfsignals; i++)
+			same = hdr.signalparam[i].smp_in_datarecord == state.samplesPerRecord[i];
+		if (!same) {
+			edfclose_reader(reader);
+			return failure(result, CONVERT_FORMAT_ERROR, "The signals of the recording changed while it was followed.");
+		}
+	}
+
+	//Only the datarecords appended since the last update are read, a chunk at a time
+	const int* signals = state.signals;
+	long long datarecords = hdr.datarecords_in_file;
+	long long chunkRecords = streamChunkRecords(hdr, datarecords - state.records);
+	ArenaVector<double> buffers[4];
+	double* bufs[4];
+	for (int c = 0; c < 4; c++) {
+		buffers[c].resize(chunkRecords * hdr.signalparam[signals[c]].smp_in_datarecord);
+		bufs[c] = buffers[c].data();
+	}
+	ArenaVector<char> readBlock(EDFLIB_READ_BLOCK_BYTES);
+	edf_reader_set_read_buffer(reader, readBlock.data(), readBlock.size());
+
+	while (state.records < datarecords) {
+		long long n = min(chunkRecords, datarecords - state.records);
+		if (edfread_reader_datarecords(reader, 4, signals, state.records, n, bufs) != n) {
+			edfclose_reader(reader);
+			return failure(result, CONVERT_READ_ERROR, "reading channel data.");
+		}
+		if (state.quality) {
+			long long counts[4];
+			for (int c = 0; c < 4; c++)
+				counts[c] = n * hdr.signalparam[signals[c]].smp_in_datarecord;
+			addQuality(options, *state.quality, bufs, counts, false);
+		}
+		state.pipeline->push(bufs[0], bufs[1], n * hdr.signalparam[signals[0]].smp_in_datarecord,
+			bufs[2], n * hdr.signalparam[signals[2]].smp_in_datarecord,
+			bufs[3], n * hdr.signalparam[signals[3]].smp_in_datarecord);
+		state.records += n;
+	}
+	edfclose_reader(reader);
+
+	if (last) {
+		state.pipeline->setSamples(state.records * hdr.signalparam[signals[0]].smp_in_datarecord,
+			state.records * hdr.signalparam[signals[2]].smp_in_datarecord,
+			state.records * hdr.signalparam[signals[3]].smp_in_datarecord);
+		state.pipeline->finish();
+		state.done = true;
+	}
+
+	result.totalSamples = state.records * hdr.signalparam[signals[0]].smp_in_datarecord;
+	result.inputBytes = datarecordBytes(hdr, state.records);
+	result.epochs = (int)state.pipeline->epochs();
+	result.streamed = true;
+
+	//Published whole under a temporary name, as CfsWriter::close() does
+	if (result.epochs != state.published || last) {
+		vector<unsigned char> cfs, none;
+		if (!state.writer.snapshot((uint16_t)result.epochs, cfs))
+			return failure(result, CONVERT_WRITE_ERROR, state.writer.error());
+		OutputFile output;
+		uint64_t size = cfs.size();
+		if (!output.open(state.cfsPath + CFSWRITER_PARTSUFFIX, options.output) || !output.finish(cfs, none, size, state.cfsPath))
+			return failure(result, CONVERT_WRITE_ERROR, output.error());
+		state.published = result.epochs;
+	}
+	result.digest = state.writer.digest();
+
+	//The statistics are written once, for the complete recording
+	string error;
+	if (last && state.quality && !writeSidecar(qualityPath(state.cfsPath), state.quality->csv(result.epochs), options.output, error))
+		failure(result, CONVERT_WRITE_ERROR, error);
+	if (last)
+		state.result = result;
+	return result;
+}
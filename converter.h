@@ -0,0 +1,181 @@
+//CONVERTER  EDF to CFS conversion as a library, without the command line around it.
+//   A Converter holds the settings of a run and converts one recording per call, from an
+//   EDF file to a CFS file, from EDF bytes already in memory (e.g. an upload) or from
+//   channels another program has decoded itself, to CFS bytes. The calls are const and
+//   keep no state between them, so one Converter can serve several threads at once.
+//   Failures are reported through ConvertResult rather than exceptions or log text.
+//   A conversion stops early, with nothing written, when the CancelToken installed on the
+//   calling thread is cancelled or reaches its deadline.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "pipeline.h"
+#include "memorybudget.h"
+#include "threadpool.h"
+#include "codec.h"
+#include "quantize.h"
+#include "profile.h"
+#include "outputwriter.h"
+#include "upload.h"
+#include "quality.h"
+
+using namespace std;
+
+//Order of the EEG and EOG band-pass filters
+#define CONVERTER_FILTERORDER (50)
+
+//Datarecords that fail to read are tried again this many times, after a pause that starts
+//at CONVERTER_RETRYMILLIS and doubles each time
+#define CONVERTER_READRETRIES (3)
+#define CONVERTER_RETRYMILLIS (500)
+
+enum ConvertStatus {
+	CONVERT_OK,
+	CONVERT_OUT_OF_MEMORY,
+	CONVERT_NO_SUCH_FILE,
+	CONVERT_FORMAT_ERROR,        // not EDF(+) or BDF(+) compliant
+	CONVERT_READ_ERROR,
+	CONVERT_OPEN_ERROR,          // any other reason the input could not be opened
+	CONVERT_CHANNEL_NOT_FOUND,
+	CONVERT_INVALID_UNIT,        // not nV, uV, mV or V
+	CONVERT_RATE_MISMATCH,       // C3 and C4 sampled at different rates
+	CONVERT_WRITE_ERROR,         // creating, compressing or writing the CFS
+	CONVERT_INVALID_INPUT,       // decoded channels that can not be converted
+	CONVERT_OUT_OF_RANGE,        // the recording ends before the range to convert starts
+	CONVERT_TIMED_OUT,           // past the deadline of the CancelToken of the thread, see cancel.h
+	CONVERT_CANCELLED            // the CancelToken of the thread was cancelled
+};
+
+//One of the four channels as found in the input
+struct ConvertChannelInfo {
+	string label;
+	double rate;                 // Hz
+	string unit;
+};
+
+struct ConvertResult {
+	ConvertResult() : status(CONVERT_OK), totalSamples(-1), inputBytes(0), epochs(0), streamed(false), downgraded(false), footprint(0) {}
+
+	bool ok() const { return status == CONVERT_OK; }
+
+	ConvertStatus status;
+	string message;              // what went wrong, empty on success
+	long long totalSamples;      // C3 samples, -1 until the channels have been checked
+	unsigned long long inputBytes; // of all datarecords, once the channels have been checked
+	ConvertChannelInfo channels[4]; // C3, C4, EL, ER
+	int epochs;
+	bool streamed;               // read in chunks rather than in one piece
+	bool downgraded;             // streamed only to stay within the memory budget
+	unsigned long long footprint; // estimated peak bytes, as reserved from the budget
+	string digest;               // SHA1 stored in the CFS header, in hex
+	string quality;              // CSV of SignalQuality with Options::quality, written to qualityPath() by convertFile()
+	FileProfile profile;         // with Options::profile
+};
+
+//Physical samples of one channel, e.g. as decoded from another format
+struct DecodedChannel {
+	vector<double> samples;
+	double rate;                 // Hz
+	string unit;                 // nV, uV, mV or V
+};
+
+struct ChannelSet {
+	DecodedChannel c3, c4, el, er;
+};
+
+//Short lower-case name of a status for logs and reports, e.g. "channel_not_found"
+const char* convertStatusName(ConvertStatus status);
+
+//Epoch of a point of a range to convert, given in seconds ("5400" or "5400s"), minutes
+//("90m"), hours ("1.5h") or as an epoch index ("180e"). Times are rounded out to whole
+//epochs, a start down to the epoch it falls in and an end up to the next boundary
+bool parseRangePoint(const string& text, bool end, long long& epoch, string& error);
+
+//Band-pass taps of order N between the normalized cutoffs fl and fh, a Hamming windowed
+//design as sp::fir1 makes it, computed once per process for each set of arguments
+shared_ptr< const vector<double> > bandPassTaps(int N, double fl, double fh);
+
+class Converter {
+public:
+	struct Options {
+		Options() : useMmap(false), streaming(false), precision(PIPELINE_DOUBLE), memoryBudget(NULL), pool(NULL), profile(false), payload(PAYLOAD_FLOAT), blockEpochs(0), output(NULL), upload(NULL), local(true), firstEpoch(0), endEpoch(-1), quality(false) {}
+
+		vector<string> channelLabels;   // C3, C4, EL, ER labels in lower case
+		bool useMmap;                   // memory-map input files
+		bool streaming;                 // read and convert in chunks
+		PipelinePrecision precision;
+		MemoryBudget* memoryBudget;     // shared by the conversions in flight, NULL for no limit
+		ThreadPool* pool;               // spreads a recording read in one piece over idle workers
+		bool profile;                   // time the phases into ConvertResult::profile
+		Codec codec;                    // compression of the CFS payload
+		PayloadFormat payload;          // CFS version 4 with reduced-precision log-magnitudes unless PAYLOAD_FLOAT
+		unsigned blockEpochs;           // CFS version 3 compressed in blocks of this many epochs, 0 for one stream
+		OutputWriter* output;           // writes CFS files on its own thread, NULL to write them on the converting one
+		Uploader* upload;               // sends CFS files to the scoring service as they are written, NULL for none
+		bool local;                     // keeps CFS files on disk, false to only upload them
+		long long firstEpoch;           // epochs [firstEpoch, endEpoch) of the recording are converted,
+		long long endEpoch;             // from the datarecords around them only, endEpoch < 0 for the rest
+		bool quality;                   // per-epoch signal quality of the samples read, see quality.h
+	};
+
+	explicit Converter(const Options& options);
+
+	//Converts the EDF at edfPath to cfsPath, which only appears once it is complete. With
+	//Options::upload it is sent to the service under its name as well, and only there unless
+	//Options::local. With Options::quality the statistics go to qualityPath(cfsPath) once
+	//the CFS is written
+	ConvertResult convertFile(const string& edfPath, const string& cfsPath) const;
+
+	//Reads only the header of the EDF at edfPath and checks what convertFile() would check
+	//before reading any samples: the channels, their units and rates, and that the recording
+	//reaches the range to convert. On success totalSamples, inputBytes, channels, footprint
+	//and streamed are filled in; nothing is reserved or written
+	ConvertResult prescan(const string& edfPath) const;
+
+	//Converts a whole EDF of size bytes at data, replacing cfs with the CFS bytes
+	ConvertResult convertBuffer(const void* data, size_t size, vector<unsigned char>& cfs) const;
+
+	//Converts channels decoded by the caller, channelLabels are not used
+	ConvertResult convertChannels(const ChannelSet& channels, vector<unsigned char>& cfs) const;
+
+	const Options& options() const { return _options; }
+
+private:
+	Options _options;
+};
+
+//Converts an EDF while it is still being recorded. Every update() reads the datarecords
+//appended since the last one (see edfopen_reader_growing), pushes them through a pipeline
+//that keeps its filter, resampler and spectrogram state between updates, and replaces the
+//CFS with one of all epochs so far. The CFS is blocked (Options::blockEpochs, or
+//FOLLOW_BLOCKEPOCHS when 0), so only the blocks completed since are compressed; the file
+//itself is rewritten from the blocks kept in memory and renamed into place, so a reader
+//never sees it half written. Epochs are the same as those of convertFile() once complete.
+//The state lives on the heap, not in a worker's arena, and the range options are not used.
+//With Options::quality the statistics are written by the last update.
+#define FOLLOW_BLOCKEPOCHS (10)
+
+class FollowConversion {
+public:
+	FollowConversion(const Converter& converter, const string& edfPath, const string& cfsPath);
+	~FollowConversion();
+
+	//Converts what was appended and publishes the CFS if there are new epochs. With last the
+	//recording is complete and the filters are flushed, later calls do nothing. Until the
+	//file has a readable header it fails with the open error, and can be called again
+	ConvertResult update(bool last = false);
+
+	//Datarecords converted so far
+	long long datarecords() const;
+
+	struct State;
+
+private:
+	FollowConversion(const FollowConversion&) = delete;
+	FollowConversion& operator=(const FollowConversion&) = delete;
+
+	unique_ptr<State> _state;
+};
@@ -0,0 +1,155 @@
+#include "crawler.h"
+#include <dirent.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <sys/stat.h>
+
+using namespace std;
+
+DirectoryCrawler::DirectoryCrawler(const string& root, const CrawlOptions& options) :
+	_options(options), _ok(false), _listing(0), _stopping(false) {
+	struct stat st;
+	if (stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+		return;
+	_ok = true;
+
+	Directory top;
+	top.path = root;
+	_dirs.push_back(top);
+	unsigned threads = _options.recursive ? max(_options.threads, 1u) : 1;
+	for (unsigned i = 0; i < threads; i++)
+		_threads.push_back(thread(&DirectoryCrawler::crawlLoop, this));
+}
+
+DirectoryCrawler::~DirectoryCrawler() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_dirReady.notify_all();
+	_fileReady.notify_all();
+	for (size_t i = 0; i < _threads.size(); i++)
+		_threads[i].join();
+}
+
+bool DirectoryCrawler::next(string& filename) {
+	unique_lock<mutex> lock(_mutex);
+	_fileReady.wait(lock, [this]() { return !_files.empty() || (_dirs.empty() && _listing == 0) || _stopping; });
+	if (_files.empty())
+		return false;
+	filename = _files.front();
+	_files.pop_front();
+	return true;
+}
+
+void DirectoryCrawler::crawlLoop() {
+	vector<Directory> subdirs;
+	vector<string> files;
+	while (true) {
+		Directory dir;
+		{
+			unique_lock<mutex> lock(_mutex);
+			_dirReady.wait(lock, [this]() { return !_dirs.empty() || _listing == 0 || _stopping; });
+			if (_stopping || _dirs.empty())
+				break;
+			dir = _dirs.front();
+			_dirs.pop_front();
+			_listing++;
+		}
+
+		subdirs.clear();
+		files.clear();
+		list(dir, subdirs, files);
+
+		bool finished;
+		{
+			lock_guard<mutex> lock(_mutex);
+			_dirs.insert(_dirs.end(), subdirs.begin(), subdirs.end());
+			_files.insert(_files.end(), files.begin(), files.end());
+			_listing--;
+			finished = _dirs.empty() && _listing == 0;
+		}
+		//Idle crawlers wake up for the new directories, or to stop once the walk is done
+		if (!subdirs.empty() || finished)
+			_dirReady.notify_all();
+		if (!files.empty() || finished)
+			_fileReady.notify_all();
+	}
+}
+
+void DirectoryCrawler::list(const Directory& dir, vector<Directory>& subdirs, vector<string>& files) const {
+	DIR* handle = opendir(dir.path.c_str());
+	if (!handle)
+		return;
+
+	string prefix = dir.path;
+	if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+		prefix += '/';
+
+	struct dirent* entry;
+	while ((entry = readdir(handle)) != NULL) {
+		string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+		string path = prefix + name;
+		string relative = dir.relative.empty() ? name : dir.relative + "/" + name;
+
+		//The entry's type saves a stat per file where the file system reports it
+		bool isDir = false, isFile = false;
+#ifdef DT_DIR
+		if (entry->d_type == DT_DIR)
+			isDir = true;
+		else if (entry->d_type == DT_REG)
+			isFile = true;
+		else if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+			continue;
+		else
+#endif
+		{
+			struct stat st;
+			if (lstat(path.c_str(), &st) != 0)
+				continue;
+			if (S_ISDIR(st.st_mode))
+				isDir = true;
+			else if (S_ISREG(st.st_mode))
+				isFile = true;
+			//Links to files count as the file, links to directories are not entered
+			else if (S_ISLNK(st.st_mode) && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+				isFile = true;
+		}
+
+		if (isDir) {
+			if (_options.recursive && !matches(_options.exclude, name, relative)) {
+				Directory subdir;
+				subdir.path = path;
+				subdir.relative = relative;
+				subdirs.push_back(subdir);
+			}
+		}
+		else if (isFile && wanted(name, relative))
+			files.push_back(path);
+	}
+	closedir(handle);
+}
+
+bool DirectoryCrawler::matches(const vector<string>& globs, const string& name, const string& relative) const {
+	for (size_t i = 0; i < globs.size(); i++) {
+		bool byPath = globs[i].find('/') != string::npos;
+		if (fnmatch(globs[i].c_str(), byPath ? relative.c_str() : name.c_str(), 0) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool DirectoryCrawler::wanted(const string& name, const string& relative) const {
+	bool extension = false;
+	for (size_t i = 0; i < _options.extensions.size() && !extension; i++) {
+		const string& suffix = _options.extensions[i];
+		extension = name.size() > suffix.size() && strcasecmp(name.c_str() + name.size() - suffix.size(), suffix.c_str()) == 0;
+	}
+	if (!extension || matches(_options.exclude, name, relative))
+		return false;
+	return _options.include.empty() || matches(_options.include, name, relative);
+}
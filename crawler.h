@@ -0,0 +1,68 @@
+//CRAWLER  Finds the EDF and BDF files of a directory tree while the first ones are converted,
+//   or the files of other extensions, e.g. the CFS files cfsverify checks.
+//   Several threads list directories at once, as on a network file system a listing mostly
+//   waits on the server, and each directory's files are handed out by next() as soon as it
+//   has been listed, so conversion starts with the first directory instead of after the
+//   whole tree has been walked. Extensions match in any case. Include and exclude globs are
+//   matched against the path below the root when they contain a '/' and against the name
+//   otherwise; an excluded directory is not entered. Symbolic links to directories are not
+//   followed, so a link back up the tree can not make the walk endless.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+using namespace std;
+
+#define CRAWLER_THREADS (8)
+
+struct CrawlOptions {
+	CrawlOptions() : recursive(false), threads(CRAWLER_THREADS), extensions{ ".edf", ".bdf" } {}
+
+	bool recursive;              // descend into subdirectories
+	unsigned threads;
+	vector<string> extensions;   // of the files wanted, in any case
+	vector<string> include;      // files have to match one of these, when there are any
+	vector<string> exclude;      // files and directories must not match any of these
+};
+
+class DirectoryCrawler {
+public:
+	DirectoryCrawler(const string& root, const CrawlOptions& options);
+	~DirectoryCrawler();
+
+	//False if root is not a directory
+	bool ok() const { return _ok; }
+
+	//Waits for the next file found, false once the whole tree has been walked
+	bool next(string& filename);
+
+private:
+	DirectoryCrawler(const DirectoryCrawler&) = delete;
+	DirectoryCrawler& operator=(const DirectoryCrawler&) = delete;
+
+	struct Directory {
+		string path;
+		string relative;         // below the root, empty for the root itself
+	};
+
+	void crawlLoop();
+	void list(const Directory& dir, vector<Directory>& subdirs, vector<string>& files) const;
+	bool matches(const vector<string>& globs, const string& name, const string& relative) const;
+	bool wanted(const string& name, const string& relative) const;
+
+	CrawlOptions _options;
+	bool _ok;
+	deque<Directory> _dirs;      // waiting to be listed
+	size_t _listing;             // being listed right now
+	deque<string> _files;
+	mutex _mutex;
+	condition_variable _dirReady, _fileReady;
+	bool _stopping;
+	vector<thread> _threads;
+};
@@ -6,11 +6,11 @@
 //
 // Patents pending (c)-2017 Amiya Patanaik amiyain@gmail.com
 // This application has miltiple dependencies including 
-// sigpack: C++ signal processing library http://sigpack.sourceforge.net/ 
 // tclap: Templatized C++ Command Line Parser Library, 
 // BOOST: C++ libraries 
-// armadillo: C++ linear algebra library
+// FFTW3: Fastest Fourier Transform in the West http://www.fftw.org/
 // zlib:  DEFLATE compression algorithm
+// libdeflate, zstd and libcurl are optional, see the Makefile
 // Licensed under GPL v3
 
 // edf2cfs.cpp : Defines the entry point for the console application.
@@ -19,15 +19,26 @@ extern "C" {
 #include "edflib.h"
 #include "zlib.h"
 }
-#include "sigpack/sigpack.h"
 #include "tclap/CmdLine.h"
 #include "tclap/ValueArg.h"
+#include "tclap/ValuesConstraint.h"
 #include "SHA1.h"
 #include "order32.h"
 #include "resample.h"
+#include "threadpool.h"
+#include "scheduler.h"
+#include "readahead.h"
+#include "memorybudget.h"
+#include "watcher.h"
+#include "spectral.h"
+#include "converter.h"
+#include "logsink.h"
+#include "manifest.h"
+#include "crawler.h"
+#include "shard.h"
+#include "cancel.h"
 #include <iostream>
 #include <vector>
-#include <armadillo>
 #include <cmath>
 #include <algorithm>
 #include <stdint.h>
@@ -38,37 +49,37 @@ extern "C" {
 #include <thread>
 #include <future> 
 #include <functional>
+#include <map>
+#include <mutex>
 #include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
 #include <boost/filesystem.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/date_time/posix_time/posix_time_io.hpp>
 #include <chrono>
 
-#define FILTERORDER  (50)
-#define SAMPLINGRATE  (100)
-#define LITTLEENDIAN (O32_HOST_ORDER == O32_LITTLE_ENDIAN)
 #define BOOST_FILESYSTEM_VERSION 3
 #define BOOST_FILESYSTEM_NO_DEPRECATED 
-#define DEBUG (false)
 #define BR "<br />"
+//A followed file is complete once it has not grown for this long
+#define FOLLOW_IDLESECONDS (600)
 
 using namespace std;
-using namespace arma;
 namespace fs = ::boost::filesystem;
 
-vec firBandPass(int N, double fl, double fh);
 string removeExtension(const string& filename);
-void writeByteReversed(FILE* file, Bytef* stream, int byteSize, unsigned long streamSize);
 int roundInt(double r);
 char *strlwr(char *str);
 
-double findMultiplier(const string& units);
-
 void showHeader(const char* filename, vector<string>& channelLabels);
-bool convertFile(const char* filename, vector<string>* channelLabelsPtr, bool overwrite, ostringstream* streamMsgPointer);
-void getAllFiles(const fs::path& root, const string& ext, vector<string>& filelist);
+void pauseIfInteractive();
+void stopWatching(int);
+bool convertFile(const char* filename, const Converter* converter, const ConvertResult* prescanned, bool overwrite, Manifest* manifest, const string& settings, ProfileReport* profileReport, LogSink* logSink, ostringstream* streamMsgPointer);
+bool skippedFile(const string& filename, bool overwrite, Manifest* manifest, const string& settings);
+void followFiles(const vector<string>& filelist, const Converter& converter, unsigned pollSeconds, bool overwrite, Manifest* manifest, const string& settings, bool quiet, LogSink* logSink, size_t& processedCounter, int& successCounter);
 
-sp::FFTW fftObject(128);
+static volatile sig_atomic_t stopRequested = 0;
 
 int main(int argc, char *argv[]) {
 	//Make sure IEEE-754 is supported
@@ -80,14 +91,39 @@ int main(int argc, char *argv[]) {
 	if(concurentThreadsSupported==0)
 		concurentThreadsSupported=2;
 
+	unsigned jobCount = concurentThreadsSupported;
+	unsigned readAheadMiB = 0;
+	unsigned long long maxMemoryMiB = 0;
 	vector<string> channelLabels;
 	vector<string> filelist;
 	string dirName;
 	bool quiet;
 	bool overwrite;
+	bool useMmap;
+	bool streaming;
+	bool watch;
+	int followSeconds = 0;
+	int timeoutSeconds = 0;
+	int reservedWorkers = 0;
+	CrawlOptions crawlOptions;
+	PipelinePrecision precision = PIPELINE_DOUBLE;
+	Codec codec;
+	int blockEpochs = 0;
+	PayloadFormat payload = PAYLOAD_FLOAT;
+	OutputSync outputSync = OUTPUT_SYNC_FILE;
 	bool saveLog;
+	bool pinNuma;
+	bool quality;
+	string uploadUrl;
+	vector<string> uploadHeaders;
+	bool uploadOnly;
 	string logFile;
-	ofstream lfile;
+	string jsonLogFile;
+	string profileFile;
+	string manifestFile;
+	ShardSpec shard;
+	long long firstEpoch = 0, endEpoch = -1;
+	ostringstream htmlHeader;
 
 	//Parse command line
 
@@ -96,11 +132,53 @@ int main(int argc, char *argv[]) {
 		TCLAP::SwitchArg isquiet("q", "quiet", "silent mode", false);
 		TCLAP::SwitchArg isoverwrite("o", "overwrite", "over write files", false);
 		TCLAP::SwitchArg islog("l", "log", "save log", false);
+		TCLAP::SwitchArg ismmap("m", "mmap", "memory-map input files (for local disks)", false);
+		TCLAP::SwitchArg iswatch("w", "watch", "keep running and convert EDF files as they arrive in the -d directory", false);
+		TCLAP::SwitchArg isrecursive("R", "recursive", "also convert the EDF files in subdirectories of the -d directory", false);
+		TCLAP::SwitchArg isstream("s", "stream", "read and convert in chunks to bound memory use (for long recordings)", false);
+		TCLAP::SwitchArg isquality("", "qc", "also write name.qc.csv with the signal quality of every epoch and channel: range, clipped samples, mean, standard deviation and 50/60 Hz mains amplitude", false);
+		TCLAP::SwitchArg isuploadonly("", "upload-only", "With --upload, do not keep the CFS files on disk", false);
+		TCLAP::SwitchArg isnuma("", "numa", "pin the workers to the NUMA nodes of the host and keep each file on one node (for multi-socket hosts)", false);
 		TCLAP::ValueArg<string> C3("a", "c3", "C3-A2 Channel Label", false, "NA", "C3-A2 Channel Label");
 		TCLAP::ValueArg<string> C4("b", "c4", "C4-A1 Channel Label", false, "NA", "C4-A1 Channel Label");
 		TCLAP::ValueArg<string> EL("x", "el", "EL-A2 Channel Label", false, "NA", "EL-A2 Channel Label");
 		TCLAP::ValueArg<string> ER("z", "er", "ER-A1 Channel Label", false, "NA", "ER-A1 Channel Label");
 		TCLAP::ValueArg<string> dir("d", "dir", "EDF Directory", false, "NA", "EDF Directory");
+		vector<string> precisions;
+		precisions.push_back("double");
+		precisions.push_back("float");
+		TCLAP::ValuesConstraint<string> allowedPrecisions(precisions);
+		TCLAP::ValueArg<string> precisionArg("p", "precision", "Sample type of the signal path (default: double)", false, "double", &allowedPrecisions);
+		TCLAP::ValueArg<string> codecArg("c", "codec", "Compression of the CFS payload: zlib[:1-9], libdeflate[:1-12], zstd[:1-22] or none (default: zlib). zstd files are CFS version 2", false, "zlib", "codec[:level]");
+		vector<string> payloads;
+		payloads.push_back("float");
+		payloads.push_back("float16");
+		payloads.push_back("q12");
+		payloads.push_back("q8");
+		TCLAP::ValuesConstraint<string> allowedPayloads(payloads);
+		TCLAP::ValueArg<string> payloadArg("", "payload", "Store log-magnitudes as half floats or 12 or 8 bit steps scaled per epoch, in CFS version 4 (default: float magnitudes)", false, "float", &allowedPayloads);
+		vector<string> syncs;
+		syncs.push_back("file");
+		syncs.push_back("batch");
+		syncs.push_back("none");
+		TCLAP::ValuesConstraint<string> allowedSyncs(syncs);
+		TCLAP::ValueArg<string> syncArg("", "sync", "When CFS files are synced to disk before they are renamed into place: each on its own, those finishing together in one batch, or never (default: file)", false, "file", &allowedSyncs);
+		TCLAP::ValueArg<int> blocks("", "block-epochs", "Write CFS version 3, compressed in parallel in blocks of this many epochs that can be read on their own, e.g. 64 (default: one stream)", false, 0, "epochs");
+		TCLAP::ValueArg<int> jobs("j", "jobs", "Number of files converted in parallel (default: number of cores)", false, 0, "Number of jobs");
+		TCLAP::ValueArg<int> maxMemory("", "max-memory", "Memory the conversions in flight may use together, in MiB (default: no limit)", false, 0, "MiB");
+		TCLAP::ValueArg<int> readAhead("r", "readahead", "Read upcoming files into the page cache, at most this many MiB ahead (default: off)", false, 0, "MiB");
+		TCLAP::ValueArg<string> profile("", "profile", "Time each phase of every file and save the report here, as CSV if it ends in .csv, JSON otherwise", false, "", "report file");
+		TCLAP::ValueArg<string> shardArg("", "shard", "Convert only shard i of N, all of the same size in recorded samples, for running one node of a cluster each, e.g. $SLURM_ARRAY_TASK_ID/20. Each shard keeps its own manifest and logs", false, "", "i/N");
+		TCLAP::ValueArg<string> startArg("", "start", "Convert only from this point of each recording on, in seconds, minutes (90m), hours (1.5h) or as an epoch index (180e), rounded down to a 30 s epoch. Only the datarecords needed are read", false, "", "time");
+		TCLAP::ValueArg<string> endArg("", "end", "Convert only up to this point of each recording, given like --start and rounded up to a 30 s epoch", false, "", "time");
+		TCLAP::ValueArg<int> followArg("", "follow", "Keep converting the given files while they are being recorded, reading what was appended every this many seconds and replacing the CFS as epochs complete. A file is done once it has not grown for 10 minutes, or on Ctrl-C", false, 0, "seconds");
+		TCLAP::ValueArg<int> timeoutArg("", "timeout", "Give up on a file still converting this many seconds after it started, e.g. 600. One stuck in a read that never returns (a hung network share) is reported as stuck 30 seconds later and its worker replaced, so the other files go on (default: no limit)", false, 0, "seconds");
+		TCLAP::ValueArg<int> reserveArg("", "reserve", "With --watch, keep this many workers free of the backlog of -d for files that arrive meanwhile, which go ahead of the backlog either way (default: 0)", false, 0, "workers");
+		TCLAP::ValueArg<string> uploadArg("", "upload", "Send each CFS to this HTTP(S) endpoint as <url>/<name>.cfs while it is being written, over a few persistent connections. Needs a build with UPLOAD=1", false, "", "url");
+		TCLAP::MultiArg<string> uploadHeaderArg("", "upload-header", "Header sent with every upload request, e.g. 'Authorization: Bearer ...' (repeatable)", false, "header");
+		TCLAP::ValueArg<string> manifestArg("", "manifest", "Record conversions here and skip inputs that have not changed since", false, "", "manifest file");
+		TCLAP::MultiArg<string> include("", "include", "Only convert files matching this glob, matched against the path below -d if it has a '/' and the name otherwise (repeatable)", false, "glob");
+		TCLAP::MultiArg<string> exclude("", "exclude", "Skip files and directories matching this glob, matched like --include (repeatable)", false, "glob");
 		TCLAP::UnlabeledMultiArg<string> files("filenames", "List of filename", false, "List of EDF files", false);
 
 		cmd.add(files);
@@ -109,14 +187,41 @@ int main(int argc, char *argv[]) {
 		cmd.add(EL);
 		cmd.add(ER);
 		cmd.add(dir);
+		cmd.add(jobs);
+		cmd.add(readAhead);
+		cmd.add(maxMemory);
+		cmd.add(profile);
+		cmd.add(manifestArg);
+		cmd.add(shardArg);
+		cmd.add(startArg);
+		cmd.add(endArg);
+		cmd.add(followArg);
+		cmd.add(timeoutArg);
+		cmd.add(reserveArg);
+		cmd.add(uploadArg);
+		cmd.add(uploadHeaderArg);
+		cmd.add(include);
+		cmd.add(exclude);
+		cmd.add(precisionArg);
+		cmd.add(codecArg);
+		cmd.add(blocks);
+		cmd.add(payloadArg);
+		cmd.add(syncArg);
 		cmd.add(isquiet);
 		cmd.add(isoverwrite);
 		cmd.add(islog);
+		cmd.add(ismmap);
+		cmd.add(isstream);
+		cmd.add(isrecursive);
+		cmd.add(iswatch);
+		cmd.add(isnuma);
+		cmd.add(isquality);
+		cmd.add(isuploadonly);
 
 		if (argc < 2) {
 			cout << "No EDF files provided\n";
 			cout << "./edf2cfs -h for usage details.\n";
-			std::system("read -n 1 -s -p \"Press any key to continue...\"");
+			pauseIfInteractive();
 			return(1);
 		}
 		
@@ -129,16 +234,124 @@ int main(int argc, char *argv[]) {
 		quiet = isquiet.getValue();
 		overwrite = isoverwrite.getValue();
 		saveLog = islog.getValue();
+		useMmap = ismmap.getValue();
+		streaming = isstream.getValue();
+		watch = iswatch.getValue();
+		pinNuma = isnuma.getValue();
+		quality = isquality.getValue();
+		if (precisionArg.getValue() == "float")
+			precision = PIPELINE_FLOAT;
+		parsePayloadFormat(payloadArg.getValue(), payload);
+		parseOutputSync(syncArg.getValue(), outputSync);
+		blockEpochs = blocks.getValue();
+		if (blockEpochs < 0 || blockEpochs > UINT16_MAX) {
+			cerr << "error: --block-epochs must be between 0 and " << UINT16_MAX << endl;
+			return(1);
+		}
+		string codecError;
+		if (!parseCodec(codecArg.getValue(), codec, codecError)) {
+			cerr << "error: " << codecError << " for arg --codec" << endl;
+			return(1);
+		}
 		filelist = files.getValue();
-		if(strcmp(dirName.c_str(),"NA") != 0){
-			fs::path dirPath{dirName};
-			getAllFiles(dirPath,".edf",filelist);
+		if(jobs.getValue() > 0)
+			jobCount = jobs.getValue();
+		if(readAhead.getValue() > 0)
+			readAheadMiB = readAhead.getValue();
+		if(maxMemory.getValue() > 0)
+			maxMemoryMiB = maxMemory.getValue();
+		profileFile = profile.getValue();
+		manifestFile = manifestArg.getValue();
+		string shardError;
+		if (!shardArg.getValue().empty() && !parseShard(shardArg.getValue(), shard, shardError)) {
+			cerr << "error: " << shardError << " for arg --shard" << endl;
+			return(1);
 		}
-
-		if(filelist.empty()){
+		if (shard.count > 0 && iswatch.getValue()) {
+			cerr << "error: --shard needs a fixed set of inputs and can not be used with --watch\n";
+			return(1);
+		}
+		string rangeError;
+		if (!startArg.getValue().empty() && !parseRangePoint(startArg.getValue(), false, firstEpoch, rangeError)) {
+			cerr << "error: " << rangeError << " for arg --start" << endl;
+			return(1);
+		}
+		if (!endArg.getValue().empty() && !parseRangePoint(endArg.getValue(), true, endEpoch, rangeError)) {
+			cerr << "error: " << rangeError << " for arg --end" << endl;
+			return(1);
+		}
+		if (endEpoch >= 0 && endEpoch <= firstEpoch) {
+			cerr << "error: --end must be at least one epoch after --start\n";
+			return(1);
+		}
+		followSeconds = followArg.getValue();
+		if (followSeconds < 0) {
+			cerr << "error: --follow must be a positive number of seconds\n";
+			return(1);
+		}
+		if (followSeconds > 0 && (watch || shard.count > 0 || dir.isSet() || startArg.isSet() || endArg.isSet())) {
+			cerr << "error: --follow converts the files given and can not be used with -d, --watch, --shard, --start or --end\n";
+			return(1);
+		}
+		if (followSeconds > 0 && (channelLabels[0] == "NA" || channelLabels[1] == "NA" || channelLabels[2] == "NA" || channelLabels[3] == "NA")) {
+			cerr << "error: --follow needs all four channel labels (-a, -b, -x and -z)\n";
+			return(1);
+		}
+		timeoutSeconds = timeoutArg.getValue();
+		if (timeoutSeconds < 0) {
+			cerr << "error: --timeout must be a positive number of seconds\n";
+			return(1);
+		}
+		if (timeoutSeconds > 0 && followSeconds > 0) {
+			cerr << "error: --follow converts for as long as a file is recorded and can not be used with --timeout\n";
+			return(1);
+		}
+		reservedWorkers = reserveArg.getValue();
+		if (reservedWorkers < 0 || (reservedWorkers > 0 && !watch)) {
+			cerr << "error: --reserve needs --watch and a positive number of workers\n";
+			return(1);
+		}
+		if (reservedWorkers > 0 && (unsigned)reservedWorkers >= jobCount) {
+			cerr << "error: --reserve must leave at least one of the " << jobCount << " workers for the backlog\n";
+			return(1);
+		}
+		uploadUrl = uploadArg.getValue();
+		uploadHeaders = uploadHeaderArg.getValue();
+		uploadOnly = isuploadonly.getValue();
+		if ((uploadOnly || !uploadHeaders.empty()) && uploadUrl.empty()) {
+			cerr << "error: --upload-only and --upload-header need --upload\n";
+			return(1);
+		}
+		if (!uploadUrl.empty() && !Uploader::available()) {
+			cerr << "error: this build can not upload, make it with UPLOAD=1\n";
+			return(1);
+		}
+		if (!uploadUrl.empty() && followSeconds > 0) {
+			cerr << "error: --follow replaces the CFS as it grows and can not be used with --upload\n";
+			return(1);
+		}
+		if (uploadOnly && !manifestFile.empty()) {
+			cerr << "error: --manifest records the CFS files on disk and can not be used with --upload-only\n";
+			return(1);
+		}
+		crawlOptions.recursive = isrecursive.getValue();
+		crawlOptions.include = include.getValue();
+		crawlOptions.exclude = exclude.getValue();
+
+		if(watch){
+			if(strcmp(dirName.c_str(),"NA") == 0){
+				cerr << "error: --watch needs a directory given with -d\n";
+				return(1);
+			}
+			if(channelLabels[0] == "NA" || channelLabels[1] == "NA" || channelLabels[2] == "NA" || channelLabels[3] == "NA"){
+				cerr << "error: --watch needs all four channel labels (-a, -b, -x and -z)\n";
+				return(1);
+			}
+		}
+		else if(filelist.empty() && strcmp(dirName.c_str(),"NA") == 0){
 			cout << "No EDF files found.\n";
 			cout << "./edf2cfs -h for usage details.\n";
-			std::system("read -n 1 -s -p \"Press any key to continue...\"");
+			pauseIfInteractive();
 			return(1);
 		}
 	}
@@ -147,10 +360,28 @@ int main(int argc, char *argv[]) {
 		return(1);
 	}
 
+	//Files under -d are converted while the crawl of the tree goes on
+	unique_ptr<DirectoryCrawler> crawler;
+	string firstFound;
+	if (strcmp(dirName.c_str(), "NA") != 0) {
+		crawler.reset(new DirectoryCrawler(dirName, crawlOptions));
+		if (!crawler->ok()) {
+			cerr << "error: can not read directory " << dirName << endl;
+			return(1);
+		}
+		//Waits for the first directory listing only, the file is converted with the rest
+		if (filelist.empty() && !watch && !crawler->next(firstFound)) {
+			cout << "No EDF files found.\n";
+			cout << "./edf2cfs -h for usage details.\n";
+			pauseIfInteractive();
+			return(1);
+		}
+	}
+
 	//Check if channel numbers are provided
 	if (strcmp(channelLabels[0].c_str(),"NA") == 0 || strcmp(channelLabels[1].c_str(), "NA") == 0  || strcmp(channelLabels[2].c_str(), "NA") == 0  || strcmp(channelLabels[3].c_str(), "NA") == 0 ) {
 		//Channels not provided 
-		showHeader(filelist[0].c_str(), channelLabels);
+		showHeader(filelist.empty() ? firstFound.c_str() : filelist[0].c_str(), channelLabels);
 	}
 
 	//if logging is on
@@ -160,92 +391,348 @@ int main(int argc, char *argv[]) {
 		std::ostringstream os;
 		os.imbue(fmt);
 		os << tnow;
-		fs::path filePath{filelist[0]};
-		fs::path fullPath = fs::complete(filePath);
-		fs::path basePath = fullPath.parent_path();
-		logFile = basePath.string() + "/" + os.str() + "_log.html";
-		cout<<"Log will be saved at:\n" << logFile << endl;
-		try{
-			lfile.open(logFile,ios::out);
+		fs::path basePath;
+		if (crawler)
+			basePath = fs::complete(fs::path{dirName});
+		else
+			basePath = fs::complete(fs::path{filelist[0]}).parent_path();
+		//Nodes of a sharded run log next to each other, each under its own name
+		string logName = basePath.string() + "/" + os.str() + (shard.count > 0 ? "_" + shardName(shard) : "");
+		logFile = logName + "_log.html";
+		jsonLogFile = logName + "_log.jsonl";
+		cout<<"Log will be saved at:\n" << logFile << "\n" << jsonLogFile << endl;
+
+		htmlHeader << "<!doctype html>\n<html lang='en'>\n<head>\n" 
+		"<meta charset='utf-8'>\n\n  <title>EDF to CFS Log</title>\n"  
+		"<meta name='description' content='Conversion Log'>\n" 
+		"<meta name='author' content='Amiya Patanaik'>\n\n  </head>\n\n<body>\n";
+
+		htmlHeader << "<p>Logging Started at: " << os.str() << BR <<endl;
+		htmlHeader << "C3-A2 Channel Label: " << channelLabels[0] << BR <<endl;
+		htmlHeader << "C4-A1 Channel Label: " << channelLabels[1] << BR <<endl;
+		htmlHeader << "EL-A2 Channel Label: " << channelLabels[2] << BR <<endl;
+		htmlHeader << "ER-A1 Channel Label: " << channelLabels[3] << BR <<endl;
+		htmlHeader << "</p><hr>" <<endl; 
+	}
+
+	//Every node of a sharded run lists all inputs, the crawl included, and keeps its own share
+	if (shard.count > 0) {
+		if (crawler) {
+			string found;
+			if (!firstFound.empty())
+				filelist.push_back(firstFound);
+			firstFound.clear();
+			while (crawler->next(found))
+				filelist.push_back(found);
 		}
-		catch (ifstream::failure e) {
-			saveLog = false;
-			lfile.close();
+		size_t total = filelist.size();
+		filelist = shardFiles(filelist, shard, jobCount);
+		cout << "Shard " << shard.index << " of " << shard.count << ": " << filelist.size() << " of " << total << " files\n";
+	}
+
+	//Console lines, progress and log files are all written by the sink's own thread
+	LogSinkOptions logOptions;
+	if (saveLog) {
+		logOptions.htmlPath = logFile;
+		logOptions.jsonPath = jsonLogFile;
+		logOptions.htmlHeader = htmlHeader.str();
+	}
+	logOptions.quiet = quiet;
+	logOptions.progress = isatty(STDOUT_FILENO) != 0;
+	logOptions.expected = (crawler && shard.count == 0) ? 0 : filelist.size();
+	LogSink logSink(logOptions);
+	if (!logSink.ok())
+		cerr << "error: can not create the log files, conversion results are only shown here\n";
+
+	Converter::Options options;
+	options.channelLabels = channelLabels;
+	options.useMmap = useMmap;
+	options.streaming = streaming;
+	options.precision = precision;
+	options.codec = codec;
+	options.payload = payload;
+	options.blockEpochs = (unsigned)blockEpochs;
+	options.firstEpoch = firstEpoch;
+	options.endEpoch = endEpoch;
+	options.quality = quality;
+
+	unique_ptr<MemoryBudget> memoryBudget;
+	if (maxMemoryMiB > 0)
+		memoryBudget.reset(new MemoryBudget(maxMemoryMiB << 20));
+	options.memoryBudget = memoryBudget.get();
+	options.profile = !profileFile.empty();
+
+	//CFS files are written by a thread of their own, so workers do not wait on the disk
+	OutputWriter output(outputSync);
+	options.output = &output;
+
+	//Each CFS goes to the service while it is written, with the buffers not yet accepted held for retries
+	unique_ptr<Uploader> uploader;
+	if (!uploadUrl.empty()) {
+		uploader.reset(new Uploader(uploadUrl, uploadHeaders));
+		if (!uploader->ok()) {
+			cerr << "error: " << uploader->error() << endl;
+			return(1);
 		}
-
-
-
-		if(saveLog) {
-			lfile << "<!doctype html>\n<html lang='en'>\n<head>\n" 
-			"<meta charset='utf-8'>\n\n  <title>EDF to CFS Log</title>\n"  
-			"<meta name='description' content='Conversion Log'>\n" 
-			"<meta name='author' content='Amiya Patanaik'>\n\n  </head>\n\n<body>\n";
-
-			lfile << "<p>Logging Started at: " << os.str() << BR <<endl;
-			lfile << "C3-A2 Channel Label: " << channelLabels[0] << BR <<endl;
-			lfile << "C4-A1 Channel Label: " << channelLabels[1] << BR <<endl;
-			lfile << "EL-A2 Channel Label: " << channelLabels[2] << BR <<endl;
-			lfile << "ER-A1 Channel Label: " << channelLabels[3] << BR <<endl;
-			lfile << "</p><hr>" <<endl; 
+		options.upload = uploader.get();
+		options.local = !uploadOnly;
+	}
+
+	//Persistent workers pull files from a shared queue, results arrive in completion order.
+	//Workers left idle once fewer files than workers remain help with the ones still running
+	vector<NumaNode> numa;
+	if (pinNuma) {
+		numa = numaNodes();
+		if (numa.size() < 2) {
+			cerr << "warning: --numa found " << (numa.empty() ? "no" : "a single") << " NUMA node, the workers are not pinned\n";
+			numa.clear();
+		}
+	}
+	ThreadPool pool(jobCount, numa);
+	if (pool.size() > 1)
+		options.pool = &pool;
+	Converter converter(options);
+	ProfileReport profileReport;
+
+	unique_ptr<Manifest> manifest;
+	string settings = manifestSettings(options);
+	if (!manifestFile.empty()) {
+		//A shard records its own conversions apart and looks up earlier ones in the shared manifest
+		if (shard.count > 0) {
+			string shared = manifestFile;
+			manifestFile += "." + shardName(shard);
+			manifest.reset(new Manifest(manifestFile));
+			manifest->inherit(shared);
+		}
+		else
+			manifest.reset(new Manifest(manifestFile));
+		if (!manifest->open()) {
+			cerr << "error: can not open manifest " << manifestFile << endl;
+			return(1);
 		}
-
 	}
 
 	//Start conversion 
-	vec successCounter = zeros<vec>(filelist.size());
-	printf("Processing upto %d files simultanously...\n", concurentThreadsSupported);
+	int successCounter = 0;
+	size_t processedCounter = 0;
+	printf("Processing upto %d files simultanously...\n", jobCount);
+	if (pool.nodes() > 0)
+		printf("Workers pinned to %u NUMA nodes.\n", pool.nodes());
 	std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
 
-	for (int i = 0; i < (int)filelist.size(); i += concurentThreadsSupported) {
-
-		vector<future<bool>> workers;
-		vector<ostringstream> streamMsg(concurentThreadsSupported);
+	//Plan the FFT once before any worker needs it
+	SpectralEngine::initialize();
+
+	unique_ptr<ReadAhead> readAhead;
+	if (readAheadMiB > 0 && !watch)
+		readAhead.reset(new ReadAhead((unsigned long long)readAheadMiB << 20));
+	FileScheduler scheduler(pool, readAhead.get(), memoryBudget.get(), timeoutSeconds);
+	scheduler.reserveWorkers((unsigned)reservedWorkers);
+
+	//Watching starts before the backlog, so nothing arriving meanwhile is missed
+	unique_ptr<DirectoryWatcher> watcher;
+	if (watch) {
+		watcher.reset(new DirectoryWatcher(dirName, ".edf"));
+		if (!watcher->ok()) {
+			cerr << "error: can not watch " << dirName << endl;
+			return(1);
+		}
+	}
+	if (watch || followSeconds > 0) {
+		signal(SIGINT, stopWatching);
+		signal(SIGTERM, stopWatching);
+	}
+
+	//Headers are checked before a file is converted, those of the given files all at once and
+	//those found by -d or arriving under -w as they come; failures found there are reported
+	//without opening the file again
+	map<string, ConvertResult> rejected;
+	mutex rejectedMutex;
+	PrescanFunction prescan = [&](const string& filename) {
+		FilePlan plan;
+		if (skippedFile(filename, overwrite, manifest.get(), settings))
+			return plan;
+		ConvertResult result = converter.prescan(filename);
+		plan.cost = result.inputBytes;
+		plan.footprint = result.footprint;
+		if (!result.ok()) {
+			plan.convertible = false;
+			lock_guard<mutex> lock(rejectedMutex);
+			rejected[filename] = result;
+		}
+		return plan;
+	};
+
+	//A rejection is used once, a file of the same name arriving later in watch mode is new
+	ConvertFunction convert = [&](const string& filename, ostringstream& streamMsg) {
+		ConvertResult prescanned;
+		bool wasRejected = false;
+		{
+			lock_guard<mutex> lock(rejectedMutex);
+			map<string, ConvertResult>::iterator it = rejected.find(filename);
+			if (it != rejected.end()) {
+				prescanned = it->second;
+				wasRejected = true;
+				rejected.erase(it);
+			}
+		}
+		return convertFile(filename.c_str(), &converter, wasRejected ? &prescanned : NULL, overwrite, manifest.get(), settings, options.profile ? &profileReport : NULL, &logSink, &streamMsg);
+	};
+	//A stuck file never got as far as logging itself, the scheduler reports it instead
+	ResultFunction report = [&](const FileResult& result) {
+		processedCounter++;
+		if (result.success)
+			successCounter++;
+		if (result.stuck) {
+			LogEntry entry;
+			entry.filename = result.filename;
+			entry.cfsFilename = removeExtension(result.filename) + ".cfs";
+			entry.code = "stuck";
+			entry.message = "Abandoned as stuck, it did not stop after --timeout.";
+			entry.html = result.log;
+			logSink.post(entry);
+		}
+	};
 
-		workers.reserve(concurentThreadsSupported);
+	if (followSeconds > 0)
+		followFiles(filelist, converter, (unsigned)followSeconds, overwrite, manifest.get(), settings, quiet, &logSink, processedCounter, successCounter);
+	else
+		scheduler.run(filelist, convert, report, prescan);
+
+	//Plans, filter designs and workers stay warm for every file that arrives. Files arriving
+	//while the backlog is converted are urgent, they go ahead of it
+	FileSource arrivals;
+	if (watch) {
+		if (!quiet)
+			cout << "Watching " << dirName << " for new EDF files, Ctrl-C to stop\n";
+		arrivals = [&watcher](string& filename) { return watcher->next(filename); };
+	}
+
+	if (crawler) {
+		//In watch mode the files already there are the backlog, except those converted before;
+		//with a manifest it decides per file, so changed ones are converted again
+		bool skipConverted = watch && !overwrite && !manifest;
+		scheduler.watch([&crawler, &firstFound, skipConverted](string& filename) {
+			if (!firstFound.empty()) {
+				filename.swap(firstFound);
+				return true;
+			}
+			while (crawler->next(filename))
+				if (!skipConverted || !fs::exists(removeExtension(filename) + ".cfs"))
+					return true;
+			return false;
+		}, convert, report, arrivals, prescan);
+	}
+	else if (watch)
+		scheduler.watch(arrivals, convert, report, FileSource(), prescan);
 
-		for (int j = 0; j< concurentThreadsSupported; j++) {
+	std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+	auto intms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
+	int intSecs = (int)(intms.count()/1000);
 
-			if (i + j >= (int)filelist.size())
-				break;
+	ostringstream htmlFooter;
+	htmlFooter << processedCounter << " Files processed in " << intSecs<< " seconds." << BR <<endl;
+	htmlFooter << successCounter << " Files converted successfully. " << (processedCounter- successCounter) << " Files could not be converted.<br />";
+	logSink.close(htmlFooter.str());
 
-			workers.push_back(async(convertFile, filelist[i+j].c_str(), &channelLabels, overwrite, &streamMsg[j]));
+	printf("%lu Files processed in %d seconds.\n%d Files converted successfully. %lu Files could not be converted.\n", processedCounter,intSecs,successCounter, processedCounter- successCounter);
 
-		}
+	if (manifest && (!manifest->save() || !manifest->ok()))
+		cerr << "error: can not write manifest " << manifestFile << ", the next run may convert some files again" << endl;
 
-		//Now wait
-		for (int j = 0; j < workers.size(); j++) {
-			successCounter(i + j) = workers[j].get();
-			if (successCounter(i + j) == 0) //If failed always print output
-				//cout << streamMsg[j].str();
-				if(!saveLog){
-					cout << "ERROR: Filename: " << filelist[i+j].c_str() << ", please enable logging to see details.\n";
-				}
-				else {
-					cout << "ERROR: Filename: " << filelist[i+j].c_str() << ", please check log.\n";
-				}
-				
-			else if (!quiet)
-				//cout << streamMsg[j].str();
-				cout << "Filename: " << filelist[i+j].c_str() << ", processed successfully\n";
+	if (!profileFile.empty()) {
+		if (profileReport.save(profileFile))
+			cout << "Profile saved at:\n" << profileFile << endl;
+		else
+			cerr << "error: can not write profile " << profileFile << endl;
+	}
 
-			if(saveLog){
-				lfile << streamMsg[j].str();
-			}
-		}
+	//Workers of stuck files may still be blocked inside the converter, pool and scheduler,
+	//which can not be torn down under them
+	if (scheduler.abandoned() > 0) {
+		cout << scheduler.abandoned() << " Files were abandoned as stuck." << endl;
+		pauseIfInteractive();
+		fflush(stdout);
+		_exit(0);
 	}
+	pauseIfInteractive();
+}
 
-	std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
-	auto intms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-	int intSecs = (int)(intms.count()/1000);
+//Keeps a console window open when started from a file browser, never blocks scripts or services
+void pauseIfInteractive() {
+	if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+		std::system("read -n 1 -s -p \"Press any key to continue...\"");
+}
 
-	printf("%lu Files processed in %d seconds.\n%d Files converted successfully. %lu Files could not be converted.\n", filelist.size(),intSecs,(int)accu(successCounter), filelist.size()- (int)accu(successCounter));
+//SIGINT and SIGTERM end --watch once the files already started are done, and --follow
+//once what was recorded so far is converted
+void stopWatching(int) {
+	stopRequested = 1;
+	DirectoryWatcher::requestStop();
+}
 
-	if(saveLog){
-		lfile << filelist.size() << " Files processed in " << intSecs<< " seconds." << BR <<endl;
-		lfile << (int)accu(successCounter) << " Files converted successfully. " << (filelist.size()- (int)accu(successCounter)) << " Files could not be converted.<br />";
-		lfile.close();
+//--follow: every file is polled on the main thread, so a conversion only ever runs for the
+//datarecords appended meanwhile; the CFS of each is there and readable the whole time
+void followFiles(const vector<string>& filelist, const Converter& converter, unsigned pollSeconds, bool overwrite, Manifest* manifest, const string& settings, bool quiet, LogSink* logSink, size_t& processedCounter, int& successCounter) {
+	struct Followed {
+		string filename;
+		unique_ptr<FollowConversion> conversion;
+		std::chrono::steady_clock::time_point grown;
+		int epochs;
+	};
+	vector<Followed> followed;
+	for (size_t i = 0; i < filelist.size(); i++) {
+		//Reported as convertFile() does, a file that was already converted is not followed
+		if (skippedFile(filelist[i], overwrite, manifest, settings)) {
+			ostringstream streamMsg;
+			processedCounter++;
+			if (convertFile(filelist[i].c_str(), &converter, NULL, false, manifest, settings, NULL, logSink, &streamMsg))
+				successCounter++;
+			continue;
+		}
+		Followed file;
+		file.filename = filelist[i];
+		file.conversion.reset(new FollowConversion(converter, filelist[i], removeExtension(filelist[i]) + ".cfs"));
+		file.grown = std::chrono::steady_clock::now();
+		file.epochs = 0;
+		followed.push_back(std::move(file));
+	}
+	if (!quiet && !followed.empty())
+		cout << "Following " << followed.size() << " recordings, Ctrl-C to stop\n";
+
+	while (!followed.empty()) {
+		for (size_t i = 0; i < followed.size();) {
+			Followed& file = followed[i];
+			long long records = file.conversion->datarecords();
+			ConvertResult result = file.conversion->update();
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (file.conversion->datarecords() != records)
+				file.grown = now;
+			if (result.ok() && result.epochs != file.epochs && !quiet)
+				cout << file.filename << ": " << result.epochs << " epochs\n";
+			file.epochs = result.epochs;
+
+			//Until the recorder has written a complete header, the file is waited for
+			bool waiting = file.conversion->datarecords() == 0 && (result.status == CONVERT_NO_SUCH_FILE
+				|| result.status == CONVERT_FORMAT_ERROR || result.status == CONVERT_OPEN_ERROR || result.status == CONVERT_READ_ERROR);
+			bool idle = now - file.grown >= std::chrono::seconds(FOLLOW_IDLESECONDS);
+			if ((result.ok() || waiting) && !idle && !stopRequested) {
+				i++;
+				continue;
+			}
+
+			//Flushes the filters, written and logged as a file converted in one go
+			if (result.ok())
+				result = file.conversion->update(true);
+			ostringstream streamMsg;
+			processedCounter++;
+			if (convertFile(file.filename.c_str(), &converter, &result, true, manifest, settings, NULL, logSink, &streamMsg))
+				successCounter++;
+			followed.erase(followed.begin() + i);
+		}
+		for (unsigned waited = 0; !followed.empty() && !stopRequested && waited < pollSeconds * 10; waited++)
+			this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
-	std::system("read -n 1 -s -p \"Press any key to continue...\"");
 }
 
 void showHeader(const char* filename, vector<string>& channelLabels) {
@@ -253,7 +740,7 @@ void showHeader(const char* filename, vector<string>& channelLabels) {
 	struct edf_hdr_struct hdr;
 	int nC3, nC4, nEL, nER;
 
-	if (edfopen_file_readonly(filename, &hdr, EDFLIB_READ_ALL_ANNOTATIONS)) {
+	if (edfopen_file_readonly(filename, &hdr, EDFLIB_DO_NOT_READ_ANNOTATIONS)) {
 		switch (hdr.filetype) {
 		case EDFLIB_MALLOC_ERROR: printf("\nMemory Error.\n\n");
 			break;
@@ -314,413 +801,106 @@ void showHeader(const char* filename, vector<string>& channelLabels) {
 
 }
 
-bool convertFile(const char* filename, vector<string>* channelLabelsPtr, bool overwrite, ostringstream* streamMsgPointer) {
+bool convertFile(const char* filename, const Converter* converter, const ConvertResult* prescanned, bool overwrite, Manifest* manifest, const string& settings, ProfileReport* profileReport, LogSink* logSink, ostringstream* streamMsgPointer) {
 
 	ostringstream &streamMsg = *(streamMsgPointer);
-	vector<string> &channelLabels = *(channelLabelsPtr);
 	streamMsg << "<p>Filename: " << filename << BR <<endl;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
 	//filename for CFS file.
 	string baseName = removeExtension(string(filename)) + ".cfs";
 
-	if (!overwrite) {
-		if (fs::exists(baseName)) {
-
-			streamMsg << "<strong style='color:red;'>ERROR: File already converted.</strong><br /></p>\n";
-			return false;
-		}
-	}
-	struct edf_hdr_struct hdr;
-	double fC3, fC4, fEL, fER;
-	int nC3, nC4, nEL, nER;
-	long long samplesRead;
-
-	vector<string> allLabels;
-
-	if (edfopen_file_readonly(filename, &hdr, EDFLIB_READ_ALL_ANNOTATIONS)) {
-
-		switch (hdr.filetype) {
-		case EDFLIB_MALLOC_ERROR: streamMsg << "<strong style='color:red;'>ERROR: Memory Error.</strong><br />\n\n</p>";
-			break;
-		case EDFLIB_NO_SUCH_FILE_OR_DIRECTORY: streamMsg << "<strong style='color:red;'>ERROR: Can not open file, no such file or directory</strong><br />\n\n</p>";
-			break;
-		case EDFLIB_FILE_CONTAINS_FORMAT_ERRORS: streamMsg << "<strong style='color:red;'>ERROR: The file is not EDF(+) or BDF(+) "
-		"compliant (it contains format errors)</strong><br />\n\n</p>";
-			break;
-		case EDFLIB_MAXFILES_REACHED: streamMsg << "<strong style='color:red;'>ERROR: Too many files opened</strong><br />\n\n</p>";
-			break;
-		case EDFLIB_FILE_READ_ERROR: streamMsg << "<strong style='color:red;'>ERROR: A read error occurred</strong><br />\n\n</p>";
-			break;
-		case EDFLIB_FILE_ALREADY_OPENED: streamMsg << "<strong style='color:red;'>ERROR: File has already been opened</strong><br />\n\n</p>";
-			break;
-		default: streamMsg << "<strong style='color:red;'>ERROR: Unknown error</strong><br />\n\n</p>";
-			break;
-		}
-
-		return false;
-	}
-
-	int Nmax = hdr.edfsignals;
-	int hdl = hdr.handle;
-
-	for (int i = 0; i<hdr.edfsignals; i++) {
-		allLabels.push_back(strlwr(hdr.signalparam[i].label));
-	}
-
-	vector<string>::iterator it;
-
-	//C3 channel
-	it = find(allLabels.begin(), allLabels.end(), channelLabels[0]);
-	if (it != allLabels.end()) {
-		nC3 = distance(allLabels.begin(), it);
-	}
-	else {
-
-		streamMsg << "<strong style='color:red;'>Error: C3 label not found!</strong><br />\n</p>" << endl;
-		edfclose_file(hdl);
-		return false;
-	}
-
-	//C4 channel
-	it = find(allLabels.begin(), allLabels.end(), channelLabels[1]);
-	if (it != allLabels.end()) {
-		nC4 = distance(allLabels.begin(), it);
-	}
-	else {
-
-		streamMsg << "<strong style='color:red;'>Error: C4 label not found!</strong><br />\n</p>" << endl;
-		edfclose_file(hdl);
-		return false;
-	}
-
-	//EL channel
-	it = find(allLabels.begin(), allLabels.end(), channelLabels[2]);
-	if (it != allLabels.end()) {
-		nEL = distance(allLabels.begin(), it);
-	}
-	else {
-
-		streamMsg << "<strong style='color:red;'>Error: EL label not found!</strong><br />\n</p>" << endl;
-		edfclose_file(hdl);
-		return false;
-	}
-
-	//ER channel
-	it = find(allLabels.begin(), allLabels.end(), channelLabels[3]);
-	if (it != allLabels.end()) {
-		nER = distance(allLabels.begin(), it);
-	}
-	else {
-
-		streamMsg << "<strong style='color:red;'>Error: ER label not found!</strong><br />\n</p>" << endl;
-		edfclose_file(hdl);
-		return false;
-	}
-
-	//Read sampling rates 
-	fC3 = ((double)hdr.signalparam[nC3].smp_in_datarecord / (double)hdr.datarecord_duration) * EDFLIB_TIME_DIMENSION;
-	fC4 = ((double)hdr.signalparam[nC4].smp_in_datarecord / (double)hdr.datarecord_duration) * EDFLIB_TIME_DIMENSION;
-	fEL = ((double)hdr.signalparam[nEL].smp_in_datarecord / (double)hdr.datarecord_duration) * EDFLIB_TIME_DIMENSION;
-	fER = ((double)hdr.signalparam[nER].smp_in_datarecord / (double)hdr.datarecord_duration) * EDFLIB_TIME_DIMENSION;
-
-	//Read measurement units
-	string fC3unit = hdr.signalparam[nC3].physdimension;
-	string fC4unit = hdr.signalparam[nC4].physdimension;
-	string fELunit = hdr.signalparam[nEL].physdimension;
-	string fERunit = hdr.signalparam[nER].physdimension;
-
-	//Ensure units are in uV
-	double fC3mult = findMultiplier(fC3unit);
-	double fC4mult = findMultiplier(fC4unit);
-	double fELmult = findMultiplier(fELunit);
-	double fERmult = findMultiplier(fERunit);
+	LogEntry entry;
+	entry.filename = filename;
+	entry.cfsFilename = baseName;
 
-	if (fC3mult < 0 || fC4mult < 0 || fELmult < 0 || fERmult < 0) {
-
-		streamMsg << "<strong style='color:red;'>ERROR: Invalid measurement unit. (must be nV, uV, mV or V)</strong><br />\n</p>" << endl;
-		edfclose_file(hdl);
-		return false;
-	}
-
-
-	if ((int)fC3 != (int)fC4) {
-
-		streamMsg << "<strong style='color:red;'>Error: C3 and C4 sampling rates must be same.</strong><br />\n</p>" << endl;
-		edfclose_file(hdl);
-		return false;
-	}
-
-	long long totSamples = hdr.signalparam[nC3].smp_in_file;
-
-
-	vector<double> bufC3(totSamples);
-	vector<double> bufC4(totSamples);
-	vector<double> bufEL(totSamples);
-	vector<double> bufER(totSamples);
-
-	streamMsg << "Total Samples found: " << totSamples << BR << endl;
-	streamMsg << "C3:A2 channel, sampling rate: " << fC3 << "Hz measured in " << fC3unit << BR << endl;
-
-
-	edfrewind(hdl, nC3);
-	samplesRead = edfread_physical_samples(hdl, nC3, totSamples, &bufC3[0]);
-
-	if (samplesRead == (-1)) {
-
-		streamMsg << "\n<strong style='color:red;'>ERROR: reading channel C3 data.</strong><br />\n</p>\n";
-		edfclose_file(hdl);
-		return false;
-	}
-
-	streamMsg << "C4:A1 channel, sampling rate: " << fC4 << "Hz measured in " << fC4unit << BR << endl;
-
-	edfrewind(hdl, nC4);
-	samplesRead = edfread_physical_samples(hdl, nC4, totSamples, &bufC4[0]);
-
-	if (samplesRead == (-1)) {
-
-		streamMsg << "\n<strong style='color:red;'>ERROR: reading channel C4 data.</strong><br />\n</p>\n";
-		edfclose_file(hdl);
-		return false;
-	}
-
-	streamMsg << "EOGl:A2 channel, sampling rate: " << fEL << "Hz measured in " << fELunit << BR << endl;
-
-	edfrewind(hdl, nEL);
-	samplesRead = edfread_physical_samples(hdl, nEL, totSamples, &bufEL[0]);
-
-	if (samplesRead == (-1)) {
-		streamMsg << "\n<strong style='color:red;'>ERROR: reading channel EOG-l  data.</strong><br />\n</p>\n";
-		edfclose_file(hdl);
-		return false;
-	}
-
-
-	streamMsg << "EOGr:A1 channel, sampling rate: " << fER << "Hz measured in " << fERunit << BR << endl;
-
-	edfrewind(hdl, nER);
-	samplesRead = edfread_physical_samples(hdl, nER, totSamples, &bufER[0]);
-
-	if (samplesRead == (-1)) {
-
-		streamMsg << "\n<strong style='color:red;'>ERROR: reading channel EOG-R data.</strong><br />\n</p>\n";
-		edfclose_file(hdl);
-		return false;
-	}
-
-
-	edfclose_file(hdl);
-
-	//Convert to Armadillo vectors
-	//This is in-place conversion to avoid copy
-	//Please remember!!
-	vec dataC3(&bufC3[0], totSamples, false, true);
-	vec dataC4(&bufC4[0], totSamples, false, true);
-	vec dataEL(&bufEL[0], totSamples, false, true);
-	vec dataER(&bufER[0], totSamples, false, true);
-
-	if(DEBUG){
-		dataC3.save("C3_Orig.csv", arma_ascii);
-	}
-
-
-	//Initialize Order 50 FIR bandpass filter weights
-	vec filterEEG = firBandPass(FILTERORDER, 0.3 * 2 / fC3, 45 * 2 / fC3);
-	vec filterEOGL = firBandPass(FILTERORDER, 0.3 * 2 / fEL, 12 * 2 / fEL);
-	vec filterEOGR;
-
-	if (fER == fEL)
-		filterEOGR = firBandPass(FILTERORDER, 0.3 * 2 / fER, 12 * 2 / fER);
-	else
-		filterEOGR = filterEOGL;
-
-	//mean computation and FIR filtering
-	//vec eeg = conv((dataC3*fC3mult + dataC4*fC4mult) / 2.0, filterEEG, "same");
-	vec eeg = (conv(dataC3*fC3mult, filterEEG, "same") + conv(dataC4*fC4mult, filterEEG, "same"))/2.0;
-	vec eogl = conv(dataEL*fELmult, filterEOGL, "same");
-	vec eogr = conv(dataER*fERmult, filterEOGR, "same");
-
-	if(DEBUG){
-		filterEEG.save("EEGb.csv", arma_ascii);
-		eeg.save("eegFiltered.csv", arma_ascii);
-	}
-
-
-	vec eegFilt;
-	vec eoglFilt;
-	vec eogrFilt;
-
-	//downsampling eeg signal to 100Hz
-	if ((int)fC3 != SAMPLINGRATE) {
-		vector<double> input = arma::conv_to< vector<double> >::from(eeg);
-		vector<double> output;
-		resample(SAMPLINGRATE,fC3,input,output);
-		eegFilt = arma::conv_to<vec>::from(output);
-	}
-	else {
-		eegFilt = eeg;
+	//Stamped before converting, so a change made meanwhile is seen by the next run
+	ManifestEntry record;
+	record.input = filename;
+	record.settings = settings;
+	record.output = baseName;
+	ManifestState state = MANIFEST_UNKNOWN;
+	if (manifest) {
+		state = manifest->check(filename, settings, baseName);
+		fileStamp(filename, record.size, record.mtime);
 	}
 
-	//downsampling eog signals to 100Hz
-	if ((int)fEL != SAMPLINGRATE) {
-		vector<double> input = arma::conv_to< vector<double> >::from(eogl);
-		vector<double> output;
-		resample(SAMPLINGRATE,fEL,input,output);
-		eoglFilt = arma::conv_to<vec>::from(output);
+	if (!overwrite && state == MANIFEST_CURRENT) {
+		entry.success = true;
+		entry.code = "up_to_date";
+		streamMsg << "Unchanged since it was last converted." << BR << "</p>\n";
 	}
-	else {
-		eoglFilt = eogl;
-	}
-
-	if ((int)fER != SAMPLINGRATE) {
-		vector<double> input = arma::conv_to< vector<double> >::from(eogr);
-		vector<double> output;
-		resample(SAMPLINGRATE,fER,input,output);
-		eogrFilt = arma::conv_to<vec>::from(output);
+	else if (!overwrite && state == MANIFEST_UNKNOWN && fs::exists(baseName)) {
+		entry.code = "already_converted";
+		entry.message = "File already converted.";
+		streamMsg << "<strong style='color:red;'>ERROR: File already converted.</strong><br /></p>\n";
 	}
 	else {
-		eogrFilt = eogr;
-	}
-
-	if(DEBUG){
-		eegFilt.save("EEGresampled.csv", arma_ascii);
-		eoglFilt.save("EOGlresampled.csv", arma_ascii);
-		eogrFilt.save("EOGrresampled.csv", arma_ascii);
-	}
-
-
-	//compute spectrogram
-	int epochs = (int)(((double)eegFilt.n_elem) / 3000);
-
-	static int epochSize = 32 * 32 * 3;
-	vec payload(epochs*epochSize, fill::zeros);
-
-	vec hamWindow = sp::hamming(128);
-
-	for (int i = 0; i<epochs; ++i) {
-		for (int j = 0; j<3000 - 128; j += 90) {
-
-			//Time index
-			int tIDX = (int)j / 90;
-
-			vec eegEpochData = eegFilt.subvec(i * 3000 + j, i * 3000 + j + 128 - 1)%hamWindow;
-			vec eegFFTResult = abs(fftObject.fft(eegEpochData));
-
-			vec eoglEpochData = eoglFilt.subvec(i * 3000 + j, i * 3000 + j + 128 - 1)%hamWindow;
-			vec eoglFFTResult = abs(fftObject.fft(eoglEpochData));
-
-			vec eogrEpochData = eogrFilt.subvec(i * 3000 + j, i * 3000 + j + 128 - 1)%hamWindow;
-			vec eogrFFTResult = abs(fftObject.fft(eogrEpochData));
-
-			payload.subvec(i*epochSize + tIDX * 32, i*epochSize + tIDX * 32 + 32 - 1) = eegFFTResult.subvec(0, 32 - 1);
-			payload.subvec(i*epochSize + 32 * 32 + tIDX * 32, i*epochSize + 32 * 32 + tIDX * 32 + 32 - 1) = eoglFFTResult.subvec(0, 32 - 1);
-			payload.subvec(i*epochSize + 32 * 32 * 2 + tIDX * 32, i*epochSize + 32 * 32 * 2 + tIDX * 32 + 32 - 1) = eogrFFTResult.subvec(0, 32 - 1);
-
-
+		try {
+			entry.result = prescanned ? *prescanned : converter->convertFile(filename, baseName);
+			entry.converted = true;
+		}
+		catch (exception& e) {
+			entry.code = "exception";
+			entry.message = e.what();
 		}
-	}
-
-	if(DEBUG){
-		payload.save("payload.csv", arma_ascii);
-	}
-
-
-	//Convert Double to Float (IEEE-754) to save space
-	vector<float> fPayload = conv_to< vector<float> >::from(payload);
-
-	//Convert float stream to binary stream
-	unsigned long sourceLen = (fPayload.size())*sizeof(float);
-	Bytef* istream = reinterpret_cast<Bytef*>(&fPayload[0]);
-
-	//HEADER
-	char signature[] = { 'C','F','S' };
-	uint8_t version = 1;
-	uint8_t nFreq = 32;
-	uint8_t nTimes = 32;
-	//next 16 bits
-	uint8_t nChannels = 3;
-	uint16_t nEpochs = epochs;
-	uint8_t compression = true;
-	uint8_t hash = true;
-
-
-	//Find SHA1 hash of stream
-	CSHA1 sha1;
-	sha1.Update(istream, sourceLen);
-	sha1.Final();
-	Bytef* SHAdigest = new Bytef[20];
-	if (!sha1.GetHash(SHAdigest)) {
-
-		streamMsg << "<strong style='color:red;'>ERROR: Problem in conversion! SHA1 Failed...</strong><br />\n</p>\n";
-		return false;
-	}
-
-	unsigned long destLen = compressBound(sourceLen);
-
-	Bytef* ostream = new Bytef[destLen];
 
-	int res = compress(ostream, &destLen, istream, sourceLen);
+		//Once the scheduler has reported the file as stuck, nothing more is recorded of it
+		CancelToken* token = currentCancelToken();
+		if (token && !token->complete())
+			return false;
 
-	if (res == Z_BUF_ERROR) {
+		const ConvertResult& result = entry.result;
+		if (entry.converted) {
+			entry.success = result.ok();
+			entry.code = convertStatusName(result.status);
+			entry.message = result.message;
+			if (profileReport && result.ok())
+				profileReport->add(result.profile);
+		}
 
-		streamMsg << "<strong style='color:red;'>ERROR: Buffer was too small!</strong><br />\n</p>\n";
-		return false;
-	}
-	if (res == Z_MEM_ERROR) {
+		long long outputMtime;
+		if (manifest && entry.success && headerDigest(filename, record.headerDigest)
+			&& fileStamp(baseName, record.outputSize, outputMtime)) {
+			record.outputDigest = result.digest;
+			manifest->record(record);
+		}
 
-		streamMsg << "<strong style='color:red;'>ERROR: Not enough memory for compression!</strong><br />\n</p>\n";
-		return false;
-	}
+		if (result.totalSamples >= 0) {
+			const char* names[4] = { "C3:A2", "C4:A1", "EOGl:A2", "EOGr:A1" };
+			streamMsg << "Total Samples found: " << result.totalSamples << BR << endl;
+			for (int c = 0; c < 4; c++)
+				streamMsg << names[c] << " channel, sampling rate: " << result.channels[c].rate << "Hz measured in " << result.channels[c].unit << BR << endl;
+		}
+		if (result.downgraded)
+			streamMsg << "Streaming in chunks to stay within --max-memory" << BR << endl;
 
-	FILE* file = fopen(baseName.c_str(), "wb");
-	if (!file) {
+		entry.peakResidentBytes = peakResidentBytes();
+		if (!entry.success) {
 
-		streamMsg << "<strong style='color:red;'>ERROR: Opening" << filename << "</strong><br />\n</p>" <<endl;
-		return false;
+			streamMsg << "<strong style='color:red;'>ERROR: " << entry.message << "</strong><br />\n</p>" << endl;
+		}
+		else {
+			streamMsg << "Memory: estimated peak " << (result.footprint >> 20) << " MiB, process peak RSS so far "
+				<< (entry.peakResidentBytes >> 20) << " MiB" << BR << endl;
+			streamMsg << "\n</p>";
+		}
 	}
-	//Start writing 
-	//Header 11 bytes
-	fwrite((Bytef*)signature, 1, 3, file);
-	fwrite((Bytef*)&version, 1, 1, file);
-	fwrite((Bytef*)&nFreq, 1, 1, file);
-	fwrite((Bytef*)&nTimes, 1, 1, file);
-	fwrite((Bytef*)&nChannels, 1, 1, file);
-	if (LITTLEENDIAN)
-		fwrite((Bytef*)&nEpochs, 1, 2, file);
-	else
-		writeByteReversed(file, (Bytef*)&nEpochs, 2, 2);
-	fwrite((Bytef*)&compression, 1, 1, file);
-	fwrite((Bytef*)&hash, 1, 1, file);
-	//SHA1 20 bytes
-	if (LITTLEENDIAN)
-		fwrite(SHAdigest, 1, 20, file);
-	else
-		writeByteReversed(file, SHAdigest, 20, 20);
-	//stream
-	if (LITTLEENDIAN)
-		fwrite(ostream, 1, destLen, file);
-	else
-		writeByteReversed(file, ostream, 4, destLen);
-	//done
-	fclose(file);
-
-	streamMsg << "\n</p>";
 
-
-	return(true);
+	entry.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	entry.html = streamMsg.str();
+	logSink->post(entry);
+	return entry.success;
 
 }
 
-
-
-
-vec firBandPass(int N, double fl, double fh) {
-	vec b(N+1), h(N+1);
-    h = sp::hamming(N+1);
-    for (int i=0;i<N+1;i++)   {
-        b[i] = h[i]*( sp::sinc(fh*(i-N/2.0))*fh - sp::sinc(fl*(i-N/2.0))*fl );
-    }
-    return b;
+//Whether convertFile() will skip filename without converting it
+bool skippedFile(const string& filename, bool overwrite, Manifest* manifest, const string& settings) {
+	if (overwrite)
+		return false;
+	string baseName = removeExtension(filename) + ".cfs";
+	ManifestState state = manifest ? manifest->check(filename, settings, baseName) : MANIFEST_UNKNOWN;
+	return state == MANIFEST_CURRENT || (state == MANIFEST_UNKNOWN && fs::exists(baseName));
 }
 
 string removeExtension(const string& filename) {
@@ -729,14 +909,6 @@ string removeExtension(const string& filename) {
 	return filename.substr(0, lastdot);
 }
 
-void writeByteReversed(FILE* file, Bytef* stream, int byteSize, unsigned long streamSize) {
-	for (unsigned long offset = 0; offset < streamSize; offset += byteSize) {
-		for (int j = byteSize - 1; j < 0; j--) {
-			std::fwrite(stream + offset + j, 1, 1, file);
-		}
-	}
-}
-
 int roundInt(double r) {
 	return (r > 0.0) ? (r + 0.5) : (r - 0.5);
 }
@@ -751,35 +923,3 @@ char *strlwr(char *str) {
 
 	return str;
 }
-
-
-double findMultiplier(const string& units) {
-
-	if (units.compare(0,2,"nV") == 0)
-		return 0.001;
-	else if (units.compare(0, 2, "uV") == 0)
-		return 1.0;
-	else if (units.compare(0, 2, "mV") == 0)
-		return 1000;
-	else if (units.compare(0, 1, "V") == 0)
-		return 1000000;
-	else
-		return -1;
-
-}
-
-void getAllFiles(const fs::path& root, const string& ext, vector<string>& filelist){
-	if(!fs::exists(root) || !fs::is_directory(root)) return;
-
-    fs::directory_iterator it(root);
-    fs::directory_iterator endit;
-
-    while(it != endit)
-    {
-        if(fs::is_regular_file(*it) && it->path().extension() == ext) filelist.push_back(it->path().string());
-        ++it;
-
-    }
-
-
-}
\ No newline at end of file
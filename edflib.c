@@ -38,10 +38,28 @@
 
 #include "edflib.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 
 #define EDFLIB_VERSION 111
 #define EDFLIB_MAXFILES 64
 
+/* the sample decoding loops are compiled for several instruction sets and the loader */
+/* picks the one the CPU has, see SIMD_CLONES in simd.h */
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GLIBC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define EDFLIB_CLONES __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#endif
+#endif
+#ifndef EDFLIB_CLONES
+#define EDFLIB_CLONES
+#endif
+
 
 #if defined(__APPLE__) || defined(__MACH__) || defined(__APPLE_CC__)
 
@@ -102,6 +120,13 @@ struct edfparamblock{
         long long sample_pntr;
       };
 
+struct edf_annotationblock{
+        long long onset;
+        char duration[16];
+        char annotation[EDFLIB_MAX_ANNOTATION_LEN + 1];
+       };
+
+
 struct edfhdrblock{
         FILE      *file_hdl;
         char      path[1024];
@@ -147,17 +172,18 @@ struct edfhdrblock{
         int       annotlist_sz;
         int       total_annot_bytes;
         int       eq_sf;
+        char      *read_buf;
+        int       read_buf_records;
+        int       read_buf_external;
+        int       map_external;
+        char      *map_base;
+        long long map_size;
         struct edfparamblock *edfparam;
+        struct edf_annotationblock *annotationslist;
+        int       annots_read;
       };
 
 
-static struct edf_annotationblock{
-        long long onset;
-        char duration[16];
-        char annotation[EDFLIB_MAX_ANNOTATION_LEN + 1];
-       } *annotationslist[EDFLIB_MAXFILES];
-
-
 static struct edf_write_annotationblock{
         long long onset;
         long long duration;
@@ -169,11 +195,18 @@ static int edf_files_open=0;
 static struct edfhdrblock *hdrlist[EDFLIB_MAXFILES];
 
 
-static struct edfhdrblock * edflib_check_edf_file(FILE *, int *);
+static struct edfhdrblock * edflib_check_edf_file(FILE *, int *, int);
+static int edflib_open_file_readonly(const char *, struct edf_hdr_struct *, int, int);
+static struct edfhdrblock * edflib_open_reader(const char *, const char *, long long, struct edf_hdr_struct *, int, int, int);
+static void edflib_free_reader(struct edfhdrblock *);
+static long long edflib_read_datarecords(struct edfhdrblock *, int, const int *, long long, long long, double **);
+static int edflib_copy_annotation(struct edfhdrblock *, int, struct edf_annotation_struct *);
+static FILE * edflib_map_file(const char *, char **, long long *);
+static void edflib_unmap_file(char *, long long);
 static int edflib_is_integer_number(char *);
 static int edflib_is_number(char *);
 static long long edflib_get_long_duration(char *);
-static int edflib_get_annotations(struct edfhdrblock *, int, int);
+static int edflib_get_annotations(struct edfhdrblock *, int);
 static int edflib_is_duration_number(char *);
 static int edflib_is_onset_number(char *);
 static long long edflib_get_long_time(char *);
@@ -190,6 +223,9 @@ static int edflib_sprint_int_number_nonlocalized(char *, int, int, int);
 static int edflib_sprint_ll_number_nonlocalized(char *, long long, int, int);
 static int edflib_fprint_int_number_nonlocalized(FILE *, int, int, int);
 static int edflib_fprint_ll_number_nonlocalized(FILE *, long long, int, int);
+static void edflib_deinterleave_record(struct edfhdrblock *, const unsigned char *, int, const int *, long long, double **);
+EDFLIB_CLONES static void edflib_decode_edf_samples(const unsigned char *, int, double, double, double *);
+EDFLIB_CLONES static void edflib_decode_bdf_samples(const unsigned char *, int, double, double, double *);
 
 
 
@@ -243,28 +279,22 @@ int edflib_get_handle(int file_number)
 
 int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int read_annotations)
 {
-  int i, j,
-      channel,
-      edf_error;
-
-  FILE *file;
+  return(edflib_open_file_readonly(path, edfhdr, read_annotations, 0));
+}
 
-  struct edfhdrblock *hdr;
 
+int edfopen_file_readonly_mmap(const char *path, struct edf_hdr_struct *edfhdr, int read_annotations)
+{
+  return(edflib_open_file_readonly(path, edfhdr, read_annotations, 1));
+}
 
-  if(read_annotations<0)
-  {
-    edfhdr->filetype = EDFLIB_INVALID_READ_ANNOTS_VALUE;
 
-    return(-1);
-  }
+static int edflib_open_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int read_annotations, int use_mmap)
+{
+  int i;
 
-  if(read_annotations>2)
-  {
-    edfhdr->filetype = EDFLIB_INVALID_READ_ANNOTS_VALUE;
+  struct edfhdrblock *hdr;
 
-    return(-1);
-  }
 
   memset(edfhdr, 0, sizeof(struct edf_hdr_struct));
 
@@ -288,22 +318,134 @@ int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int r
     }
   }
 
-  file = fopeno(path, "rb");
+  hdr = edflib_open_reader(path, NULL, 0LL, edfhdr, read_annotations, use_mmap, 0);
+  if(hdr==NULL)
+  {
+    return(-1);
+  }
+
+  for(i=0; i<EDFLIB_MAXFILES; i++)
+  {
+    if(hdrlist[i]==NULL)
+    {
+      hdrlist[i] = hdr;
+
+      edfhdr->handle = i;
+
+      break;
+    }
+  }
+
+  edf_files_open++;
+
+  return(0);
+}
+
+
+int edfopen_reader(const char *path, struct edf_hdr_struct *edfhdr, int read_annotations, int use_mmap, struct edfhdrblock **reader)
+{
+  *reader = edflib_open_reader(path, NULL, 0LL, edfhdr, read_annotations, use_mmap, 0);
+  if(*reader==NULL)
+  {
+    return(-1);
+  }
+
+  return(0);
+}
+
+
+int edfopen_reader_growing(const char *path, struct edf_hdr_struct *edfhdr, struct edfhdrblock **reader)
+{
+  *reader = edflib_open_reader(path, NULL, 0LL, edfhdr, EDFLIB_DO_NOT_READ_ANNOTATIONS, 0, 1);
+  if(*reader==NULL)
+  {
+    return(-1);
+  }
+
+  return(0);
+}
+
+
+int edfopen_reader_memory(const char *data, long long size, struct edf_hdr_struct *edfhdr, int read_annotations, struct edfhdrblock **reader)
+{
+  *reader = edflib_open_reader(NULL, data, size, edfhdr, read_annotations, 0, 0);
+  if(*reader==NULL)
+  {
+    return(-1);
+  }
+
+  return(0);
+}
+
+
+/* parses the file (or the file already in memory at data) into a header block of its own, */
+/* the handle table is left to the caller, growing as for edfopen_reader_growing() */
+static struct edfhdrblock * edflib_open_reader(const char *path, const char *data, long long data_size, struct edf_hdr_struct *edfhdr, int read_annotations, int use_mmap, int growing)
+{
+  int i, j,
+      channel,
+      edf_error;
+
+  char *map_base=NULL;
+
+  long long map_size=0LL;
+
+  FILE *file;
+
+  struct edfhdrblock *hdr;
+
+
+  if(read_annotations<0)
+  {
+    edfhdr->filetype = EDFLIB_INVALID_READ_ANNOTS_VALUE;
+
+    return(NULL);
+  }
+
+  if(read_annotations>2)
+  {
+    edfhdr->filetype = EDFLIB_INVALID_READ_ANNOTS_VALUE;
+
+    return(NULL);
+  }
+
+  memset(edfhdr, 0, sizeof(struct edf_hdr_struct));
+
+  edfhdr->handle = -1;
+
+  if(data!=NULL)
+  {
+#ifndef _WIN32
+    file = (data_size>0LL) ? fmemopen((void *)data, (size_t)data_size, "rb") : NULL;
+#else
+    file = NULL;
+#endif
+  }
+  else if(use_mmap)
+  {
+    file = edflib_map_file(path, &map_base, &map_size);
+  }
+  else
+  {
+    file = fopeno(path, "rb");
+  }
   if(file==NULL)
   {
     edfhdr->filetype = EDFLIB_NO_SUCH_FILE_OR_DIRECTORY;
 
-    return(-1);
+    return(NULL);
   }
 
-  hdr = edflib_check_edf_file(file, &edf_error);
+  hdr = edflib_check_edf_file(file, &edf_error, growing);
   if(hdr==NULL)
   {
     edfhdr->filetype = edf_error;
 
     fclose(file);
 
-    return(-1);
+    edflib_unmap_file(map_base, map_size);
+
+    return(NULL);
   }
 
   if(hdr->discontinuous)
@@ -315,21 +457,25 @@ int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int r
 
     fclose(file);
 
-    return(-1);
+    edflib_unmap_file(map_base, map_size);
+
+    return(NULL);
   }
 
   hdr->writemode = 0;
 
-  for(i=0; i<EDFLIB_MAXFILES; i++)
+  hdr->map_base = map_base;
+
+  hdr->map_size = map_size;
+
+  /* memory of the caller is decoded like a mapping, but never unmapped */
+  if(data!=NULL)
   {
-    if(hdrlist[i]==NULL)
-    {
-      hdrlist[i] = hdr;
+    hdr->map_base = (char *)data;
 
-      edfhdr->handle = i;
+    hdr->map_size = data_size;
 
-      break;
-    }
+    hdr->map_external = 1;
   }
 
   if((hdr->edf)&&(!(hdr->edfplus)))
@@ -364,7 +510,7 @@ int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int r
   edfhdr->datarecords_in_file = hdr->datarecords;
   edfhdr->datarecord_duration = hdr->long_data_record_duration;
 
-  annotationslist[edfhdr->handle] = NULL;
+  hdr->annotationslist = NULL;
 
   hdr->annotlist_sz = 0;
 
@@ -402,25 +548,32 @@ int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int r
 
     if((read_annotations==EDFLIB_READ_ANNOTATIONS)||(read_annotations==EDFLIB_READ_ALL_ANNOTATIONS))
     {
-      if(edflib_get_annotations(hdr, edfhdr->handle, read_annotations))
+      if(edflib_get_annotations(hdr, read_annotations))
       {
         edfhdr->filetype = EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
 
+        free(hdr->annotationslist);
+
         fclose(file);
 
+        edflib_unmap_file(map_base, map_size);
+
         free(hdr->edfparam);
         free(hdr);
 
-        return(-1);
+        return(NULL);
       }
+
+      hdr->annots_read = 1;
     }
 
     edfhdr->annotations_in_file = hdr->annots_in_file;
   }
 
-  strcpy(hdr->path, path);
-
-  edf_files_open++;
+  if(path!=NULL)
+  {
+    strcpy(hdr->path, path);
+  }
 
   j = 0;
 
@@ -448,7 +601,7 @@ int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int r
     edfhdr->signalparam[i].smp_in_datarecord = hdr->edfparam[channel].smp_per_record;
   }
 
-  return(0);
+  return(hdr);
 }
 
 
@@ -640,26 +793,61 @@ int edfclose_file(int handle)
     }
 
     free(write_annotationslist[handle]);
+
+    fclose(hdr->file_hdl);
+
+    free(hdr->edfparam);
+
+    free(hdr);
   }
   else
   {
-    free(annotationslist[handle]);
+    edflib_free_reader(hdr);
   }
 
-  fclose(hdr->file_hdl);
+  hdrlist[handle] = NULL;
 
-  free(hdr->edfparam);
+  edf_files_open--;
 
-  free(hdr);
+  return(0);
+}
 
-  hdrlist[handle] = NULL;
 
-  edf_files_open--;
+int edfclose_reader(struct edfhdrblock *reader)
+{
+  if(reader==NULL)
+  {
+    return(-1);
+  }
+
+  edflib_free_reader(reader);
 
   return(0);
 }
 
 
+static void edflib_free_reader(struct edfhdrblock *hdr)
+{
+  free(hdr->annotationslist);
+
+  fclose(hdr->file_hdl);
+
+  if(!(hdr->map_external))
+  {
+    edflib_unmap_file(hdr->map_base, hdr->map_size);
+  }
+
+  if(!(hdr->read_buf_external))
+  {
+    free(hdr->read_buf);
+  }
+
+  free(hdr->edfparam);
+
+  free(hdr);
+}
+
+
 long long edfseek(int handle, int edfsignal, long long offset, int whence)
 {
   long long smp_in_file;
@@ -1180,6 +1368,291 @@ int edfread_digital_samples(int handle, int edfsignal, int n, int *buf)
 }
 
 
+long long edfread_physical_datarecords(int handle, int nsignals, const int *edfsignals, long long first_record, long long n, double **bufs)
+{
+  if(handle<0)
+  {
+    return(-1);
+  }
+
+  if(handle>=EDFLIB_MAXFILES)
+  {
+    return(-1);
+  }
+
+  if(hdrlist[handle]==NULL)
+  {
+    return(-1);
+  }
+
+  if(hdrlist[handle]->writemode)
+  {
+    return(-1);
+  }
+
+  return(edflib_read_datarecords(hdrlist[handle], nsignals, edfsignals, first_record, n, bufs));
+}
+
+
+long long edfread_reader_datarecords(struct edfhdrblock *reader, int nsignals, const int *edfsignals, long long first_record, long long n, double **bufs)
+{
+  if(reader==NULL)
+  {
+    return(-1);
+  }
+
+  return(edflib_read_datarecords(reader, nsignals, edfsignals, first_record, n, bufs));
+}
+
+
+static long long edflib_read_datarecords(struct edfhdrblock *hdr, int nsignals, const int *edfsignals, long long first_record, long long n, double **bufs)
+{
+  int i, j,
+      block_records,
+      channel[EDFLIB_MAXSIGNALS];
+
+  long long records_done=0LL;
+
+  size_t nmemb;
+
+  const unsigned char *record;
+
+
+  if((nsignals<1)||(nsignals>EDFLIB_MAXSIGNALS))
+  {
+    return(-1);
+  }
+
+  for(i=0; i<nsignals; i++)
+  {
+    if((edfsignals[i]<0)||(edfsignals[i]>=(hdr->edfsignals - hdr->nr_annot_chns)))
+    {
+      return(-1);
+    }
+
+    channel[i] = hdr->mapped_signals[edfsignals[i]];
+  }
+
+  if((first_record<0LL)||(n<0LL))
+  {
+    return(-1);
+  }
+
+  if(first_record>=hdr->datarecords)
+  {
+    return(0LL);
+  }
+
+  if((first_record + n) > hdr->datarecords)
+  {
+    n = hdr->datarecords - first_record;
+  }
+
+  if(n==0LL)
+  {
+    return(0LL);
+  }
+
+  /* a mapped file is decoded straight from the page cache */
+  if(hdr->map_base!=NULL)
+  {
+    for(j=0; j<n; j++)
+    {
+      record = (const unsigned char *)hdr->map_base + hdr->hdrsize + (first_record + j) * hdr->recordsize;
+
+      edflib_deinterleave_record(hdr, record, nsignals, channel, j, bufs);
+    }
+
+    return(n);
+  }
+
+  /* the block buffer is kept with the file, so reading in chunks does not allocate again */
+  block_records = EDFLIB_READ_BLOCK_BYTES / hdr->recordsize;
+  if(block_records<1)
+  {
+    block_records = 1;
+  }
+
+  if(hdr->read_buf==NULL)
+  {
+    hdr->read_buf = (char *)malloc((size_t)block_records * hdr->recordsize);
+    if(hdr->read_buf==NULL)
+    {
+      return(-1);
+    }
+
+    hdr->read_buf_records = block_records;
+  }
+
+  /* an error of an earlier call is not kept, so a failed read can be tried again */
+  clearerr(hdr->file_hdl);
+
+  if(fseeko(hdr->file_hdl, hdr->hdrsize + first_record * hdr->recordsize, SEEK_SET))
+  {
+    return(-1);
+  }
+
+  while(records_done<n)
+  {
+    nmemb = hdr->read_buf_records;
+    if((long long)nmemb > (n - records_done))
+    {
+      nmemb = (size_t)(n - records_done);
+    }
+
+    nmemb = fread(hdr->read_buf, hdr->recordsize, nmemb, hdr->file_hdl);
+    if(nmemb==0)
+    {
+      if(ferror(hdr->file_hdl))
+      {
+        return(-1);
+      }
+
+      break;
+    }
+
+    for(j=0; j<(int)nmemb; j++)
+    {
+      record = (const unsigned char *)hdr->read_buf + (size_t)j * hdr->recordsize;
+
+      edflib_deinterleave_record(hdr, record, nsignals, channel, records_done + j, bufs);
+    }
+
+    records_done += nmemb;
+  }
+
+  return(records_done);
+}
+
+
+/* decodes the selected signals (channel numbers in the file) of one datarecord into position record_nr of bufs */
+static void edflib_deinterleave_record(struct edfhdrblock *hdr, const unsigned char *record, int nsignals, const int *channel, long long record_nr, double **bufs)
+{
+  int i;
+
+  for(i=0; i<nsignals; i++)
+  {
+    struct edfparamblock *param = hdr->edfparam + channel[i];
+
+    double *dst = bufs[i] + record_nr * param->smp_per_record;
+
+    if(hdr->edf)
+    {
+      edflib_decode_edf_samples(record + param->buf_offset, param->smp_per_record, param->bitvalue, param->offset, dst);
+    }
+    else
+    {
+      edflib_decode_bdf_samples(record + param->buf_offset, param->smp_per_record, param->bitvalue, param->offset, dst);
+    }
+  }
+}
+
+
+/* maps the whole file read-only and returns a stream over the mapping, so the header and */
+/* annotations are parsed from the same pages the samples are decoded from */
+static FILE * edflib_map_file(const char *path, char **map_base, long long *map_size)
+{
+#ifndef _WIN32
+  int fd;
+
+  struct stat st;
+
+  void *base;
+
+  FILE *file;
+
+
+  fd = open(path, O_RDONLY);
+  if(fd<0)
+  {
+    return(NULL);
+  }
+
+  if((fstat(fd, &st))||(st.st_size<256))
+  {
+    close(fd);
+
+    return(NULL);
+  }
+
+  base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if(base==MAP_FAILED)
+  {
+    return(NULL);
+  }
+
+  madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  file = fmemopen(base, (size_t)st.st_size, "rb");
+  if(file==NULL)
+  {
+    munmap(base, (size_t)st.st_size);
+
+    return(NULL);
+  }
+
+  *map_base = (char *)base;
+
+  *map_size = st.st_size;
+
+  return(file);
+#else
+  *map_base = NULL;
+
+  *map_size = 0LL;
+
+  return(fopeno(path, "rb"));
+#endif
+}
+
+
+static void edflib_unmap_file(char *map_base, long long map_size)
+{
+#ifndef _WIN32
+  if(map_base!=NULL)
+  {
+    munmap(map_base, (size_t)map_size);
+  }
+#else
+  (void)map_base;
+  (void)map_size;
+#endif
+}
+
+
+/* little endian 16-bit two's complement, no data dependent branches so the loop vectorizes */
+EDFLIB_CLONES
+static void edflib_decode_edf_samples(const unsigned char *src, int n, double bitvalue, double offset, double *dst)
+{
+  int i;
+
+  for(i=0; i<n; i++)
+  {
+    dst[i] = bitvalue * (offset + (double)(signed short)(src[2 * i] | (src[2 * i + 1] << 8)));
+  }
+}
+
+
+/* little endian 24-bit two's complement */
+EDFLIB_CLONES
+static void edflib_decode_bdf_samples(const unsigned char *src, int n, double bitvalue, double offset, double *dst)
+{
+  int i, v;
+
+  for(i=0; i<n; i++)
+  {
+    v = src[3 * i] | (src[3 * i + 1] << 8) | (src[3 * i + 2] << 16);
+
+    v -= (v & 0x800000) << 1;
+
+    dst[i] = bitvalue * (offset + (double)v);
+  }
+}
+
+
 int edf_get_annotation(int handle, int n, struct edf_annotation_struct *annot)
 {
   memset(annot, 0, sizeof(struct edf_annotation_struct));
@@ -1204,25 +1677,114 @@ int edf_get_annotation(int handle, int n, struct edf_annotation_struct *annot)
     return(-1);
   }
 
+  return(edflib_copy_annotation(hdrlist[handle], n, annot));
+}
+
+
+int edf_reader_get_annotation(struct edfhdrblock *reader, int n, struct edf_annotation_struct *annot)
+{
+  memset(annot, 0, sizeof(struct edf_annotation_struct));
+
+  if(reader==NULL)
+  {
+    return(-1);
+  }
+
+  return(edflib_copy_annotation(reader, n, annot));
+}
+
+
+int edf_reader_set_read_buffer(struct edfhdrblock *reader, char *buf, long long size)
+{
+  if(reader==NULL)
+  {
+    return(-1);
+  }
+
+  if((buf==NULL)||(size<reader->recordsize))
+  {
+    return(-1);
+  }
+
+  if(!(reader->read_buf_external))
+  {
+    free(reader->read_buf);
+  }
+
+  reader->read_buf = buf;
+
+  reader->read_buf_records = (int)(size / reader->recordsize);
+
+  reader->read_buf_external = 1;
+
+  return(0);
+}
+
+
+long long edf_reader_read_annotations(struct edfhdrblock *reader, int read_annotations)
+{
+  if(reader==NULL)
+  {
+    return(-1);
+  }
+
+  if((read_annotations!=EDFLIB_READ_ANNOTATIONS)&&(read_annotations!=EDFLIB_READ_ALL_ANNOTATIONS))
+  {
+    return(-1);
+  }
+
+  if((!(reader->edfplus))&&(!(reader->bdfplus)))
+  {
+    return(0LL);
+  }
+
+  if(reader->annots_read)
+  {
+    return(reader->annots_in_file);
+  }
+
+  if(edflib_get_annotations(reader, read_annotations))
+  {
+    free(reader->annotationslist);
+
+    reader->annotationslist = NULL;
+
+    reader->annotlist_sz = 0;
+
+    reader->annots_in_file = 0;
+
+    return(-1);
+  }
+
+  reader->annots_read = 1;
+
+  return(reader->annots_in_file);
+}
+
+
+static int edflib_copy_annotation(struct edfhdrblock *hdr, int n, struct edf_annotation_struct *annot)
+{
   if(n<0)
   {
     return(-1);
   }
 
-  if(n>=hdrlist[handle]->annots_in_file)
+  if(n>=hdr->annots_in_file)
   {
     return(-1);
   }
 
-  annot->onset = (annotationslist[handle] + n)->onset;
-  strcpy(annot->duration, (annotationslist[handle] + n)->duration);
-  strcpy(annot->annotation, (annotationslist[handle] + n)->annotation);
+  annot->onset = (hdr->annotationslist + n)->onset;
+  strcpy(annot->duration, (hdr->annotationslist + n)->duration);
+  strcpy(annot->annotation, (hdr->annotationslist + n)->annotation);
 
   return(0);
 }
 
 
-static struct edfhdrblock * edflib_check_edf_file(FILE *inputfile, int *edf_error)
+/* with growing the file may still be recorded: the number of datarecords in the header */
+/* may be -1 or behind the file, the complete datarecords in the file are taken instead */
+static struct edfhdrblock * edflib_check_edf_file(FILE *inputfile, int *edf_error, int growing)
 {
   int i, j, p, r=0, n,
       dotposition,
@@ -1650,7 +2212,7 @@ static struct edfhdrblock * edflib_check_edf_file(FILE *inputfile, int *edf_erro
   }
 
   edfhdr->datarecords = edflib_atof_nonlocalized(scratchpad);
-  if(edfhdr->datarecords<1)
+  if(edfhdr->datarecords<(growing ? -1 : 1))
   {
     *edf_error = EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
     free(edf_hdr);
@@ -2573,7 +3135,12 @@ static struct edfhdrblock * edflib_check_edf_file(FILE *inputfile, int *edf_erro
   edfhdr->hdrsize = edfhdr->edfsignals * 256 + 256;
 
   fseeko(inputfile, 0LL, SEEK_END);
-  if(ftello(inputfile)!=(edfhdr->recordsize * edfhdr->datarecords + edfhdr->hdrsize))
+  if(growing)
+  {
+    edfhdr->datarecords = (ftello(inputfile) - edfhdr->hdrsize) / edfhdr->recordsize;
+  }
+  if((edfhdr->datarecords<0)||(ftello(inputfile)<(edfhdr->recordsize * edfhdr->datarecords + edfhdr->hdrsize))||
+     ((!growing)&&(ftello(inputfile)!=(edfhdr->recordsize * edfhdr->datarecords + edfhdr->hdrsize))))
   {
     *edf_error = EDFLIB_FILE_CONTAINS_FORMAT_ERRORS;
     free(edf_hdr);
@@ -2824,7 +3391,7 @@ int edflib_version(void)
 }
 
 
-static int edflib_get_annotations(struct edfhdrblock *edfhdr, int hdl, int read_annotations)
+static int edflib_get_annotations(struct edfhdrblock *edfhdr, int read_annotations)
 {
   int i, j, k, p, r=0, n,
       edfsignals,
@@ -3084,7 +3651,7 @@ static int edflib_get_annotations(struct edfhdrblock *edfhdr, int hdl, int read_
               {
                 if(edfhdr->annots_in_file >= edfhdr->annotlist_sz)
                 {
-                  malloc_list = (struct edf_annotationblock *)realloc(annotationslist[hdl],
+                  malloc_list = (struct edf_annotationblock *)realloc(edfhdr->annotationslist,
                                                                       sizeof(struct edf_annotationblock) * (edfhdr->annotlist_sz + EDFLIB_ANNOT_MEMBLOCKSZ));
                   if(malloc_list==NULL)
                   {
@@ -3095,12 +3662,12 @@ static int edflib_get_annotations(struct edfhdrblock *edfhdr, int hdl, int read_
                     return(-1);
                   }
 
-                  annotationslist[hdl] = malloc_list;
+                  edfhdr->annotationslist = malloc_list;
 
                   edfhdr->annotlist_sz += EDFLIB_ANNOT_MEMBLOCKSZ;
                 }
 
-                new_annotation = annotationslist[hdl] + edfhdr->annots_in_file;
+                new_annotation = edfhdr->annotationslist + edfhdr->annots_in_file;
 
                 new_annotation->annotation[0] = 0;
 
@@ -78,6 +78,9 @@
 #define EDFLIB_READ_ANNOTATIONS        1
 #define EDFLIB_READ_ALL_ANNOTATIONS    2
 
+/* datarecords are read from the file in blocks of about this size */
+#define EDFLIB_READ_BLOCK_BYTES 4194304
+
 /* the following defines are possible errors returned by edfopen_file_writeonly() */
 #define EDFLIB_NO_SIGNALS                  -20
 #define EDFLIB_TOO_MANY_SIGNALS            -21
@@ -172,6 +175,46 @@ int edfopen_file_readonly(const char *path, struct edf_hdr_struct *edfhdr, int r
 
 
 
+int edfopen_file_readonly_mmap(const char *path, struct edf_hdr_struct *edfhdr, int read_annotations);
+
+/* same as edfopen_file_readonly() but the file is memory-mapped (with sequential read-ahead advice) */
+/* the header is parsed from the mapping and edfread_physical_datarecords() decodes the samples */
+/* directly from the mapped datarecords without copying them through stdio buffers */
+/* intended for files on local disks, on systems without mmap it behaves like edfopen_file_readonly() */
+
+
+
+struct edfhdrblock;
+
+int edfopen_reader(const char *path, struct edf_hdr_struct *edfhdr, int read_annotations, int use_mmap, struct edfhdrblock **reader);
+
+/* opens an existing file for reading like edfopen_file_readonly() (use_mmap 1 like edfopen_file_readonly_mmap()) */
+/* but without a handle in the library's table: the file belongs to the reader stored in *reader, which the caller */
+/* owns until edfclose_reader(), so it does not count towards EDFLIB_MAXFILES and the member "handle" is set to -1 */
+/* readers do not share any state, different threads can open, read and close their own readers at the same time */
+/* (the handle based functions use one table for all files and must not be called from several threads) */
+/* the same file may be opened by several readers */
+/* returns 0 on success, in case of an error it returns -1 and an errorcode will be set in the member "filetype" of struct edf_hdr_struct */
+
+
+
+int edfopen_reader_memory(const char *data, long long size, struct edf_hdr_struct *edfhdr, int read_annotations, struct edfhdrblock **reader);
+
+/* same as edfopen_reader() for a whole file of size bytes that is already in memory at data (e.g. received over a network) */
+/* the datarecords are decoded straight from data, which stays owned by the caller and must be valid until edfclose_reader() */
+/* not available on Windows */
+
+
+
+int edfopen_reader_growing(const char *path, struct edf_hdr_struct *edfhdr, struct edfhdrblock **reader);
+
+/* same as edfopen_reader() without annotations for a file that is still being recorded */
+/* the number of datarecords in the header may be -1 or lag behind the datarecords appended to the file, */
+/* datarecords_in_file is the number of complete datarecords in the file when it is opened */
+/* open it again for the datarecords appended since, the samples already read do not change */
+
+
+
 long long edfread_physical_samples(int handle, int edfsignal, long long n, double *buf);
 
 /* reads n samples from edfsignal, starting from the current sample position indicator, into buf (edfsignal starts at 0) */
@@ -192,6 +235,31 @@ int edfread_digital_samples(int handle, int edfsignal, int n, int *buf);
 /* or -1 in case of an error */
 
 
+long long edfread_physical_datarecords(int handle, int nsignals, const int *edfsignals, long long first_record, long long n, double **bufs);
+
+/* reads n whole datarecords, starting at datarecord first_record (starts at 0), in one pass over the file */
+/* and de-interleaves the nsignals signals listed in edfsignals (edfsignal starts at 0) */
+/* datarecords are read in large blocks instead of sample by sample */
+/* bufs[i] receives the samples of edfsignals[i], converted to their physical values */
+/* bufsize of bufs[i] should be equal to or bigger than sizeof(double[n * smp_in_datarecord of edfsignals[i]]) */
+/* the sample position indicators are not used and not changed */
+/* returns the amount of datarecords read (this can be less than n or zero!) */
+/* or -1 in case of an error, after which the same call can be tried again */
+
+
+long long edfread_reader_datarecords(struct edfhdrblock *reader, int nsignals, const int *edfsignals, long long first_record, long long n, double **bufs);
+
+/* same as edfread_physical_datarecords() for a file opened with edfopen_reader() */
+
+
+int edf_reader_set_read_buffer(struct edfhdrblock *reader, char *buf, long long size);
+
+/* lets edfread_reader_datarecords() read blocks of datarecords into buf instead of a buffer of its own */
+/* (of EDFLIB_READ_BLOCK_BYTES), size must hold at least one datarecord */
+/* buf stays owned by the caller and must be valid until edfclose_reader(), it is not used for memory-mapped files */
+/* returns 0 on success, otherwise -1 */
+
+
 long long edfseek(int handle, int edfsignal, long long offset, int whence);
 
 /* The edfseek() function sets the sample position indicator for the edfsignal pointed to by edfsignal. */
@@ -222,6 +290,20 @@ int edf_get_annotation(int handle, int n, struct edf_annotation_struct *annot);
 /* The string that describes the annotation/event is encoded in UTF-8 */
 /* To obtain the number of annotations in a file, check edf_hdr_struct -> annotations_in_file. */
 
+
+int edf_reader_get_annotation(struct edfhdrblock *reader, int n, struct edf_annotation_struct *annot);
+
+/* same as edf_get_annotation() for a file opened with edfopen_reader() */
+
+
+long long edf_reader_read_annotations(struct edfhdrblock *reader, int read_annotations);
+
+/* reads the annotations of a file that was opened with EDFLIB_DO_NOT_READ_ANNOTATIONS, when they are first needed */
+/* read_annotations is EDFLIB_READ_ANNOTATIONS or EDFLIB_READ_ALL_ANNOTATIONS, as for edfopen_file_readonly() */
+/* this reads every datarecord of the file once, later calls return the annotations already read */
+/* returns the number of annotations, to be fetched with edf_reader_get_annotation() (0 for EDF and BDF files) */
+/* or -1 in case of an error */
+
 /*
 Notes:
 
@@ -257,6 +339,12 @@ int edfclose_file(int handle);
 /* unnessecary memory usage and in case of writing it will cause a corrupted and incomplete file */
 
 
+int edfclose_reader(struct edfhdrblock *reader);
+
+/* closes a file opened with edfopen_reader() and frees the reader */
+/* returns -1 in case of an error, 0 on success */
+
+
 int edflib_version(void);
 
 /* Returns the version number of this library, multiplied by hundred. if version is "1.00" than it will return 100 */
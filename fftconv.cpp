@@ -0,0 +1,140 @@
+#include "fftconv.h"
+#include "spectral.h"
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+//The double and float FFTW interfaces behind one name
+template<class T> struct Fftw;
+
+template<> struct Fftw<double> {
+	typedef fftw_complex Complex;
+	typedef fftw_plan Plan;
+	static double* allocReal(size_t n) { return fftw_alloc_real(n); }
+	static Complex* allocComplex(size_t n) { return fftw_alloc_complex(n); }
+	static void free(void* p) { fftw_free(p); }
+	static Plan planForward(int n, double* in, Complex* out) { return fftw_plan_dft_r2c_1d(n, in, out, FFTW_ESTIMATE); }
+	static Plan planBackward(int n, Complex* in, double* out) { return fftw_plan_dft_c2r_1d(n, in, out, FFTW_ESTIMATE); }
+	static void forward(Plan p, double* in, Complex* out) { fftw_execute_dft_r2c(p, in, out); }
+	static void backward(Plan p, Complex* in, double* out) { fftw_execute_dft_c2r(p, in, out); }
+};
+
+template<> struct Fftw<float> {
+	typedef fftwf_complex Complex;
+	typedef fftwf_plan Plan;
+	static float* allocReal(size_t n) { return fftwf_alloc_real(n); }
+	static Complex* allocComplex(size_t n) { return fftwf_alloc_complex(n); }
+	static void free(void* p) { fftwf_free(p); }
+	static Plan planForward(int n, float* in, Complex* out) { return fftwf_plan_dft_r2c_1d(n, in, out, FFTW_ESTIMATE); }
+	static Plan planBackward(int n, Complex* in, float* out) { return fftwf_plan_dft_c2r_1d(n, in, out, FFTW_ESTIMATE); }
+	static void forward(Plan p, float* in, Complex* out) { fftwf_execute_dft_r2c(p, in, out); }
+	static void backward(Plan p, Complex* in, float* out) { fftwf_execute_dft_c2r(p, in, out); }
+};
+
+//Forward and backward plans of one size, never destroyed
+template<class T>
+struct PlanPair {
+	typename Fftw<T>::Plan forward, backward;
+};
+
+template<class T>
+static PlanPair<T> plansFor(int n) {
+	static map< int, PlanPair<T> > plans;
+
+	lock_guard<mutex> lock(fftwPlannerMutex());
+	typename map< int, PlanPair<T> >::iterator it = plans.find(n);
+	if (it != plans.end())
+		return it->second;
+
+	//FFTW_ESTIMATE as for the spectrogram plans: timing candidates with FFTW_MEASURE could
+	//pick another algorithm, and other rounding of the filtered signal, in every run. The
+	//scratch buffers have the fftw_malloc alignment of the convolvers' own
+	T* real = Fftw<T>::allocReal(n);
+	typename Fftw<T>::Complex* spectrum = Fftw<T>::allocComplex(n / 2 + 1);
+	PlanPair<T> pair;
+	pair.forward = Fftw<T>::planForward(n, real, spectrum);
+	pair.backward = Fftw<T>::planBackward(n, spectrum, real);
+	Fftw<T>::free(real);
+	Fftw<T>::free(spectrum);
+
+	if (pair.forward == NULL || pair.backward == NULL)
+		throw runtime_error("Unable to create FFTW plan");
+	plans[n] = pair;
+	return pair;
+}
+
+template<class T>
+struct FftConvolver<T>::Buffers {
+	PlanPair<T> plans;
+	T* block;
+	typename Fftw<T>::Complex* spectrum;
+	typename Fftw<T>::Complex* response;    // FFT of the taps, scaled by 1/size
+};
+
+template<class T>
+FftConvolver<T>::FftConvolver(const vector<double>& taps) : _taps(taps.size()) {
+	if (taps.empty())
+		throw invalid_argument("FIR filter needs at least one tap");
+
+	//Blocks of about four filter lengths keep the per-sample FFT cost near its minimum
+	_size = 64;
+	while ((size_t)_size < 4 * _taps)
+		_size *= 2;
+	_step = _size - (_taps - 1);
+
+	int bins = _size / 2 + 1;
+	_buffers = new Buffers;
+	_buffers->plans = plansFor<T>(_size);
+	_buffers->block = Fftw<T>::allocReal(_size);
+	_buffers->spectrum = Fftw<T>::allocComplex(bins);
+	_buffers->response = Fftw<T>::allocComplex(bins);
+
+	fill(_buffers->block, _buffers->block + _size, T(0));
+	for (size_t k = 0; k < _taps; k++)
+		_buffers->block[k] = (T)(taps[k] / _size);
+	Fftw<T>::forward(_buffers->plans.forward, _buffers->block, _buffers->response);
+}
+
+template<class T>
+FftConvolver<T>::~FftConvolver() {
+	Fftw<T>::free(_buffers->block);
+	Fftw<T>::free(_buffers->spectrum);
+	Fftw<T>::free(_buffers->response);
+	delete _buffers;
+}
+
+template<class T>
+void FftConvolver<T>::filter(const T* window, size_t count, T* out) {
+	size_t history = _taps - 1;
+	size_t length = history + count;
+	int bins = _size / 2 + 1;
+	T* block = _buffers->block;
+	typename Fftw<T>::Complex* spectrum = _buffers->spectrum;
+	const typename Fftw<T>::Complex* response = _buffers->response;
+
+	for (size_t start = 0; start < count; start += _step) {
+		//Block of _size samples from window[start], zero past the end
+		size_t available = min((size_t)_size, length - start);
+		copy(window + start, window + start + available, block);
+		fill(block + available, block + _size, T(0));
+
+		Fftw<T>::forward(_buffers->plans.forward, block, spectrum);
+		for (int k = 0; k < bins; k++) {
+			T re = spectrum[k][0] * response[k][0] - spectrum[k][1] * response[k][1];
+			T im = spectrum[k][0] * response[k][1] + spectrum[k][1] * response[k][0];
+			spectrum[k][0] = re;
+			spectrum[k][1] = im;
+		}
+		Fftw<T>::backward(_buffers->plans.backward, spectrum, block);
+
+		//The first taps-1 samples of every block are wrapped around and discarded
+		size_t valid = min(_step, count - start);
+		copy(block + history, block + history + valid, out + start);
+	}
+}
+
+template class FftConvolver<double>;
+template class FftConvolver<float>;
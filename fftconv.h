@@ -0,0 +1,49 @@
+//FFTCONV  Overlap-save FFT convolution for long FIR filters.
+//   Direct convolution costs taps multiply-adds per sample; overlap-save costs a couple of
+//   FFTs per block of FFT size - taps + 1 samples, which wins once filters reach a few
+//   hundred taps. Plans are made once per FFT size and precision with FFTW_ESTIMATE, under
+//   the same planner lock as the spectrogram plan, then executed concurrently on
+//   per-convolver buffers.
+
+#pragma once
+
+#include <vector>
+#include <fftw3.h>
+
+using namespace std;
+
+//Filters at least this long may use the FFT, shorter ones always run directly
+#ifndef FFTCONV_MINTAPS
+#define FFTCONV_MINTAPS (128)
+#endif
+
+//...and only for pushes of at least this many taps x samples
+#ifndef FFTCONV_MINWORK
+#define FFTCONV_MINWORK (1 << 20)
+#endif
+
+template<class T>
+class FftConvolver {
+public:
+	explicit FftConvolver(const vector<double>& taps);
+	~FftConvolver();
+
+	//window holds taps-1 samples of history followed by count new samples;
+	//out[i] = sum over k of taps[k] * window[taps-1+i-k], for i < count
+	void filter(const T* window, size_t count, T* out);
+
+	static bool worthwhile(size_t taps, size_t count) {
+		return taps >= FFTCONV_MINTAPS && (double)taps * count >= FFTCONV_MINWORK;
+	}
+
+private:
+	FftConvolver(const FftConvolver&) = delete;
+	FftConvolver& operator=(const FftConvolver&) = delete;
+
+	struct Buffers;
+
+	size_t _taps;
+	int _size;                 // FFT length
+	size_t _step;              // valid outputs per block
+	Buffers* _buffers;
+};
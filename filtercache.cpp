@@ -0,0 +1,62 @@
+#include "filtercache.h"
+#include "resample.h"
+#include <map>
+#include <mutex>
+#include <tuple>
+
+using namespace std;
+
+typedef tuple<int, double, double> BandPassKey;
+typedef tuple< int, int, vector<double> > ResampleKey;
+
+static mutex cacheMutex;
+static map< BandPassKey, shared_ptr< const vector<double> > > bandPassCache;
+static map< ResampleKey, shared_ptr<const ResampleDesign> > resampleCache;
+
+shared_ptr< const vector<double> > cachedBandPass(int order, double fl, double fh,
+	const function<vector<double>()>& design) {
+
+	//Designs are cheap next to a conversion, so they are made under the lock
+	lock_guard<mutex> lock(cacheMutex);
+	shared_ptr< const vector<double> >& taps = bandPassCache[BandPassKey(order, fl, fh)];
+	if (!taps)
+		taps = make_shared< const vector<double> >(design());
+	return taps;
+}
+
+shared_ptr<const ResampleDesign> cachedResampleDesign(int upFactor, int downFactor,
+	const vector<double>& prefilter) {
+
+	lock_guard<mutex> lock(cacheMutex);
+	shared_ptr<const ResampleDesign>& cached = resampleCache[ResampleKey(upFactor, downFactor, prefilter)];
+	if (!cached) {
+		shared_ptr<ResampleDesign> design = make_shared<ResampleDesign>();
+		design->upFactor = upFactor;
+		design->downFactor = downFactor;
+		resampleFilter(upFactor, downFactor, design->filter, design->delay);
+
+		if (!prefilter.empty()) {
+			//At the upsampled rate the prefilter has upFactor-1 zeros between taps
+			const vector<double>& h = design->filter;
+			vector<double> merged(h.size() + upFactor * (prefilter.size() - 1), 0.0);
+			for (size_t j = 0; j < prefilter.size(); j++)
+				for (size_t k = 0; k < h.size(); k++)
+					merged[j * upFactor + k] += prefilter[j] * h[k];
+
+			//Both delays, padded in front so the total is a whole number of outputs
+			long long total = (long long)design->delay * downFactor + upFactor * (long long)(prefilter.size() / 2);
+			int nz = (int)((downFactor - total % downFactor) % downFactor);
+			design->filter.assign(nz, 0.0);
+			design->filter.insert(design->filter.end(), merged.begin(), merged.end());
+			design->delay = (int)((total + nz) / downFactor);
+		}
+
+		design->polyphase = make_shared< const PolyphaseTable<double> >(upFactor,
+			&design->filter[0], (int)design->filter.size());
+		vector<float> filterFloat(design->filter.begin(), design->filter.end());
+		design->polyphaseFloat = make_shared< const PolyphaseTable<float> >(upFactor,
+			&filterFloat[0], (int)filterFloat.size());
+		cached = design;
+	}
+	return cached;
+}
@@ -0,0 +1,33 @@
+//FILTERCACHE  Process-wide cache of designed filters.
+//   An archive holds only a handful of distinct sampling rates, so band-pass taps and
+//   resampler coefficient tables are designed the first time a rate is seen and shared,
+//   read-only, by every later file and thread.
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include "upfirdn.h"
+
+using namespace std;
+
+//Anti-aliasing filter of RESAMPLE for factors already reduced by their GCD, optionally
+//merged with a FIR filter meant to run at the input rate before resampling
+struct ResampleDesign {
+	int upFactor, downFactor;
+	vector<double> filter;                        // as built by resampleFilter, or merged
+	int delay;                                    // in output samples
+	shared_ptr< const PolyphaseTable<double> > polyphase; // filter transposed for Resampler
+	shared_ptr< const PolyphaseTable<float> > polyphaseFloat;
+};
+
+//Band-pass taps of the given order and normalized cutoffs, made by design on first use
+shared_ptr< const vector<double> > cachedBandPass(int order, double fl, double fh,
+	const function<vector<double>()>& design);
+
+//Resampling filter for upFactor/downFactor, which must be reduced already and differ.
+//A non-empty prefilter is folded in, so one polyphase pass gives the same result as
+//conv(x, prefilter, "same") followed by RESAMPLE, up to the edges of the signal
+shared_ptr<const ResampleDesign> cachedResampleDesign(int upFactor, int downFactor,
+	const vector<double>& prefilter = vector<double>());
@@ -0,0 +1,186 @@
+#include "logsink.h"
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+
+using namespace std;
+
+LogSink::LogSink(const LogSinkOptions& options) :
+	_options(options), _ok(true), _head(NULL), _tail(new Node()), _closing(false), _closed(false),
+	_done(0), _failed(0), _progressWidth(0) {
+
+	_head.store(_tail);
+	_start = _lastProgress = chrono::steady_clock::now();
+
+	if (!_options.jsonPath.empty()) {
+		_json.open(_options.jsonPath.c_str(), ios::out);
+		_ok = _ok && _json.is_open();
+	}
+	if (!_options.htmlPath.empty()) {
+		_html.open(_options.htmlPath.c_str(), ios::out);
+		_ok = _ok && _html.is_open();
+		_html << _options.htmlHeader;
+	}
+
+	_thread = thread([this]() {
+		while (!_closing.load(memory_order_acquire)) {
+			drain();
+			showProgress(false);
+			this_thread::sleep_for(chrono::milliseconds(LOGSINK_POLLMS));
+		}
+		drain();
+	});
+}
+
+LogSink::~LogSink() {
+	close("");
+
+	while (_tail) {
+		Node* next = _tail->next.load(memory_order_relaxed);
+		delete _tail;
+		_tail = next;
+	}
+}
+
+void LogSink::post(const LogEntry& entry) {
+	Node* node = new Node();
+	node->entry = entry;
+	Node* previous = _head.exchange(node, memory_order_acq_rel);
+	//Until this store the consumer sees the queue end at previous, it never blocks on it
+	previous->next.store(node, memory_order_release);
+}
+
+bool LogSink::pop(LogEntry& entry) {
+	Node* next = _tail->next.load(memory_order_acquire);
+	if (!next)
+		return false;
+	entry = next->entry;
+	next->entry = LogEntry();
+	delete _tail;
+	_tail = next;
+	return true;
+}
+
+void LogSink::drain() {
+	LogEntry entry;
+	bool wrote = false;
+	while (pop(entry)) {
+		write(entry);
+		wrote = true;
+	}
+	//Flushed once the queue runs dry, so a crash loses at most the last few files
+	if (wrote && _json.is_open())
+		_json.flush();
+}
+
+void LogSink::write(const LogEntry& entry) {
+	_done++;
+	if (!entry.success)
+		_failed++;
+
+	//If failed always print output
+	if (!entry.success || !_options.quiet) {
+		clearProgress();
+		if (entry.success && entry.code == "up_to_date")
+			cout << "Filename: " << entry.filename << ", unchanged since it was converted\n";
+		else if (entry.success)
+			cout << "Filename: " << entry.filename << ", processed successfully\n";
+		else if (_options.htmlPath.empty() && _options.jsonPath.empty())
+			cout << "ERROR: Filename: " << entry.filename << ", please enable logging to see details.\n";
+		else
+			cout << "ERROR: Filename: " << entry.filename << ", please check log.\n";
+		cout.flush();
+	}
+
+	if (_json.is_open())
+		_json << logEntryJson(entry) << '\n';
+	if (_html.is_open())
+		_html << entry.html;
+}
+
+void LogSink::showProgress(bool force) {
+	if (!_options.progress)
+		return;
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	if (!force && now - _lastProgress < chrono::milliseconds(LOGSINK_PROGRESSMS))
+		return;
+	_lastProgress = now;
+
+	double elapsed = chrono::duration<double>(now - _start).count();
+	double rate = elapsed > 0 ? _done / elapsed : 0;
+	ostringstream line;
+	line.precision(3);
+	line << _done;
+	if (_options.expected > 0)
+		line << "/" << _options.expected;
+	line << " files, " << _failed << " failed, " << rate << " files/s";
+	if (_options.expected > _done && rate > 0) {
+		long long eta = (long long)((_options.expected - _done) / rate);
+		char clock[32];
+		snprintf(clock, sizeof(clock), "%lld:%02lld:%02lld", eta / 3600, eta / 60 % 60, eta % 60);
+		line << ", ETA " << clock;
+	}
+
+	string text = line.str();
+	size_t width = text.size();
+	if (width < _progressWidth)
+		text.append(_progressWidth - width, ' ');
+	cout << '\r' << text << flush;
+	_progressWidth = width;
+}
+
+void LogSink::clearProgress() {
+	if (_progressWidth == 0)
+		return;
+	cout << '\r' << string(_progressWidth, ' ') << '\r';
+	_progressWidth = 0;
+}
+
+void LogSink::close(const string& htmlFooter) {
+	if (_closed)
+		return;
+	_closed = true;
+	_closing.store(true, memory_order_release);
+	_thread.join();
+
+	if (_options.progress && _done > 0) {
+		showProgress(true);
+		cout << '\n';
+		_progressWidth = 0;
+	}
+	if (_json.is_open())
+		_json.close();
+	if (_html.is_open()) {
+		_html << htmlFooter;
+		_html.close();
+	}
+}
+
+//EDF header fields are padded with spaces
+static string trimmed(const string& field) {
+	size_t end = field.find_last_not_of(' ');
+	return (end == string::npos) ? string() : field.substr(0, end + 1);
+}
+
+string logEntryJson(const LogEntry& entry) {
+	ostringstream json;
+	json << "{\"file\":" << jsonString(entry.filename) << ",\"cfs\":" << jsonString(entry.cfsFilename)
+		<< ",\"success\":" << (entry.success ? "true" : "false") << ",\"code\":" << jsonString(entry.code)
+		<< ",\"message\":" << jsonString(entry.message);
+
+	const ConvertResult& result = entry.result;
+	if (entry.converted && result.totalSamples >= 0) {
+		const char* names[4] = { "c3", "c4", "el", "er" };
+		json << ",\"total_samples\":" << result.totalSamples << ",\"channels\":{";
+		for (int c = 0; c < 4; c++)
+			json << (c ? "," : "") << "\"" << names[c] << "\":{\"label\":" << jsonString(trimmed(result.channels[c].label))
+				<< ",\"rate\":" << result.channels[c].rate << ",\"unit\":" << jsonString(trimmed(result.channels[c].unit)) << "}";
+		json << "}";
+	}
+	if (entry.converted && result.ok())
+		json << ",\"epochs\":" << result.epochs << ",\"streamed\":" << (result.streamed ? "true" : "false")
+			<< ",\"downgraded\":" << (result.downgraded ? "true" : "false") << ",\"footprint_bytes\":" << result.footprint;
+
+	json << ",\"seconds\":" << entry.seconds << ",\"peak_rss_bytes\":" << entry.peakResidentBytes << "}";
+	return json.str();
+}
@@ -0,0 +1,95 @@
+//LOGSINK  Conversion results written to the console and log files off the worker threads.
+//   Workers post one LogEntry per file to a lock-free queue and go on with the next file;
+//   a single thread drains it, prints the per-file console lines and a live progress line,
+//   appends a JSON object per file to the JSON-lines log and the HTML fragment to the HTML
+//   report. Files are only flushed when the queue runs dry, not after every line, and the
+//   HTML report, which nothing reads while the run is going, only when the run ends.
+
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "converter.h"
+
+using namespace std;
+
+#define LOGSINK_POLLMS (50)
+#define LOGSINK_PROGRESSMS (250)
+
+//Outcome of one file as the log reports it
+struct LogEntry {
+	LogEntry() : success(false), converted(false), seconds(0), peakResidentBytes(0) {}
+
+	string filename;
+	string cfsFilename;
+	bool success;
+	bool converted;              // result holds what the converter returned
+	string code;                 // convertStatusName() or a reason of edf2cfs, e.g. up_to_date
+	string message;              // empty on success
+	ConvertResult result;
+	double seconds;
+	unsigned long long peakResidentBytes;
+	string html;                 // fragment for the HTML report
+};
+
+struct LogSinkOptions {
+	LogSinkOptions() : quiet(false), progress(false), expected(0) {}
+
+	string jsonPath;             // JSON-lines log, none when empty
+	string htmlPath;             // HTML report, none when empty
+	string htmlHeader;           // written before the first fragment
+	bool quiet;                  // no console line for files that converted
+	bool progress;               // keep a progress line at the bottom of the console
+	size_t expected;             // files in the run, 0 when not known (watching)
+};
+
+class LogSink {
+public:
+	explicit LogSink(const LogSinkOptions& options);
+	~LogSink();
+
+	//False if a log file could not be created
+	bool ok() const { return _ok; }
+
+	//Queues one result, from any thread, without blocking
+	void post(const LogEntry& entry);
+
+	//Writes everything queued so far followed by htmlFooter and stops the sink thread
+	void close(const string& htmlFooter);
+
+private:
+	LogSink(const LogSink&) = delete;
+	LogSink& operator=(const LogSink&) = delete;
+
+	//Intrusive multi-producer single-consumer queue, producers only swap the head
+	struct Node {
+		Node() : next(NULL) {}
+		atomic<Node*> next;
+		LogEntry entry;
+	};
+
+	bool pop(LogEntry& entry);
+	void drain();
+	void write(const LogEntry& entry);
+	void showProgress(bool force);
+	void clearProgress();
+
+	LogSinkOptions _options;
+	bool _ok;
+	ofstream _json, _html;
+	atomic<Node*> _head;         // last node pushed
+	Node* _tail;                 // consumer's stub, its successor is the next entry
+	atomic<bool> _closing;
+	thread _thread;
+	bool _closed;
+
+	size_t _done, _failed;
+	chrono::steady_clock::time_point _start, _lastProgress;
+	size_t _progressWidth;       // characters of the progress line on screen
+};
+
+//One line of JSON for the JSON-lines log
+string logEntryJson(const LogEntry& entry);
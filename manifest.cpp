@@ -0,0 +1,233 @@
+#include "manifest.h"
+#include "SHA1.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define MANIFEST_FIELDS (8)
+#define EDF_HEADERBYTES (256)
+#define EDF_MAXSIGNALS (4096)
+
+bool fileStamp(const string& path, unsigned long long& size, long long& mtime) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+	size = (unsigned long long)st.st_size;
+#ifdef __APPLE__
+	mtime = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+	mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
+
+bool headerDigest(const string& path, string& digest) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	//The fixed record ends with the number of signals, each has another 256 bytes
+	vector<unsigned char> header(EDF_HEADERBYTES);
+	bool ok = fread(header.data(), 1, EDF_HEADERBYTES, file) == EDF_HEADERBYTES;
+	if (ok) {
+		string field(header.begin() + 252, header.end());
+		int signals = atoi(field.c_str());
+		ok = signals > 0 && signals <= EDF_MAXSIGNALS;
+		if (ok) {
+			header.resize((size_t)EDF_HEADERBYTES * (signals + 1));
+			size_t rest = header.size() - EDF_HEADERBYTES;
+			ok = fread(header.data() + EDF_HEADERBYTES, 1, rest, file) == rest;
+		}
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+
+	CSHA1 sha1;
+	sha1.Update(header.data(), (UINT_32)header.size());
+	sha1.Final();
+	return sha1.ReportHashStl(digest, CSHA1::REPORT_HEX_SHORT);
+}
+
+string manifestSettings(const Converter::Options& options) {
+	ostringstream settings;
+	for (size_t i = 0; i < options.channelLabels.size(); i++)
+		settings << options.channelLabels[i] << "|";
+	settings << (options.precision == PIPELINE_FLOAT ? "float" : "double");
+	//Only named when not the default, so manifests of earlier releases stay valid
+	if (options.codec != Codec())
+		settings << "|" << codecName(options.codec);
+	if (options.payload != PAYLOAD_FLOAT)
+		settings << "|payload:" << payloadFormatName(options.payload);
+	if (options.blockEpochs > 0)
+		settings << "|blocks:" << options.blockEpochs;
+	if (options.firstEpoch > 0 || options.endEpoch >= 0)
+		settings << "|epochs:" << options.firstEpoch << "-" << (options.endEpoch >= 0 ? to_string(options.endEpoch) : string());
+	if (options.quality)
+		settings << "|qc";
+	return settings.str();
+}
+
+static string absolutePath(const string& path) {
+	char resolved[PATH_MAX];
+	if (realpath(path.c_str(), resolved))
+		return resolved;
+	return path;
+}
+
+//Tabs and line breaks would split the line, such names are not recorded
+static bool storable(const string& field) {
+	return field.find_first_of("\t\r\n") == string::npos;
+}
+
+static bool parse(const string& line, ManifestEntry& entry) {
+	vector<string> fields;
+	size_t start = 0;
+	while (true) {
+		size_t tab = line.find('\t', start);
+		fields.push_back(line.substr(start, tab == string::npos ? string::npos : tab - start));
+		if (tab == string::npos)
+			break;
+		start = tab + 1;
+	}
+	if (fields.size() != MANIFEST_FIELDS)
+		return false;
+
+	entry.input = fields[0];
+	entry.size = strtoull(fields[1].c_str(), NULL, 10);
+	entry.mtime = strtoll(fields[2].c_str(), NULL, 10);
+	entry.headerDigest = fields[3];
+	entry.settings = fields[4];
+	entry.output = fields[5];
+	entry.outputSize = strtoull(fields[6].c_str(), NULL, 10);
+	entry.outputDigest = fields[7];
+	return !entry.input.empty();
+}
+
+//Adds the entries of the manifest at path to entries, false if there is none
+static bool readEntries(const string& path, map<string, ManifestEntry>& entries) {
+	ifstream in(path.c_str());
+	string line;
+	while (getline(in, line)) {
+		ManifestEntry entry;
+		//A line cut short by a crash does not parse and is dropped
+		if (line.empty() || line[0] == '#' || !parse(line, entry))
+			continue;
+		entries[entry.input] = entry;
+	}
+	return in.eof();
+}
+
+Manifest::Manifest(const string& path) : _path(path), _journal(NULL), _ok(true) {
+}
+
+Manifest::~Manifest() {
+	if (_journal)
+		fclose(_journal);
+}
+
+bool Manifest::open() {
+	lock_guard<mutex> lock(_mutex);
+	bool exists = readEntries(_path, _entries);
+
+	_journal = fopen(_path.c_str(), "a");
+	if (!_journal) {
+		_ok = false;
+		return false;
+	}
+	if (!exists)
+		fprintf(_journal, "%s\n", MANIFEST_SIGNATURE);
+	//A line left unterminated by a crash must not swallow the first one appended now
+	else
+		fputc('\n', _journal);
+	return fflush(_journal) == 0;
+}
+
+bool Manifest::inherit(const string& path) {
+	lock_guard<mutex> lock(_mutex);
+	return readEntries(path, _inherited);
+}
+
+bool Manifest::merge(const string& path) {
+	lock_guard<mutex> lock(_mutex);
+	return readEntries(path, _entries);
+}
+
+ManifestState Manifest::check(const string& input, const string& settings, const string& output) const {
+	ManifestEntry entry;
+	{
+		lock_guard<mutex> lock(_mutex);
+		string key = absolutePath(input);
+		map<string, ManifestEntry>::const_iterator it = _entries.find(key);
+		if (it == _entries.end()) {
+			it = _inherited.find(key);
+			if (it == _inherited.end())
+				return MANIFEST_UNKNOWN;
+		}
+		if (it->second.output != absolutePath(output))
+			return MANIFEST_UNKNOWN;
+		entry = it->second;
+	}
+
+	unsigned long long size, outputSize;
+	long long mtime, outputMtime;
+	if (entry.settings != settings || !fileStamp(input, size, mtime) || size != entry.size || mtime != entry.mtime)
+		return MANIFEST_STALE;
+	if (!fileStamp(output, outputSize, outputMtime) || outputSize != entry.outputSize)
+		return MANIFEST_STALE;
+	return MANIFEST_CURRENT;
+}
+
+void Manifest::record(ManifestEntry entry) {
+	entry.input = absolutePath(entry.input);
+	entry.output = absolutePath(entry.output);
+	if (!storable(entry.input) || !storable(entry.output) || !storable(entry.settings))
+		return;
+
+	lock_guard<mutex> lock(_mutex);
+	_entries[entry.input] = entry;
+	if (!_journal || !append(_journal, entry) || fflush(_journal) != 0)
+		_ok = false;
+}
+
+bool Manifest::append(FILE* file, const ManifestEntry& entry) const {
+	return fprintf(file, "%s\t%llu\t%lld\t%s\t%s\t%s\t%llu\t%s\n", entry.input.c_str(), entry.size, entry.mtime,
+		entry.headerDigest.c_str(), entry.settings.c_str(), entry.output.c_str(), entry.outputSize,
+		entry.outputDigest.c_str()) > 0;
+}
+
+bool Manifest::save() {
+	lock_guard<mutex> lock(_mutex);
+	string temporary = _path + ".tmp";
+	FILE* file = fopen(temporary.c_str(), "w");
+	if (!file)
+		return _ok = false;
+
+	bool written = fprintf(file, "%s\n", MANIFEST_SIGNATURE) > 0;
+	for (map<string, ManifestEntry>::const_iterator it = _entries.begin(); it != _entries.end(); ++it)
+		written = append(file, it->second) && written;
+	written = fflush(file) == 0 && written;
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temporary.c_str(), _path.c_str()) != 0) {
+		remove(temporary.c_str());
+		return _ok = false;
+	}
+
+	//Later records go to the new file
+	if (_journal)
+		fclose(_journal);
+	_journal = fopen(_path.c_str(), "a");
+	if (!_journal)
+		_ok = false;
+	return _ok;
+}
+
+bool Manifest::ok() const {
+	lock_guard<mutex> lock(_mutex);
+	return _ok;
+}
@@ -0,0 +1,97 @@
+//MANIFEST  Record of earlier conversions, so that a re-run only converts what changed.
+//   One line per input holds its size, modification time and header digest, the settings
+//   it was converted with, and the CFS it became with that file's size and SHA1. An input
+//   whose size and modification time are as recorded, with the same settings and with its
+//   CFS still there at the recorded size, is up to date; telling takes a stat of the two
+//   files and never opens the EDF. Conversions are appended as they finish, so a run that
+//   is interrupted keeps what it did, and save() rewrites the file with a single line per
+//   input through a temporary and a rename. Lines are tab separated, later ones win.
+//
+//   Each shard of a run split over several nodes keeps a manifest of its own next to the
+//   one given, named with shardName(), and also consults the given one for files converted
+//   before; cfsmerge merges the shard manifests back into it.
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include "converter.h"
+
+using namespace std;
+
+#define MANIFEST_SIGNATURE "# edf2cfs manifest 1"
+
+struct ManifestEntry {
+	ManifestEntry() : size(0), mtime(0), outputSize(0) {}
+
+	string input;                // absolute path of the EDF
+	unsigned long long size;
+	long long mtime;             // nanoseconds since the epoch
+	string headerDigest;         // SHA1 of the EDF header, in hex
+	string settings;             // as manifestSettings() gives them
+	string output;               // absolute path of the CFS
+	unsigned long long outputSize;
+	string outputDigest;         // SHA1 stored in the CFS header, in hex
+};
+
+enum ManifestState {
+	MANIFEST_UNKNOWN,            // never converted to this output
+	MANIFEST_STALE,              // converted, but the input, settings or output changed since
+	MANIFEST_CURRENT
+};
+
+//Size and modification time of path, false if it can not be stat'ed
+bool fileStamp(const string& path, unsigned long long& size, long long& mtime);
+
+//SHA1 of the fixed and per-signal header records of the EDF at path, in hex
+bool headerDigest(const string& path, string& digest);
+
+//The options that change the output, inputs converted with others are converted again:
+//the channel labels, the precision, the codec and the block size
+string manifestSettings(const Converter::Options& options);
+
+class Manifest {
+public:
+	explicit Manifest(const string& path);
+	~Manifest();
+
+	//Loads the entries of earlier runs and opens the file for appending, a missing
+	//manifest starts empty
+	bool open();
+
+	//Also consults the entries of the manifest at path where this one has none of its own;
+	//they are neither changed nor saved. False if there is none
+	bool inherit(const string& path);
+
+	//Adds the entries of the manifest at path as if they had been recorded here, replacing
+	//those of the same inputs; save() writes them. False if there is none
+	bool merge(const string& path);
+
+	//State of input for a conversion to output with settings, from any thread
+	ManifestState check(const string& input, const string& settings, const string& output) const;
+
+	//Records a finished conversion and appends it to the file, from any thread. The paths
+	//may be relative, they are stored as absolute ones
+	void record(ManifestEntry entry);
+
+	//Rewrites the file with one line per input, replacing it only once complete
+	bool save();
+
+	//False once any line could not be written
+	bool ok() const;
+
+private:
+	Manifest(const Manifest&) = delete;
+	Manifest& operator=(const Manifest&) = delete;
+
+	bool append(FILE* file, const ManifestEntry& entry) const;
+
+	string _path;
+	mutable mutex _mutex;
+	map<string, ManifestEntry> _entries; // by input
+	map<string, ManifestEntry> _inherited; // of the manifest inherit() read
+	FILE* _journal;
+	bool _ok;
+};
@@ -0,0 +1,50 @@
+#include "memorybudget.h"
+#include <sys/resource.h>
+
+using namespace std;
+
+MemoryBudget::MemoryBudget(unsigned long long bytes) : _total(bytes), _reserved(0) {
+}
+
+bool MemoryBudget::fits(unsigned long long bytes) const {
+	return _reserved == 0 || _reserved + bytes <= _total;
+}
+
+bool MemoryBudget::tryAcquire(unsigned long long bytes) {
+	lock_guard<mutex> lock(_mutex);
+	if (!fits(bytes))
+		return false;
+	_reserved += bytes;
+	return true;
+}
+
+void MemoryBudget::acquire(unsigned long long bytes) {
+	unique_lock<mutex> lock(_mutex);
+	_released.wait(lock, [this, bytes]() { return fits(bytes); });
+	_reserved += bytes;
+}
+
+void MemoryBudget::release(unsigned long long bytes) {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_reserved -= bytes;
+	}
+	_released.notify_all();
+}
+
+bool MemoryBudget::wouldFit(unsigned long long bytes) const {
+	lock_guard<mutex> lock(_mutex);
+	return fits(bytes);
+}
+
+unsigned long long peakResidentBytes() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#if defined(__APPLE__) || defined(__MACH__)
+	return (unsigned long long)usage.ru_maxrss;
+#else
+	//Linux reports kilobytes
+	return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+}
@@ -0,0 +1,59 @@
+//MEMORYBUDGET  Admission control for the memory held by conversions running in parallel.
+//   Each conversion reserves its estimated peak footprint before it allocates anything and
+//   gives it back when it is done. A reservation that does not fit waits for others to be
+//   released, except that one conversion is always let through so a single file larger
+//   than the budget still runs (on its own).
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+class MemoryBudget {
+public:
+	explicit MemoryBudget(unsigned long long bytes);
+
+	//Reserves bytes if they fit right now
+	bool tryAcquire(unsigned long long bytes);
+
+	//Reserves bytes, waiting for other reservations to be released if needed
+	void acquire(unsigned long long bytes);
+
+	void release(unsigned long long bytes);
+
+	//Whether a reservation of bytes would be let through right now, without reserving it
+	bool wouldFit(unsigned long long bytes) const;
+
+	unsigned long long total() const { return _total; }
+
+private:
+	bool fits(unsigned long long bytes) const;
+
+	unsigned long long _total;
+	unsigned long long _reserved;
+	mutable mutex _mutex;
+	condition_variable _released;
+};
+
+//Releases a reservation when it goes out of scope
+class MemoryReservation {
+public:
+	MemoryReservation() : _budget(NULL), _bytes(0) {}
+	~MemoryReservation() { reset(); }
+
+	//Takes over bytes already reserved on budget
+	void adopt(MemoryBudget* budget, unsigned long long bytes) { reset(); _budget = budget; _bytes = bytes; }
+	void reset() { if (_budget) _budget->release(_bytes); _budget = NULL; _bytes = 0; }
+
+private:
+	MemoryReservation(const MemoryReservation&) = delete;
+	MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+	MemoryBudget* _budget;
+	unsigned long long _bytes;
+};
+
+//Peak resident set size of the whole process so far, 0 where it is not available
+unsigned long long peakResidentBytes();
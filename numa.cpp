@@ -0,0 +1,88 @@
+#include "numa.h"
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdlib.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+
+//CPUs of a list such as "0-15,32-47"
+static vector<int> parseCpuList(const string& text) {
+	vector<int> cpus;
+	stringstream list(text);
+	string range;
+	while (getline(list, range, ',')) {
+		char* end = NULL;
+		long first = strtol(range.c_str(), &end, 10);
+		if (end == range.c_str())
+			continue;
+		long last = (*end == '-') ? strtol(end + 1, NULL, 10) : first;
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			cpus.push_back((int)cpu);
+	}
+	return cpus;
+}
+
+vector<NumaNode> numaNodes() {
+	vector<NumaNode> nodes;
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return nodes;
+
+	const string root = "/sys/devices/system/node/";
+	DIR* listing = opendir(root.c_str());
+	if (!listing)
+		return nodes;
+	while (struct dirent* item = readdir(listing)) {
+		string name = item->d_name;
+		if (name.compare(0, 4, "node") != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != string::npos)
+			continue;
+		ifstream in((root + name + "/cpulist").c_str());
+		string text;
+		if (!getline(in, text))
+			continue;
+
+		NumaNode node;
+		node.id = (unsigned)strtoul(name.c_str() + 4, NULL, 10);
+		vector<int> cpus = parseCpuList(text);
+		for (size_t i = 0; i < cpus.size(); i++)
+			if (CPU_ISSET(cpus[i], &allowed))
+				node.cpus.push_back(cpus[i]);
+		//Memory-only nodes and nodes outside a cpuset get no workers
+		if (!node.cpus.empty())
+			nodes.push_back(node);
+	}
+	closedir(listing);
+
+	sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+	return nodes;
+}
+
+bool numaPinThread(const NumaNode& node) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (size_t i = 0; i < node.cpus.size(); i++)
+		CPU_SET(node.cpus[i], &cpus);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+#else
+
+vector<NumaNode> numaNodes() {
+	return vector<NumaNode>();
+}
+
+bool numaPinThread(const NumaNode&) {
+	return false;
+}
+
+#endif
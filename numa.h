@@ -0,0 +1,23 @@
+//NUMA  Placement of worker threads on the NUMA nodes of a multi-socket host.
+//   Nodes and their CPUs are read from /sys/devices/system/node on Linux, limited to the
+//   CPUs the process may run on; elsewhere no nodes are found and nothing is pinned.
+//   Linux puts a page on the node of the thread that first touches it, so a worker pinned
+//   to the CPUs of a node gets its read buffers, filter state and arena from that node as
+//   long as it fills them itself; ThreadPool keeps the helpers of a file on its node too.
+
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+struct NumaNode {
+	unsigned id;                 // number of the node in /sys
+	vector<int> cpus;            // that the process may run on
+};
+
+//Nodes with at least one usable CPU, empty if they can not be found
+vector<NumaNode> numaNodes();
+
+//Restricts the calling thread to the CPUs of node, false if that is not possible
+bool numaPinThread(const NumaNode& node);
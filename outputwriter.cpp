@@ -0,0 +1,307 @@
+#include "outputwriter.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+struct OutputFile::State {
+	State() : fd(-1), discard(false), closed(false) {}
+
+	int fd;
+	string partname;
+	string filename;             // set by finish()
+	bool discard;                // removed instead of renamed
+	string error;
+	bool closed;
+	mutex lock;
+	condition_variable done;
+};
+
+typedef OutputFile::State FileState;
+
+static const char* syncNames[] = { "file", "batch", "none" };
+
+bool parseOutputSync(const string& text, OutputSync& sync) {
+	for (int i = 0; i < 3; i++)
+		if (text == syncNames[i]) {
+			sync = (OutputSync)i;
+			return true;
+		}
+	return false;
+}
+
+static bool failed(FileState& file) {
+	lock_guard<mutex> lock(file.lock);
+	return !file.error.empty();
+}
+
+static void fail(FileState& file, const string& message) {
+	lock_guard<mutex> lock(file.lock);
+	if (file.error.empty())
+		file.error = message + ": " + strerror(errno);
+}
+
+//Writes all count buffers one after another from offset, in one call unless it comes back short
+static bool writeAt(int fd, struct iovec* iov, int count, uint64_t offset) {
+	while (count > 0) {
+#if defined(__linux__) || defined(__FreeBSD__)
+		ssize_t written = pwritev(fd, iov, count, (off_t)offset);
+#else
+		ssize_t written = (lseek(fd, (off_t)offset, SEEK_SET) < 0) ? -1 : writev(fd, iov, count);
+#endif
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0) {
+			if (written == 0)
+				errno = EIO;
+			return false;
+		}
+		offset += written;
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+//head, if any, goes to 0 and data to offset, both in one call when they are adjacent
+static void writeBuffers(FileState& file, const vector<unsigned char>* head, const vector<unsigned char>& data, uint64_t offset) {
+	if (failed(file))
+		return;
+	struct iovec iov[2];
+	int count = 0;
+	uint64_t start = offset;
+	if (head && !head->empty()) {
+		iov[count].iov_base = (void*)head->data();
+		iov[count++].iov_len = head->size();
+		if (offset != head->size()) {
+			if (!writeAt(file.fd, iov, count, 0)) {
+				fail(file, "Writing " + file.partname);
+				return;
+			}
+			count = 0;
+		}
+		else
+			start = 0;
+	}
+	if (!data.empty()) {
+		iov[count].iov_base = (void*)data.data();
+		iov[count++].iov_len = data.size();
+	}
+	if (count > 0 && !writeAt(file.fd, iov, count, start))
+		fail(file, "Writing " + file.partname);
+}
+
+//Syncs unless told not to, closes and renames or removes the file, and wakes finish()
+static void completeFile(FileState& file, bool sync) {
+	bool keep = !file.discard && !failed(file);
+	if (keep && sync) {
+#if defined(__linux__)
+		bool synced = fdatasync(file.fd) == 0;
+#else
+		bool synced = fsync(file.fd) == 0;
+#endif
+		//On disk before the rename, or a crash could leave an empty file under the real name
+		if (!synced) {
+			fail(file, "Syncing " + file.partname);
+			keep = false;
+		}
+	}
+	if (close(file.fd) != 0 && keep) {
+		fail(file, "Writing " + file.partname);
+		keep = false;
+	}
+	file.fd = -1;
+	if (keep && rename(file.partname.c_str(), file.filename.c_str()) != 0) {
+		fail(file, "Renaming " + file.partname + " to " + file.filename);
+		keep = false;
+	}
+	if (!keep)
+		unlink(file.partname.c_str());
+
+	{
+		lock_guard<mutex> lock(file.lock);
+		file.closed = true;
+	}
+	file.done.notify_all();
+}
+
+OutputFile::OutputFile() : _writer(NULL) {
+}
+
+OutputFile::~OutputFile() {
+	abandon();
+}
+
+bool OutputFile::open(const string& partname, OutputWriter* writer) {
+	abandon();
+	_writer = writer;
+	_state.reset(new State());
+	_state->partname = partname;
+	_state->fd = ::open(partname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (_state->fd < 0) {
+		fail(*_state, "Opening " + partname);
+		return false;
+	}
+	return true;
+}
+
+bool OutputFile::write(vector<unsigned char>& data, uint64_t offset) {
+	if (!_state || failed(*_state))
+		return false;
+	if (!_writer) {
+		writeBuffers(*_state, NULL, data, offset);
+		data.clear();
+		return !failed(*_state);
+	}
+	OutputWriter::Job job;
+	job.file = _state;
+	job.data.swap(data);
+	job.offset = offset;
+	return _writer->submit(job);
+}
+
+bool OutputFile::finish(vector<unsigned char>& head, vector<unsigned char>& data, uint64_t offset, const string& filename) {
+	if (!_state || _state->fd < 0)
+		return false;
+	_state->filename = filename;
+	if (!_writer) {
+		writeBuffers(*_state, &head, data, offset);
+		completeFile(*_state, true);
+	}
+	else {
+		OutputWriter::Job job;
+		job.file = _state;
+		job.head.swap(head);
+		job.data.swap(data);
+		job.offset = offset;
+		job.finish = true;
+		if (!_writer->submit(job))
+			return false;
+		unique_lock<mutex> lock(_state->lock);
+		while (!_state->closed)
+			_state->done.wait(lock);
+	}
+	return !failed(*_state);
+}
+
+void OutputFile::abandon() {
+	if (!_state || _state->fd < 0 || !_state->filename.empty())
+		return;
+	_state->discard = true;
+	if (!_writer) {
+		completeFile(*_state, false);
+		return;
+	}
+
+	//The writer may still have buffers of the file, it is closed after them
+	OutputWriter::Job job;
+	job.file = _state;
+	job.finish = true;
+	if (!_writer->submit(job))
+		return;
+	unique_lock<mutex> lock(_state->lock);
+	while (!_state->closed)
+		_state->done.wait(lock);
+}
+
+string OutputFile::error() const {
+	if (!_state)
+		return string();
+	lock_guard<mutex> lock(_state->lock);
+	return _state->error;
+}
+
+OutputWriter::OutputWriter(OutputSync sync, unsigned long long budgetBytes) :
+	_sync(sync), _budget(budgetBytes), _queued(0), _stopping(false) {
+	_thread = thread(&OutputWriter::ioLoop, this);
+}
+
+OutputWriter::~OutputWriter() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeUp.notify_all();
+	_thread.join();
+}
+
+bool OutputWriter::submit(Job& job) {
+	unsigned long long bytes = job.head.size() + job.data.size();
+	{
+		unique_lock<mutex> lock(_mutex);
+		//A buffer larger than the whole budget still goes once nothing else is queued
+		while (!_stopping && _queued > 0 && _queued + bytes > _budget)
+			_drained.wait(lock);
+		if (_stopping)
+			return false;
+		_queued += bytes;
+		_queue.push_back(move(job));
+	}
+	_wakeUp.notify_one();
+	return true;
+}
+
+void OutputWriter::ioLoop() {
+	vector< shared_ptr<FileState> > batch;
+	while (true) {
+		Job job;
+		{
+			unique_lock<mutex> lock(_mutex);
+			while (_queue.empty() && batch.empty() && !_stopping)
+				_wakeUp.wait(lock);
+			if (_queue.empty() && batch.empty())
+				return;
+			if (!_queue.empty()) {
+				job = move(_queue.front());
+				_queue.pop_front();
+			}
+		}
+
+		//Files waiting for their sync are done together once nothing else is to be written
+		if (!job.file) {
+			syncBatch(batch);
+			continue;
+		}
+		writeBuffers(*job.file, &job.head, job.data, job.offset);
+		unsigned long long bytes = job.head.size() + job.data.size();
+		job.head = vector<unsigned char>();
+		job.data = vector<unsigned char>();
+		{
+			lock_guard<mutex> lock(_mutex);
+			_queued -= bytes;
+		}
+		_drained.notify_all();
+
+		if (!job.finish)
+			continue;
+		if (_sync == OUTPUT_SYNC_BATCH && !job.file->discard) {
+			batch.push_back(job.file);
+			if (batch.size() >= OUTPUTWRITER_BATCHFILES)
+				syncBatch(batch);
+		}
+		else
+			completeFile(*job.file, _sync == OUTPUT_SYNC_FILE);
+	}
+}
+
+void OutputWriter::syncBatch(vector< shared_ptr<FileState> >& batch) {
+#ifdef SYNC_FILE_RANGE_WRITE
+	//Writeback of every file is under way before the first sync waits for its own
+	for (size_t i = 0; i < batch.size(); i++)
+		if (!failed(*batch[i]))
+			sync_file_range(batch[i]->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+	for (size_t i = 0; i < batch.size(); i++)
+		completeFile(*batch[i], true);
+	batch.clear();
+}
@@ -0,0 +1,107 @@
+//OUTPUTWRITER  Writes CFS files to disk on a thread of its own.
+//   A worker hands over whole buffers of a file, each with the offset it goes to, and goes
+//   back to computing while the writer thread puts them out with one pwritev per buffer, so
+//   a slow disk or network filesystem only holds up the writer. Bytes handed over and not
+//   yet written are limited to a budget; a worker only waits when it is that far ahead.
+//   finish() writes the last buffer together with the header, syncs the file and renames it
+//   into place, and waits for that to be done so its result is true. With OUTPUT_SYNC_BATCH
+//   the files finishing while others are still being written are synced together once the
+//   queue runs empty, their writeback started for all of them before waiting on any.
+//   An OutputFile without a writer does the same writes on the calling thread.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+using namespace std;
+
+#define OUTPUTWRITER_QUEUEBYTES (64 << 20)
+#define OUTPUTWRITER_BATCHFILES (32)
+
+enum OutputSync {
+	OUTPUT_SYNC_FILE,            // each file is synced on its own before the rename
+	OUTPUT_SYNC_BATCH,           // files finishing together are synced together
+	OUTPUT_SYNC_NONE             // renamed without a sync, a crash can leave empty files
+};
+
+//Parses "file", "batch" or "none"
+bool parseOutputSync(const string& text, OutputSync& sync);
+
+class OutputWriter;
+
+//A file written at given offsets, created under a temporary name and renamed by finish()
+class OutputFile {
+public:
+	OutputFile();
+	~OutputFile();
+
+	//Creates partname, written through writer or on this thread for NULL
+	bool open(const string& partname, OutputWriter* writer);
+
+	//Writes data at offset, taking it over. False once a write of this file has failed
+	bool write(vector<unsigned char>& data, uint64_t offset);
+
+	//Writes head at 0 and data at offset, syncs, closes and renames the file to filename
+	bool finish(vector<unsigned char>& head, vector<unsigned char>& data, uint64_t offset, const string& filename);
+
+	//Closes and removes the file unless it is finished
+	void abandon();
+
+	//What went wrong
+	string error() const;
+
+	struct State;
+
+private:
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+
+	OutputWriter* _writer;
+	shared_ptr<State> _state;
+};
+
+class OutputWriter {
+public:
+	explicit OutputWriter(OutputSync sync = OUTPUT_SYNC_FILE, unsigned long long budgetBytes = OUTPUTWRITER_QUEUEBYTES);
+	~OutputWriter();
+
+	OutputSync sync() const { return _sync; }
+
+private:
+	friend class OutputFile;
+
+	OutputWriter(const OutputWriter&) = delete;
+	OutputWriter& operator=(const OutputWriter&) = delete;
+
+	//Buffers of one file and where they go; a finishing job also syncs and renames it
+	struct Job {
+		Job() : offset(0), finish(false) {}
+
+		shared_ptr<OutputFile::State> file;
+		vector<unsigned char> head;
+		vector<unsigned char> data;
+		uint64_t offset;
+		bool finish;
+	};
+
+	//Queues job, waiting while the budget is used up, false once the writer has stopped
+	bool submit(Job& job);
+	void ioLoop();
+	void syncBatch(vector< shared_ptr<OutputFile::State> >& batch);
+
+	OutputSync _sync;
+	unsigned long long _budget;
+	unsigned long long _queued;          // bytes of the jobs not written yet
+	deque<Job> _queue;
+	mutex _mutex;
+	condition_variable _wakeUp, _drained;
+	bool _stopping;
+	thread _thread;
+};
@@ -0,0 +1,625 @@
+#include "pipeline.h"
+#include "resample.h"
+#include "filtercache.h"
+#include "simd.h"
+#include "profile.h"
+#include "cancel.h"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+using namespace std;
+
+#define SAMPLINGRATE (100)
+
+//The channels of an epoch are transformed in one batch
+#if SPECTRAL_BATCH != PIPELINE_CHANNELS
+#error SPECTRAL_BATCH must match PIPELINE_CHANNELS
+#endif
+
+//Polyphase table of a cached design in the precision of the stage
+static shared_ptr< const PolyphaseTable<double> > designTable(const ResampleDesign& design, double*) {
+	return design.polyphase;
+}
+
+static shared_ptr< const PolyphaseTable<float> > designTable(const ResampleDesign& design, float*) {
+	return design.polyphaseFloat;
+}
+
+//Resampling loops compiled for the usual rates, with the band-pass of CONVERTER_FILTERORDER
+//merged in. Factors are reduced by their GCD, e.g. 25/32 for 128 Hz, and the phase
+//lengths are those of the designs, padded to the SIMD width of the precision. Other rates,
+//or other filters, keep the generic loop
+static void specializeResampler(Resampler<double, double, double>& resampler) {
+	resampler.specialize<25, 32, 80>()                // 128 Hz
+		|| resampler.specialize<1, 2, 96>()           // 200 Hz
+		|| resampler.specialize<25, 64, 108>()        // 256 Hz
+		|| resampler.specialize<1, 5, 156>()          // 500 Hz
+		|| resampler.specialize<25, 128, 160>();      // 512 Hz
+}
+
+static void specializeResampler(Resampler<float, float, float>& resampler) {
+	resampler.specialize<25, 32, 80>()
+		|| resampler.specialize<1, 2, 96>()
+		|| resampler.specialize<25, 64, 112>()
+		|| resampler.specialize<1, 5, 160>()
+		|| resampler.specialize<25, 128, 160>();
+}
+
+static atomic<bool> resamplerSpecialization(true);
+
+void setResamplerSpecialization(bool specialize) {
+	resamplerSpecialization = specialize;
+}
+
+template<class T>
+FirStage<T>::FirStage(const vector<double>& taps) :
+	_reversedTaps(taps.rbegin(), taps.rend()), _window(taps.empty() ? 0 : taps.size() - 1, 0), _skip(taps.size() / 2) {
+	if (taps.empty())
+		throw invalid_argument("FIR filter needs at least one tap");
+	if (taps.size() >= FFTCONV_MINTAPS)
+		_fft.reset(new FftConvolver<T>(taps));
+}
+
+template<class T>
+void FirStage<T>::push(const T* x, size_t count, ArenaVector<T>& out) {
+	copy(x, x + count, reserve(count));
+	filter(count, out);
+}
+
+template<class T>
+T* FirStage<T>::reserve(size_t count) {
+	//Samples before the first chunk are zero, as in a full convolution
+	size_t history = _reversedTaps.size() - 1;
+	_window.resize(history + count);
+	return &_window[0] + history;
+}
+
+template<class T>
+void FirStage<T>::filter(size_t count, ArenaVector<T>& out) {
+	size_t taps = _reversedTaps.size();
+	size_t history = taps - 1;
+
+	size_t first = min(_skip, count);
+	_skip -= first;
+
+	size_t base = out.size();
+	out.resize(base + count - first);
+	T* y = &out[0] + base;
+	const T* h = &_reversedTaps[0];
+
+	if (_fft && FftConvolver<T>::worthwhile(taps, count)) {
+		_fftOut.resize(count);
+		_fft->filter(&_window[0], count, &_fftOut[0]);
+		copy(_fftOut.begin() + first, _fftOut.end(), y);
+	}
+	else {
+		//Oldest to newest sample of the window ending at input i
+		for (size_t i = first; i < count; i++)
+			*y++ = simdDot(h, &_window[i], (int)taps);
+	}
+
+	copy(_window.end() - history, _window.end(), _window.begin());
+	_window.resize(history);
+}
+
+template<class T>
+void FirStage<T>::finish(ArenaVector<T>& out) {
+	ArenaVector<T> zeros(_reversedTaps.size() / 2, 0);
+	if (!zeros.empty())
+		push(&zeros[0], zeros.size(), out);
+}
+
+template<class T>
+CombineFirStage<T>::CombineFirStage(const vector<double>& weights, const vector<double>& taps) :
+	FirStage<T>(taps), _weights(weights.begin(), weights.end()) {
+	if (weights.empty())
+		throw invalid_argument("channel combination needs at least one weight");
+}
+
+template<class T>
+void CombineFirStage<T>::push(const double* const* inputs, size_t count, ArenaVector<T>& out) {
+	T* x = this->reserve(count);
+	size_t channels = _weights.size();
+
+	const double* in = inputs[0];
+	T w = _weights[0];
+	for (size_t i = 0; i < count; i++)
+		x[i] = (T)in[i] * w;
+	for (size_t c = 1; c < channels; c++) {
+		in = inputs[c];
+		w = _weights[c];
+		for (size_t i = 0; i < count; i++)
+			x[i] += (T)in[i] * w;
+	}
+
+	this->filter(count, out);
+}
+
+template<class T>
+ResampleStage<T>::ResampleStage(int upFactor, int downFactor, long long inputSize,
+	const vector<double>& prefilter) : _up(1), _down(1), _delay(0), _outputSize(inputSize), _skip(0), _remaining(0) {
+	if (upFactor <= 0 || downFactor <= 0)
+		throw runtime_error("factors must be positive integer");
+
+	int gcd = getGCD(upFactor, downFactor);
+	upFactor /= gcd;
+	downFactor /= gcd;
+	_up = upFactor;
+	_down = downFactor;
+
+	_passThrough = (upFactor == downFactor);
+	if (_passThrough) {
+		if (!prefilter.empty())
+			throw invalid_argument("no rate change, the prefilter needs a FirStage");
+		return;
+	}
+
+	//Designed once per rate pair (and prefilter) and shared by every stage
+	shared_ptr<const ResampleDesign> design = cachedResampleDesign(upFactor, downFactor, prefilter);
+	_resampler.reset(new Resampler<T, T, T>(upFactor, downFactor, designTable(*design, (T*)NULL)));
+	if (resamplerSpecialization)
+		specializeResampler(*_resampler);
+
+	_skip = _delay = design->delay;
+	_remaining = _outputSize = (inputSize * upFactor + downFactor - 1) / downFactor;
+}
+
+template<class T>
+void ResampleStage<T>::setInputSize(long long inputSize) {
+	long long outputSize = _passThrough ? inputSize : (inputSize * _up + _down - 1) / _down;
+	_remaining += outputSize - _outputSize;
+	_outputSize = outputSize;
+}
+
+template<class T>
+int ResampleStage<T>::history() const {
+	return _resampler ? _resampler->stride() - 1 : 0;
+}
+
+template<class T>
+void ResampleStage<T>::push(const T* x, size_t count, ArenaVector<T>& out) {
+	if (_passThrough) {
+		out.insert(out.end(), x, x + count);
+		return;
+	}
+	if (count == 0)
+		return;
+
+	int needed = _resampler->neededOutCount((int)count);
+	_scratch.resize(needed);
+	int computed = _resampler->apply(const_cast<T*>(x), (int)count, _scratch.data(), needed);
+	emit(_scratch.data(), computed, out);
+}
+
+template<class T>
+void ResampleStage<T>::finish(ArenaVector<T>& out) {
+	if (_passThrough)
+		return;
+
+	//Flush the filter with zeros until the resampled length is complete
+	ArenaVector<T> zeros(max(_resampler->coefsPerPhase(), 64), 0);
+	while (_remaining > 0)
+		push(&zeros[0], zeros.size(), out);
+}
+
+template<class T>
+void ResampleStage<T>::emit(const T* y, size_t count, ArenaVector<T>& out) {
+	size_t skipped = (size_t)min<long long>(_skip, count);
+	_skip -= skipped;
+	y += skipped;
+	count -= skipped;
+
+	size_t kept = (size_t)min<long long>(_remaining, count);
+	_remaining -= kept;
+	out.insert(out.end(), y, y + kept);
+}
+
+template<class T>
+ChannelStage<T>::ChannelStage(const vector<double>& weights, const vector<double>& taps, int rate, long long inputSize) :
+	_weightValues(weights), _taps(taps), _rate(rate), _inputSize(inputSize), _weights(weights.begin(), weights.end()) {
+	if (rate <= 0)
+		throw runtime_error("factors must be positive integer");
+	if (weights.empty())
+		throw invalid_argument("channel combination needs at least one weight");
+
+	int gcd = getGCD(SAMPLINGRATE, rate);
+	bool resampled = (SAMPLINGRATE / gcd != rate / gcd);
+	if (!resampled)
+		_fir.reset(new CombineFirStage<T>(weights, taps));
+	else if (taps.size() >= FFTCONV_MINTAPS) {
+		//Merged into the polyphase filter a long band-pass would be applied directly
+		_fir.reset(new CombineFirStage<T>(weights, taps));
+		_resample.reset(new ResampleStage<T>(SAMPLINGRATE, rate, inputSize));
+	}
+	else
+		_resample.reset(new ResampleStage<T>(SAMPLINGRATE, rate, inputSize, taps));
+}
+
+template<class T>
+void ChannelStage<T>::push(const double* const* inputs, size_t count, ArenaVector<T>& out) {
+	if (_fir && _resample) {
+		_filtered.clear();
+		{
+			ScopedTimer timer(PROFILE_FILTER);
+			_fir->push(inputs, count, _filtered);
+		}
+		ScopedTimer timer(PROFILE_RESAMPLE);
+		_resample->push(_filtered.data(), _filtered.size(), out);
+		return;
+	}
+	if (_fir) {
+		ScopedTimer timer(PROFILE_FILTER);
+		_fir->push(inputs, count, out);
+		return;
+	}
+
+	ScopedTimer timer(PROFILE_RESAMPLE);
+	_combined.resize(count);
+	for (size_t i = 0; i < count; i++)
+		_combined[i] = (T)inputs[0][i] * _weights[0];
+	for (size_t c = 1; c < _weights.size(); c++)
+		for (size_t i = 0; i < count; i++)
+			_combined[i] += (T)inputs[c][i] * _weights[c];
+
+	_resample->push(_combined.data(), count, out);
+}
+
+template<class T>
+void ChannelStage<T>::finish(ArenaVector<T>& out) {
+	if (_fir && _resample) {
+		_filtered.clear();
+		{
+			ScopedTimer timer(PROFILE_FILTER);
+			_fir->finish(_filtered);
+		}
+		ScopedTimer timer(PROFILE_RESAMPLE);
+		_resample->push(_filtered.data(), _filtered.size(), out);
+		_resample->finish(out);
+	}
+	else if (_fir) {
+		ScopedTimer timer(PROFILE_FILTER);
+		_fir->finish(out);
+	}
+	else {
+		ScopedTimer timer(PROFILE_RESAMPLE);
+		_resample->finish(out);
+	}
+}
+
+template<class T>
+long long ChannelStage<T>::outputSize() const {
+	return _resample ? _resample->outputSize() : _inputSize;
+}
+
+template<class T>
+void ChannelStage<T>::setInputSize(long long inputSize) {
+	_inputSize = inputSize;
+	if (_resample)
+		_resample->setInputSize(inputSize);
+}
+
+template<class T>
+bool ChannelStage<T>::splittable() const {
+	return !(_fir && _resample) && _taps.size() < FFTCONV_MINTAPS;
+}
+
+template<class T>
+void ChannelStage<T>::segment(const double* const* inputs, long long first, long long last, T* out) const {
+	if (first >= last)
+		return;
+	bool whole = first == 0 && last == outputSize();
+	if (!whole && !splittable())
+		throw logic_error("channel stage can not be split into segments");
+
+	//First input to feed, so the window of output first holds no zeros from before it, and
+	//the end of the inputs that complete output last - 1. A FIR output o ends at input
+	//o + taps/2 and reaches taps - 1 inputs back
+	long long start, end, base;
+	if (whole) {
+		start = base = 0;
+		end = _inputSize;
+	}
+	else if (_resample) {
+		int align = _resample->inputAlignment();
+		start = max(0LL, (_resample->inputOf(first) - _resample->history()) / align * align);
+		end = _resample->inputOf(last - 1) + 1;
+		base = start / align * SAMPLINGRATE / getGCD(SAMPLINGRATE, _rate);
+	}
+	else {
+		long long half = (long long)_taps.size() / 2;
+		start = max(0LL, first + half - (long long)_taps.size() + 1);
+		end = last + half;
+		base = start;
+	}
+	end = min(end, _inputSize);
+
+	ChannelStage<T> part(_weightValues, _taps, _rate, _inputSize - start);
+	vector<const double*> shifted(_weightValues.size());
+	for (size_t c = 0; c < shifted.size(); c++)
+		shifted[c] = inputs[c] + start;
+
+	ArenaVector<T> y;
+	part.push(shifted.data(), (size_t)(end - start), y);
+	if (end == _inputSize)
+		part.finish(y);
+	if ((long long)y.size() < last - base)
+		throw logic_error("channel segment ended early");
+	copy(y.begin() + (first - base), y.begin() + (last - base), out);
+}
+
+template<class T>
+long long ChannelStage<T>::warmup() const {
+	long long inputs = 0;
+	if (_fir)
+		inputs += (long long)_taps.size();
+	if (_resample)
+		inputs += _resample->history() + _resample->inputAlignment();
+	return inputs;
+}
+
+template class FirStage<double>;
+template class FirStage<float>;
+template class CombineFirStage<double>;
+template class CombineFirStage<float>;
+template class ResampleStage<double>;
+template class ResampleStage<float>;
+template class ChannelStage<double>;
+template class ChannelStage<float>;
+
+class ConversionPipeline::Channels {
+public:
+	Channels() : epochs(0) {}
+	virtual ~Channels() {}
+	virtual void push(const double* c3, const double* c4, size_t eegCount,
+		const double* el, size_t elCount, const double* er, size_t erCount) = 0;
+	virtual void finish() = 0;
+	virtual void setSamples(long long eegSamples, long long elSamples, long long erSamples) = 0;
+	virtual void convertAll(const double* c3, const double* c4, size_t eegCount,
+		const double* el, size_t elCount, const double* er, size_t erCount,
+		const ParallelFor& parallel, unsigned width) = 0;
+
+	long long epochs;
+};
+
+template<class T>
+class PipelineChannels : public ConversionPipeline::Channels {
+public:
+	PipelineChannels(const PipelineSettings& settings, ConversionPipeline::EpochSink sink) :
+		_sink(sink), _logMagnitude(settings.logMagnitude),
+		_eeg(vector<double>{ settings.c3Mult / 2.0, settings.c4Mult / 2.0 }, settings.eegTaps, settings.eegRate, settings.eegSamples),
+		_el(vector<double>{ settings.elMult }, settings.elTaps, settings.elRate, settings.elSamples),
+		_er(vector<double>{ settings.erMult }, settings.erTaps, settings.erRate, settings.erSamples),
+		_consumed(0), _limit(settings.epochLimit), _epoch(PIPELINE_EPOCHSIZE) {
+		for (int c = 0; c < PIPELINE_CHANNELS; c++)
+			_skip[c] = settings.skipSamples;
+	}
+
+	void push(const double* c3, const double* c4, size_t eegCount,
+		const double* el, size_t elCount, const double* er, size_t erCount) {
+
+		//EEG is the mean of C3 and C4, scaled to uV and filtered in the same pass
+		const double* eeg[2] = { c3, c4 };
+		_eeg.push(eeg, eegCount, _pending[0]);
+		_el.push(&el, elCount, _pending[1]);
+		_er.push(&er, erCount, _pending[2]);
+
+		emitEpochs();
+	}
+
+	void finish() {
+		_eeg.finish(_pending[0]);
+		_el.finish(_pending[1]);
+		_er.finish(_pending[2]);
+
+		emitEpochs();
+	}
+
+	void setSamples(long long eegSamples, long long elSamples, long long erSamples) {
+		_eeg.setInputSize(eegSamples);
+		_el.setInputSize(elSamples);
+		_er.setInputSize(erSamples);
+	}
+
+	void convertAll(const double* c3, const double* c4, size_t eegCount,
+		const double* el, size_t elCount, const double* er, size_t erCount,
+		const ParallelFor& parallel, unsigned width);
+
+private:
+	void emitEpochs();
+	bool limitReached() const { return _limit >= 0 && epochs >= _limit; }
+
+	ConversionPipeline::EpochSink _sink;
+	bool _logMagnitude;
+	ChannelStage<T> _eeg, _el, _er;
+	ArenaVector<T> _pending[PIPELINE_CHANNELS];    // 100 Hz samples not yet in an epoch
+	size_t _consumed;
+	long long _skip[PIPELINE_CHANNELS];  // leading samples still to drop
+	long long _limit;
+	ArenaVector<float> _epoch;
+};
+
+template<class T>
+void PipelineChannels<T>::emitEpochs() {
+	SpectralEngine& stft = SpectralEngine::local();
+
+	//Nothing is consumed before every channel is past its skipped samples
+	for (int c = 0; c < PIPELINE_CHANNELS; c++) {
+		size_t dropped = (size_t)min(_skip[c], (long long)_pending[c].size());
+		_pending[c].erase(_pending[c].begin(), _pending[c].begin() + dropped);
+		_skip[c] -= dropped;
+	}
+
+	while (!limitReached()) {
+		for (int c = 0; c < PIPELINE_CHANNELS; c++)
+			if (_pending[c].size() < _consumed + SPECTRAL_EPOCHSAMPLES)
+				goto done;
+
+		{
+			ScopedTimer timer(PROFILE_SPECTROGRAM);
+			const T* x[PIPELINE_CHANNELS];
+			for (int c = 0; c < PIPELINE_CHANNELS; c++)
+				x[c] = &_pending[c][_consumed];
+			stft.spectrograms(x, &_epoch[0], _logMagnitude);
+		}
+
+		_sink(&_epoch[0]);
+		_consumed += SPECTRAL_EPOCHSAMPLES;
+		epochs++;
+	}
+
+done:
+	if (limitReached()) {
+		for (int c = 0; c < PIPELINE_CHANNELS; c++)
+			_pending[c].clear();
+		_consumed = 0;
+		return;
+	}
+
+	//Drop consumed samples once they outweigh what is still pending
+	for (int c = 0; c < PIPELINE_CHANNELS; c++)
+		if (_consumed > _pending[c].size() - _consumed)
+			goto compact;
+	return;
+
+compact:
+	for (int c = 0; c < PIPELINE_CHANNELS; c++)
+		_pending[c].erase(_pending[c].begin(), _pending[c].begin() + min(_consumed, _pending[c].size()));
+	_consumed = 0;
+}
+
+//Outputs [first, last) of one channel, converted by a task of convertAll()
+struct ChannelSegment {
+	int channel;
+	long long first, last;
+};
+
+template<class T>
+void PipelineChannels<T>::convertAll(const double* c3, const double* c4, size_t eegCount,
+	const double* el, size_t elCount, const double* er, size_t erCount,
+	const ParallelFor& parallel, unsigned width) {
+
+	ChannelStage<T>* stages[PIPELINE_CHANNELS] = { &_eeg, &_el, &_er };
+	const double* eeg[2] = { c3, c4 };
+	const double* const* inputs[PIPELINE_CHANNELS] = { eeg, &el, &er };
+	size_t counts[PIPELINE_CHANNELS] = { eegCount, elCount, erCount };
+	bool split = width > 1 && epochs == 0;
+	for (int c = 0; c < PIPELINE_CHANNELS; c++)
+		split = split && stages[c]->inputSize() == (long long)counts[c];
+	if (!split) {
+		push(c3, c4, eegCount, el, elCount, er, erCount);
+		finish();
+		return;
+	}
+
+	//Every channel at 100 Hz, then epochs a batch at a time. The phases are timed here as a
+	//whole, the timers inside the stages would only see the part run on this thread
+	FileProfile* profile = currentProfile();
+	ArenaVector<T> signals[PIPELINE_CHANNELS];
+	for (int c = 0; c < PIPELINE_CHANNELS; c++)
+		signals[c].resize((size_t)stages[c]->outputSize());
+	size_t samples = min(signals[0].size(), min(signals[1].size(), signals[2].size()));
+
+	//The channels are independent up to the epochs, each is a task of its own or, where the
+	//stage allows it, width segments. Whole channels go first, they take longest
+	vector<ChannelSegment> segments;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int c = 0; c < PIPELINE_CHANNELS; c++) {
+			bool splittable = stages[c]->splittable();
+			if (splittable != (pass == 1))
+				continue;
+			long long size = (long long)signals[c].size();
+			unsigned parts = splittable ? width : 1;
+			for (unsigned i = 0; i < parts; i++) {
+				ChannelSegment segment = { c, size * i / parts, size * (i + 1) / parts };
+				segments.push_back(segment);
+			}
+		}
+	}
+	{
+		ScopedTimer timer(profile, PROFILE_RESAMPLE);
+		ProfileScope untimed(NULL);
+		parallel(segments.size(), [&](size_t task) {
+			const ChannelSegment& segment = segments[task];
+			stages[segment.channel]->segment(inputs[segment.channel], segment.first, segment.last,
+				signals[segment.channel].data() + segment.first);
+		});
+	}
+	cancellationPoint();
+
+	//Trailing samples that do not fill an epoch are dropped, as in emitEpochs()
+	size_t skip = (size_t)min(_skip[0], (long long)samples);
+	size_t total = (samples - skip) / SPECTRAL_EPOCHSAMPLES;
+	if (_limit >= 0)
+		total = min(total, (size_t)_limit);
+	size_t batch = (size_t)width * PIPELINE_BATCHEPOCHS;
+	ArenaVector<float> epochsOut(min(batch, total) * PIPELINE_EPOCHSIZE);
+	for (size_t done = 0; done < total; done += batch) {
+		size_t count = min(batch, total - done);
+		cancellationPoint();
+		{
+			ScopedTimer timer(profile, PROFILE_SPECTROGRAM);
+			ProfileScope untimed(NULL);
+			parallel(count, [&](size_t i) {
+				SpectralEngine& stft = SpectralEngine::local();
+				size_t offset = skip + (done + i) * SPECTRAL_EPOCHSAMPLES;
+				const T* x[PIPELINE_CHANNELS];
+				for (int c = 0; c < PIPELINE_CHANNELS; c++)
+					x[c] = &signals[c][offset];
+				stft.spectrograms(x, &epochsOut[i * PIPELINE_EPOCHSIZE], _logMagnitude);
+			});
+		}
+		for (size_t i = 0; i < count; i++) {
+			_sink(&epochsOut[i * PIPELINE_EPOCHSIZE]);
+			epochs++;
+		}
+	}
+}
+
+double pipelineWarmup(const PipelineSettings& settings, int alignment[PIPELINE_CHANNELS]) {
+	ChannelStage<double> eeg(vector<double>{ settings.c3Mult / 2.0, settings.c4Mult / 2.0 }, settings.eegTaps, settings.eegRate, 0);
+	ChannelStage<double> el(vector<double>{ settings.elMult }, settings.elTaps, settings.elRate, 0);
+	ChannelStage<double> er(vector<double>{ settings.erMult }, settings.erTaps, settings.erRate, 0);
+	const ChannelStage<double>* stages[PIPELINE_CHANNELS] = { &eeg, &el, &er };
+	int rates[PIPELINE_CHANNELS] = { settings.eegRate, settings.elRate, settings.erRate };
+
+	double seconds = 0;
+	for (int c = 0; c < PIPELINE_CHANNELS; c++) {
+		seconds = max(seconds, (double)stages[c]->warmup() / rates[c]);
+		alignment[c] = stages[c]->inputAlignment();
+	}
+	return seconds;
+}
+
+ConversionPipeline::ConversionPipeline(const PipelineSettings& settings, EpochSink sink) {
+	if (settings.precision == PIPELINE_FLOAT)
+		_channels.reset(new PipelineChannels<float>(settings, sink));
+	else
+		_channels.reset(new PipelineChannels<double>(settings, sink));
+}
+
+ConversionPipeline::~ConversionPipeline() {
+}
+
+void ConversionPipeline::push(const double* c3, const double* c4, size_t eegCount,
+	const double* el, size_t elCount, const double* er, size_t erCount) {
+	_channels->push(c3, c4, eegCount, el, elCount, er, erCount);
+}
+
+void ConversionPipeline::finish() {
+	_channels->finish();
+}
+
+void ConversionPipeline::setSamples(long long eegSamples, long long elSamples, long long erSamples) {
+	_channels->setSamples(eegSamples, elSamples, erSamples);
+}
+
+void ConversionPipeline::convertAll(const double* c3, const double* c4, size_t eegCount,
+	const double* el, size_t elCount, const double* er, size_t erCount,
+	const ParallelFor& parallel, unsigned width) {
+	_channels->convertAll(c3, c4, eegCount, el, elCount, er, erCount, parallel, width);
+}
+
+long long ConversionPipeline::epochs() const {
+	return _channels->epochs;
+}
@@ -0,0 +1,212 @@
+//PIPELINE  Filter -> resample -> spectrogram stages of the EDF to CFS conversion.
+//   Every stage keeps the state it needs between calls, so a recording can be pushed in
+//   one piece or in chunks of datarecords and the output is the same either way. In
+//   chunks the memory used is bounded by the chunk size instead of the recording length.
+//   A recording that is in memory as a whole can also be converted on several threads:
+//   every channel is split into segments that start far enough back to see the same input
+//   samples as the single pass, and epochs are split into batches, which gives the same
+//   bytes as pushing it in one piece. Part of a recording is converted the same way, from
+//   the inputs around it, with the 100 Hz samples before the part skipped.
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include "upfirdn.h"
+#include "spectral.h"
+#include "fftconv.h"
+#include "arena.h"
+
+using namespace std;
+
+#define PIPELINE_CHANNELS (3)
+#define PIPELINE_EPOCHSIZE (PIPELINE_CHANNELS * SPECTRAL_WINDOWS * SPECTRAL_BINS)
+//Epochs per thread whose spectrograms are computed before they go to the sink in order
+#define PIPELINE_BATCHEPOCHS (16)
+
+//Runs task(0) .. task(count - 1), possibly in parallel, and returns once all have run
+typedef function<void(size_t count, const function<void(size_t)>& task)> ParallelFor;
+
+//Sample type the signal path runs in, the CFS payload is float either way
+enum PipelinePrecision { PIPELINE_DOUBLE, PIPELINE_FLOAT };
+
+//FIR filter giving the same result as conv(x, taps, "same") over the whole signal. Long
+//filters switch to overlap-save FFT convolution for pushes large enough to pay for it
+template<class T>
+class FirStage {
+public:
+	explicit FirStage(const vector<double>& taps);
+
+	//Filters count more samples, appending the outputs that are complete to out
+	void push(const T* x, size_t count, ArenaVector<T>& out);
+
+	//End of signal, appends the outputs that depend on samples past the end (taken as zero)
+	void finish(ArenaVector<T>& out);
+
+protected:
+	//Room for count new input samples, to be filled before calling filter(count, out)
+	T* reserve(size_t count);
+	void filter(size_t count, ArenaVector<T>& out);
+
+private:
+	vector<T> _reversedTaps;
+	ArenaVector<T> _window;         // last taps-1 inputs followed by the current chunk
+	size_t _skip;              // leading outputs still to drop for "same" alignment
+	unique_ptr< FftConvolver<T> > _fft;
+	ArenaVector<T> _fftOut;
+};
+
+//Weighted sum of several channels followed by one FIR filter. As both steps are linear,
+//combining first needs a single filter pass, e.g. weights {0.5, 0.5} for the mean of two
+//channels or {1, -1} to reference an electrode
+template<class T>
+class CombineFirStage : public FirStage<T> {
+public:
+	CombineFirStage(const vector<double>& weights, const vector<double>& taps);
+
+	//inputs holds one pointer per weight, each to count more physical samples
+	void push(const double* const* inputs, size_t count, ArenaVector<T>& out);
+
+private:
+	vector<T> _weights;
+};
+
+//Whether the ResampleStages made from now on run the loops compiled for the usual rates,
+//as they do unless told otherwise, or the generic loop, which gives the same bytes. Only
+//for checking just that, e.g. in benchmark
+void setResamplerSpecialization(bool specialize);
+
+//Rational resampler giving the same result as resample() over the whole signal. With a
+//prefilter it also applies that FIR filter (taken at the input rate) in the same
+//polyphase pass, so outputs are only evaluated at the output rate
+template<class T>
+class ResampleStage {
+public:
+	ResampleStage(int upFactor, int downFactor, long long inputSize,
+		const vector<double>& prefilter = vector<double>());
+
+	void push(const T* x, size_t count, ArenaVector<T>& out);
+	void finish(ArenaVector<T>& out);
+
+	//Outputs of the whole signal
+	long long outputSize() const { return _outputSize; }
+
+	//Length of a signal that was not known when the stage was created, before finish()
+	void setInputSize(long long inputSize);
+
+	//Input whose arrival completes output o; o also depends on the history() inputs before it
+	long long inputOf(long long o) const { return (o + _delay) * _down / _up; }
+	int history() const;
+
+	//A stage starting at an input that is a multiple of this keeps the phase of the outputs
+	int inputAlignment() const { return _passThrough ? 1 : _down; }
+
+private:
+	void emit(const T* y, size_t count, ArenaVector<T>& out);
+
+	bool _passThrough;
+	int _up, _down;
+	long long _delay;
+	long long _outputSize;
+	unique_ptr< Resampler<T, T, T> > _resampler;
+	ArenaVector<T> _scratch;
+	long long _skip;           // filter delay, in output samples
+	long long _remaining;      // outputs left before the resampled length is reached
+};
+
+//One output channel: weighted combination of inputs, band-pass and resampling to 100 Hz.
+//At 100 Hz input this is a CombineFirStage, otherwise the band-pass is merged into the
+//resampling filter, unless it is long enough for FFT convolution at the native rate
+template<class T>
+class ChannelStage {
+public:
+	ChannelStage(const vector<double>& weights, const vector<double>& taps, int rate, long long inputSize);
+
+	void push(const double* const* inputs, size_t count, ArenaVector<T>& out);
+	void finish(ArenaVector<T>& out);
+
+	//Samples of each input and outputs of the whole signal
+	long long inputSize() const { return _inputSize; }
+	long long outputSize() const;
+	void setInputSize(long long inputSize);
+
+	//Whether segment() matches push() and finish(); not with FFT convolution, whose
+	//rounding depends on where its blocks fall
+	bool splittable() const;
+
+	//Outputs [first, last) of the whole signal in inputs, computed by a stage of its own,
+	//which can run on any thread. Unless the stage is splittable only the whole signal
+	void segment(const double* const* inputs, long long first, long long last, T* out) const;
+
+	//Inputs before or after the one at the time of an output that the output depends on,
+	//and the multiple of inputs a stage must start at to keep the phase of the outputs
+	long long warmup() const;
+	int inputAlignment() const { return _resample ? _resample->inputAlignment() : 1; }
+
+private:
+	vector<double> _weightValues, _taps;
+	int _rate;
+	long long _inputSize;
+	vector<T> _weights;
+	unique_ptr< CombineFirStage<T> > _fir;
+	unique_ptr< ResampleStage<T> > _resample;
+	ArenaVector<T> _combined, _filtered;
+};
+
+//Everything convertFile needs to know about the selected channels
+struct PipelineSettings {
+	PipelineSettings() : skipSamples(0), epochLimit(-1) {}
+
+	int eegRate, elRate, erRate;                   // Hz, as in the EDF header
+	long long eegSamples, elSamples, erSamples;    // samples per channel in the recording, or a bound until setSamples()
+	double c3Mult, c4Mult, elMult, erMult;         // to uV
+	vector<double> eegTaps, elTaps, erTaps;        // band-pass filters at the native rates
+	PipelinePrecision precision;
+	bool logMagnitude;                             // spectrograms of log(1 + magnitude)
+	long long skipSamples;                         // 100 Hz samples dropped before the first epoch
+	long long epochLimit;                          // epochs after which the rest is dropped, -1 for none
+};
+
+//Seconds of input before and after a stretch of 100 Hz output that it depends on. Part of
+//a recording converted from that far around it, starting at a multiple of alignment[c]
+//samples of every channel c, gives the same samples there as the whole recording
+double pipelineWarmup(const PipelineSettings& settings, int alignment[PIPELINE_CHANNELS]);
+
+//EEG (mean of C3 and C4), EOG-L and EOG-R from native rate samples to CFS epochs
+class ConversionPipeline {
+public:
+	//Called with PIPELINE_EPOCHSIZE floats per epoch, in CFS payload layout
+	typedef function<void(const float* epoch)> EpochSink;
+
+	ConversionPipeline(const PipelineSettings& settings, EpochSink sink);
+	~ConversionPipeline();
+
+	//Next physical samples of each channel, C3 and C4 share the EEG count
+	void push(const double* c3, const double* c4, size_t eegCount,
+		const double* el, size_t elCount, const double* er, size_t erCount);
+
+	//Flushes the filters, trailing samples that do not fill an epoch are dropped
+	void finish();
+
+	//Samples per channel of a recording pushed before its length was known, before finish()
+	void setSamples(long long eegSamples, long long elSamples, long long erSamples);
+
+	//The whole recording in place of push() and finish(), on up to width threads of
+	//parallel. The sink is only called from the calling thread, in epoch order. Between the
+	//resampling and each batch of spectrograms it is a cancellationPoint() of cancel.h
+	void convertAll(const double* c3, const double* c4, size_t eegCount,
+		const double* el, size_t elCount, const double* er, size_t erCount,
+		const ParallelFor& parallel, unsigned width);
+
+	long long epochs() const;
+
+	//Stages and pending samples of one precision
+	class Channels;
+
+private:
+	ConversionPipeline(const ConversionPipeline&) = delete;
+	ConversionPipeline& operator=(const ConversionPipeline&) = delete;
+
+	unique_ptr<Channels> _channels;
+};
@@ -0,0 +1,180 @@
+#include "profile.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+static const char* phaseNames[PROFILE_PHASES] = {
+	"open", "read", "filter", "resample", "spectrogram", "sha1", "compress", "write"
+};
+
+static const double percentiles[] = { 50, 90, 99, 100 };
+static const char* percentileNames[] = { "p50", "p90", "p99", "max" };
+#define PERCENTILES (4)
+
+static thread_local FileProfile* activeProfile = NULL;
+
+FileProfile::FileProfile() : totalSeconds(0), bytesRead(0), samplesDecoded(0), epochs(0), payloadBytes(0), compressedBytes(0) {
+	fill(seconds, seconds + PROFILE_PHASES, 0.0);
+}
+
+const char* profilePhaseName(ProfilePhase phase) {
+	return phaseNames[phase];
+}
+
+FileProfile* currentProfile() {
+	return activeProfile;
+}
+
+ProfileScope::ProfileScope(FileProfile* profile) : _previous(activeProfile) {
+	activeProfile = profile;
+}
+
+ProfileScope::~ProfileScope() {
+	activeProfile = _previous;
+}
+
+void ProfileReport::add(const FileProfile& profile) {
+	lock_guard<mutex> lock(_mutex);
+	_files.push_back(profile);
+}
+
+//Nearest-rank percentile, values is sorted
+static double percentile(const vector<double>& values, double p) {
+	if (values.empty())
+		return 0;
+	size_t rank = (size_t)ceil(p / 100.0 * values.size());
+	return values[min(values.size(), max(rank, (size_t)1)) - 1];
+}
+
+//Column c of a profile: total, the phases, then the compression ratio
+#define PROFILE_COLUMNS (PROFILE_PHASES + 2)
+
+static double column(const FileProfile& profile, int c) {
+	if (c == 0)
+		return profile.totalSeconds;
+	if (c <= PROFILE_PHASES)
+		return profile.seconds[c - 1];
+	return profile.compressionRatio();
+}
+
+static const char* columnName(int c) {
+	if (c == 0)
+		return "total";
+	if (c <= PROFILE_PHASES)
+		return phaseNames[c - 1];
+	return "compression_ratio";
+}
+
+static void sortedColumns(const vector<FileProfile>& files, vector<double> sorted[PROFILE_COLUMNS]) {
+	for (int c = 0; c < PROFILE_COLUMNS; c++) {
+		for (size_t i = 0; i < files.size(); i++)
+			sorted[c].push_back(column(files[i], c));
+		sort(sorted[c].begin(), sorted[c].end());
+	}
+}
+
+string jsonString(const string& text) {
+	ostringstream out;
+	out << '"';
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char ch = (unsigned char)text[i];
+		if (ch == '"' || ch == '\\')
+			out << '\\' << ch;
+		else if (ch < 0x20)
+			out << "\\u" << hex << setw(4) << setfill('0') << (int)ch << dec << setfill(' ');
+		else
+			out << ch;
+	}
+	out << '"';
+	return out.str();
+}
+
+static string csvString(const string& text) {
+	if (text.find_first_of(",\"\n") == string::npos)
+		return text;
+	string quoted = "\"";
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '"')
+			quoted += '"';
+		quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+void ProfileReport::writeJson(ostream& out) const {
+	lock_guard<mutex> lock(_mutex);
+	unsigned long long bytesRead = 0, samples = 0, epochs = 0, payload = 0, compressed = 0;
+
+	out << "{\n  \"files\": [";
+	for (size_t i = 0; i < _files.size(); i++) {
+		const FileProfile& f = _files[i];
+		out << (i ? ",\n" : "\n") << "    {\"filename\": " << jsonString(f.filename)
+			<< ", \"total_seconds\": " << f.totalSeconds << ", \"seconds\": {";
+		for (int p = 0; p < PROFILE_PHASES; p++)
+			out << (p ? ", " : "") << "\"" << phaseNames[p] << "\": " << f.seconds[p];
+		out << "}, \"bytes_read\": " << f.bytesRead << ", \"samples_decoded\": " << f.samplesDecoded
+			<< ", \"epochs\": " << f.epochs << ", \"payload_bytes\": " << f.payloadBytes
+			<< ", \"compressed_bytes\": " << f.compressedBytes << ", \"compression_ratio\": " << f.compressionRatio() << "}";
+		bytesRead += f.bytesRead;
+		samples += f.samplesDecoded;
+		epochs += f.epochs;
+		payload += f.payloadBytes;
+		compressed += f.compressedBytes;
+	}
+
+	vector<double> sorted[PROFILE_COLUMNS];
+	sortedColumns(_files, sorted);
+	out << "\n  ],\n  \"summary\": {\n    \"files\": " << _files.size() << ", \"bytes_read\": " << bytesRead
+		<< ", \"samples_decoded\": " << samples << ", \"epochs\": " << epochs << ", \"payload_bytes\": " << payload
+		<< ", \"compressed_bytes\": " << compressed << ",\n    \"percentiles\": {";
+	for (int c = 0; c < PROFILE_COLUMNS; c++) {
+		out << (c ? ",\n" : "\n") << "      \"" << columnName(c) << "\": {";
+		for (int p = 0; p < PERCENTILES; p++)
+			out << (p ? ", " : "") << "\"" << percentileNames[p] << "\": " << percentile(sorted[c], percentiles[p]);
+		out << "}";
+	}
+	out << "\n    }\n  }\n}\n";
+}
+
+void ProfileReport::writeCsv(ostream& out) const {
+	lock_guard<mutex> lock(_mutex);
+
+	//One row per file, then one per percentile with the filename column empty
+	out << "row,filename";
+	for (int c = 0; c < PROFILE_COLUMNS - 1; c++)
+		out << "," << columnName(c) << "_seconds";
+	out << ",bytes_read,samples_decoded,epochs,payload_bytes,compressed_bytes,compression_ratio\n";
+
+	for (size_t i = 0; i < _files.size(); i++) {
+		const FileProfile& f = _files[i];
+		out << "file," << csvString(f.filename);
+		for (int c = 0; c < PROFILE_COLUMNS - 1; c++)
+			out << "," << column(f, c);
+		out << "," << f.bytesRead << "," << f.samplesDecoded << "," << f.epochs << "," << f.payloadBytes
+			<< "," << f.compressedBytes << "," << f.compressionRatio() << "\n";
+	}
+
+	vector<double> sorted[PROFILE_COLUMNS];
+	sortedColumns(_files, sorted);
+	for (int p = 0; p < PERCENTILES; p++) {
+		out << percentileNames[p] << ",";
+		for (int c = 0; c < PROFILE_COLUMNS - 1; c++)
+			out << "," << percentile(sorted[c], percentiles[p]);
+		out << ",,,,,," << percentile(sorted[PROFILE_COLUMNS - 1], percentiles[p]) << "\n";
+	}
+}
+
+bool ProfileReport::save(const string& path) const {
+	ofstream out(path.c_str());
+	if (!out)
+		return false;
+	if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0)
+		writeCsv(out);
+	else
+		writeJson(out);
+	return (bool)out;
+}
@@ -0,0 +1,106 @@
+//PROFILE  Per-phase timers and counters of a conversion, for the --profile report.
+//   A conversion that is profiled installs its FileProfile on the worker thread with a
+//   ProfileScope, and the ScopedTimers spread through the reader, pipeline and writer add
+//   their elapsed time to it. Without a profile installed a timer only checks a thread-local
+//   pointer, so the instrumentation stays in place in normal runs. Phases are exclusive:
+//   compression does not include the writing of its output, and so on.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+
+using namespace std;
+
+enum ProfilePhase {
+	PROFILE_OPEN,                // opening the EDF and parsing its header
+	PROFILE_READ,                // reading and de-interleaving datarecords
+	PROFILE_FILTER,              // band-pass at the native rate
+	PROFILE_RESAMPLE,            // resampling to 100 Hz, with the band-pass folded in when it is
+	PROFILE_SPECTROGRAM,
+	PROFILE_SHA1,
+	PROFILE_COMPRESS,
+	PROFILE_WRITE,
+	PROFILE_PHASES
+};
+
+struct FileProfile {
+	FileProfile();
+
+	string filename;
+	double seconds[PROFILE_PHASES];
+	double totalSeconds;                   // wall time of the whole conversion
+	unsigned long long bytesRead;          // datarecord bytes decoded
+	unsigned long long samplesDecoded;     // of the four converted channels
+	unsigned long long epochs;
+	unsigned long long payloadBytes;       // CFS payload before compression
+	unsigned long long compressedBytes;
+
+	double compressionRatio() const { return compressedBytes ? (double)payloadBytes / compressedBytes : 0; }
+};
+
+const char* profilePhaseName(ProfilePhase phase);
+
+//text as a quoted and escaped JSON string, for the reports and logs
+string jsonString(const string& text);
+
+//Profile of the conversion running on this thread, NULL when not profiling
+FileProfile* currentProfile();
+
+class ProfileScope {
+public:
+	//profile may be NULL, then nothing is recorded
+	explicit ProfileScope(FileProfile* profile);
+	~ProfileScope();
+
+private:
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	FileProfile* _previous;
+};
+
+//Adds the time until the end of the scope to one phase of the current profile, or of the
+//given one for work done on another thread
+class ScopedTimer {
+public:
+	explicit ScopedTimer(ProfilePhase phase) : _profile(currentProfile()), _phase(phase) { start(); }
+	ScopedTimer(FileProfile* profile, ProfilePhase phase) : _profile(profile), _phase(phase) { start(); }
+	~ScopedTimer() {
+		if (_profile)
+			_profile->seconds[_phase] += chrono::duration<double>(chrono::steady_clock::now() - _start).count();
+	}
+
+private:
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+	void start() {
+		if (_profile)
+			_start = chrono::steady_clock::now();
+	}
+
+	FileProfile* _profile;
+	ProfilePhase _phase;
+	chrono::steady_clock::time_point _start;
+};
+
+//Profiles of every file of a run, written per file followed by percentiles across the run
+class ProfileReport {
+public:
+	//Safe to call from several workers at once
+	void add(const FileProfile& profile);
+
+	void writeJson(ostream& out) const;
+	void writeCsv(ostream& out) const;
+
+	//CSV when path ends in .csv, JSON otherwise
+	bool save(const string& path) const;
+
+private:
+	mutable mutex _mutex;
+	vector<FileProfile> _files;
+};
@@ -0,0 +1,212 @@
+#include "quality.h"
+#include "simd.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdio.h>
+
+using namespace std;
+
+static const char* qualityNames[QUALITY_CHANNELS] = { "C3", "C4", "EL", "ER" };
+static const double mainsHz[2] = { 50, 60 };
+
+QualityChannel::QualityChannel() : rate(0), clipLow(-numeric_limits<double>::infinity()),
+	clipHigh(numeric_limits<double>::infinity()), mult(1) {
+}
+
+void qualityLimits(double physMin, double physMax, int digMin, int digMax, double& clipLow, double& clipHigh) {
+	clipLow = -numeric_limits<double>::infinity();
+	clipHigh = numeric_limits<double>::infinity();
+	if (digMax == digMin || physMax == physMin)
+		return;
+	double step = fabs(physMax - physMin) / fabs((double)digMax - digMin);
+	clipLow = min(physMin, physMax) + step / 2;
+	clipHigh = max(physMin, physMax) - step / 2;
+}
+
+string qualityPath(const string& cfsPath) {
+	size_t dot = cfsPath.find_last_of('.');
+	size_t slash = cfsPath.find_last_of('/');
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return cfsPath + ".qc.csv";
+	return cfsPath.substr(0, dot) + ".qc.csv";
+}
+
+SignalQuality::SignalQuality(const QualityChannel channels[QUALITY_CHANNELS], const long long first[QUALITY_CHANNELS], long long firstEpoch)
+	: _firstEpoch(firstEpoch) {
+	const double PI_2 = 6.28318530717958647692;
+	for (int c = 0; c < QUALITY_CHANNELS; c++) {
+		_channels[c] = channels[c];
+		_position[c] = first[c];
+		_epoch[c] = -1;
+		if (!(channels[c].rate > 0))
+			continue;
+		//Epochs are one sample longer at most where 30 s is not a whole number of samples
+		size_t length = (size_t)ceil(QUALITY_EPOCHSECONDS * channels[c].rate) + 1;
+		for (int f = 0; f < 2; f++) {
+			if (!(channels[c].rate > 2 * mainsHz[f]))
+				continue;
+			double w = PI_2 * mainsHz[f] / channels[c].rate;
+			_mains[c][f][0].resize(length);
+			_mains[c][f][1].resize(length);
+			for (size_t i = 0; i < length; i++) {
+				_mains[c][f][0][i] = cos(w * i);
+				_mains[c][f][1][i] = sin(w * i);
+			}
+		}
+	}
+}
+
+long long SignalQuality::epochStart(int c, long long epoch) const {
+	return llround(epoch * QUALITY_EPOCHSECONDS * _channels[c].rate);
+}
+
+//Extremes, clipped samples and the shifted sums of n samples, in four lanes the compiler
+//can keep in vector registers
+static void accumulateSums(const double* x, size_t n, double shift, double clipLow, double clipHigh,
+	double& lowest, double& highest, long long& clipped, double& sum, double& squares) {
+	double lo[4] = { lowest, lowest, lowest, lowest }, hi[4] = { highest, highest, highest, highest };
+	double s[4] = { 0, 0, 0, 0 }, q[4] = { 0, 0, 0, 0 };
+	long long k[4] = { 0, 0, 0, 0 };
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		for (int l = 0; l < 4; l++) {
+			double v = x[i + l];
+			double d = v - shift;
+			lo[l] = (v < lo[l]) ? v : lo[l];
+			hi[l] = (v > hi[l]) ? v : hi[l];
+			k[l] += (v <= clipLow) | (v >= clipHigh);
+			s[l] += d;
+			q[l] += d * d;
+		}
+	}
+	for (; i < n; i++) {
+		double v = x[i];
+		double d = v - shift;
+		lo[0] = min(lo[0], v);
+		hi[0] = max(hi[0], v);
+		k[0] += (v <= clipLow) | (v >= clipHigh);
+		s[0] += d;
+		q[0] += d * d;
+	}
+	lowest = min(min(lo[0], lo[1]), min(lo[2], lo[3]));
+	highest = max(max(hi[0], hi[1]), max(hi[2], hi[3]));
+	clipped += k[0] + k[1] + k[2] + k[3];
+	sum += (s[0] + s[1]) + (s[2] + s[3]);
+	squares += (q[0] + q[1]) + (q[2] + q[3]);
+}
+
+void SignalQuality::add(int c, const double* x, size_t count) {
+	const QualityChannel& channel = _channels[c];
+	while (count > 0) {
+		//The first epoch boundary at or after the position, from firstEpoch on
+		if (_epoch[c] < 0) {
+			double epochSamples = QUALITY_EPOCHSECONDS * channel.rate;
+			long long epoch = max(_firstEpoch, epochSamples > 0 ? (long long)floor(_position[c] / epochSamples) : 0LL);
+			while (epochStart(c, epoch) < _position[c])
+				epoch++;
+			long long skip = min((long long)count, epochStart(c, epoch) - _position[c]);
+			x += skip;
+			count -= (size_t)skip;
+			_position[c] += skip;
+			if (_position[c] < epochStart(c, epoch) || count == 0)
+				continue;
+			_epoch[c] = epoch;
+			Accumulator& start = _sums[c];
+			start.count = 0;
+			start.shift = x[0];
+			start.min = start.max = x[0];
+			start.sum = start.squares = 0;
+			start.clipped = 0;
+			start.re[0] = start.re[1] = start.im[0] = start.im[1] = 0;
+		}
+
+		Accumulator& sums = _sums[c];
+		long long end = epochStart(c, _epoch[c] + 1);
+		size_t n = (size_t)min((long long)count, end - _position[c]);
+		accumulateSums(x, n, sums.shift, channel.clipLow, channel.clipHigh, sums.min, sums.max, sums.clipped, sums.sum, sums.squares);
+		size_t offset = (size_t)sums.count;
+		for (int f = 0; f < 2; f++) {
+			if (_mains[c][f][0].empty())
+				continue;
+			sums.re[f] += simdDot(x, &_mains[c][f][0][offset], (int)n);
+			sums.im[f] += simdDot(x, &_mains[c][f][1][offset], (int)n);
+		}
+		sums.count += n;
+		x += n;
+		count -= n;
+		_position[c] += n;
+		if (_position[c] == end)
+			finishEpoch(c);
+	}
+}
+
+void SignalQuality::finishEpoch(int c) {
+	const Accumulator& sums = _sums[c];
+	double mult = _channels[c].mult;
+	double n = (double)max(1LL, sums.count);
+	double mean = sums.sum / n;
+
+	Epoch epoch;
+	epoch.index = _epoch[c];
+	epoch.min = sums.min * mult;
+	epoch.max = sums.max * mult;
+	epoch.clipped = sums.clipped;
+	epoch.mean = (sums.shift + mean) * mult;
+	epoch.sd = sqrt(max(0.0, sums.squares / n - mean * mean)) * mult;
+	for (int f = 0; f < 2; f++)
+		epoch.line[f] = _mains[c][f][0].empty() ? -1 : 2 * hypot(sums.re[f], sums.im[f]) / n * mult;
+	_epochs[c].push_back(epoch);
+
+	//The next epoch starts right here
+	_epoch[c] = -1;
+}
+
+//Upper bound of a line of csv()
+#define QUALITY_LINEBYTES (96)
+
+unsigned long long SignalQuality::footprint(const double rates[QUALITY_CHANNELS], double seconds) {
+	unsigned long long epochs = (unsigned long long)(seconds / QUALITY_EPOCHSECONDS) + 1;
+	unsigned long long bytes = epochs * QUALITY_CHANNELS * (sizeof(Epoch) + QUALITY_LINEBYTES);
+	for (int c = 0; c < QUALITY_CHANNELS; c++)
+		bytes += 4 * ((unsigned long long)ceil(QUALITY_EPOCHSECONDS * rates[c]) + 1) * sizeof(double);
+	return bytes;
+}
+
+string SignalQuality::csv(long long epochs) const {
+	string text = "epoch,channel,min_uv,max_uv,clipped,mean_uv,sd_uv,line50_uv,line60_uv,flags\n";
+	char line[256];
+	for (long long e = _firstEpoch; e < _firstEpoch + epochs; e++) {
+		const Epoch* found[QUALITY_CHANNELS];
+		bool complete = true;
+		for (int c = 0; c < QUALITY_CHANNELS && complete; c++) {
+			const vector<Epoch>& list = _epochs[c];
+			long long i = list.empty() ? -1 : e - list[0].index;
+			complete = i >= 0 && i < (long long)list.size();
+			found[c] = complete ? &list[(size_t)i] : NULL;
+		}
+		if (!complete)
+			continue;
+
+		for (int c = 0; c < QUALITY_CHANNELS; c++) {
+			const Epoch& epoch = *found[c];
+			double samples = QUALITY_EPOCHSECONDS * _channels[c].rate;
+			string flags;
+			if (epoch.sd < QUALITY_FLATMICROVOLTS)
+				flags += "|flat";
+			if (epoch.clipped > QUALITY_CLIPFRACTION * samples)
+				flags += "|clipped";
+			if (max(epoch.line[0], epoch.line[1]) > QUALITY_LINEMICROVOLTS)
+				flags += "|line";
+
+			char mains[2][32] = { "", "" };
+			for (int f = 0; f < 2; f++)
+				if (epoch.line[f] >= 0)
+					snprintf(mains[f], sizeof(mains[f]), "%.2f", epoch.line[f]);
+			snprintf(line, sizeof(line), "%lld,%s,%.2f,%.2f,%lld,%.2f,%.2f,%s,%s,%s\n", epoch.index, qualityNames[c],
+				epoch.min, epoch.max, epoch.clipped, epoch.mean, epoch.sd, mains[0], mains[1], flags.empty() ? "" : flags.c_str() + 1);
+			text += line;
+		}
+	}
+	return text;
+}
@@ -0,0 +1,83 @@
+//QUALITY  Signal-quality statistics of every epoch, taken from the samples read for the
+//   conversion so that QC needs no second pass over the EDF. For each of C3, C4, EL and ER
+//   and each 30 s epoch of the recording: the smallest and largest sample, how many sit at
+//   the physical minimum or maximum of the header (clipped by the amplifier), mean and
+//   standard deviation, and the amplitude of the 50 and 60 Hz mains lines. The CFS bins end
+//   at 24 Hz, below the band-pass, so the mains are measured on the raw samples instead, as
+//   the DFT at 50 and 60 Hz over the epoch: dot products with sine and cosine tables of one
+//   epoch, in the vector kernels of simd.h. Both lines make whole cycles in 30 s, so the DC
+//   offset does not leak into them. Values are in uV, as CSV with one line per epoch and channel.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define QUALITY_CHANNELS (4)
+#define QUALITY_EPOCHSECONDS (30)
+#define QUALITY_FLATMICROVOLTS (0.5)           // standard deviation below which an epoch is flat
+#define QUALITY_CLIPFRACTION (0.01)            // of the samples at the physical limits for clipped
+#define QUALITY_LINEMICROVOLTS (20.0)          // mains amplitude above which an epoch has line noise
+
+struct QualityChannel {
+	QualityChannel();
+
+	double rate;                 // Hz
+	double clipLow, clipHigh;    // samples at or beyond these are clipped, infinite if not known
+	double mult;                 // from the unit of the samples to uV
+};
+
+//Physical range of an EDF signal as limits for QualityChannel, half a digital step inside it
+void qualityLimits(double physMin, double physMax, int digMin, int digMax, double& clipLow, double& clipHigh);
+
+//"<name>.qc.csv" next to "<name>.cfs"
+string qualityPath(const string& cfsPath);
+
+class SignalQuality {
+public:
+	//Samples added start at sample first[c] of the recording; epochs before firstEpoch and
+	//those the samples only cover in part are left out
+	SignalQuality(const QualityChannel channels[QUALITY_CHANNELS], const long long first[QUALITY_CHANNELS], long long firstEpoch);
+
+	//The next count samples of channel c. Channels are independent, so different channels
+	//can be added from different threads
+	void add(int c, const double* x, size_t count);
+
+	//CSV of epochs [firstEpoch, firstEpoch + epochs) complete on every channel, with a header line
+	string csv(long long epochs) const;
+
+	//Peak bytes of the tables, the statistics and the CSV for seconds of channels at rates
+	static unsigned long long footprint(const double rates[QUALITY_CHANNELS], double seconds);
+
+private:
+	struct Epoch {
+		long long index;         // of the epoch in the recording
+		double min, max;
+		long long clipped;
+		double mean, sd;
+		double line[2];          // 50 and 60 Hz, negative above the Nyquist frequency
+	};
+
+	//Running sums of the epoch being added, of the samples less the first one (shift) so the
+	//variance keeps its precision on a large offset
+	struct Accumulator {
+		long long count;
+		double shift, min, max, sum, squares;
+		long long clipped;
+		double re[2], im[2];     // DFT at 50 and 60 Hz so far
+	};
+
+	long long epochStart(int c, long long epoch) const;
+	void finishEpoch(int c);
+
+	QualityChannel _channels[QUALITY_CHANNELS];
+	long long _firstEpoch;
+	long long _position[QUALITY_CHANNELS];   // sample of the recording added next
+	long long _epoch[QUALITY_CHANNELS];      // epoch being accumulated, -1 while in a partial one
+	vector<Epoch> _epochs[QUALITY_CHANNELS]; // in order, from firstEpoch on
+	Accumulator _sums[QUALITY_CHANNELS];
+	vector<double> _mains[QUALITY_CHANNELS][2][2]; // cos and sin of the mains lines over an epoch,
+	                                               // empty above the Nyquist frequency
+};
@@ -0,0 +1,185 @@
+#include "quantize.h"
+#include "spectral.h"
+#include "pipeline.h"
+#include <cmath>
+#include <string.h>
+
+using namespace std;
+
+#define QUANTIZE_CHANNELVALUES (SPECTRAL_WINDOWS * SPECTRAL_BINS)
+#define QUANTIZE_SCALEBYTES (2 * sizeof(float))
+
+static const char* formatNames[] = { "float", "float16", "q12", "q8" };
+#define FORMATS (4)
+
+bool parsePayloadFormat(const string& text, PayloadFormat& format) {
+	for (int i = 0; i < FORMATS; i++)
+		if (text == formatNames[i]) {
+			format = (PayloadFormat)i;
+			return true;
+		}
+	return false;
+}
+
+const char* payloadFormatName(PayloadFormat format) {
+	return (format >= 0 && format < FORMATS) ? formatNames[format] : "unknown";
+}
+
+static size_t channelBytes(PayloadFormat format) {
+	switch (format) {
+	case PAYLOAD_FLOAT16: return QUANTIZE_CHANNELVALUES * 2;
+	case PAYLOAD_Q12: return QUANTIZE_SCALEBYTES + QUANTIZE_CHANNELVALUES / 2 * 3;
+	case PAYLOAD_Q8: return QUANTIZE_SCALEBYTES + QUANTIZE_CHANNELVALUES;
+	default: return QUANTIZE_CHANNELVALUES * sizeof(float);
+	}
+}
+
+size_t payloadEpochBytes(PayloadFormat format) {
+	return PIPELINE_CHANNELS * channelBytes(format);
+}
+
+static void putFloat(float value, unsigned char* out) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	for (int i = 0; i < 4; i++)
+		out[i] = (unsigned char)(bits >> (8 * i));
+}
+
+static float getFloat(const unsigned char* in) {
+	uint32_t bits = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+//IEEE half of value, rounded to nearest even
+static uint16_t halfOf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t exponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+	if (exponent == 0xff)
+		return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+	int e = (int)exponent - 127 + 15;
+	if (e >= 0x1f)
+		return (uint16_t)(sign | 0x7c00);
+	int shift = 13;
+	uint32_t half;
+	if (e <= 0) {
+		//Subnormal, the implicit bit becomes part of the mantissa
+		if (e < -10)
+			return (uint16_t)sign;
+		mantissa |= 0x800000;
+		shift = 14 - e;
+		half = mantissa >> shift;
+	}
+	else
+		half = ((uint32_t)e << 10) | (mantissa >> shift);
+	//A carry out of the mantissa correctly moves on to the next exponent, up to infinity
+	uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1)))
+		half++;
+	return (uint16_t)(sign | half);
+}
+
+static float floatOf(uint16_t half) {
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0x1f)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else if (exponent != 0)
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	else {
+		float value = ldexpf((float)mantissa, -24);
+		return sign ? -value : value;
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static void quantize(const float* values, int bits, unsigned char* out) {
+	float lowest = values[0], highest = values[0];
+	for (int i = 1; i < QUANTIZE_CHANNELVALUES; i++) {
+		lowest = min(lowest, values[i]);
+		highest = max(highest, values[i]);
+	}
+	const unsigned levels = (1u << bits) - 1;
+	float step = (highest - lowest) / levels;
+	putFloat(lowest, out);
+	putFloat(step, out + sizeof(float));
+	out += QUANTIZE_SCALEBYTES;
+
+	for (int i = 0; i < QUANTIZE_CHANNELVALUES; i += 2) {
+		unsigned q[2] = { 0, 0 };
+		if (step > 0)
+			for (int j = 0; j < 2; j++)
+				q[j] = min((unsigned)lrintf((values[i + j] - lowest) / step), levels);
+		if (bits == 8) {
+			*out++ = (unsigned char)q[0];
+			*out++ = (unsigned char)q[1];
+		}
+		else {
+			*out++ = (unsigned char)q[0];
+			*out++ = (unsigned char)((q[0] >> 8) | (q[1] << 4));
+			*out++ = (unsigned char)(q[1] >> 4);
+		}
+	}
+}
+
+static void dequantize(const unsigned char* in, int bits, float* values) {
+	float lowest = getFloat(in), step = getFloat(in + sizeof(float));
+	in += QUANTIZE_SCALEBYTES;
+	for (int i = 0; i < QUANTIZE_CHANNELVALUES; i += 2) {
+		unsigned q[2];
+		if (bits == 8) {
+			q[0] = in[0];
+			q[1] = in[1];
+			in += 2;
+		}
+		else {
+			q[0] = in[0] | ((in[1] & 0x0f) << 8);
+			q[1] = (in[1] >> 4) | (in[2] << 4);
+			in += 3;
+		}
+		values[i] = expm1f(lowest + q[0] * step);
+		values[i + 1] = expm1f(lowest + q[1] * step);
+	}
+}
+
+void encodeEpoch(PayloadFormat format, const float* epoch, unsigned char* out) {
+	for (int c = 0; c < PIPELINE_CHANNELS; c++) {
+		const float* values = epoch + c * QUANTIZE_CHANNELVALUES;
+		unsigned char* stored = out + c * channelBytes(format);
+		if (format == PAYLOAD_Q12 || format == PAYLOAD_Q8)
+			quantize(values, format == PAYLOAD_Q8 ? 8 : 12, stored);
+		else if (format == PAYLOAD_FLOAT16)
+			for (int i = 0; i < QUANTIZE_CHANNELVALUES; i++) {
+				uint16_t half = halfOf(values[i]);
+				stored[2 * i] = (unsigned char)half;
+				stored[2 * i + 1] = (unsigned char)(half >> 8);
+			}
+		else
+			for (int i = 0; i < QUANTIZE_CHANNELVALUES; i++)
+				putFloat(values[i], stored + 4 * i);
+	}
+}
+
+void decodeEpoch(PayloadFormat format, const unsigned char* in, float* epoch) {
+	for (int c = 0; c < PIPELINE_CHANNELS; c++) {
+		float* values = epoch + c * QUANTIZE_CHANNELVALUES;
+		const unsigned char* stored = in + c * channelBytes(format);
+		if (format == PAYLOAD_Q12 || format == PAYLOAD_Q8)
+			dequantize(stored, format == PAYLOAD_Q8 ? 8 : 12, values);
+		else if (format == PAYLOAD_FLOAT16)
+			for (int i = 0; i < QUANTIZE_CHANNELVALUES; i++)
+				values[i] = expm1f(floatOf((uint16_t)(stored[2 * i] | (stored[2 * i + 1] << 8))));
+		else
+			for (int i = 0; i < QUANTIZE_CHANNELVALUES; i++)
+				values[i] = getFloat(stored + 4 * i);
+	}
+}
@@ -0,0 +1,40 @@
+//QUANTIZE  Reduced-precision CFS payloads of log-magnitude spectrograms.
+//   A float payload keeps all 23 mantissa bits of every magnitude, and their noise is most
+//   of what the codec has to store. These formats keep log(1 + magnitude) instead, which the
+//   spectrogram kernel produces directly: as IEEE half floats, or as 12 or 8 bit steps
+//   between the smallest and largest value of each channel of each epoch. Each channel of a
+//   quantized epoch starts with that smallest value and the step size (float32), followed
+//   by its SPECTRAL_WINDOWS x SPECTRAL_BINS steps, 12 bit ones packed two to three bytes.
+//   All numbers are little-endian. Such files are CFS version 4, see cfswriter.h.
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+using namespace std;
+
+//Values are the format byte of a version 4 header
+enum PayloadFormat {
+	PAYLOAD_FLOAT = 0,           // magnitudes as float32, versions 1 to 3
+	PAYLOAD_FLOAT16 = 1,
+	PAYLOAD_Q12 = 2,
+	PAYLOAD_Q8 = 3
+};
+
+//Parses "float", "float16", "q12" or "q8"
+bool parsePayloadFormat(const string& text, PayloadFormat& format);
+
+//As parsePayloadFormat() takes it
+const char* payloadFormatName(PayloadFormat format);
+
+//Stored bytes of one epoch
+size_t payloadEpochBytes(PayloadFormat format);
+
+//Stores one epoch of PIPELINE_EPOCHSIZE log-magnitudes, or magnitudes for PAYLOAD_FLOAT,
+//as payloadEpochBytes() bytes at out
+void encodeEpoch(PayloadFormat format, const float* epoch, unsigned char* out);
+
+//Magnitudes of an epoch stored by encodeEpoch()
+void decodeEpoch(PayloadFormat format, const unsigned char* in, float* epoch);
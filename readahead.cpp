@@ -0,0 +1,97 @@
+#include "readahead.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+//Reads the file through once so its pages are cached, the data itself is not kept
+static void readThrough(const string& filename) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+	vector<char> block(READAHEAD_BLOCKBYTES);
+	while (read(fd, &block[0], block.size()) > 0) {
+	}
+	close(fd);
+}
+
+ReadAhead::ReadAhead(unsigned long long budgetBytes, unsigned threads) :
+	_budget(budgetBytes), _charged(0), _stopping(false) {
+	for (unsigned i = 0; i < threads; i++)
+		_threads.push_back(thread(&ReadAhead::ioLoop, this));
+}
+
+ReadAhead::~ReadAhead() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeUp.notify_all();
+	for (size_t i = 0; i < _threads.size(); i++)
+		_threads[i].join();
+}
+
+void ReadAhead::schedule(const vector<string>& filenames) {
+	{
+		lock_guard<mutex> lock(_mutex);
+		for (size_t i = 0; i < filenames.size(); i++) {
+			struct stat st;
+			Pending pending;
+			pending.filename = filenames[i];
+			pending.bytes = (stat(filenames[i].c_str(), &st) == 0) ? st.st_size : 0;
+			_queue.push_back(pending);
+		}
+	}
+	_wakeUp.notify_all();
+}
+
+void ReadAhead::claim(const string& filename) {
+	lock_guard<mutex> lock(_mutex);
+	_claimed.insert(filename);
+}
+
+void ReadAhead::release(const string& filename) {
+	{
+		lock_guard<mutex> lock(_mutex);
+		map<string, unsigned long long>::iterator it = _inCache.find(filename);
+		if (it == _inCache.end())
+			return;
+		_charged -= it->second;
+		_inCache.erase(it);
+	}
+	_wakeUp.notify_all();
+}
+
+void ReadAhead::ioLoop() {
+	while (true) {
+		Pending next;
+		{
+			unique_lock<mutex> lock(_mutex);
+			while (true) {
+				if (_stopping)
+					return;
+
+				//Files workers got to first are not worth reading twice
+				while (!_queue.empty() && _claimed.count(_queue.front().filename))
+					_queue.pop_front();
+
+				//A file larger than the whole budget is still read once nothing else is cached
+				if (!_queue.empty() && (_charged == 0 || _charged + _queue.front().bytes <= _budget))
+					break;
+				_wakeUp.wait(lock);
+			}
+			next = _queue.front();
+			_queue.pop_front();
+			_inCache[next.filename] = next.bytes;
+			_charged += next.bytes;
+		}
+		readThrough(next.filename);
+	}
+}
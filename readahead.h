@@ -0,0 +1,58 @@
+//READAHEAD  Pulls upcoming input files into the page cache while workers convert others.
+//   A few I/O threads go through the files in the order the scheduler starts them, advise
+//   the kernel to fetch them and read them through, so a worker opening a file finds it in
+//   memory instead of waiting on the disk or the network. Files read ahead and not yet
+//   converted are limited to a byte budget, and files a worker has already started are
+//   left alone.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+using namespace std;
+
+#define READAHEAD_THREADS (2)
+#define READAHEAD_BLOCKBYTES (1 << 20)
+
+class ReadAhead {
+public:
+	explicit ReadAhead(unsigned long long budgetBytes, unsigned threads = READAHEAD_THREADS);
+	~ReadAhead();
+
+	//Files in the order they will be converted
+	void schedule(const vector<string>& filenames);
+
+	//A worker is starting on filename, reading it ahead is no longer useful
+	void claim(const string& filename);
+
+	//filename is converted, its bytes no longer count against the budget
+	void release(const string& filename);
+
+private:
+	ReadAhead(const ReadAhead&) = delete;
+	ReadAhead& operator=(const ReadAhead&) = delete;
+
+	void ioLoop();
+
+	struct Pending {
+		string filename;
+		unsigned long long bytes;
+	};
+
+	unsigned long long _budget;
+	unsigned long long _charged;                 // bytes of files read ahead and not released
+	deque<Pending> _queue;
+	map<string, unsigned long long> _inCache;
+	set<string> _claimed;
+	vector<thread> _threads;
+	mutex _mutex;
+	condition_variable _wakeUp;
+	bool _stopping;
+};
@@ -4,6 +4,7 @@
 #include <math.h>
 #include "upfirdn.h"
 #include "resample.h"
+#include "filtercache.h"
 
 using namespace std;
 
@@ -139,27 +140,11 @@ void kaiser ( const int order, const double bta, vector<double>& window )
     window.push_back ( fabs ( w[i] ) );
 }
 
-void resample ( int upFactor, int downFactor, 
-  vector<double>& inputSignal, vector<double>& outputSignal )
+void resampleFilter ( int upFactor, int downFactor, 
+  vector<double>& filter, int& delay )
 {
   const int n = 10;
   const double bta = 5.0;
-  if ( upFactor <= 0 || downFactor <= 0 )
-    throw std::runtime_error ( "factors must be positive integer" );
-  int gcd = getGCD ( upFactor, downFactor );
-  upFactor /= gcd;
-  downFactor /= gcd;
-
-  if ( upFactor == downFactor )
-  {
-    outputSignal = inputSignal;
-    return;
-  }
-
-  int inputSize = inputSignal.size();
-  outputSignal.clear ();
-  int outputSize =  quotientCeil ( inputSize * upFactor, downFactor );
-  outputSignal.reserve ( outputSize );
 
   int maxFactor = max ( upFactor, downFactor );
   double firlsFreq = 1.0 / 2.0 / static_cast<double> ( maxFactor );
@@ -180,16 +165,41 @@ void resample ( int upFactor, int downFactor,
 
   int lengthHalf = ( length - 1 ) / 2;
   int nz = downFactor - lengthHalf % downFactor;
-  vector<double> h;
-  h.reserve ( coefficientsSize + nz );
+  filter.clear ();
+  filter.reserve ( coefficientsSize + nz );
   for ( int i = 0; i < nz; i++ )
-    h.push_back ( 0.0 );
+    filter.push_back ( 0.0 );
   for ( int i = 0; i < coefficientsSize; i++ )
-    h.push_back ( coefficients[i] );
-  int hSize = h.size();
+    filter.push_back ( coefficients[i] );
   lengthHalf += nz;
-  int delay = lengthHalf / downFactor;
-  nz = 0;
+  delay = lengthHalf / downFactor;
+}
+
+void resample ( int upFactor, int downFactor, 
+  vector<double>& inputSignal, vector<double>& outputSignal )
+{
+  if ( upFactor <= 0 || downFactor <= 0 )
+    throw std::runtime_error ( "factors must be positive integer" );
+  int gcd = getGCD ( upFactor, downFactor );
+  upFactor /= gcd;
+  downFactor /= gcd;
+
+  if ( upFactor == downFactor )
+  {
+    outputSignal = inputSignal;
+    return;
+  }
+
+  int inputSize = inputSignal.size();
+  outputSignal.clear ();
+  int outputSize =  quotientCeil ( inputSize * upFactor, downFactor );
+  outputSignal.reserve ( outputSize );
+
+  shared_ptr<const ResampleDesign> design = cachedResampleDesign ( upFactor, downFactor );
+  vector<double> h = design->filter;
+  int delay = design->delay;
+  int hSize = h.size();
+  int nz = 0;
   while ( quotientCeil( ( inputSize - 1 ) * upFactor + hSize + nz, downFactor ) - delay < outputSize )
     nz++;
   for ( int i = 0; i < nz; i++ )
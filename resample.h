@@ -17,4 +17,14 @@
 using namespace std;
 
 void resample ( int upFactor, int downFactor, 
-  vector<double>& inputSignal, vector<double>& outputSignal );
\ No newline at end of file
+  vector<double>& inputSignal, vector<double>& outputSignal );
+
+//RESAMPLEFILTER  Anti-aliasing filter used by RESAMPLE for factors already reduced by 
+//   their GCD, and its delay in output samples. Exposed so the filter can be applied 
+//   in chunks with a Resampler that carries its state.
+void resampleFilter ( int upFactor, int downFactor, 
+  vector<double>& filter, int& delay );
+
+int getGCD ( int num1, int num2 );
+
+int quotientCeil ( int num1, int num2 );
\ No newline at end of file
@@ -0,0 +1,548 @@
+#include "scheduler.h"
+#include "arena.h"
+#include <algorithm>
+#include <exception>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+unsigned long long estimateFileCost(const string& filename) {
+
+	unsigned long long cost = 0;
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return 0;
+
+	//Fixed part of the header: datarecords at byte 236, number of signals at byte 252
+	char hdr[256];
+	if (fread(hdr, 1, 256, file) == 256) {
+		long long datarecords = atoll(string(hdr + 236, 8).c_str());
+		int signals = atoi(string(hdr + 252, 4).c_str());
+		int bytesPerSample = ((unsigned char)hdr[0] == 0xff) ? 3 : 2;
+
+		//Samples per datarecord of every signal follow 216 bytes of other fields per signal
+		if (datarecords > 0 && signals > 0 && signals <= 4096 && fseek(file, 256 + signals * 216, SEEK_SET) == 0) {
+			vector<char> counts(signals * 8);
+			if (fread(&counts[0], 1, counts.size(), file) == counts.size()) {
+				unsigned long long recordSamples = 0;
+				for (int i = 0; i < signals; i++)
+					recordSamples += atoi(string(&counts[i * 8], 8).c_str());
+				cost = (unsigned long long)datarecords * recordSamples * bytesPerSample;
+			}
+		}
+	}
+	fclose(file);
+
+	if (cost == 0) {
+		struct stat st;
+		if (stat(filename.c_str(), &st) == 0)
+			cost = st.st_size;
+	}
+	return cost;
+}
+
+FileScheduler::FileScheduler(ThreadPool& pool, ReadAhead* readAhead, const MemoryBudget* budget, double timeout) :
+	_pool(pool), _readAhead(readAhead), _budget(budget), _watched(0),
+	_timeout(timeout), _nextRunning(0), _abandoned(0), _watchdogStopping(false), _reserved(0), _preemptive(false) {
+	_active[FILE_PRIORITY_BULK] = _active[FILE_PRIORITY_URGENT] = 0;
+}
+
+FileScheduler::~FileScheduler() {
+	stopWatchdog();
+}
+
+//Prescans still running, shared with their tasks since a stuck one may outlive run()
+struct PrescanCount {
+	PrescanCount(size_t files) : finished(0), stuck(files, false) {}
+
+	void settle(size_t index, bool abandoned) {
+		{
+			lock_guard<mutex> lock(guard);
+			finished++;
+			stuck[index] = abandoned;
+		}
+		done.notify_all();
+	}
+
+	mutex guard;
+	condition_variable done;
+	size_t finished;
+	vector<bool> stuck;
+};
+
+void FileScheduler::run(const vector<string>& filelist, ConvertFunction convert, ResultFunction onResult, PrescanFunction prescan) {
+
+	startWatchdog();
+	_plans.assign(filelist.size(), FilePlan());
+	shared_ptr<PrescanCount> scans = make_shared<PrescanCount>(filelist.size());
+	if (prescan) {
+		//Headers only, in parallel on the workers before any conversion takes them. A stuck
+		//one is reported right away, without trying to convert the file
+		for (size_t i = 0; i < filelist.size(); i++) {
+			string filename = filelist[i];
+			_pool.submit([this, i, filename, prescan, scans]() {
+				unsigned long long id;
+				shared_ptr<CancelToken> token = track(i, filename, 0, [this, i, scans](const FileResult& result) {
+					finish(result);
+					scans->settle(i, true);
+				}, -1, 0, id);
+				FilePlan plan;
+				{
+					CancelScope scope(token.get());
+					try {
+						plan = prescan(filename);
+					}
+					catch (exception&) {
+						plan.cost = estimateFileCost(filename);
+					}
+				}
+				untrack(id);
+				if (token && !token->complete())
+					return;
+				_plans[i] = plan;
+				scans->settle(i, false);
+			});
+		}
+		unique_lock<mutex> lock(scans->guard);
+		scans->done.wait(lock, [&scans]() { return scans->finished == scans->stuck.size(); });
+	}
+	else {
+		for (size_t i = 0; i < filelist.size(); i++)
+			_plans[i].cost = estimateFileCost(filelist[i]);
+	}
+
+	vector<size_t> order;
+	vector<size_t> rejected;
+	for (size_t i = 0; i < filelist.size(); i++) {
+		lock_guard<mutex> lock(scans->guard);
+		if (!scans->stuck[i])
+			(_plans[i].convertible ? order : rejected).push_back(i);
+	}
+
+	//Longest job first, so a long recording does not start last and finish alone
+	stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return _plans[a].cost > _plans[b].cost; });
+
+	if (_readAhead) {
+		vector<string> sorted;
+		for (size_t i = 0; i < order.size(); i++)
+			sorted.push_back(filelist[order[i]]);
+		_readAhead->schedule(sorted);
+	}
+
+	//Rejected files only report their failure, they go ahead of everything else
+	for (size_t i = 0; i < rejected.size(); i++) {
+		size_t index = rejected[i];
+		const string& filename = filelist[index];
+		_pool.submit([this, index, filename, convert]() {
+			convertOne(index, filename, convert, [this](const FileResult& result) { finish(result); }, false);
+		});
+	}
+
+	{
+		lock_guard<mutex> lock(_admitMutex);
+		_admitQueue.assign(order.begin(), order.end());
+	}
+	//Each task takes whichever file admit() picks when a worker gets to it
+	for (size_t i = 0; i < order.size(); i++) {
+		_pool.submit([this, &filelist, convert]() {
+			size_t index = admit();
+			convertOne(index, filelist[index], convert, [this](const FileResult& result) { finish(result); }, false);
+		});
+	}
+
+	for (size_t done = 0; done < filelist.size(); done++) {
+		FileResult result;
+		{
+			unique_lock<mutex> lock(_mutex);
+			_resultReady.wait(lock, [this]() { return !_finished.empty(); });
+			result = _finished.front();
+			_finished.pop_front();
+		}
+		onResult(result);
+	}
+	stopWatchdog();
+}
+
+//The longest file left whose footprint fits in the budget right now, the longest of all
+//without a budget or when none fits. A file passed over keeps its place at the front
+size_t FileScheduler::admit() {
+	lock_guard<mutex> lock(_admitMutex);
+	deque<size_t>::iterator pick = _admitQueue.begin();
+	if (_budget) {
+		for (deque<size_t>::iterator it = _admitQueue.begin(); it != _admitQueue.end(); ++it) {
+			if (_budget->wouldFit(_plans[*it].footprint)) {
+				pick = it;
+				break;
+			}
+		}
+	}
+	size_t index = *pick;
+	_admitQueue.erase(pick);
+	return index;
+}
+
+void FileScheduler::reserveWorkers(unsigned urgent) {
+	lock_guard<mutex> lock(_queueMutex);
+	_reserved = min(urgent, _pool.size() - 1);
+}
+
+void FileScheduler::watch(FileSource source, ConvertFunction convert, ResultFunction onResult, FileSource urgent,
+	PrescanFunction prescan) {
+
+	//Counted on from an earlier call, e.g. the crawl of a backlog before watching
+	size_t delivered;
+	{
+		lock_guard<mutex> lock(_mutex);
+		delivered = _watched;
+	}
+
+	startWatchdog();
+	ResultFunction deliver = [this, onResult](const FileResult& result) {
+		{
+			lock_guard<mutex> lock(_mutex);
+			onResult(result);
+			_watched++;
+		}
+		_resultReady.notify_all();
+	};
+
+	//Files wait in the queue of their class and are started as workers become free. Bulk
+	//files only yield at their checkpoints when a memory budget can not hold them back
+	size_t submitted = 0;
+	{
+		lock_guard<mutex> lock(_queueMutex);
+		_preemptive = urgent && !_budget;
+	}
+	auto add = [&](const string& filename, FilePriority priority) {
+		Waiting file = { 0, filename, convert, deliver, 0 };
+		{
+			lock_guard<mutex> lock(_queueMutex);
+			file.index = submitted++;
+		}
+		if (prescan && priority == FILE_PRIORITY_BULK)
+			_pool.submit([this, file, prescan]() { prescanAndEnqueue(file, prescan); });
+		else
+			enqueue(file, priority);
+	};
+
+	//The urgent source is drained on a thread of its own, both may block waiting for files
+	thread arrivals;
+	if (urgent) {
+		arrivals = thread([&urgent, &add]() {
+			string filename;
+			while (urgent(filename))
+				add(filename, FILE_PRIORITY_URGENT);
+		});
+	}
+	string filename;
+	while (source(filename))
+		add(filename, FILE_PRIORITY_BULK);
+	if (arrivals.joinable())
+		arrivals.join();
+
+	size_t total;
+	{
+		lock_guard<mutex> lock(_queueMutex);
+		total = submitted;
+	}
+	{
+		unique_lock<mutex> lock(_mutex);
+		_resultReady.wait(lock, [this, delivered, total]() { return _watched == delivered + total; });
+	}
+	{
+		lock_guard<mutex> lock(_queueMutex);
+		_preemptive = false;
+	}
+	stopWatchdog();
+}
+
+void FileScheduler::enqueue(const Waiting& file, FilePriority priority) {
+	if (_readAhead)
+		_readAhead->schedule(vector<string>(1, file.filename));
+	{
+		lock_guard<mutex> lock(_queueMutex);
+		_waiting[priority].push_back(file);
+	}
+	dispatch();
+}
+
+//Header of a bulk file of watch(), on a worker before the file is queued, as run() does
+//for all files at once. A file bound to fail is reported right away without holding a
+//worker of watch(), a stuck prescan is reported by the watchdog
+void FileScheduler::prescanAndEnqueue(Waiting file, PrescanFunction prescan) {
+	unsigned long long id;
+	shared_ptr<CancelToken> token = track(file.index, file.filename, 0, file.deliver, -1, 0, id);
+	FilePlan plan;
+	{
+		CancelScope scope(token.get());
+		//A header the prescan can not take is left to the conversion to report
+		try {
+			plan = prescan(file.filename);
+		}
+		catch (exception&) {
+		}
+	}
+	untrack(id);
+	if (token && !token->complete())
+		return;
+
+	if (!plan.convertible) {
+		convertOne(file.index, file.filename, file.convert, file.deliver, false);
+		return;
+	}
+	file.footprint = plan.footprint;
+	enqueue(file, FILE_PRIORITY_BULK);
+}
+
+//Starts waiting files while there are free workers: urgent ones first, bulk ones while they
+//leave the reserved workers free. With a memory budget the bulk file started is the first
+//whose prescanned footprint fits in it right now, as admit() picks, the first of all when
+//none does
+void FileScheduler::dispatch() {
+	vector<Waiting> files;
+	vector<FilePriority> priorities;
+	bool preemptive;
+	{
+		lock_guard<mutex> lock(_queueMutex);
+		preemptive = _preemptive;
+		while (_active[FILE_PRIORITY_BULK] + _active[FILE_PRIORITY_URGENT] < _pool.size()) {
+			FilePriority priority;
+			if (!_waiting[FILE_PRIORITY_URGENT].empty())
+				priority = FILE_PRIORITY_URGENT;
+			else if (!_waiting[FILE_PRIORITY_BULK].empty() && _active[FILE_PRIORITY_BULK] + _reserved < _pool.size())
+				priority = FILE_PRIORITY_BULK;
+			else
+				break;
+			deque<Waiting>::iterator pick = _waiting[priority].begin();
+			if (_budget && priority == FILE_PRIORITY_BULK) {
+				for (deque<Waiting>::iterator it = _waiting[priority].begin(); it != _waiting[priority].end(); ++it) {
+					if (_budget->wouldFit(it->footprint)) {
+						pick = it;
+						break;
+					}
+				}
+			}
+			files.push_back(*pick);
+			priorities.push_back(priority);
+			_waiting[priority].erase(pick);
+			_active[priority]++;
+		}
+	}
+	for (size_t i = 0; i < files.size(); i++) {
+		Waiting file = files[i];
+		FilePriority priority = priorities[i];
+		bool preemptible = preemptive && priority == FILE_PRIORITY_BULK;
+		_pool.submit([this, file, priority, preemptible]() {
+			//An abandoned file had its worker freed by the watchdog already
+			if (convertOne(file.index, file.filename, file.convert, file.deliver, preemptible, priority)) {
+				lock_guard<mutex> lock(_queueMutex);
+				_active[priority]--;
+			}
+			dispatch();
+		});
+	}
+}
+
+//Checkpoint of a bulk file: converts the urgent files that find every worker busy right
+//here, on the bulk file's thread, then lets it go on. They do not take a worker of their
+//own, so a worker that frees up meanwhile starts the next file. The deadline of the bulk
+//file is paused for the time taken, and what the urgent files allocated is handed back to
+//the arena. An urgent file stuck here has the bulk file abandoned with it
+void FileScheduler::preempt(unsigned long long hostId) {
+	CancelToken* host = currentCancelToken();
+	while (true) {
+		Waiting file;
+		{
+			lock_guard<mutex> lock(_queueMutex);
+			if (_waiting[FILE_PRIORITY_URGENT].empty() || _active[FILE_PRIORITY_BULK] + _active[FILE_PRIORITY_URGENT] < _pool.size())
+				return;
+			file = _waiting[FILE_PRIORITY_URGENT].front();
+			_waiting[FILE_PRIORITY_URGENT].pop_front();
+		}
+
+		if (host)
+			host->pause();
+		{
+			ArenaRewind rewind;
+			convertOne(file.index, file.filename, file.convert, file.deliver, false, -1, hostId);
+		}
+		if (host) {
+			host->resume();
+			if (host->abandoned())
+				return;
+		}
+	}
+}
+
+bool FileScheduler::convertOne(size_t index, const string& filename, ConvertFunction convert, ResultFunction deliver, bool preemptible,
+	int slot, unsigned long long host) {
+	FileResult result;
+	ostringstream log;
+	result.index = index;
+	result.filename = filename;
+	if (_readAhead)
+		_readAhead->claim(filename);
+	unsigned long long id;
+	shared_ptr<CancelToken> token = track(index, filename, FILESCHEDULER_GRACESECONDS, deliver, slot, host, id);
+	if (preemptible) {
+		if (!token)
+			token = make_shared<CancelToken>();
+		token->setCheckpoint([this, id]() { preempt(id); });
+	}
+	{
+		CancelScope scope(token.get());
+		try {
+			result.success = convert(filename, log);
+		}
+		catch (exception& e) {
+			log << "<strong style='color:red;'>ERROR: " << e.what() << "</strong><br />\n</p>\n";
+			result.success = false;
+		}
+	}
+	untrack(id);
+	result.log = log.str();
+	if (_readAhead)
+		_readAhead->release(filename);
+	if (token && !token->complete())
+		return false;
+	deliver(result);
+	return true;
+}
+
+void FileScheduler::finish(const FileResult& result) {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_finished.push_back(result);
+	}
+	_resultReady.notify_one();
+}
+
+size_t FileScheduler::abandoned() {
+	lock_guard<mutex> lock(_runningMutex);
+	return _abandoned;
+}
+
+//Seconds as a steady_clock duration
+static chrono::steady_clock::duration clockSeconds(double seconds) {
+	return chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+}
+
+shared_ptr<CancelToken> FileScheduler::track(size_t index, const string& filename, double grace, ResultFunction deliver, int slot,
+	unsigned long long host, unsigned long long& id) {
+	id = 0;
+	if (!(_timeout > 0))
+		return shared_ptr<CancelToken>();
+
+	Running running;
+	running.token = make_shared<CancelToken>();
+	running.started = chrono::steady_clock::now();
+	running.token->setDeadline(running.started + clockSeconds(_timeout));
+	running.grace = clockSeconds(grace);
+	running.worker = this_thread::get_id();
+	running.index = index;
+	running.filename = filename;
+	running.deliver = deliver;
+	running.slot = slot;
+	running.host = host;
+
+	lock_guard<mutex> lock(_runningMutex);
+	id = ++_nextRunning;
+	_running[id] = running;
+	return running.token;
+}
+
+void FileScheduler::untrack(unsigned long long id) {
+	if (id == 0)
+		return;
+	lock_guard<mutex> lock(_runningMutex);
+	_running.erase(id);
+}
+
+void FileScheduler::startWatchdog() {
+	if (!(_timeout > 0) || _watchdog.joinable())
+		return;
+	_watchdogStopping = false;
+	_watchdog = thread(&FileScheduler::watchdogLoop, this);
+}
+
+void FileScheduler::stopWatchdog() {
+	if (!_watchdog.joinable())
+		return;
+	{
+		lock_guard<mutex> lock(_runningMutex);
+		_watchdogStopping = true;
+	}
+	_watchdogWake.notify_all();
+	_watchdog.join();
+}
+
+//Abandons what is still running a grace period past its deadline. The file is reported from
+//here and its worker replaced; the conversion finds its token abandoned if it ever returns.
+//The worker of watch() it held is free again, for the replacement to start the next file.
+//A file paused while it converts an urgent one is not stuck, unless the urgent one is
+void FileScheduler::watchdogLoop() {
+	unique_lock<mutex> lock(_runningMutex);
+	while (!_watchdogStopping) {
+		_watchdogWake.wait_for(lock, chrono::milliseconds(FILESCHEDULER_WATCHDOGMILLIS));
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		vector<Running> stuck;
+		vector<string> guests;   // of the files abandoned with an urgent file stuck on their thread
+		for (map<unsigned long long, Running>::iterator it = _running.begin(); it != _running.end(); ) {
+			const Running& running = it->second;
+			if (!running.token->paused() && now >= running.token->deadline() + running.grace && running.token->abandon()) {
+				stuck.push_back(running);
+				guests.push_back(string());
+				it = _running.erase(it);
+			}
+			else
+				++it;
+		}
+		for (size_t i = 0, n = stuck.size(); i < n; i++) {
+			map<unsigned long long, Running>::iterator host = _running.find(stuck[i].host);
+			if (stuck[i].host == 0 || host == _running.end() || !host->second.token->abandon())
+				continue;
+			stuck.push_back(host->second);
+			guests.push_back(stuck[i].filename);
+			_running.erase(host);
+		}
+		if (stuck.empty())
+			continue;
+		_abandoned += stuck.size();
+
+		lock.unlock();
+		for (size_t i = 0; i < stuck.size(); i++) {
+			if (_readAhead)
+				_readAhead->release(stuck[i].filename);
+			_pool.abandonWorker(stuck[i].worker);
+
+			FileResult result;
+			result.index = stuck[i].index;
+			result.filename = stuck[i].filename;
+			result.stuck = true;
+			ostringstream log;
+			log << "<p>Filename: " << result.filename << "<br />\n<strong style='color:red;'>ERROR: ";
+			if (guests[i].empty())
+				log << "Still running " << (int)chrono::duration<double>(now - stuck[i].started).count() << " seconds after it started, abandoned as stuck.";
+			else
+				log << "Abandoned as stuck with " << guests[i] << ", which preempted it and got stuck on its worker.";
+			log << "</strong><br />\n</p>\n";
+			result.log = log.str();
+			stuck[i].deliver(result);
+		}
+		bool freed = false;
+		{
+			lock_guard<mutex> queueLock(_queueMutex);
+			for (size_t i = 0; i < stuck.size(); i++)
+				if (stuck[i].slot >= 0) {
+					_active[stuck[i].slot]--;
+					freed = true;
+				}
+		}
+		if (freed)
+			dispatch();
+		lock.lock();
+	}
+}
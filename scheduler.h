@@ -0,0 +1,183 @@
+//SCHEDULER  Runs one conversion per input file on a ThreadPool.
+//   Files are handed out longest-job-first, using the size of the recording given in the
+//   EDF header, and results are reported in the order they finish rather than in batches.
+//   With a prescan every header is read in parallel first: files that are bound to fail are
+//   reported straight away instead of waiting behind long conversions, and with a memory
+//   budget the next file started is the longest one whose footprint fits in what is left.
+//   With a ReadAhead the files are also read into the page cache in that same order.
+//   In watch mode files are converted as they arrive, on the same warm pool; that is also
+//   how files found by crawling a directory tree are converted while the crawl goes on.
+//   There the prescan reads the header of each file on the pool as it arrives, before the
+//   file is queued, and the footprint it finds admits files under the budget in turn.
+//   With a timeout each file, and each prescan, runs under a CancelToken with that deadline.
+//   A conversion that does not stop at its next checkpoint within FILESCHEDULER_GRACESECONDS
+//   after it is stuck, e.g. in a read that never returns: a watchdog reports it as stuck,
+//   replaces its worker and drops whatever it returns later, so the rest of the run goes on.
+//   A prescan has no checkpoints and every conversion waits for it, it is stuck right away.
+//   Watch mode has two priority classes. Urgent files, e.g. a study a clinician is waiting
+//   for, start before any bulk file still queued, on workers that can be reserved for them.
+//   When every worker is busy, a bulk conversion is preempted at its next checkpoint (see
+//   cancel.h): it converts the urgent file on its own thread and then goes on. The clock of
+//   its deadline stands still meanwhile, and an urgent file stuck there takes it along.
+
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include "threadpool.h"
+#include "cancel.h"
+#include "readahead.h"
+#include "memorybudget.h"
+
+using namespace std;
+
+//Seconds past its deadline a file is given to stop by itself before it counts as stuck, and
+//how often the watchdog looks
+#define FILESCHEDULER_GRACESECONDS (30)
+#define FILESCHEDULER_WATCHDOGMILLIS (1000)
+
+struct FileResult {
+	FileResult() : index(0), success(false), stuck(false) {}
+
+	size_t index;      // position in the input file list
+	string filename;
+	bool success;
+	bool stuck;        // abandoned by the watchdog, convert never returned in time
+	string log;        // HTML fragment produced by the conversion
+};
+
+typedef function<bool(const string& filename, ostringstream& log)> ConvertFunction;
+typedef function<void(const FileResult& result)> ResultFunction;
+typedef function<bool(string& filename)> FileSource;
+
+enum FilePriority {
+	FILE_PRIORITY_BULK,
+	FILE_PRIORITY_URGENT
+};
+
+//What a prescan of the header tells about a file before a worker is committed to it
+struct FilePlan {
+	FilePlan() : convertible(true), cost(0), footprint(0) {}
+
+	bool convertible;            // false when converting is bound to fail
+	unsigned long long cost;     // longer files are started first
+	unsigned long long footprint; // peak bytes the conversion reserves, 0 if not known
+};
+
+typedef function<FilePlan(const string& filename)> PrescanFunction;
+
+//Bytes of sample data in the file according to its header, file size if the header is unusable
+unsigned long long estimateFileCost(const string& filename);
+
+class FileScheduler {
+public:
+	//budget is the one the conversions reserve from, for admission after a prescan. With a
+	//timeout in seconds every file gets a deadline that long after its conversion starts
+	explicit FileScheduler(ThreadPool& pool, ReadAhead* readAhead = NULL, const MemoryBudget* budget = NULL, double timeout = 0);
+	~FileScheduler();
+
+	//Converts every file and calls onResult on the calling thread as each one completes.
+	//Files the prescan finds unconvertible are still passed to convert, first, to be reported
+	void run(const vector<string>& filelist, ConvertFunction convert, ResultFunction onResult,
+		PrescanFunction prescan = PrescanFunction());
+
+	//Converts the files source hands out until it returns false, then waits for the ones
+	//still running. onResult is called on the worker threads or the watchdog, one result at
+	//a time. Files are read ahead in the order they arrive, there is no longest-first order
+	//to keep. Files from urgent, taken at the same time until it returns false too, are
+	//converted ahead of those from source. Without a memory budget, bulk files running on
+	//every worker are preempted for them; with one an urgent file could wait for memory its
+	//host holds, so it waits for a worker instead. With a prescan, files from source the
+	//prescan finds unconvertible are passed to convert as soon as it is done, only to be
+	//reported. Urgent files are not prescanned, which could leave them waiting for a worker
+	void watch(FileSource source, ConvertFunction convert, ResultFunction onResult, FileSource urgent = FileSource(),
+		PrescanFunction prescan = PrescanFunction());
+
+	//Workers bulk files in watch() leave free for urgent ones, at most all but one
+	void reserveWorkers(unsigned urgent);
+
+	//Files and prescans abandoned as stuck so far. Their workers may still touch whatever
+	//convert and prescan use, so with any the caller should exit without tearing that down
+	size_t abandoned();
+
+private:
+	//A file or prescan running under a deadline, for the watchdog to report if it is stuck
+	struct Running {
+		shared_ptr<CancelToken> token;
+		chrono::steady_clock::time_point started;
+		chrono::steady_clock::duration grace;  // past the deadline before it is stuck
+		thread::id worker;
+		size_t index;
+		string filename;
+		ResultFunction deliver;
+		int slot;                // FilePriority of the watch() worker it counts against, -1 for none
+		unsigned long long host; // of the file whose thread converts it at a checkpoint, 0 for none
+	};
+
+	//A file of watch() not started yet
+	struct Waiting {
+		size_t index;
+		string filename;
+		ConvertFunction convert;
+		ResultFunction deliver;
+		unsigned long long footprint;  // from the prescan, 0 if not known
+	};
+
+	//Runs convert on filename and passes the result to deliver, unless the watchdog
+	//abandoned the file meanwhile and has delivered it already; false then. A preemptible
+	//one runs urgent files waiting for a worker at its checkpoints. A file holding a worker
+	//of watch() names its slot, which the watchdog frees if it abandons the file, and one
+	//converted at a checkpoint names the tracked file it preempted
+	bool convertOne(size_t index, const string& filename, ConvertFunction convert, ResultFunction deliver, bool preemptible,
+		int slot = -1, unsigned long long host = 0);
+	void enqueue(const Waiting& file, FilePriority priority);
+	void prescanAndEnqueue(Waiting file, PrescanFunction prescan);
+	void dispatch();
+	void preempt(unsigned long long host);
+	void finish(const FileResult& result);
+	size_t admit();
+
+	//A token with the deadline, registered with the watchdog to count as stuck grace seconds
+	//after it; NULL without a timeout
+	shared_ptr<CancelToken> track(size_t index, const string& filename, double grace, ResultFunction deliver, int slot,
+		unsigned long long host, unsigned long long& id);
+	void untrack(unsigned long long id);
+	void startWatchdog();
+	void stopWatchdog();
+	void watchdogLoop();
+
+	ThreadPool& _pool;
+	ReadAhead* _readAhead;
+	const MemoryBudget* _budget;
+	mutex _admitMutex;
+	vector<FilePlan> _plans;
+	deque<size_t> _admitQueue;   // files not started yet, longest first
+	mutex _mutex;
+	condition_variable _resultReady;
+	deque<FileResult> _finished;
+	size_t _watched;           // watch mode: results delivered so far
+
+	double _timeout;
+	mutex _runningMutex;
+	condition_variable _watchdogWake;
+	map<unsigned long long, Running> _running;
+	unsigned long long _nextRunning;
+	size_t _abandoned;
+	bool _watchdogStopping;
+	thread _watchdog;
+
+	mutex _queueMutex;
+	deque<Waiting> _waiting[2];  // watch mode: files not started yet, by FilePriority
+	unsigned _active[2];         // files running, by FilePriority
+	unsigned _reserved;          // workers bulk files leave free
+	bool _preemptive;            // bulk files yield to urgent ones at their checkpoints
+};
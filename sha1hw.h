@@ -0,0 +1,19 @@
+//SHA1HW  SHA-1 block transform on the SHA instructions of the CPU.
+//   x86 CPUs with the SHA extensions (SHA-NI) and 64-bit ARM CPUs with the ARMv8 crypto
+//   extensions compute a 64 byte block in a few dozen instructions. Which one is used is
+//   found out once at run time, as for the kernels of simd.h; CSHA1 only calls
+//   sha1HardwareBlocks() when sha1HardwareAvailable() and keeps its scalar transform
+//   otherwise, so digests do not depend on the CPU.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+bool sha1HardwareAvailable();
+
+//Runs count 64 byte blocks at data through the five words of state
+void sha1HardwareBlocks(uint32_t* state, const unsigned char* data, size_t count);
+
+//"sha-ni", "armv8" or "scalar"
+const char* sha1InstructionSet();
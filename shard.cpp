@@ -0,0 +1,76 @@
+#include "shard.h"
+#include "scheduler.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace std;
+
+bool parseShard(const string& text, ShardSpec& shard, string& error) {
+	size_t slash = text.find('/');
+	char* end = NULL;
+	unsigned long index = 0, count = 0;
+	bool parsed = slash != string::npos && slash > 0 && slash + 1 < text.size();
+	if (parsed) {
+		index = strtoul(text.substr(0, slash).c_str(), &end, 10);
+		parsed = *end == 0;
+	}
+	if (parsed) {
+		count = strtoul(text.substr(slash + 1).c_str(), &end, 10);
+		parsed = *end == 0;
+	}
+	if (!parsed || text[0] == '-' || text[slash + 1] == '-') {
+		error = "expected i/N, e.g. 3/20";
+		return false;
+	}
+	if (count == 0 || index >= count) {
+		error = "the shard must be at least 0 and below the number of shards";
+		return false;
+	}
+	shard.index = (unsigned)index;
+	shard.count = (unsigned)count;
+	return true;
+}
+
+string shardName(const ShardSpec& shard) {
+	ostringstream name;
+	name << "shard-" << shard.index << "-of-" << shard.count;
+	return name.str();
+}
+
+vector<string> shardFiles(const vector<string>& files, const ShardSpec& shard, unsigned threads) {
+	if (shard.count <= 1)
+		return files;
+
+	vector<unsigned long long> costs(files.size());
+	{
+		//Header reads wait on the disk or the network, not the CPU
+		ThreadPool pool(threads);
+		pool.parallelFor(files.size(), pool.size() + 1, [&](size_t i) {
+			costs[i] = estimateFileCost(files[i]);
+		});
+	}
+
+	//Longest processing time first: every file goes to the shard with the least so far
+	vector<size_t> order(files.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return costs[a] != costs[b] ? costs[a] > costs[b] : files[a] < files[b];
+	});
+	vector<unsigned long long> totals(shard.count, 0);
+	vector<bool> mine(files.size(), false);
+	for (size_t k = 0; k < order.size(); k++) {
+		size_t least = min_element(totals.begin(), totals.end()) - totals.begin();
+		//An empty file still counts, so files without a usable header spread out as well
+		totals[least] += max(costs[order[k]], 1ULL);
+		mine[order[k]] = least == shard.index;
+	}
+
+	vector<string> selected;
+	for (size_t i = 0; i < files.size(); i++)
+		if (mine[i])
+			selected.push_back(files[i]);
+	return selected;
+}
@@ -0,0 +1,32 @@
+//SHARD  Splits one run over the nodes of a batch cluster without a coordinator.
+//   Every node lists all inputs and works out the same assignment on its own: the files,
+//   sorted longest first by the cost estimateFileCost() reads from their headers (ties by
+//   path), each go to the shard with the smallest total so far. Shards so end up with
+//   close to the same amount of sample data, and so about the same wall time. The
+//   assignment only depends on the paths and the headers, not on what earlier runs
+//   converted, so a file stays on its shard across re-runs as long as the inputs are the
+//   same; all nodes must be given the same paths.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct ShardSpec {
+	ShardSpec() : index(0), count(0) {}
+
+	unsigned index;              // of this node, 0 to count - 1
+	unsigned count;              // 0 when not sharded
+};
+
+//Parses "i/N" with 0 <= i < N, e.g. "$SLURM_ARRAY_TASK_ID/20"
+bool parseShard(const string& text, ShardSpec& shard, string& error);
+
+//"shard-3-of-20", for the names of the shard's manifest and logs
+string shardName(const ShardSpec& shard);
+
+//The files of shard out of all files, in the order given, with the headers read on that
+//many threads besides the calling one
+vector<string> shardFiles(const vector<string>& files, const ShardSpec& shard, unsigned threads);
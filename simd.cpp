@@ -0,0 +1,266 @@
+#include "simd.h"
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+//The order every kernel sums in, whatever the instruction set: 2 * L partial sums, one
+//per lane of two vectors of L elements, then one more vector of L if it fits, the partial
+//sums folded in halves, and what is left one at a time. Without fused multiply-adds
+//(-ffp-contract=off) this gives the same bits on every CPU. N is n when it is not 0, as
+//for dotAvx2
+template<class T, int L, int N>
+static T dotScalar(const T* a, const T* b, int n) {
+	if (N)
+		n = N;
+	T acc[2 * L] = {};
+	int i = 0;
+	for (; i + 2 * L <= n; i += 2 * L)
+		for (int k = 0; k < 2 * L; k++)
+			acc[k] += a[i + k] * b[i + k];
+	if (i + L <= n) {
+		for (int k = 0; k < L; k++)
+			acc[k] += a[i + k] * b[i + k];
+		i += L;
+	}
+	for (int width = L; width >= 1; width /= 2)
+		for (int k = 0; k < width; k++)
+			acc[k] += acc[k + width];
+	T sum = acc[0];
+	for (; !N && i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+template<int N>
+static inline double dotScalar(const double* a, const double* b, int n) {
+	return dotScalar<double, 4, N>(a, b, n);
+}
+
+template<int N>
+static inline float dotScalar(const float* a, const float* b, int n) {
+	return dotScalar<float, 8, N>(a, b, n);
+}
+
+//Written so that compilers turn it into byte shuffles of whole vectors
+static void swapBytesScalar(const unsigned char* in, unsigned char* out, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		uint32_t word;
+		memcpy(&word, in + 4 * i, 4);
+		word = __builtin_bswap32(word);
+		memcpy(out + 4 * i, &word, 4);
+	}
+}
+
+#ifdef SIMD_X86
+
+//N is n when it is not 0, for the loops to be unrolled
+template<int N>
+__attribute__((target("avx2")))
+static double dotAvx2(const double* a, const double* b, int n) {
+	if (N)
+		n = N;
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+	}
+	for (; i + 4 <= n; i += 4)
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+
+	acc0 = _mm256_add_pd(acc0, acc1);
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+	sum = _mm_add_sd(sum, _mm_unpackhi_pd(sum, sum));
+	double acc = _mm_cvtsd_f64(sum);
+	//Fixed lengths are whole vectors
+	for (; !N && i < n; i++)
+		acc += a[i] * b[i];
+	return acc;
+}
+
+template<int N>
+__attribute__((target("avx2")))
+static float dotAvx2(const float* a, const float* b, int n) {
+	if (N)
+		n = N;
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+	}
+	for (; i + 8 <= n; i += 8)
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+
+	acc0 = _mm256_add_ps(acc0, acc1);
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	float acc = _mm_cvtss_f32(sum);
+	for (; !N && i < n; i++)
+		acc += a[i] * b[i];
+	return acc;
+}
+
+static bool hasAvx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static const bool useAvx2 = hasAvx2();
+
+double simdDot(const double* a, const double* b, int n) {
+	return useAvx2 ? dotAvx2<0>(a, b, n) : dotScalar<0>(a, b, n);
+}
+
+float simdDot(const float* a, const float* b, int n) {
+	return useAvx2 ? dotAvx2<0>(a, b, n) : dotScalar<0>(a, b, n);
+}
+
+template<int N>
+double simdDotFixed(const double* a, const double* b) {
+	return useAvx2 ? dotAvx2<N>(a, b, N) : dotScalar<N>(a, b, N);
+}
+
+template<int N>
+float simdDotFixed(const float* a, const float* b) {
+	return useAvx2 ? dotAvx2<N>(a, b, N) : dotScalar<N>(a, b, N);
+}
+
+const char* simdInstructionSet() {
+	return useAvx2 ? "avx2" : "scalar";
+}
+
+#elif defined(SIMD_NEON)
+
+//The order of dotScalar, four registers standing in for two vectors of AVX2
+static inline double dotNeon(const double* a, const double* b, int n) {
+	float64x2_t acc0 = vdupq_n_f64(0.0);
+	float64x2_t acc1 = vdupq_n_f64(0.0);
+	float64x2_t acc2 = vdupq_n_f64(0.0);
+	float64x2_t acc3 = vdupq_n_f64(0.0);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = vaddq_f64(acc0, vmulq_f64(vld1q_f64(a + i), vld1q_f64(b + i)));
+		acc1 = vaddq_f64(acc1, vmulq_f64(vld1q_f64(a + i + 2), vld1q_f64(b + i + 2)));
+		acc2 = vaddq_f64(acc2, vmulq_f64(vld1q_f64(a + i + 4), vld1q_f64(b + i + 4)));
+		acc3 = vaddq_f64(acc3, vmulq_f64(vld1q_f64(a + i + 6), vld1q_f64(b + i + 6)));
+	}
+	for (; i + 4 <= n; i += 4) {
+		acc0 = vaddq_f64(acc0, vmulq_f64(vld1q_f64(a + i), vld1q_f64(b + i)));
+		acc1 = vaddq_f64(acc1, vmulq_f64(vld1q_f64(a + i + 2), vld1q_f64(b + i + 2)));
+	}
+	float64x2_t sum = vaddq_f64(vaddq_f64(acc0, acc2), vaddq_f64(acc1, acc3));
+	double acc = vgetq_lane_f64(sum, 0) + vgetq_lane_f64(sum, 1);
+	for (; i < n; i++)
+		acc += a[i] * b[i];
+	return acc;
+}
+
+static inline float dotNeon(const float* a, const float* b, int n) {
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	float32x4_t acc2 = vdupq_n_f32(0.0f);
+	float32x4_t acc3 = vdupq_n_f32(0.0f);
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc0 = vaddq_f32(acc0, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+		acc1 = vaddq_f32(acc1, vmulq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+		acc2 = vaddq_f32(acc2, vmulq_f32(vld1q_f32(a + i + 8), vld1q_f32(b + i + 8)));
+		acc3 = vaddq_f32(acc3, vmulq_f32(vld1q_f32(a + i + 12), vld1q_f32(b + i + 12)));
+	}
+	for (; i + 8 <= n; i += 8) {
+		acc0 = vaddq_f32(acc0, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+		acc1 = vaddq_f32(acc1, vmulq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)));
+	}
+	float32x4_t sum = vaddq_f32(vaddq_f32(acc0, acc2), vaddq_f32(acc1, acc3));
+	float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+	float acc = vget_lane_f32(half, 0) + vget_lane_f32(half, 1);
+	for (; i < n; i++)
+		acc += a[i] * b[i];
+	return acc;
+}
+
+double simdDot(const double* a, const double* b, int n) {
+	return dotNeon(a, b, n);
+}
+
+float simdDot(const float* a, const float* b, int n) {
+	return dotNeon(a, b, n);
+}
+
+template<int N>
+double simdDotFixed(const double* a, const double* b) {
+	return dotNeon(a, b, N);
+}
+
+template<int N>
+float simdDotFixed(const float* a, const float* b) {
+	return dotNeon(a, b, N);
+}
+
+void simdSwapBytes32(const void* in, void* out, size_t count) {
+	const unsigned char* from = (const unsigned char*)in;
+	unsigned char* to = (unsigned char*)out;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		vst1q_u8(to + 4 * i, vrev32q_u8(vld1q_u8(from + 4 * i)));
+	swapBytesScalar(from + 4 * i, to + 4 * i, count - i);
+}
+
+const char* simdInstructionSet() {
+	return "neon";
+}
+
+#else
+
+double simdDot(const double* a, const double* b, int n) {
+	return dotScalar<0>(a, b, n);
+}
+
+float simdDot(const float* a, const float* b, int n) {
+	return dotScalar<0>(a, b, n);
+}
+
+template<int N>
+double simdDotFixed(const double* a, const double* b) {
+	return dotScalar<N>(a, b, N);
+}
+
+template<int N>
+float simdDotFixed(const float* a, const float* b) {
+	return dotScalar<N>(a, b, N);
+}
+
+const char* simdInstructionSet() {
+	return "scalar";
+}
+
+#endif
+
+#ifndef SIMD_NEON
+void simdSwapBytes32(const void* in, void* out, size_t count) {
+	swapBytesScalar((const unsigned char*)in, (unsigned char*)out, count);
+}
+#endif
+
+//Phase lengths of the resampling designs specialized in pipeline.cpp
+template double simdDotFixed<80>(const double* a, const double* b);
+template double simdDotFixed<96>(const double* a, const double* b);
+template double simdDotFixed<108>(const double* a, const double* b);
+template double simdDotFixed<156>(const double* a, const double* b);
+template double simdDotFixed<160>(const double* a, const double* b);
+
+template float simdDotFixed<80>(const float* a, const float* b);
+template float simdDotFixed<96>(const float* a, const float* b);
+template float simdDotFixed<112>(const float* a, const float* b);
+template float simdDotFixed<160>(const float* a, const float* b);
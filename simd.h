@@ -0,0 +1,42 @@
+//SIMD  Vector kernels for the filtering hot loops and the byte order of the payload.
+//   The instruction set is picked once at run time on x86 (AVX2 when the CPU has it), NEON
+//   is always available on 64-bit ARM, and every other target gets a portable loop with
+//   several accumulators that the compiler can still vectorize. All of them add the same
+//   products in the same order, without fusing multiply and add, so a dot product has the
+//   same bits on every CPU.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Compiles an element-wise loop for several instruction sets, the loader picking the one
+//the CPU has (glibc on x86-64, with GCC or clang 14 and later). Only for loops without a
+//multiply followed by an add, which the FMA of AVX-512 would fuse: the results must not
+//depend on the CPU
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GLIBC__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#endif
+#endif
+#ifndef SIMD_CLONES
+#define SIMD_CLONES
+#endif
+
+//Sum of a[i] * b[i] for i < n
+double simdDot(const double* a, const double* b, int n);
+float simdDot(const float* a, const float* b, int n);
+
+//simdDot for an n fixed at compile time, with the loops unrolled for it. N is a whole
+//number of vectors (4 doubles or 8 floats), as the phases of a PolyphaseTable are, and
+//only those of the resampling filters of the usual sampling rates are compiled in (see
+//pipeline.cpp). The sums are those of simdDot in the same order, so are the results
+template<int N> double simdDotFixed(const double* a, const double* b);
+template<int N> float simdDotFixed(const float* a, const float* b);
+
+//Copies count 32-bit words from in to out with the bytes of each reversed, in place if
+//in == out, which is how big-endian hosts store floats little-endian
+void simdSwapBytes32(const void* in, void* out, size_t count);
+
+//Name of the kernels in use, e.g. for a --profile or version report
+const char* simdInstructionSet();
@@ -0,0 +1,217 @@
+#include "spectral.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+
+using namespace std;
+
+#define SPECTRAL_OUTSIZE (SPECTRAL_FFTSIZE / 2 + 1)
+#define SPECTRAL_BATCHWINDOWS (SPECTRAL_BATCH * SPECTRAL_WINDOWS)
+
+static fftw_plan stftPlan = NULL;
+static fftwf_plan stftPlanFloat = NULL;
+static fftw_plan batchPlan = NULL;
+static fftwf_plan batchPlanFloat = NULL;
+static bool batchExact = false;
+static bool batchExactFloat = false;
+static double hamWindow[SPECTRAL_FFTSIZE];
+static float hamWindowFloat[SPECTRAL_FFTSIZE];
+static once_flag stftPlanOnce;
+
+mutex& fftwPlannerMutex() {
+	static mutex plannerMutex;
+	return plannerMutex;
+}
+
+//Fills in with the same made-up samples in every run
+template<class T>
+static void testSignal(T* in, int n) {
+	uint32_t state = 1;
+	for (int i = 0; i < n; i++) {
+		state = state * 1664525u + 1013904223u;
+		in[i] = (T)((int32_t)state / 65536.0);
+	}
+}
+
+//Whether the batched plan gives every window the same bits as the epoch plan. FFTW does
+//not promise that plans of different batch sizes use the same codelets, so this is
+//checked once on a test signal; out must have room for two batches
+static bool sameAsEpochPlans(fftw_plan batch, fftw_plan epoch, double* in, fftw_complex* out) {
+	testSignal(in, SPECTRAL_BATCHWINDOWS * SPECTRAL_FFTSIZE);
+	fftw_complex* single = out + SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE;
+	fftw_execute_dft_r2c(batch, in, out);
+	for (int b = 0; b < SPECTRAL_BATCH; b++)
+		fftw_execute_dft_r2c(epoch, in + b * SPECTRAL_WINDOWS * SPECTRAL_FFTSIZE, single + b * SPECTRAL_WINDOWS * SPECTRAL_OUTSIZE);
+	return memcmp(out, single, SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE * sizeof(fftw_complex)) == 0;
+}
+
+static bool sameAsEpochPlans(fftwf_plan batch, fftwf_plan epoch, float* in, fftwf_complex* out) {
+	testSignal(in, SPECTRAL_BATCHWINDOWS * SPECTRAL_FFTSIZE);
+	fftwf_complex* single = out + SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE;
+	fftwf_execute_dft_r2c(batch, in, out);
+	for (int b = 0; b < SPECTRAL_BATCH; b++)
+		fftwf_execute_dft_r2c(epoch, in + b * SPECTRAL_WINDOWS * SPECTRAL_FFTSIZE, single + b * SPECTRAL_WINDOWS * SPECTRAL_OUTSIZE);
+	return memcmp(out, single, SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE * sizeof(fftwf_complex)) == 0;
+}
+
+static void createPlan() {
+	lock_guard<mutex> lock(fftwPlannerMutex());
+
+	//Same symmetric window as sp::hamming
+	const double PI_2 = 6.28318530717958647692;
+	for (int i = 0; i < SPECTRAL_FFTSIZE; i++)
+		hamWindow[i] = 0.54 - 0.46 * cos(1.0 * PI_2 * i / (SPECTRAL_FFTSIZE - 1));
+	for (int i = 0; i < SPECTRAL_FFTSIZE; i++)
+		hamWindowFloat[i] = (float)hamWindow[i];
+
+	//FFTW_ESTIMATE picks the plan without timing anything, so every run on a host computes
+	//the same transforms in the same order. FFTW_MEASURE could pick another algorithm, and
+	//other rounding, from one run to the next. The scratch buffers have the same
+	//(fftw_malloc) alignment the engines will use
+	int n = SPECTRAL_FFTSIZE;
+	double* in = fftw_alloc_real(SPECTRAL_BATCHWINDOWS * SPECTRAL_FFTSIZE);
+	fftw_complex* out = fftw_alloc_complex(2 * SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE);
+	stftPlan = fftw_plan_many_dft_r2c(1, &n, SPECTRAL_WINDOWS,
+		in, NULL, 1, SPECTRAL_FFTSIZE,
+		out, NULL, 1, SPECTRAL_OUTSIZE, FFTW_ESTIMATE);
+	batchPlan = fftw_plan_many_dft_r2c(1, &n, SPECTRAL_BATCHWINDOWS,
+		in, NULL, 1, SPECTRAL_FFTSIZE,
+		out, NULL, 1, SPECTRAL_OUTSIZE, FFTW_ESTIMATE);
+	if (stftPlan != NULL && batchPlan != NULL)
+		batchExact = sameAsEpochPlans(batchPlan, stftPlan, in, out);
+	fftw_free(in);
+	fftw_free(out);
+
+	float* inFloat = fftwf_alloc_real(SPECTRAL_BATCHWINDOWS * SPECTRAL_FFTSIZE);
+	fftwf_complex* outFloat = fftwf_alloc_complex(2 * SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE);
+	stftPlanFloat = fftwf_plan_many_dft_r2c(1, &n, SPECTRAL_WINDOWS,
+		inFloat, NULL, 1, SPECTRAL_FFTSIZE,
+		outFloat, NULL, 1, SPECTRAL_OUTSIZE, FFTW_ESTIMATE);
+	batchPlanFloat = fftwf_plan_many_dft_r2c(1, &n, SPECTRAL_BATCHWINDOWS,
+		inFloat, NULL, 1, SPECTRAL_FFTSIZE,
+		outFloat, NULL, 1, SPECTRAL_OUTSIZE, FFTW_ESTIMATE);
+	if (stftPlanFloat != NULL && batchPlanFloat != NULL)
+		batchExactFloat = sameAsEpochPlans(batchPlanFloat, stftPlanFloat, inFloat, outFloat);
+	fftwf_free(inFloat);
+	fftwf_free(outFloat);
+
+	if (stftPlan == NULL || stftPlanFloat == NULL || batchPlan == NULL || batchPlanFloat == NULL)
+		throw runtime_error("Unable to create FFTW plan");
+}
+
+void SpectralEngine::initialize() {
+	call_once(stftPlanOnce, createPlan);
+}
+
+SpectralEngine& SpectralEngine::local() {
+	static thread_local SpectralEngine engine;
+	return engine;
+}
+
+SpectralEngine::SpectralEngine() {
+	initialize();
+	_in = fftw_alloc_real(SPECTRAL_BATCHWINDOWS * SPECTRAL_FFTSIZE);
+	_out = fftw_alloc_complex(SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE);
+	_inFloat = fftwf_alloc_real(SPECTRAL_BATCHWINDOWS * SPECTRAL_FFTSIZE);
+	_outFloat = fftwf_alloc_complex(SPECTRAL_BATCHWINDOWS * SPECTRAL_OUTSIZE);
+}
+
+SpectralEngine::~SpectralEngine() {
+	fftw_free(_in);
+	fftw_free(_out);
+	fftwf_free(_inFloat);
+	fftwf_free(_outFloat);
+}
+
+//Overlapping windows of x laid out back to back in rows, already windowed
+SIMD_CLONES
+static void windowSegments(const double* x, double* rows) {
+	for (int w = 0; w < SPECTRAL_WINDOWS; w++) {
+		const double* segment = x + w * SPECTRAL_HOP;
+		double* row = rows + w * SPECTRAL_FFTSIZE;
+		for (int k = 0; k < SPECTRAL_FFTSIZE; k++)
+			row[k] = segment[k] * hamWindow[k];
+	}
+}
+
+SIMD_CLONES
+static void windowSegments(const float* x, float* rows) {
+	for (int w = 0; w < SPECTRAL_WINDOWS; w++) {
+		const float* segment = x + w * SPECTRAL_HOP;
+		float* row = rows + w * SPECTRAL_FFTSIZE;
+		for (int k = 0; k < SPECTRAL_FFTSIZE; k++)
+			row[k] = segment[k] * hamWindowFloat[k];
+	}
+}
+
+//Kept bins of SPECTRAL_WINDOWS transforms in CFS layout
+static void magnitudes(const fftw_complex* spectra, float* out, bool logMagnitude) {
+	for (int w = 0; w < SPECTRAL_WINDOWS; w++) {
+		const fftw_complex* bins = spectra + w * SPECTRAL_OUTSIZE;
+		float* row = out + w * SPECTRAL_BINS;
+		if (logMagnitude)
+			for (int k = 0; k < SPECTRAL_BINS; k++)
+				row[k] = (float)log1p(hypot(bins[k][0], bins[k][1]));
+		else
+			for (int k = 0; k < SPECTRAL_BINS; k++)
+				row[k] = (float)hypot(bins[k][0], bins[k][1]);
+	}
+}
+
+static void magnitudes(const fftwf_complex* spectra, float* out, bool logMagnitude) {
+	for (int w = 0; w < SPECTRAL_WINDOWS; w++) {
+		const fftwf_complex* bins = spectra + w * SPECTRAL_OUTSIZE;
+		float* row = out + w * SPECTRAL_BINS;
+		if (logMagnitude)
+			for (int k = 0; k < SPECTRAL_BINS; k++)
+				row[k] = log1pf(hypotf(bins[k][0], bins[k][1]));
+		else
+			for (int k = 0; k < SPECTRAL_BINS; k++)
+				row[k] = hypotf(bins[k][0], bins[k][1]);
+	}
+}
+
+void SpectralEngine::spectrogram(const double* x, float* out, bool logMagnitude) {
+	windowSegments(x, _in);
+
+	//New-array execute is thread safe and keeps the SIMD path as the buffers share the plan's alignment
+	fftw_execute_dft_r2c(stftPlan, _in, _out);
+	magnitudes(_out, out, logMagnitude);
+}
+
+void SpectralEngine::spectrogram(const float* x, float* out, bool logMagnitude) {
+	windowSegments(x, _inFloat);
+
+	fftwf_execute_dft_r2c(stftPlanFloat, _inFloat, _outFloat);
+	magnitudes(_outFloat, out, logMagnitude);
+}
+
+void SpectralEngine::spectrograms(const double* const x[SPECTRAL_BATCH], float* out, bool logMagnitude) {
+	for (int b = 0; b < SPECTRAL_BATCH; b++)
+		windowSegments(x[b], _in + b * SPECTRAL_WINDOWS * SPECTRAL_FFTSIZE);
+
+	//Otherwise the epoch plan, one signal at a time, for the bits of spectrogram()
+	if (batchExact)
+		fftw_execute_dft_r2c(batchPlan, _in, _out);
+	else
+		for (int b = 0; b < SPECTRAL_BATCH; b++)
+			fftw_execute_dft_r2c(stftPlan, _in + b * SPECTRAL_WINDOWS * SPECTRAL_FFTSIZE, _out + b * SPECTRAL_WINDOWS * SPECTRAL_OUTSIZE);
+	for (int b = 0; b < SPECTRAL_BATCH; b++)
+		magnitudes(_out + b * SPECTRAL_WINDOWS * SPECTRAL_OUTSIZE, out + b * SPECTRAL_WINDOWS * SPECTRAL_BINS, logMagnitude);
+}
+
+void SpectralEngine::spectrograms(const float* const x[SPECTRAL_BATCH], float* out, bool logMagnitude) {
+	for (int b = 0; b < SPECTRAL_BATCH; b++)
+		windowSegments(x[b], _inFloat + b * SPECTRAL_WINDOWS * SPECTRAL_FFTSIZE);
+
+	if (batchExactFloat)
+		fftwf_execute_dft_r2c(batchPlanFloat, _inFloat, _outFloat);
+	else
+		for (int b = 0; b < SPECTRAL_BATCH; b++)
+			fftwf_execute_dft_r2c(stftPlanFloat, _inFloat + b * SPECTRAL_WINDOWS * SPECTRAL_FFTSIZE, _outFloat + b * SPECTRAL_WINDOWS * SPECTRAL_OUTSIZE);
+	for (int b = 0; b < SPECTRAL_BATCH; b++)
+		magnitudes(_outFloat + b * SPECTRAL_WINDOWS * SPECTRAL_OUTSIZE, out + b * SPECTRAL_WINDOWS * SPECTRAL_BINS, logMagnitude);
+}
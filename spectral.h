@@ -0,0 +1,62 @@
+//SPECTRAL  FFTW-backed short-time Fourier transform of one 30 s epoch.
+//   The CFS spectrogram of a channel is 32 Hamming-windowed 128 point transforms taken
+//   every 90 samples of a 3000 sample (100 Hz) epoch, of which only bins 0..31 are kept.
+//   All 32 windows go through one batched r2c plan made once per process with
+//   FFTW_ESTIMATE, which times nothing, so every run on a host gets the same plan and the
+//   same rounding. Every thread owns an engine with its own aligned buffers and runs that
+//   plan on them, so the hot loop does no planning, no locking and no allocation. The
+//   single-precision signal path has a matching fftwf plan.
+//   spectrograms() runs the windows of all channels of an epoch as one batch of 96
+//   transforms, which saves two thirds of the plan executions of the pipelines. FFTW
+//   does not promise that this plan uses the codelets of the one of 32, so it is only
+//   used once a test signal has come out of both with the same bits; otherwise the plan
+//   of 32 runs three times.
+
+#pragma once
+
+#include <fftw3.h>
+#include <mutex>
+
+#define SPECTRAL_FFTSIZE (128)
+#define SPECTRAL_HOP (90)
+#define SPECTRAL_WINDOWS (32)
+#define SPECTRAL_BINS (32)
+#define SPECTRAL_EPOCHSAMPLES (3000)
+#define SPECTRAL_BATCH (3)           // signals transformed together by spectrograms()
+
+//Serializes calls into the FFTW planner, which is not thread safe
+std::mutex& fftwPlannerMutex();
+
+class SpectralEngine {
+public:
+	SpectralEngine();
+	~SpectralEngine();
+
+	//Creates the shared plan, safe to call more than once
+	static void initialize();
+
+	//Engine owned by the calling thread
+	static SpectralEngine& local();
+
+	//Spectrogram of SPECTRAL_EPOCHSAMPLES samples of x, written in CFS layout:
+	//SPECTRAL_WINDOWS rows of SPECTRAL_BINS magnitudes, or of log(1 + magnitude) for the
+	//reduced-precision payloads of quantize.h
+	void spectrogram(const double* x, float* out, bool logMagnitude = false);
+
+	//Same from single-precision samples, using the fftwf plan
+	void spectrogram(const float* x, float* out, bool logMagnitude = false);
+
+	//Spectrograms of SPECTRAL_BATCH signals through one batched plan, written to out one after
+	//another; each is the same as that of spectrogram(), the batched plan being checked for that
+	void spectrograms(const double* const x[SPECTRAL_BATCH], float* out, bool logMagnitude = false);
+	void spectrograms(const float* const x[SPECTRAL_BATCH], float* out, bool logMagnitude = false);
+
+private:
+	SpectralEngine(const SpectralEngine&) = delete;
+	SpectralEngine& operator=(const SpectralEngine&) = delete;
+
+	double* _in;
+	fftw_complex* _out;
+	float* _inFloat;
+	fftwf_complex* _outFloat;
+};
@@ -0,0 +1,152 @@
+#include "threadpool.h"
+#include <atomic>
+#include <exception>
+
+using namespace std;
+
+//Shared with the helpers, which may outlive the parallelFor() call that queued them
+struct ParallelRun {
+	ParallelRun(size_t count, const function<void(size_t)>* task) : count(count), next(0), done(0), task(task) {}
+
+	//Claims and runs tasks until none are left
+	void work() {
+		size_t i;
+		while ((i = next.fetch_add(1)) < count) {
+			try {
+				(*task)(i);
+			}
+			catch (...) {
+				lock_guard<mutex> lock(guard);
+				if (!error)
+					error = current_exception();
+			}
+			if (done.fetch_add(1) + 1 == count) {
+				lock_guard<mutex> lock(guard);
+				finished.notify_all();
+			}
+		}
+	}
+
+	size_t count;
+	atomic<size_t> next, done;
+	const function<void(size_t)>* task;    // only used for a claimed index, while the caller waits
+	mutex guard;
+	condition_variable finished;
+	exception_ptr error;
+};
+
+//Pool and node of the worker running on this thread, for parallelFor() to find its node
+static thread_local const ThreadPool* workerPool = NULL;
+static thread_local unsigned workerNode = 0;
+
+ThreadPool::ThreadPool(unsigned threads, const vector<NumaNode>& nodes) :
+	_nodes(nodes), _nodeWorkers(nodes.size(), 0), _nodeTasks(nodes.size()), _stopping(false) {
+	if (threads == 0)
+		threads = 1;
+
+	_workers.reserve(threads);
+	for (unsigned i = 0; i < threads; i++) {
+		//Each worker goes to the node with the fewest workers per CPU so far
+		unsigned node = 0;
+		for (unsigned n = 1; n < _nodes.size(); n++)
+			if ((_nodeWorkers[n] + 1) * _nodes[node].cpus.size() < (_nodeWorkers[node] + 1) * _nodes[n].cpus.size())
+				node = n;
+		if (!_nodes.empty())
+			_nodeWorkers[node]++;
+		_workerNodes.push_back(node);
+		_retired.push_back(make_shared< atomic<bool> >(false));
+		_workers.push_back(thread(&ThreadPool::workerLoop, this, node, _retired.back()));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeUp.notify_all();
+
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i].join();
+}
+
+void ThreadPool::parallelFor(size_t count, unsigned width, const function<void(size_t)>& task) {
+	if (count == 0)
+		return;
+
+	shared_ptr<ParallelRun> run = make_shared<ParallelRun>(count, &task);
+	size_t helpers = min((size_t)(width > 0 ? width - 1 : 0), count - 1);
+	bool onNode = !_nodes.empty() && workerPool == this;
+	if (onNode)
+		helpers = min(helpers, (size_t)_nodeWorkers[workerNode] - 1);
+	{
+		lock_guard<mutex> lock(_mutex);
+		deque< function<void()> >& queue = onNode ? _nodeTasks[workerNode] : _tasks;
+		for (size_t i = 0; i < helpers; i++)
+			queue.push_back([run]() { run->work(); });
+	}
+	//Workers of every node wait on the same condition, one woken might be on another node
+	if (helpers == 1 && !onNode)
+		_wakeUp.notify_one();
+	else if (helpers > 0)
+		_wakeUp.notify_all();
+
+	run->work();
+	{
+		unique_lock<mutex> lock(run->guard);
+		run->finished.wait(lock, [&run]() { return run->done.load() == run->count; });
+	}
+	if (run->error)
+		rethrow_exception(run->error);
+}
+
+bool ThreadPool::abandonWorker(thread::id id) {
+	lock_guard<mutex> lock(_mutex);
+	if (_stopping)
+		return false;
+	for (size_t i = 0; i < _workers.size(); i++) {
+		if (_workers[i].get_id() != id)
+			continue;
+		_retired[i]->store(true);
+		_workers[i].detach();
+		_retired[i] = make_shared< atomic<bool> >(false);
+		_workers[i] = thread(&ThreadPool::workerLoop, this, _workerNodes[i], _retired[i]);
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::workerLoop(unsigned node, shared_ptr< atomic<bool> > retired) {
+	//Memory first touched by a pinned worker comes from its node
+	deque< function<void()> >* helping = NULL;
+	if (!_nodes.empty()) {
+		numaPinThread(_nodes[node]);
+		workerPool = this;
+		workerNode = node;
+		helping = &_nodeTasks[node];
+	}
+
+	while (true) {
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(_mutex);
+			_wakeUp.wait(lock, [this, helping]() { return _stopping || !_tasks.empty() || (helping && !helping->empty()); });
+
+			//Drain what is queued before shutting down. Helpers wait behind the shared queue,
+			//as they would in it
+			deque< function<void()> >* queue = &_tasks;
+			if (_tasks.empty() && helping && !helping->empty())
+				queue = helping;
+			if (queue->empty())
+				return;
+
+			task = move(queue->front());
+			queue->pop_front();
+		}
+		task();
+
+		//The pool may be gone by the time an abandoned task returns
+		if (retired->load())
+			return;
+	}
+}
@@ -0,0 +1,80 @@
+//THREADPOOL  A fixed set of persistent worker threads fed from one shared task queue.
+//   Workers are started once and pull tasks until the pool is destroyed, so a long task
+//   only occupies its own thread instead of holding back a whole batch. parallelFor() lets
+//   a task spread its own work over workers that are idle, e.g. when fewer files than
+//   workers are left. Given NUMA nodes, the workers are spread over them and pinned, and
+//   a task only gets helpers from its own node, so the memory of a file stays local.
+//   A worker stuck in a task that will not return, e.g. on a hung network read, can be
+//   abandoned and replaced so the pool keeps its size.
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include "numa.h"
+
+using namespace std;
+
+class ThreadPool {
+public:
+	//With nodes, each node gets workers in proportion to its CPUs, pinned to them
+	explicit ThreadPool(unsigned threads, const vector<NumaNode>& nodes = vector<NumaNode>());
+	~ThreadPool();
+
+	template<class F>
+	future<typename result_of<F()>::type> submit(F task);
+
+	unsigned size() const { return (unsigned)_workers.size(); }
+
+	//Nodes the workers are pinned to, 0 when they are not
+	unsigned nodes() const { return (unsigned)_nodes.size(); }
+
+	//Runs task(0) .. task(count - 1) on the calling thread and on up to width - 1 workers and
+	//returns once all have run, rethrowing the first exception of any. The caller goes through
+	//the tasks itself as well, so this never waits for a worker to become free and is safe to
+	//call from a task of the same pool; helpers that only start once everything is claimed
+	//return at once. Called from a worker pinned to a node, the helpers are workers of that
+	//node, which take them once the shared queue is empty
+	void parallelFor(size_t count, unsigned width, const function<void(size_t)>& task);
+
+	//Detaches the worker running on thread id and starts another on its node in its place.
+	//The abandoned worker leaves the pool as soon as its task returns, if ever; whatever that
+	//task uses has to outlive it. False if id is not a worker of the pool
+	bool abandonWorker(thread::id id);
+
+private:
+	void workerLoop(unsigned node, shared_ptr< atomic<bool> > retired);
+
+	vector<thread> _workers;
+	vector<unsigned> _workerNodes;               // node of each worker
+	vector< shared_ptr< atomic<bool> > > _retired; // set when the worker has been abandoned
+	deque< function<void()> > _tasks;
+	vector<NumaNode> _nodes;
+	vector<unsigned> _nodeWorkers;                // workers pinned to each node
+	vector< deque< function<void()> > > _nodeTasks; // helpers for the tasks running on each node
+	mutex _mutex;
+	condition_variable _wakeUp;
+	bool _stopping;
+};
+
+template<class F>
+future<typename result_of<F()>::type> ThreadPool::submit(F task) {
+	typedef typename result_of<F()>::type R;
+
+	//packaged_task is move-only, std::function needs a copyable callable
+	shared_ptr< packaged_task<R()> > job = make_shared< packaged_task<R()> >(task);
+	future<R> result = job->get_future();
+	{
+		lock_guard<mutex> lock(_mutex);
+		_tasks.push_back([job]() { (*job)(); });
+	}
+	_wakeUp.notify_one();
+	return result;
+}
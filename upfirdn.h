@@ -37,6 +37,41 @@ using namespace std;
 #include <stdexcept>
 #include <complex>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include "simd.h"
+#include "arena.h"
+
+#define RESAMPLER_ALIGNMENT 32
+
+/*
+  Polyphase coefficients in the transposed, flipped layout apply() uses.
+  Every phase is zero-padded at the front to a multiple of the SIMD width
+  and starts on a RESAMPLER_ALIGNMENT boundary, so each output is one
+  fixed-length dot product.  A table is read-only once built and can be
+  shared by any number of resamplers with the same filter.
+*/
+template<class C>
+class PolyphaseTable {
+public:
+    PolyphaseTable(int upRate, const C *coefs, int coefCount);
+    ~PolyphaseTable() { delete [] _storage; }
+
+    int        upRate() const { return _upRate; }
+    int        coefsPerPhase() const { return _coefsPerPhase; }
+    int        stride() const { return _stride; }
+    const C   *phase(int t) const { return _coefs + t*_stride; }
+
+private:
+    PolyphaseTable(const PolyphaseTable&) = delete;
+    PolyphaseTable& operator=(const PolyphaseTable&) = delete;
+
+    int        _upRate;
+    int        _coefsPerPhase;    // ceil(coefCount/upRate)
+    int        _stride;           // _coefsPerPhase rounded up to the SIMD width
+    C         *_storage;
+    C         *_coefs;            // aligned start of phase 0
+};
 
 template<class S1, class S2, class C>
 class Resampler{
@@ -46,29 +81,50 @@ public:
     typedef    C coefType;
 
     Resampler(int upRate, int downRate, C *coefs, int coefCount);
+    /* shares a table built for the same upRate, so resamplers with the
+     * same filter do not each rebuild it */
+    Resampler(int upRate, int downRate, shared_ptr< const PolyphaseTable<C> > table);
     virtual ~Resampler();
 
     int        apply(S1* in, int inCount, S2* out, int outCount);
     int        neededOutCount(int inCount);
     int        coefsPerPhase() { return _coefsPerPhase; }
+    /* inputs in the window of every output, the latest one included */
+    int        stride() { return _stride; }
+
+    /* makes apply() run a loop compiled for this upRate, downRate and
+     * stride, with the phase steps and the dot product unrolled for them.
+     * The outputs are the same; false, and nothing changes, for a
+     * resampler with other rates or another table */
+    template<int Up, int Down, int Stride> bool specialize();
     
 private:
+    Resampler(const Resampler&) = delete;
+    Resampler& operator=(const Resampler&) = delete;
+
+    void       init(shared_ptr< const PolyphaseTable<C> > table);
+    /* the loop of apply(), with the rates and stride of the object
+     * where a template argument is 0 */
+    template<int Up, int Down, int Stride>
+    int        run(const S1* in, int inCount, S2* out);
+
     int        _upRate;
     int        _downRate;
 
-    coefType   *_transposedCoefs;
-    inputType  *_state;
-    inputType  *_stateEnd;
+    shared_ptr< const PolyphaseTable<C> > _table;
+    inputType  *_state;           // last _stride-1 inputs
+    ArenaVector<inputType> _buffer;    // _state followed by the current input
     
-    int        _paddedCoefCount;  // ceil(len(coefs)/upRate)*upRate
-    int        _coefsPerPhase;    // _paddedCoefCount / upRate
+    int        _coefsPerPhase;    // ceil(len(coefs)/upRate)
+    int        _stride;           // coefficients per phase including padding
     
     int        _t;                // "time" (modulo upRate)
     int        _xOffset;
+
+    int        (Resampler::*_run)(const S1*, int, S2*);
     
 };
 
-
 #include <iostream>
 #include <cmath>
 
@@ -82,10 +138,57 @@ using std::copy;
 
 using std::invalid_argument;
 
+/* Dot product of one phase with the input window; float and double go to
+ * the vector kernels in simd.h */
 template<class S1, class S2, class C>
-Resampler<S1, S2, C>::Resampler(int upRate, int downRate, C *coefs,
-                                int coefCount):
-  _upRate(upRate), _downRate(downRate), _t(0), _xOffset(0)
+struct ResamplerKernel {
+    static S2 dot(const C *h, const S1 *x, int n) {
+        S2 acc = 0.;
+        for (int i=0; i<n; ++i)
+            acc += x[i] * h[i];
+        return acc;
+    }
+};
+
+template<>
+struct ResamplerKernel<double, double, double> {
+    static double dot(const double *h, const double *x, int n) { return simdDot(h, x, n); }
+};
+
+template<>
+struct ResamplerKernel<float, float, float> {
+    static float dot(const float *h, const float *x, int n) { return simdDot(h, x, n); }
+};
+
+/* The same for a length known at compile time, 0 for the one passed */
+template<class S1, class S2, class C, int N>
+struct ResamplerFixedKernel {
+    static S2 dot(const C *h, const S1 *x, int n) {
+        return ResamplerKernel<S1, S2, C>::dot(h, x, N ? N : n);
+    }
+};
+
+template<int N>
+struct ResamplerFixedKernel<double, double, double, N> {
+    static double dot(const double *h, const double *x, int) { return simdDotFixed<N>(h, x); }
+};
+
+template<int N>
+struct ResamplerFixedKernel<float, float, float, N> {
+    static float dot(const float *h, const float *x, int) { return simdDotFixed<N>(h, x); }
+};
+
+template<>
+struct ResamplerFixedKernel<double, double, double, 0> : ResamplerKernel<double, double, double> {
+};
+
+template<>
+struct ResamplerFixedKernel<float, float, float, 0> : ResamplerKernel<float, float, float> {
+};
+
+template<class C>
+PolyphaseTable<C>::PolyphaseTable(int upRate, const C *coefs, int coefCount):
+  _upRate(upRate)
 /*
   The coefficients are copied into local storage in a transposed, flipped
   arrangement.  For example, suppose upRate is 3, and the input number
@@ -94,38 +197,77 @@ Resampler<S1, S2, C>::Resampler(int upRate, int downRate, C *coefs,
         h[9], h[6], h[3], h[0],   // flipped phase 0 coefs
            0, h[7], h[4], h[1],   // flipped phase 1 coefs (zero-padded)
            0, h[8], h[5], h[2],   // flipped phase 2 coefs (zero-padded)
+  with further zeros in front of every row up to the SIMD width.
 */
 {
-    _paddedCoefCount = coefCount;
-    while (_paddedCoefCount % _upRate) {
-        _paddedCoefCount++;
+    if (upRate <= 0 || coefCount <= 0)
+        throw invalid_argument("Empty resampling filter");
+
+    _coefsPerPhase = (coefCount + upRate - 1) / upRate;
+    int width = sizeof(C) < RESAMPLER_ALIGNMENT ? RESAMPLER_ALIGNMENT / sizeof(C) : 1;
+    _stride = (_coefsPerPhase + width - 1) / width * width;
+
+    int extra = RESAMPLER_ALIGNMENT / sizeof(C) + 1;
+    _storage = new C[_stride * upRate + extra];
+    void *aligned = _storage;
+    size_t space = (_stride * upRate + extra) * sizeof(C);
+    _coefs = static_cast<C*>(align(RESAMPLER_ALIGNMENT, _stride * upRate * sizeof(C), aligned, space));
+    if (!_coefs)
+        _coefs = _storage;
+    fill(_coefs, _coefs + _stride * upRate, C(0.));
+
+    int pad = _stride - _coefsPerPhase;
+    for (int i=0; i<upRate; ++i) {
+        for (int j=0; j<_coefsPerPhase; ++j) {
+            if (j*upRate + i  < coefCount)
+                _coefs[pad + (_coefsPerPhase-1-j) + i*_stride] =
+                                                coefs[j*upRate + i];
+        }
     }
-    _coefsPerPhase = _paddedCoefCount / _upRate;
-    
-    _transposedCoefs = new coefType[_paddedCoefCount];
-    fill(_transposedCoefs, _transposedCoefs + _paddedCoefCount, 0.);
+}
 
-    _state = new inputType[_coefsPerPhase - 1];
-    _stateEnd = _state + _coefsPerPhase - 1;
-    fill(_state, _stateEnd, 0.);
+template<class S1, class S2, class C>
+Resampler<S1, S2, C>::Resampler(int upRate, int downRate, C *coefs,
+                                int coefCount):
+  _upRate(upRate), _downRate(downRate), _state(NULL), _t(0), _xOffset(0)
+{
+    init(make_shared< const PolyphaseTable<C> >(upRate, coefs, coefCount));
+}
 
+template<class S1, class S2, class C>
+Resampler<S1, S2, C>::Resampler(int upRate, int downRate,
+                                shared_ptr< const PolyphaseTable<C> > table):
+  _upRate(upRate), _downRate(downRate), _state(NULL), _t(0), _xOffset(0)
+{
+    if (!table || table->upRate() != upRate)
+        throw invalid_argument("Coefficient table does not match upRate");
+    init(table);
+}
 
-    /* This both transposes, and "flips" each phase, while
-     * copying the defined coefficients into local storage.
-     * There is probably a faster way to do this
-     */
-    for (int i=0; i<_upRate; ++i) {
-        for (int j=0; j<_coefsPerPhase; ++j) {
-            if (j*_upRate + i  < coefCount)
-                _transposedCoefs[(_coefsPerPhase-1-j) + i*_coefsPerPhase] =
-                                                coefs[j*_upRate + i];
-        }
-    }
+template<class S1, class S2, class C>
+void Resampler<S1, S2, C>::init(shared_ptr< const PolyphaseTable<C> > table)
+{
+    _table = table;
+    _coefsPerPhase = _table->coefsPerPhase();
+    _stride = _table->stride();
+
+    _state = new inputType[_stride - 1];
+    fill(_state, _state + _stride - 1, 0.);
+    _run = &Resampler::template run<0, 0, 0>;
+}
+
+template<class S1, class S2, class C>
+template<int Up, int Down, int Stride>
+bool Resampler<S1, S2, C>::specialize()
+{
+    if (_upRate != Up || _downRate != Down || _stride != Stride)
+        return false;
+    _run = &Resampler::template run<Up, Down, Stride>;
+    return true;
 }
 
 template<class S1, class S2, class C>
 Resampler<S1, S2, C>::~Resampler() {
-    delete [] _transposedCoefs;
     delete [] _state;
 }
 
@@ -146,50 +288,41 @@ int Resampler<S1, S2, C>::apply(S1* in, int inCount,
     if (outCount < neededOutCount(inCount)) 
         throw invalid_argument("Not enough output samples");
 
-    // x points to the latest processed input sample
-    inputType *x = in + _xOffset;
+    return (this->*_run)(in, inCount, out);
+}
+
+template<class S1, class S2, class C>
+template<int Up, int Down, int Stride>
+int Resampler<S1, S2, C>::run(const S1* in, int inCount, S2* out) {
+    const int upRate = Up ? Up : _upRate;
+    const int downRate = Down ? Down : _downRate;
+
+    // history and input back to back, so every window is contiguous
+    int history = _stride - 1;
+    _buffer.resize(history + inCount);
+    copy(_state, _state + history, _buffer.begin());
+    copy(in, in + inCount, _buffer.begin() + history);
+
+    // x is the latest processed input sample, its window starts at _buffer[x]
+    const inputType *window = &_buffer[0];
     outputType *y = out;
-    inputType *end = in + inCount;
-    while (x < end) {
-        outputType acc = 0.;
-        coefType *h = _transposedCoefs + _t*_coefsPerPhase;
-        inputType *xPtr = x - _coefsPerPhase + 1;
-        int offset = in - xPtr;
-        if (offset > 0) {
-            // need to draw from the _state buffer
-            inputType *statePtr = _stateEnd - offset;
-            while (statePtr < _stateEnd) {
-                acc += *statePtr++ * *h++;
-            }
-            xPtr += offset;
-        }
-        while (xPtr <= x) {
-            acc += *xPtr++ * *h++;
-        }
-        *y++ = acc;
-        _t += _downRate;
+    int x = _xOffset;
+    int t = _t;
+    while (x < inCount) {
+        *y++ = ResamplerFixedKernel<S1, S2, C, Stride>::dot(_table->phase(t), window + x, _stride);
+        t += downRate;
 
-        int advanceAmount = _t / _upRate;
+        int advanceAmount = t / upRate;
 
         x += advanceAmount;
         // which phase of the filter to use
-        _t %= _upRate;
-    }
-    _xOffset = x - end;
-
-    // manage _state buffer
-    // find number of samples retained in buffer:
-    int retain = (_coefsPerPhase - 1) - inCount;
-    if (retain > 0) {
-        // for inCount smaller than state buffer, copy end of buffer
-        // to beginning:
-        copy(_stateEnd - retain, _stateEnd, _state);
-        // Then, copy the entire (short) input to end of buffer
-        copy(in, end, _stateEnd - inCount);
-    } else {
-        // just copy last input samples into state buffer
-        copy(end - (_coefsPerPhase - 1), end, _state);
+        t %= upRate;
     }
+    _t = t;
+    _xOffset = x - inCount;
+
+    // keep the last inputs for the next call
+    copy(_buffer.end() - history, _buffer.end(), _state);
     // number of samples computed
     return y - out;
 }
@@ -232,7 +365,7 @@ the original version of this function.
     results.resize(resultsCount);
 
     // run filtering
-    int numSamplesComputed = theResampler.apply(inputPadded, 
+    theResampler.apply(inputPadded, 
             inLength + padding, &results[0], resultsCount);
     delete[] inputPadded;
 }
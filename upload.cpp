@@ -0,0 +1,401 @@
+#include "upload.h"
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#ifdef OUTPUT_UPLOAD
+#include <curl/curl.h>
+#endif
+
+using namespace std;
+
+struct UploadFile::State {
+	State() : parts(0), sent(false), ended(false), finished(false), deleted(false), closed(false) {}
+
+	string url;
+	unsigned parts;              // written and not answered yet
+	bool sent;                   // a part or the end was handed to the session
+	bool ended;                  // finish() or abandon() was called
+	bool finished;               // finish() succeeded
+	bool deleted;                // abandon() was called
+	string error;
+	bool closed;                 // the service has answered the finishing requests
+	mutex lock;
+	condition_variable done;
+};
+
+typedef UploadFile::State FileState;
+
+static bool failed(FileState& file) {
+	lock_guard<mutex> lock(file.lock);
+	return !file.error.empty();
+}
+
+static void fail(FileState& file, const string& message) {
+	lock_guard<mutex> lock(file.lock);
+	if (file.error.empty())
+		file.error = message;
+}
+
+//name as a path segment, everything but the unreserved characters percent-encoded
+static string escapeName(const string& name) {
+	string escaped;
+	char code[4];
+	for (size_t i = 0; i < name.size(); i++) {
+		unsigned char c = (unsigned char)name[i];
+		if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~')
+			escaped += (char)c;
+		else {
+			snprintf(code, sizeof(code), "%%%02X", c);
+			escaped += code;
+		}
+	}
+	return escaped;
+}
+
+#ifdef OUTPUT_UPLOAD
+
+//Handles are reset between requests but keep their connection, and share the cache of
+//connections, DNS answers and TLS sessions, which libcurl locks through these
+struct Uploader::Session {
+	Session() : share(NULL) {}
+
+	CURLSH* share;
+	mutex locks[CURL_LOCK_DATA_LAST];
+	vector<CURL*> handles;       // one per connection thread
+};
+
+static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* session) {
+	static_cast<Uploader::Session*>(session)->locks[data].lock();
+}
+
+static void unlockShare(CURL*, curl_lock_data data, void* session) {
+	static_cast<Uploader::Session*>(session)->locks[data].unlock();
+}
+
+static once_flag curlInitialized;
+
+enum { UPLOAD_SENT, UPLOAD_RETRY, UPLOAD_FAILED };
+
+struct RequestBody {
+	const unsigned char* data;
+	size_t left;
+};
+
+static size_t readBody(char* buffer, size_t size, size_t count, void* body) {
+	RequestBody& request = *static_cast<RequestBody*>(body);
+	size_t n = min(size * count, request.left);
+	copy(request.data, request.data + n, buffer);
+	request.data += n;
+	request.left -= n;
+	return n;
+}
+
+static size_t discardResponse(char*, size_t size, size_t count, void*) {
+	return size * count;
+}
+
+//A PUT of count bytes at offset of a file of total bytes (0 while not known), or a DELETE
+//for data NULL, sent once. Whether a failure may pass is up to the caller to retry
+static int sendRequest(CURL* curl, CURLSH* share, const string& url, const vector<string>& headers,
+	const unsigned char* data, size_t count, uint64_t offset, uint64_t total, string& error) {
+	char errorBuffer[CURL_ERROR_SIZE] = "";
+	struct curl_slist* list = NULL;
+	for (size_t i = 0; i < headers.size(); i++)
+		list = curl_slist_append(list, headers[i].c_str());
+	RequestBody body = { data, count };
+
+	curl_easy_reset(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)UPLOADER_CONNECTSECONDS);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)UPLOADER_STALLSECONDS);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discardResponse);
+	if (data) {
+		char range[96];
+		if (total > 0)
+			snprintf(range, sizeof(range), "Content-Range: bytes %llu-%llu/%llu", (unsigned long long)offset,
+				(unsigned long long)(offset + count - 1), (unsigned long long)total);
+		else
+			snprintf(range, sizeof(range), "Content-Range: bytes %llu-%llu/*", (unsigned long long)offset, (unsigned long long)(offset + count - 1));
+		list = curl_slist_append(list, range);
+		list = curl_slist_append(list, "Content-Type: application/octet-stream");
+		//Without it every buffer waits for a 100 Continue that many servers never send
+		list = curl_slist_append(list, "Expect:");
+		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, readBody);
+		curl_easy_setopt(curl, CURLOPT_READDATA, &body);
+		curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)count);
+	}
+	else
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+
+	CURLcode code = curl_easy_perform(curl);
+	long status = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	curl_slist_free_all(list);
+
+	if (code != CURLE_OK) {
+		error = "Uploading " + url + ": " + (errorBuffer[0] ? errorBuffer : curl_easy_strerror(code));
+		return UPLOAD_RETRY;
+	}
+	if ((status >= 200 && status < 300) || (!data && status == 404))
+		return UPLOAD_SENT;
+	error = "Uploading " + url + ": HTTP " + to_string(status);
+	return (status == 408 || status == 429 || status >= 500) ? UPLOAD_RETRY : UPLOAD_FAILED;
+}
+
+#else
+
+struct Uploader::Session {
+};
+
+#endif
+
+UploadFile::UploadFile() : _uploader(NULL) {
+}
+
+UploadFile::~UploadFile() {
+	if (_state && !_state->finished)
+		abandon();
+}
+
+bool UploadFile::open(const string& name, Uploader* uploader) {
+	if (_state && !_state->finished)
+		abandon();
+	_uploader = uploader;
+	_state.reset(new State());
+	_state->url = uploader->url() + "/" + escapeName(name);
+	if (!uploader->ok()) {
+		fail(*_state, uploader->error());
+		return false;
+	}
+	return true;
+}
+
+bool UploadFile::write(vector<unsigned char>& data, uint64_t offset) {
+	if (!_state || failed(*_state))
+		return false;
+	Uploader::Job job;
+	job.file = _state;
+	job.data.swap(data);
+	job.offset = offset;
+	return _uploader->submit(job);
+}
+
+bool UploadFile::finish(vector<unsigned char>& head, vector<unsigned char>& data, uint64_t offset) {
+	if (!_state || _state->ended)
+		return false;
+	_state->ended = true;
+	Uploader::Job job;
+	job.kind = Uploader::UPLOAD_JOB_FINISH;
+	job.file = _state;
+	job.head.swap(head);
+	job.data.swap(data);
+	job.offset = offset;
+	if (!_uploader->submit(job))
+		return false;
+	unique_lock<mutex> lock(_state->lock);
+	while (!_state->closed)
+		_state->done.wait(lock);
+	_state->finished = _state->error.empty();
+	return _state->finished;
+}
+
+void UploadFile::abandon() {
+	if (!_state || _state->deleted)
+		return;
+	_state->ended = true;
+	_state->deleted = true;
+	if (!_state->sent)
+		return;
+
+	//Deleted once the parts still queued, or the end, are answered, without waiting for it here
+	Uploader::Job job;
+	job.kind = Uploader::UPLOAD_JOB_DELETE;
+	job.file = _state;
+	_uploader->submit(job);
+}
+
+string UploadFile::error() const {
+	if (!_state)
+		return string();
+	lock_guard<mutex> lock(_state->lock);
+	return _state->error;
+}
+
+Uploader::Uploader(const string& url, const vector<string>& headers, unsigned connections, unsigned long long budgetBytes) :
+	_url(url), _headers(headers), _budget(budgetBytes), _held(0), _stopping(false), _session(new Session()) {
+	while (!_url.empty() && _url[_url.size() - 1] == '/')
+		_url.erase(_url.size() - 1);
+#ifdef OUTPUT_UPLOAD
+	call_once(curlInitialized, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+	_session->share = curl_share_init();
+	if (!_session->share) {
+		_error = "Can not start the upload session";
+		_stopping = true;
+		return;
+	}
+	curl_share_setopt(_session->share, CURLSHOPT_LOCKFUNC, lockShare);
+	curl_share_setopt(_session->share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+	curl_share_setopt(_session->share, CURLSHOPT_USERDATA, _session.get());
+	curl_share_setopt(_session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(_session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(_session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	for (unsigned c = 0; c < max(connections, 1u); c++) {
+		CURL* curl = curl_easy_init();
+		if (!curl) {
+			_error = "Can not start the upload session";
+			break;
+		}
+		_session->handles.push_back(curl);
+	}
+	if (!_error.empty()) {
+		_stopping = true;
+		return;
+	}
+	for (unsigned c = 0; c < _session->handles.size(); c++)
+		_threads.push_back(thread(&Uploader::connectionLoop, this, c));
+#else
+	(void)connections;
+	_error = "This build can not upload, make it with UPLOAD=1";
+	_stopping = true;
+#endif
+}
+
+Uploader::~Uploader() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeUp.notify_all();
+	for (size_t t = 0; t < _threads.size(); t++)
+		_threads[t].join();
+#ifdef OUTPUT_UPLOAD
+	for (size_t c = 0; c < _session->handles.size(); c++)
+		curl_easy_cleanup(_session->handles[c]);
+	if (_session->share)
+		curl_share_cleanup(_session->share);
+#endif
+}
+
+bool Uploader::available() {
+#ifdef OUTPUT_UPLOAD
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Uploader::submit(Job& job) {
+	unsigned long long bytes = job.head.size() + job.data.size();
+	{
+		unique_lock<mutex> lock(_mutex);
+		//A buffer larger than the whole budget still goes once nothing else is held
+		while (!_stopping && _held > 0 && _held + bytes > _budget)
+			_drained.wait(lock);
+		if (_stopping)
+			return false;
+		if (job.kind != UPLOAD_JOB_DELETE) {
+			lock_guard<mutex> fileLock(job.file->lock);
+			if (job.kind == UPLOAD_JOB_PART)
+				job.file->parts++;
+			job.file->sent = true;
+		}
+		_held += bytes;
+		_queue.push_back(move(job));
+	}
+	_wakeUp.notify_one();
+	return true;
+}
+
+void Uploader::connectionLoop(unsigned connection) {
+	while (true) {
+		Job job;
+		{
+			unique_lock<mutex> lock(_mutex);
+			while (_queue.empty() && !_stopping)
+				_wakeUp.wait(lock);
+			if (_queue.empty())
+				return;
+			job = move(_queue.front());
+			_queue.pop_front();
+		}
+
+		perform(connection, job);
+		unsigned long long bytes = job.head.size() + job.data.size();
+		job.head = vector<unsigned char>();
+		job.data = vector<unsigned char>();
+		{
+			lock_guard<mutex> lock(_mutex);
+			_held -= bytes;
+		}
+		_drained.notify_all();
+	}
+}
+
+void Uploader::perform(unsigned connection, Job& job) {
+	FileState& file = *job.file;
+
+	//The parts of a file queued before its end were taken by connections before it, so
+	//waiting for their answers here only waits on requests already under way
+	if (job.kind != UPLOAD_JOB_PART) {
+		unique_lock<mutex> lock(file.lock);
+		while (file.parts > 0)
+			file.done.wait(lock);
+	}
+
+	//Each request is sent again while its failure may pass, the buffer is held meanwhile
+	auto send = [&](const unsigned char* data, size_t count, uint64_t offset, uint64_t total) -> bool {
+#ifdef OUTPUT_UPLOAD
+		string error;
+		for (int attempt = 0; ; attempt++) {
+			int outcome = sendRequest(_session->handles[connection], _session->share, file.url, _headers, data, count, offset, total, error);
+			if (outcome == UPLOAD_SENT)
+				return true;
+			if (outcome == UPLOAD_FAILED || attempt == UPLOADER_RETRIES || (data && failed(file)))
+				break;
+			this_thread::sleep_for(chrono::milliseconds((long long)UPLOADER_RETRYMILLIS << attempt));
+		}
+		fail(file, error);
+#else
+		(void)connection;
+		(void)data;
+		(void)count;
+		(void)offset;
+		(void)total;
+#endif
+		return false;
+	};
+
+	if (job.kind == UPLOAD_JOB_PART) {
+		if (!failed(file) && !job.data.empty())
+			send(job.data.data(), job.data.size(), job.offset, 0);
+		{
+			lock_guard<mutex> lock(file.lock);
+			file.parts--;
+		}
+		file.done.notify_all();
+		return;
+	}
+
+	if (job.kind == UPLOAD_JOB_DELETE)
+		send(NULL, 0, 0, 0);
+	else {
+		//The header goes last, so the file is only complete on the service once it is right
+		uint64_t total = job.offset + job.data.size();
+		if (!failed(file) && !job.data.empty())
+			send(job.data.data(), job.data.size(), job.offset, total);
+		if (!failed(file) && !job.head.empty())
+			send(job.head.data(), job.head.size(), 0, total);
+	}
+	{
+		lock_guard<mutex> lock(file.lock);
+		file.closed = true;
+	}
+	file.done.notify_all();
+}
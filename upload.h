@@ -0,0 +1,125 @@
+//UPLOAD  Sends CFS files to the scoring service while they are being written.
+//   An Uploader is one session with the service: a few connection threads, each keeping
+//   its connection open from one request to the next, with DNS, TLS sessions and the
+//   connections themselves shared between them. An UploadFile is handed the buffers of a
+//   file as a CfsWriter flushes them, the same buffers an OutputFile gets, and each goes out
+//   as its own request while the later epochs are still being computed: a PUT of
+//   <url>/<name> with "Content-Range: bytes first-last/*". The header is only complete at
+//   the end, so finish() sends the last buffer and then the header at 0, both with the
+//   total size in place of the '*'; the service has the file once it holds all its bytes.
+//   A file that is abandoned is deleted with a DELETE of the same URL. A buffer is kept
+//   until the service has accepted it, so it can be sent again after a dropped connection
+//   or a 408, 429 or 5xx, up to UPLOADER_RETRIES times with a growing pause. Bytes held
+//   for the session, queued or in flight, are limited to a budget; a worker only waits
+//   when it is that far ahead of the network. Only there when built with UPLOAD=1
+//   (OUTPUT_UPLOAD), which links libcurl.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+using namespace std;
+
+#define UPLOADER_CONNECTIONS (4)
+#define UPLOADER_QUEUEBYTES (64 << 20)
+#define UPLOADER_RETRIES (5)
+#define UPLOADER_RETRYMILLIS (500)         // before the first retry, doubled for each one after
+#define UPLOADER_CONNECTSECONDS (30)
+#define UPLOADER_STALLSECONDS (60)         // a request moving no bytes for this long has failed
+
+class Uploader;
+
+//A file sent at given offsets, complete on the service once finish() has returned true
+class UploadFile {
+public:
+	UploadFile();
+	~UploadFile();
+
+	//Starts name, under the URL of uploader. Nothing is sent before the first write
+	bool open(const string& name, Uploader* uploader);
+
+	//Sends data to offset, taking it over. False once a request of this file has failed
+	bool write(vector<unsigned char>& data, uint64_t offset);
+
+	//Sends data to offset and then head to 0, waits until the service has accepted all of the file
+	bool finish(vector<unsigned char>& head, vector<unsigned char>& data, uint64_t offset);
+
+	//Deletes what was sent of the file, also once finish() has returned, e.g. when the local
+	//copy could not be finished. A file that is not finished is abandoned when this is
+	//destroyed or opened again
+	void abandon();
+
+	//What went wrong
+	string error() const;
+
+	struct State;
+
+private:
+	UploadFile(const UploadFile&) = delete;
+	UploadFile& operator=(const UploadFile&) = delete;
+
+	Uploader* _uploader;
+	shared_ptr<State> _state;
+};
+
+class Uploader {
+public:
+	//Files go to url + "/" + name; headers such as "Authorization: ..." are sent with every request
+	explicit Uploader(const string& url, const vector<string>& headers = vector<string>(),
+		unsigned connections = UPLOADER_CONNECTIONS, unsigned long long budgetBytes = UPLOADER_QUEUEBYTES);
+	~Uploader();
+
+	//Whether this build can upload at all
+	static bool available();
+
+	//False when the session could not be set up, error() says why
+	bool ok() const { return _error.empty(); }
+	const string& error() const { return _error; }
+
+	const string& url() const { return _url; }
+
+	struct Session;
+
+private:
+	friend class UploadFile;
+
+	Uploader(const Uploader&) = delete;
+	Uploader& operator=(const Uploader&) = delete;
+
+	enum JobKind { UPLOAD_JOB_PART, UPLOAD_JOB_FINISH, UPLOAD_JOB_DELETE };
+
+	//A buffer of one file and where it goes; a finishing job also carries the header
+	struct Job {
+		Job() : kind(UPLOAD_JOB_PART), offset(0) {}
+
+		JobKind kind;
+		shared_ptr<UploadFile::State> file;
+		vector<unsigned char> head;
+		vector<unsigned char> data;
+		uint64_t offset;
+	};
+
+	//Queues job, waiting while the budget is used up, false once the session has stopped
+	bool submit(Job& job);
+	void connectionLoop(unsigned connection);
+	void perform(unsigned connection, Job& job);
+
+	string _url;
+	vector<string> _headers;
+	unsigned long long _budget;
+	unsigned long long _held;            // bytes of the jobs not accepted yet
+	deque<Job> _queue;
+	mutex _mutex;
+	condition_variable _wakeUp, _drained;
+	bool _stopping;
+	string _error;
+	unique_ptr<Session> _session;
+	vector<thread> _threads;
+};
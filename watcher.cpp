@@ -0,0 +1,119 @@
+#include "watcher.h"
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+void DirectoryWatcher::requestStop() {
+	stopRequested = 1;
+}
+
+DirectoryWatcher::DirectoryWatcher(const string& dir, const string& ext) :
+	_dir(dir), _ext(ext), _ok(false), _fd(-1) {
+	struct stat st;
+	if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+		return;
+	_ok = true;
+
+#ifdef __linux__
+	_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (_fd >= 0 && inotify_add_watch(_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(_fd);
+		_fd = -1;
+	}
+#endif
+
+	//Polling only reports files that appear from now on
+	if (_fd < 0) {
+		scan();
+		for (map<string, long long>::iterator it = _sizes.begin(); it != _sizes.end(); ++it)
+			it->second = -1;
+	}
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+	if (_fd >= 0)
+		close(_fd);
+}
+
+bool DirectoryWatcher::matches(const string& name) const {
+	return name.size() > _ext.size() && name.compare(name.size() - _ext.size(), _ext.size(), _ext) == 0;
+}
+
+bool DirectoryWatcher::next(string& filename) {
+	while (_ready.empty()) {
+		if (stopRequested || !_ok)
+			return false;
+		poll();
+	}
+	filename = _ready.front();
+	_ready.pop_front();
+	return true;
+}
+
+void DirectoryWatcher::poll() {
+#ifdef __linux__
+	if (_fd >= 0) {
+		struct pollfd waitFor;
+		waitFor.fd = _fd;
+		waitFor.events = POLLIN;
+		if (::poll(&waitFor, 1, WATCHER_POLLMS) <= 0)
+			return;
+
+		char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t length;
+		while ((length = read(_fd, events, sizeof(events))) > 0) {
+			for (char* p = events; p < events + length; ) {
+				const struct inotify_event* event = (const struct inotify_event*)p;
+				if (event->len > 0 && matches(event->name))
+					_ready.push_back(_dir + "/" + event->name);
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+		return;
+	}
+#endif
+
+	usleep(WATCHER_POLLMS * 1000);
+	map<string, long long> previous = _sizes;
+	scan();
+	for (map<string, long long>::iterator it = _sizes.begin(); it != _sizes.end(); ++it) {
+		map<string, long long>::iterator seen = previous.find(it->first);
+		if (seen == previous.end())
+			continue;
+		if (seen->second < 0)
+			it->second = -1;
+		else if (seen->second == it->second) {
+			_ready.push_back(it->first);
+			it->second = -1;
+		}
+	}
+}
+
+void DirectoryWatcher::scan() {
+	DIR* dir = opendir(_dir.c_str());
+	if (!dir)
+		return;
+
+	map<string, long long> sizes;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		string name = entry->d_name;
+		struct stat st;
+		string path = _dir + "/" + name;
+		if (!matches(name) || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		map<string, long long>::iterator known = _sizes.find(path);
+		sizes[path] = (known != _sizes.end() && known->second < 0) ? -1 : (long long)st.st_size;
+	}
+	closedir(dir);
+	_sizes.swap(sizes);
+}
@@ -0,0 +1,44 @@
+//WATCHER  Reports files as they land in a directory, for the --watch mode.
+//   With inotify a file is reported once it is closed after writing or moved in, so a
+//   recording still being copied is not picked up half written. Without inotify the
+//   directory is polled and a file is reported once its size has stopped changing.
+
+#pragma once
+
+#include <string>
+#include <deque>
+#include <map>
+
+using namespace std;
+
+#define WATCHER_POLLMS (500)
+
+class DirectoryWatcher {
+public:
+	//Files directly in dir whose name ends in ext
+	DirectoryWatcher(const string& dir, const string& ext);
+	~DirectoryWatcher();
+
+	//False if the directory can not be watched
+	bool ok() const { return _ok; }
+
+	//Waits for the next new file, false once requestStop() has been called
+	bool next(string& filename);
+
+	//Safe to call from a signal handler
+	static void requestStop();
+
+private:
+	DirectoryWatcher(const DirectoryWatcher&) = delete;
+	DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+	bool matches(const string& name) const;
+	void poll();
+	void scan();
+
+	string _dir, _ext;
+	bool _ok;
+	int _fd;                                 // inotify descriptor, -1 when polling
+	deque<string> _ready;
+	map<string, long long> _sizes;           // polling: size seen last time, -1 once reported
+};